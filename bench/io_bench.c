@@ -0,0 +1,323 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/**
+ * @file io_bench.c
+ * @brief Compares the server's I/O backends under a broadcast-heavy load.
+ *
+ * For every backend named on the command line the server is started with
+ * `-i <backend>`, BENCH_CLIENTS clients join the lobby and each sends
+ * BENCH_MESSAGES chat lines, which the server fans out to every member.
+ * The run ends once every client has received every line; the report lists
+ * wall time, deliveries per second and the CPU time the server used.
+ *
+ * Usage: io_bench <server binary> <backend>... [-- <extra server args>]
+ *
+ * Extra arguments go to every server run, e.g. `-- -n 8` to measure how
+ * throughput scales with reactor threads.
+ */
+
+#define BENCH_PORT      9950    /**< First port; each backend gets the next one */
+#define BENCH_CLIENTS   50      /**< Concurrent clients */
+#define BENCH_MESSAGES  200     /**< Chat lines sent by each client */
+#define BENCH_TIMEOUT   60      /**< Seconds before a run is abandoned */
+#define BENCH_LINE      "benchmark payload line with a few words in it\n"
+
+/**
+ * @brief One benchmark client.
+ */
+typedef struct {
+    int fd;             /**< Socket */
+    int sent;           /**< Chat lines written so far */
+    size_t partial;     /**< Bytes of the current line already written */
+    long received;      /**< Lines received since the timed phase began */
+    int finished;       /**< Flag: every expected line has arrived */
+} BenchClient;
+
+/**
+ * @brief Returns the monotonic clock in seconds.
+ *
+ * @return Seconds.
+ */
+static double now_seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define BENCH_MAX_ARGS  32      /**< Extra server arguments accepted after `--` */
+
+/** @brief Extra server arguments from the command line. */
+static char *extra_args[BENCH_MAX_ARGS];
+static int extra_count = 0;
+
+/**
+ * @brief Starts the server with the given backend.
+ *
+ * @param server Path to the server binary.
+ * @param backend Backend name for -i.
+ * @param port Port to listen on.
+ * @return Child pid, or -1 on failure.
+ */
+static pid_t start_server(const char *server, const char *backend, int port) {
+    char port_str[16];
+    char *argv[12 + BENCH_MAX_ARGS];
+    int argc = 0;
+    pid_t pid;
+    int null_fd;
+    int i;
+
+    snprintf(port_str, sizeof(port_str), "%d", port);
+
+    pid = fork();
+    if (pid != 0) return pid;
+
+    null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+    /* No output queue limit worth hitting: the benchmark measures throughput */
+    argv[argc++] = (char *)server;
+    argv[argc++] = "-p";
+    argv[argc++] = port_str;
+    argv[argc++] = "-i";
+    argv[argc++] = (char *)backend;
+    argv[argc++] = "-c";
+    argv[argc++] = "1024";
+    argv[argc++] = "-q";
+    argv[argc++] = "268435456";
+    for (i = 0; i < extra_count; i++) {
+        argv[argc++] = extra_args[i];
+    }
+    argv[argc] = NULL;
+    execv(server, argv);
+    perror(server);
+    _exit(127);
+}
+
+/**
+ * @brief Connects to the server, retrying while it starts up.
+ *
+ * @param port Server port.
+ * @return Connected socket, or -1 on failure.
+ */
+static int connect_client(int port) {
+    struct sockaddr_in addr;
+    int attempt;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (attempt = 0; attempt < 100; attempt++) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+        close(fd);
+        usleep(20000);
+    }
+    return -1;
+}
+
+/**
+ * @brief Reads and discards whatever the clients have pending.
+ *
+ * @param clients Clients.
+ * @param count Number of clients.
+ * @param wait_ms Quiet period that ends the drain.
+ */
+static void drain_clients(BenchClient *clients, int count, int wait_ms) {
+    char buf[65536];
+    double deadline = now_seconds() + wait_ms / 1000.0;
+    int i;
+
+    while (now_seconds() < deadline) {
+        for (i = 0; i < count; i++) {
+            while (recv(clients[i].fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+                deadline = now_seconds() + wait_ms / 1000.0;
+            }
+        }
+        usleep(1000);
+    }
+}
+
+/**
+ * @brief Runs the load against one backend.
+ *
+ * @param server Path to the server binary.
+ * @param backend Backend name.
+ * @param port Port to use.
+ * @return 0 on success, -1 on failure.
+ */
+static int run_backend(const char *server, const char *backend, int port) {
+    static BenchClient clients[BENCH_CLIENTS];
+    struct pollfd pfds[BENCH_CLIENTS];
+    const long expected = (long)BENCH_CLIENTS * BENCH_MESSAGES;
+    const size_t line_len = strlen(BENCH_LINE);
+    char buf[65536];
+    char name[32];
+    struct rusage usage;
+    double start, elapsed, cpu;
+    long delivered;
+    int done = 0;
+    int closed = 0;
+    int status;
+    ssize_t n;
+    pid_t pid;
+    int i, j;
+
+    pid = start_server(server, backend, port);
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+
+    for (i = 0; i < BENCH_CLIENTS; i++) {
+        clients[i].fd = connect_client(port);
+        clients[i].sent = 0;
+        clients[i].partial = 0;
+        clients[i].received = 0;
+        clients[i].finished = 0;
+        if (clients[i].fd < 0) {
+            fprintf(stderr, "%s: cannot connect client %d\n", backend, i);
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            return -1;
+        }
+        snprintf(name, sizeof(name), "/name bench%d\n", i);
+        send(clients[i].fd, name, strlen(name), MSG_NOSIGNAL);
+    }
+
+    /* Welcome banners and join notices are not part of the timed phase */
+    drain_clients(clients, BENCH_CLIENTS, 200);
+    for (i = 0; i < BENCH_CLIENTS; i++) {
+        fcntl(clients[i].fd, F_SETFL, fcntl(clients[i].fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    start = now_seconds();
+    while (!closed && done < BENCH_CLIENTS && now_seconds() - start < BENCH_TIMEOUT) {
+        for (i = 0; i < BENCH_CLIENTS; i++) {
+            pfds[i].fd = clients[i].fd;
+            pfds[i].events = POLLIN;
+            if (clients[i].sent < BENCH_MESSAGES) pfds[i].events |= POLLOUT;
+        }
+        if (poll(pfds, BENCH_CLIENTS, 1000) < 0 && errno != EINTR) break;
+
+        for (i = 0; i < BENCH_CLIENTS; i++) {
+            if (pfds[i].revents & POLLOUT) {
+                while (clients[i].sent < BENCH_MESSAGES) {
+                    n = send(clients[i].fd, BENCH_LINE + clients[i].partial,
+                             line_len - clients[i].partial, MSG_NOSIGNAL);
+                    if (n <= 0) break;
+                    clients[i].partial += n;
+                    if (clients[i].partial == line_len) {
+                        clients[i].partial = 0;
+                        clients[i].sent++;
+                    }
+                }
+            }
+
+            if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                while ((n = recv(clients[i].fd, buf, sizeof(buf), 0)) > 0) {
+                    for (j = 0; j < n; j++) {
+                        if (buf[j] == '\n') clients[i].received++;
+                    }
+                }
+                if (n == 0) {
+                    fprintf(stderr, "%s: server closed client %d\n", backend, i);
+                    closed = 1;
+                    break;
+                }
+                if (!clients[i].finished && clients[i].received >= expected) {
+                    clients[i].finished = 1;
+                    done++;
+                }
+            }
+        }
+    }
+    elapsed = now_seconds() - start;
+
+    for (i = 0; i < BENCH_CLIENTS; i++) {
+        close(clients[i].fd);
+    }
+    delivered = (long)done * expected;
+
+    kill(pid, SIGTERM);
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        return -1;
+    }
+    cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+          usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+    if (done < BENCH_CLIENTS) {
+        fprintf(stderr, "%s: run incomplete (%d of %d clients finished)\n",
+                backend, done, BENCH_CLIENTS);
+        return -1;
+    }
+
+    printf("%-8s %8d %10ld %9.3f %14.0f %12.3f\n",
+           backend, BENCH_CLIENTS, delivered, elapsed, delivered / elapsed, cpu);
+    return 0;
+}
+
+/**
+ * @brief Benchmarks every backend named on the command line.
+ *
+ * @param argc Argument count.
+ * @param argv Server binary followed by backend names.
+ * @return 0 if every run completed, 1 otherwise.
+ */
+int main(int argc, char *argv[]) {
+    int backends = argc;
+    int failed = 0;
+    int i;
+
+    for (i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            backends = i;
+            for (i++; i < argc && extra_count < BENCH_MAX_ARGS; i++) {
+                extra_args[extra_count++] = argv[i];
+            }
+            break;
+        }
+    }
+
+    if (backends < 3) {
+        fprintf(stderr, "Usage: %s <server> <backend>... [-- <server args>]\n", argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%d clients x %d messages, every line fanned out to all clients\n",
+           BENCH_CLIENTS, BENCH_MESSAGES);
+    printf("%-8s %8s %10s %9s %14s %12s\n",
+           "backend", "clients", "delivered", "seconds", "deliveries/s", "server cpu");
+
+    for (i = 2; i < backends; i++) {
+        if (run_backend(argv[1], argv[i], BENCH_PORT + i) < 0) {
+            failed = 1;
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,221 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include "server_utils.h"
+
+/**
+ * @file layout_bench.c
+ * @brief Measures client scans with the old and the split client layout.
+ *
+ * LegacyClient mirrors the Client struct before its hot fields moved into
+ * the parallel client_* arrays. Both layouts are filled with the same
+ * clients and scanned the way server loops do: once for the members of a
+ * room (descriptor, room, flags) and once for idle clients (descriptor,
+ * last activity). The report gives nanoseconds per client visited and the
+ * bytes each layout drags through the cache per client.
+ *
+ * Usage: layout_bench [clients]
+ */
+
+#define BENCH_CLIENTS   100000  /**< Default table size */
+#define BENCH_ROOMS     50      /**< Rooms the clients are spread over */
+#define BENCH_ROUNDS    200     /**< Scans per measurement */
+
+/**
+ * @brief The client layout before the hot/cold split.
+ */
+typedef struct {
+    int fd;
+    unsigned long id;
+    char username[MAX_USERNAME];
+    int room_id;
+    int room_slot;
+    struct sockaddr_in addr;
+    time_t last_activity;
+    time_t last_typing_sent;
+    OutQueue out;
+    int send_inflight;
+    unsigned long send_round;
+    int flush_queued;
+    int closing;
+    char *in_buf;
+    size_t in_len;
+    int in_discard;
+} LegacyClient;
+
+/** @brief Keeps the compiler from dropping the scans. */
+static volatile long sink;
+
+/**
+ * @brief Returns the monotonic clock in nanoseconds.
+ *
+ * @return Nanoseconds.
+ */
+static double now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * @brief Counts the live members of a room in the legacy layout.
+ *
+ * @param table Clients.
+ * @param count Table size.
+ * @param room Room index.
+ * @return Member count.
+ */
+static long legacy_room_scan(const LegacyClient *table, int count, int room) {
+    long members = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (table[i].fd >= 0 && table[i].room_id == room && !table[i].closing) members++;
+    }
+    return members;
+}
+
+/**
+ * @brief Counts the live members of a room in the parallel arrays.
+ *
+ * @param count Table size.
+ * @param room Room index.
+ * @return Member count.
+ */
+static long split_room_scan(int count, int room) {
+    long members = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (client_fds[i] >= 0 && client_rooms[i] == room && !(client_flags[i] & CLIENT_CLOSING)) members++;
+    }
+    return members;
+}
+
+/**
+ * @brief Counts clients idle since before `cutoff` in the legacy layout.
+ *
+ * @param table Clients.
+ * @param count Table size.
+ * @param cutoff Activity time.
+ * @return Idle client count.
+ */
+static long legacy_idle_scan(const LegacyClient *table, int count, time_t cutoff) {
+    long idle = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (table[i].fd >= 0 && table[i].last_activity < cutoff) idle++;
+    }
+    return idle;
+}
+
+/**
+ * @brief Counts clients idle since before `cutoff` in the parallel arrays.
+ *
+ * @param count Table size.
+ * @param cutoff Activity time.
+ * @return Idle client count.
+ */
+static long split_idle_scan(int count, time_t cutoff) {
+    long idle = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (client_fds[i] >= 0 && client_last_activity[i] < cutoff) idle++;
+    }
+    return idle;
+}
+
+/**
+ * @brief Prints one result line.
+ *
+ * @param name Scan name.
+ * @param legacy_ns Total time with the legacy layout.
+ * @param split_ns Total time with the parallel arrays.
+ * @param visits Clients visited per layout.
+ */
+static void report(const char *name, double legacy_ns, double split_ns, double visits) {
+    printf("%-10s %12.2f %12.2f %9.1fx\n", name, legacy_ns / visits, split_ns / visits, legacy_ns / split_ns);
+}
+
+/**
+ * @brief Fills both layouts and times the scans.
+ *
+ * @param argc Argument count.
+ * @param argv Optional client count.
+ * @return 0 on success, 1 on failure.
+ */
+int main(int argc, char *argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : BENCH_CLIENTS;
+    LegacyClient *legacy;
+    double start, legacy_ns, split_ns;
+    double visits;
+    long total = 0;
+    int round;
+    int i;
+
+    if (count < 1) {
+        fprintf(stderr, "Usage: %s [clients]\n", argv[0]);
+        return 1;
+    }
+
+    max_clients = count;
+    max_rooms = BENCH_ROOMS + 1;
+    init_clients();
+
+    legacy = calloc(count, sizeof(*legacy));
+    if (!legacy) return 1;
+
+    /* Same clients in both layouts; descriptors are never touched */
+    for (i = 0; i < count; i++) {
+        if (add_client(i + 3, NULL) != i) {
+            fprintf(stderr, "Cannot add client %d\n", i);
+            return 1;
+        }
+        client_rooms[i] = i % BENCH_ROOMS;
+        client_last_activity[i] = i % 600;
+
+        legacy[i].fd = i + 3;
+        legacy[i].room_id = i % BENCH_ROOMS;
+        legacy[i].last_activity = i % 600;
+    }
+
+    visits = (double)count * BENCH_ROUNDS;
+    printf("Clients: %d, %d scans each\n", count, BENCH_ROUNDS);
+    printf("Bytes per client: legacy %zu, hot arrays %zu (room scan), %zu (idle scan)\n",
+           sizeof(LegacyClient),
+           sizeof(*client_fds) + sizeof(*client_rooms) + sizeof(*client_flags),
+           sizeof(*client_fds) + sizeof(*client_last_activity));
+    printf("%-10s %12s %12s %10s\n", "scan", "legacy ns", "split ns", "speedup");
+
+    start = now_ns();
+    for (round = 0; round < BENCH_ROUNDS; round++) total += legacy_room_scan(legacy, count, round % BENCH_ROOMS);
+    legacy_ns = now_ns() - start;
+    start = now_ns();
+    for (round = 0; round < BENCH_ROUNDS; round++) total -= split_room_scan(count, round % BENCH_ROOMS);
+    split_ns = now_ns() - start;
+    report("room", legacy_ns, split_ns, visits);
+
+    start = now_ns();
+    for (round = 0; round < BENCH_ROUNDS; round++) total += legacy_idle_scan(legacy, count, round % 600);
+    legacy_ns = now_ns() - start;
+    start = now_ns();
+    for (round = 0; round < BENCH_ROUNDS; round++) total -= split_idle_scan(count, round % 600);
+    split_ns = now_ns() - start;
+    report("idle", legacy_ns, split_ns, visits);
+
+    /* Both layouts must agree, or the comparison is meaningless */
+    sink = total;
+    free(legacy);
+    if (total != 0) {
+        fprintf(stderr, "Layouts disagree\n");
+        return 1;
+    }
+    return 0;
+}
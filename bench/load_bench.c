@@ -0,0 +1,682 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/**
+ * @file load_bench.c
+ * @brief Load generator: thousands of chat clients and their delivery latency.
+ *
+ * Starts the server (or uses one already listening), connects the clients
+ * over loopback, names them and spreads them over the rooms. For the timed
+ * phase it then issues actions at a fixed aggregate rate, each from a
+ * random client: chat lines, private messages, /join and /typing, in the
+ * proportions given by the mix. Chat lines and private messages carry their
+ * send time, so every copy that arrives gives one end-to-end latency
+ * sample (the sender's own /msg echo and history replays are not counted).
+ *
+ * The report gives the actions sent, the timed deliveries per second and
+ * the p50/p99/p99.9/max latency. Samples go into a log-linear histogram
+ * (16 buckets per power of two), so percentiles are within about 6%.
+ *
+ * Usage: load_bench [-c clients] [-r rooms] [-d seconds] [-R actions/s]
+ *                   [-x chat,msg,join,typing] [-p port] <server | ->
+ *                   [-- <extra server args>]
+ *
+ * With `-` instead of a server binary, the clients connect to a server that
+ * is already listening on the port.
+ *
+ * A server that lags while the clients connect may turn some of them away
+ * (see shed_accept); like real clients, those reconnect before the clock
+ * starts.
+ */
+
+#define LOAD_PORT       9940    /**< Default port */
+#define LOAD_CLIENTS    1000    /**< Default number of clients */
+#define LOAD_ROOMS      20      /**< Default number of rooms */
+#define LOAD_SECONDS    10      /**< Default length of the timed phase */
+#define LOAD_RATE       2000    /**< Default actions per second, all clients together */
+#define LOAD_TAIL_MS    500     /**< Quiet period that ends the wait for in-flight messages */
+#define LOAD_TAIL_MAX   5       /**< Longest wait for in-flight messages (seconds) */
+#define LOAD_LINE_MAX   256     /**< Longest line a client sends */
+#define LOAD_IN_MAX     8192    /**< Input buffer per client */
+#define LOAD_MARK       "@@"    /**< Brackets the send time in timed messages */
+#define LOAD_MAX_ARGS   32      /**< Extra server arguments accepted after `--` */
+#define LOAD_RETRIES    20      /**< Rounds of reconnecting clients the server turned away */
+
+#define HIST_SUB_BITS   4                       /**< log2 of the buckets per power of two */
+#define HIST_BUCKETS    (64 << HIST_SUB_BITS)   /**< Buckets covering any 64-bit value */
+
+/**
+ * @brief Kinds of action, in the order of the mix.
+ */
+typedef enum {
+    ACTION_CHAT,
+    ACTION_MSG,
+    ACTION_JOIN,
+    ACTION_TYPING,
+    ACTION_KINDS
+} ActionKind;
+
+static const char *const ACTION_NAMES[ACTION_KINDS] = {"chat", "msg", "join", "typing"};
+
+/**
+ * @brief One simulated client.
+ */
+typedef struct {
+    int fd;                     /**< Socket */
+    char out[LOAD_LINE_MAX];    /**< Line being written */
+    size_t out_len;             /**< Bytes in out */
+    size_t out_off;             /**< Bytes of out already written */
+    int want_out;               /**< Flag: waiting for the socket to take the rest of out */
+    char in[LOAD_IN_MAX];       /**< Partial input line */
+    size_t in_len;              /**< Bytes in in */
+    int in_history;             /**< Flag: reading a history replay, whose lines are not deliveries */
+} LoadClient;
+
+static LoadClient *clients;
+static int client_count = LOAD_CLIENTS;
+static int room_count = LOAD_ROOMS;
+static int epoll_fd = -1;
+
+/** @brief Action mix in percent, indexed by ActionKind. */
+static int mix[ACTION_KINDS] = {80, 10, 5, 5};
+
+/** @brief Counters of the timed phase. */
+static long actions[ACTION_KINDS];
+static long skipped = 0;
+static long lines_received = 0;
+static long samples = 0;
+static long server_closed = 0;
+static long reconnects = 0;
+static int timing = 0;
+
+/** @brief Latency histogram in microseconds. */
+static unsigned long hist[HIST_BUCKETS];
+static unsigned long long max_latency = 0;
+
+/** @brief Extra server arguments from the command line. */
+static char *extra_args[LOAD_MAX_ARGS];
+static int extra_count = 0;
+
+/**
+ * @brief Returns the monotonic clock in nanoseconds.
+ *
+ * @return Nanoseconds.
+ */
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Maps a value to its histogram bucket.
+ *
+ * @param v Value.
+ * @return Bucket index.
+ */
+static int hist_index(unsigned long long v) {
+    int major;
+
+    if (v < (1ULL << HIST_SUB_BITS)) return (int)v;
+    major = 63 - __builtin_clzll(v);
+    return ((major - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+           (int)((v >> (major - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+/**
+ * @brief Returns the smallest value that falls into a bucket.
+ *
+ * @param index Bucket index.
+ * @return Lower bound of the bucket.
+ */
+static unsigned long long hist_value(int index) {
+    int major;
+
+    if (index < (1 << HIST_SUB_BITS)) return (unsigned long long)index;
+    major = (index >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    return (unsigned long long)((1 << HIST_SUB_BITS) | (index & ((1 << HIST_SUB_BITS) - 1)))
+           << (major - HIST_SUB_BITS);
+}
+
+/**
+ * @brief Returns a latency percentile.
+ *
+ * @param fraction Percentile as a fraction (0.99 for p99).
+ * @return Upper bound of the bucket holding it, in microseconds.
+ */
+static unsigned long long percentile(double fraction) {
+    unsigned long wanted = (unsigned long)(fraction * samples + 0.5);
+    unsigned long seen = 0;
+    int i;
+
+    if (wanted < 1) wanted = 1;
+    for (i = 0; i < HIST_BUCKETS - 1; i++) {
+        seen += hist[i];
+        if (seen >= wanted) return hist_value(i + 1) - 1;
+    }
+    return max_latency;
+}
+
+/**
+ * @brief Records the latency of one timed line.
+ *
+ * @param c The receiving client.
+ * @param line A received line.
+ * @param now Receive time.
+ */
+static void record_line(LoadClient *c, const char *line, unsigned long long now) {
+    const char *mark;
+    unsigned long long sent;
+    unsigned long long us;
+
+    lines_received++;
+
+    /* A /join replays old lines, which still carry their original send time */
+    if (strstr(line, "--- Recent messages ---")) {
+        c->in_history = 1;
+        return;
+    }
+    if (c->in_history) {
+        if (strstr(line, "--- End of history ---")) c->in_history = 0;
+        return;
+    }
+
+    /* The sender's copy of its own private message is not a delivery */
+    mark = strstr(line, LOAD_MARK);
+    if (!mark || strstr(line, "[PM to")) return;
+
+    sent = strtoull(mark + strlen(LOAD_MARK), NULL, 10);
+    if (sent == 0 || sent > now) return;
+
+    us = (now - sent) / 1000;
+    hist[hist_index(us)]++;
+    if (us > max_latency) max_latency = us;
+    samples++;
+}
+
+/**
+ * @brief Starts the server.
+ *
+ * @param server Path to the server binary.
+ * @param port Port to listen on.
+ * @return Child pid, or -1 on failure.
+ */
+static pid_t start_server(const char *server, int port) {
+    char port_str[16];
+    char clients_str[16];
+    char rooms_str[16];
+    char *argv[12 + LOAD_MAX_ARGS];
+    int argc = 0;
+    pid_t pid;
+    int null_fd;
+    int i;
+
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    snprintf(clients_str, sizeof(clients_str), "%d", client_count + 64);
+    snprintf(rooms_str, sizeof(rooms_str), "%d", room_count + 16);
+
+    pid = fork();
+    if (pid != 0) return pid;
+
+    null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+    /* Slow-consumer limits would only measure the generator's own reading */
+    argv[argc++] = (char *)server;
+    argv[argc++] = "-p";
+    argv[argc++] = port_str;
+    argv[argc++] = "-c";
+    argv[argc++] = clients_str;
+    argv[argc++] = "-r";
+    argv[argc++] = rooms_str;
+    argv[argc++] = "-q";
+    argv[argc++] = "268435456";
+    for (i = 0; i < extra_count; i++) {
+        argv[argc++] = extra_args[i];
+    }
+    argv[argc] = NULL;
+    execv(server, argv);
+    perror(server);
+    _exit(127);
+}
+
+/**
+ * @brief Connects to the server, retrying while it starts up.
+ *
+ * @param port Server port.
+ * @return Connected socket, or -1 on failure.
+ */
+static int connect_client(int port) {
+    struct sockaddr_in addr;
+    int one = 1;
+    int attempt;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (attempt = 0; attempt < 100; attempt++) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            /* Lines go out one at a time; Nagle would hold them for the peer's delayed ACK */
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return fd;
+        }
+        close(fd);
+        usleep(20000);
+    }
+    return -1;
+}
+
+/**
+ * @brief Writes as much of a client's pending line as the socket takes.
+ *
+ * Watches for writability while part of it is left.
+ *
+ * @param idx Client index.
+ */
+static void flush_client(int idx) {
+    LoadClient *c = &clients[idx];
+    struct epoll_event ev;
+    int want_out;
+    ssize_t n;
+
+    while (c->out_off < c->out_len) {
+        n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n <= 0) break;
+        c->out_off += n;
+    }
+
+    want_out = c->out_off < c->out_len;
+    if (want_out != c->want_out) {
+        ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+        ev.data.u32 = (unsigned int)idx;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->want_out = want_out;
+    }
+}
+
+/**
+ * @brief Queues a line for a client and starts writing it.
+ *
+ * @param idx Client index.
+ * @param line The line, newline included.
+ * @return 0 if queued, -1 while the previous line is still being written.
+ */
+static int send_line(int idx, const char *line) {
+    LoadClient *c = &clients[idx];
+    size_t len = strlen(line);
+
+    if (c->out_off < c->out_len || len > sizeof(c->out)) return -1;
+
+    memcpy(c->out, line, len);
+    c->out_len = len;
+    c->out_off = 0;
+    flush_client(idx);
+    return 0;
+}
+
+/**
+ * @brief Reads everything a client has pending and handles complete lines.
+ *
+ * @param idx Client index.
+ */
+static void read_client(int idx) {
+    LoadClient *c = &clients[idx];
+    unsigned long long now;
+    char *line;
+    char *nl;
+    ssize_t n;
+
+    for (;;) {
+        n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len, MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+            if (timing) {
+                server_closed++;
+            } else {
+                /* Turned away while connecting; join_clients() tries again */
+                close(c->fd);
+                memset(c, 0, sizeof(*c));
+                c->fd = -1;
+            }
+            return;
+        }
+        if (n < 0) return;
+
+        now = now_ns();
+        c->in_len += n;
+        c->in[c->in_len] = '\0';
+
+        line = c->in;
+        while ((nl = strchr(line, '\n')) != NULL) {
+            *nl = '\0';
+            if (timing) record_line(c, line, now);
+            line = nl + 1;
+        }
+
+        /* Keep the incomplete tail; a line longer than the buffer is dropped */
+        c->in_len -= line - c->in;
+        if (c->in_len == sizeof(c->in) - 1) c->in_len = 0;
+        memmove(c->in, line, c->in_len);
+    }
+}
+
+/**
+ * @brief Waits for socket events and handles them.
+ *
+ * @param timeout_ms Longest wait.
+ * @return Number of events handled.
+ */
+static int poll_clients(int timeout_ms) {
+    struct epoll_event events[256];
+    int n;
+    int i;
+
+    n = epoll_wait(epoll_fd, events, 256, timeout_ms);
+    for (i = 0; i < n; i++) {
+        if (events[i].events & EPOLLOUT) flush_client((int)events[i].data.u32);
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) read_client((int)events[i].data.u32);
+    }
+    return n > 0 ? n : 0;
+}
+
+/**
+ * @brief Handles events until nothing has arrived for `quiet_ms`.
+ *
+ * @param quiet_ms Quiet period.
+ * @param max_seconds Longest total wait.
+ */
+static void drain_clients(int quiet_ms, int max_seconds) {
+    unsigned long long deadline = now_ns() + (unsigned long long)max_seconds * 1000000000ULL;
+    unsigned long long quiet = now_ns() + (unsigned long long)quiet_ms * 1000000ULL;
+
+    while (now_ns() < quiet && now_ns() < deadline) {
+        if (poll_clients(10) > 0) {
+            quiet = now_ns() + (unsigned long long)quiet_ms * 1000000ULL;
+        }
+    }
+}
+
+/**
+ * @brief Issues one action from a random client.
+ *
+ * @param seed Random state.
+ */
+static void random_action(unsigned int *seed) {
+    char line[LOAD_LINE_MAX];
+    int idx = rand_r(seed) % client_count;
+    int pick = rand_r(seed) % 100;
+    int kind;
+
+    for (kind = 0; kind < ACTION_KINDS - 1 && pick >= mix[kind]; kind++) {
+        pick -= mix[kind];
+    }
+
+    if (kind == ACTION_CHAT) {
+        snprintf(line, sizeof(line), LOAD_MARK "%llu" LOAD_MARK " load test chat line\n", now_ns());
+    } else if (kind == ACTION_MSG) {
+        snprintf(line, sizeof(line), "/msg load%d " LOAD_MARK "%llu" LOAD_MARK " load test private line\n",
+                 rand_r(seed) % client_count, now_ns());
+    } else if (kind == ACTION_JOIN) {
+        snprintf(line, sizeof(line), "/join room%d\n", rand_r(seed) % room_count);
+    } else {
+        snprintf(line, sizeof(line), "/typing\n");
+    }
+
+    if (send_line(idx, line) < 0) {
+        skipped++;
+    } else {
+        actions[kind]++;
+    }
+}
+
+/**
+ * @brief Parses the action mix, e.g. "80,10,5,5".
+ *
+ * @param arg The mix.
+ * @return 0 on success, -1 if it is not four percentages adding up to 100.
+ */
+static int parse_mix(const char *arg) {
+    int total = 0;
+    int kind;
+    char *end;
+
+    for (kind = 0; kind < ACTION_KINDS; kind++) {
+        mix[kind] = (int)strtol(arg, &end, 10);
+        if (end == arg || mix[kind] < 0) return -1;
+        total += mix[kind];
+        if (kind < ACTION_KINDS - 1) {
+            if (*end != ',') return -1;
+            arg = end + 1;
+        } else if (*end != '\0') {
+            return -1;
+        }
+    }
+    return total == 100 ? 0 : -1;
+}
+
+/**
+ * @brief Raises the descriptor limit for the clients (and a started server).
+ */
+static void raise_fd_limit(void) {
+    struct rlimit lim;
+    rlim_t wanted = (rlim_t)client_count * 2 + 256;
+
+    if (getrlimit(RLIMIT_NOFILE, &lim) < 0 || lim.rlim_cur >= wanted) return;
+    lim.rlim_cur = wanted < lim.rlim_max ? wanted : lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+}
+
+/**
+ * @brief Connects every client without a connection, names it and puts it in its room.
+ *
+ * @param port Server port.
+ * @return Number of clients connected, or -1 if one cannot connect.
+ */
+static int join_clients(int port) {
+    struct epoll_event ev;
+    char line[LOAD_LINE_MAX];
+    int joined = 0;
+    int i;
+
+    for (i = 0; i < client_count; i++) {
+        if (clients[i].fd >= 0) continue;
+
+        clients[i].fd = connect_client(port);
+        if (clients[i].fd < 0) {
+            fprintf(stderr, "Cannot connect client %d\n", i);
+            return -1;
+        }
+        fcntl(clients[i].fd, F_SETFL, fcntl(clients[i].fd, F_GETFL, 0) | O_NONBLOCK);
+        ev.events = EPOLLIN;
+        ev.data.u32 = (unsigned int)i;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, clients[i].fd, &ev);
+
+        snprintf(line, sizeof(line), "/name load%d\n/join room%d\n", i, i % room_count);
+        send_line(i, line);
+        if (++joined % 64 == 0) poll_clients(0);
+    }
+    return joined;
+}
+
+/**
+ * @brief Prints the usage line.
+ *
+ * @param prog Program name.
+ */
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-c clients] [-r rooms] [-d seconds] [-R actions/s] "
+                    "[-x chat,msg,join,typing] [-p port] <server | -> [-- <server args>]\n", prog);
+}
+
+/**
+ * @brief Runs the load and prints the report.
+ *
+ * @param argc Argument count.
+ * @param argv Options, the server binary and extra server arguments.
+ * @return 0 on success, 1 on failure.
+ */
+int main(int argc, char *argv[]) {
+    const char *server = NULL;
+    int seconds = LOAD_SECONDS;
+    int rate = LOAD_RATE;
+    int port = LOAD_PORT;
+    unsigned int seed = 1;
+    unsigned long long start, now, end;
+    struct rusage usage_info;
+    double elapsed;
+    long issued = 0;
+    long due;
+    int joined;
+    pid_t pid = -1;
+    int status;
+    int kind;
+    int ok = 1;
+    int i;
+
+    for (i = 1; i < argc && ok; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            for (i++; i < argc && extra_count < LOAD_MAX_ARGS; i++) {
+                extra_args[extra_count++] = argv[i];
+            }
+            break;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0' && i + 1 < argc) {
+            if (strcmp(argv[i], "-c") == 0) {
+                client_count = atoi(argv[++i]);
+                ok = client_count >= 2;
+            } else if (strcmp(argv[i], "-r") == 0) {
+                room_count = atoi(argv[++i]);
+                ok = room_count >= 1;
+            } else if (strcmp(argv[i], "-d") == 0) {
+                seconds = atoi(argv[++i]);
+                ok = seconds >= 1;
+            } else if (strcmp(argv[i], "-R") == 0) {
+                rate = atoi(argv[++i]);
+                ok = rate >= 1;
+            } else if (strcmp(argv[i], "-x") == 0) {
+                ok = parse_mix(argv[++i]) == 0;
+            } else if (strcmp(argv[i], "-p") == 0) {
+                port = atoi(argv[++i]);
+                ok = port > 0;
+            } else {
+                ok = 0;
+            }
+        } else if (!server) {
+            server = argv[i];
+        } else {
+            ok = 0;
+        }
+    }
+    if (!ok || !server) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit();
+
+    clients = calloc(client_count, sizeof(*clients));
+    epoll_fd = epoll_create1(0);
+    if (!clients || epoll_fd < 0) {
+        perror("setup");
+        return 1;
+    }
+    for (i = 0; i < client_count; i++) {
+        clients[i].fd = -1;
+    }
+
+    if (strcmp(server, "-") != 0) {
+        pid = start_server(server, port);
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+    }
+
+    /* Name every client and put it in its room before the clock starts */
+    for (i = 0, joined = 0; i < LOAD_RETRIES && (joined = join_clients(port)) > 0; i++) {
+        drain_clients(300, 30);
+        if (i > 0) reconnects += joined;
+    }
+    if (joined != 0) {
+        if (joined > 0) fprintf(stderr, "The server kept turning clients away\n");
+        ok = 0;
+    }
+
+    if (ok) {
+        printf("%d clients in %d rooms, %d s at %d actions/s (chat %d%%, msg %d%%, join %d%%, typing %d%%)\n",
+               client_count, room_count, seconds, rate, mix[ACTION_CHAT], mix[ACTION_MSG],
+               mix[ACTION_JOIN], mix[ACTION_TYPING]);
+        if (reconnects > 0) {
+            printf("%ld clients reconnected after the server turned them away\n", reconnects);
+        }
+
+        timing = 1;
+        start = now_ns();
+        end = start + (unsigned long long)seconds * 1000000000ULL;
+        while ((now = now_ns()) < end && server_closed == 0) {
+            due = (long)((double)(now - start) * rate / 1e9) - issued;
+            for (; due > 0; due--, issued++) {
+                random_action(&seed);
+            }
+            poll_clients(1);
+        }
+        elapsed = (now_ns() - start) / 1e9;
+        drain_clients(LOAD_TAIL_MS, LOAD_TAIL_MAX);
+
+        printf("sent:");
+        for (kind = 0; kind < ACTION_KINDS; kind++) {
+            printf(" %s %ld%s", ACTION_NAMES[kind], actions[kind], kind < ACTION_KINDS - 1 ? "," : "");
+        }
+        printf(" (%ld skipped while a client was still writing)\n", skipped);
+        printf("received: %ld lines, %ld timed deliveries (%.0f/s)\n",
+               lines_received, samples, samples / elapsed);
+        if (samples > 0) {
+            printf("latency (us): p50 %llu, p99 %llu, p99.9 %llu, max %llu\n",
+                   percentile(0.50), percentile(0.99), percentile(0.999), max_latency);
+        }
+        if (server_closed > 0) {
+            fprintf(stderr, "The server closed %ld connections\n", server_closed);
+            ok = 0;
+        }
+        if (samples == 0) ok = 0;
+    }
+
+    for (i = 0; i < client_count; i++) {
+        if (clients[i].fd >= 0) close(clients[i].fd);
+    }
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        if (wait4(pid, &status, 0, &usage_info) == pid) {
+            printf("server cpu: %.3f s\n",
+                   usage_info.ru_utime.tv_sec + usage_info.ru_utime.tv_usec / 1e6 +
+                   usage_info.ru_stime.tv_sec + usage_info.ru_stime.tv_usec / 1e6);
+        }
+    }
+    free(clients);
+    close(epoll_fd);
+    return ok ? 0 : 1;
+}
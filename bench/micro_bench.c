@@ -0,0 +1,397 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "server_utils.h"
+
+/**
+ * @file micro_bench.c
+ * @brief Microbenchmarks of the server_utils hot paths.
+ *
+ * Fills the client and room tables the way a busy shard has them (every
+ * client named and spread evenly over the rooms) and times single calls of
+ * broadcast_to_room, find_room, find_client_by_username,
+ * add_message_to_history, send_room_history, handle_client_message and
+ * cleanup_empty_rooms. Each case runs in doubling batches until one batch
+ * takes the minimum time; that batch gives nanoseconds per call and heap
+ * allocations per call.
+ *
+ * Client descriptors are duplicates of one UDP socket connected to a sink
+ * on loopback. send() refuses /dev/null, and a socketpair fills up and
+ * turns every broadcast into output queueing, while the sink takes every
+ * datagram (dropping what it cannot hold), so the send paths run exactly
+ * as they do when sockets keep up.
+ *
+ * Allocations are counted by wrapping malloc, calloc and realloc at link
+ * time (see the bench rule in the Makefile); calls made inside libc are not
+ * counted.
+ *
+ * Usage: micro_bench [-c clients] [-r rooms] [-t ms] [-o results.json]
+ */
+
+#define MICRO_CLIENTS   1000    /**< Default number of clients */
+#define MICRO_ROOMS     20      /**< Default number of rooms */
+#define MICRO_MIN_MS    200     /**< Default minimum time of the measured batch */
+#define MICRO_MAX_CASES 16      /**< Room for results */
+
+/** @brief A typical chat line as broadcast_to_room() gets it. */
+#define MICRO_LINE      "[12:00:00] \033[1;32muser1\033[0m: hello everyone, this is a benchmark line\n"
+
+/**
+ * @brief Result of one case.
+ */
+typedef struct {
+    const char *name;           /**< Function measured */
+    long ops;                   /**< Calls in the measured batch */
+    double ns_per_op;           /**< Wall time per call */
+    double allocs_per_op;       /**< malloc/calloc/realloc calls per call */
+} MicroResult;
+
+static unsigned long allocations;           /**< Heap allocations so far (see __wrap_malloc) */
+static int client_count = MICRO_CLIENTS;
+static int room_count = MICRO_ROOMS;
+static int *room_ids;                       /**< Table index of each benchmark room */
+static char (*usernames)[MAX_USERNAME];     /**< Username of each client */
+static char (*room_names)[MAX_ROOMNAME];    /**< Name of each benchmark room */
+static MicroResult results[MICRO_MAX_CASES];
+static int result_count;
+static volatile long sink;                  /**< Keeps the compiler from dropping lookups */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+/**
+ * @brief Counts a malloc() call made by the server code.
+ *
+ * @param size Bytes requested.
+ * @return The allocation.
+ */
+void *__wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+/**
+ * @brief Counts a calloc() call made by the server code.
+ *
+ * @param count Number of elements.
+ * @param size Size of an element.
+ * @return The allocation.
+ */
+void *__wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+/**
+ * @brief Counts a realloc() call made by the server code.
+ *
+ * @param ptr Block to resize.
+ * @param size New size.
+ * @return The resized block.
+ */
+void *__wrap_realloc(void *ptr, size_t size) {
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+/**
+ * @brief Returns the monotonic clock in nanoseconds.
+ *
+ * @return Nanoseconds.
+ */
+static double now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * @brief Raises the descriptor limit for one descriptor per client.
+ */
+static void raise_fd_limit(void) {
+    struct rlimit lim;
+    rlim_t wanted = (rlim_t)client_count + 64;
+
+    if (getrlimit(RLIMIT_NOFILE, &lim) < 0 || lim.rlim_cur >= wanted) return;
+    lim.rlim_cur = wanted < lim.rlim_max ? wanted : lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+}
+
+/**
+ * @brief Opens a UDP socket connected to a loopback sink that discards.
+ *
+ * The sink is never read; once its receive buffer is full the kernel
+ * drops further datagrams, and the sender never waits.
+ *
+ * @return The sending socket, or -1 on failure.
+ */
+static int open_sink(void) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (rx < 0 || tx < 0 || bind(rx, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        getsockname(rx, (struct sockaddr *)&addr, &len) < 0 ||
+        connect(tx, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("sink");
+        return -1;
+    }
+    return tx;
+}
+
+/**
+ * @brief Connects, names and seats every client.
+ *
+ * Client i is "user<i>" in "room<i % rooms>".
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int fill_tables(void) {
+    int out = open_sink();
+    int idx;
+    int i;
+
+    usernames = calloc(client_count, sizeof(*usernames));
+    room_names = calloc(room_count, sizeof(*room_names));
+    room_ids = calloc(room_count, sizeof(*room_ids));
+    if (out < 0 || !usernames || !room_names || !room_ids) return -1;
+
+    max_clients = client_count;
+    max_rooms = room_count + 1;
+    init_clients();
+    init_rooms();
+
+    for (i = 0; i < room_count; i++) {
+        snprintf(room_names[i], sizeof(room_names[i]), "room%d", i);
+    }
+    for (i = 0; i < client_count; i++) {
+        snprintf(usernames[i], sizeof(usernames[i]), "user%d", i);
+        idx = add_client(dup(out), NULL);
+        if (idx != i) {
+            fprintf(stderr, "Cannot add client %d (descriptor limit?)\n", i);
+            return -1;
+        }
+        handle_setname(idx, usernames[i]);
+        handle_join(idx, room_names[i % room_count]);
+    }
+    for (i = 0; i < room_count; i++) {
+        room_ids[i] = find_room(room_names[i]);
+        if (room_ids[i] < 0) return -1;
+    }
+    close(out);
+    return 0;
+}
+
+/**
+ * @brief Fans a chat line out to every member of a room.
+ * @param i Call number.
+ */
+static void op_broadcast(long i) {
+    broadcast_to_room(room_ids[i % room_count], MICRO_LINE, -1);
+}
+
+/**
+ * @brief Looks up a room by name.
+ * @param i Call number.
+ */
+static void op_find_room(long i) {
+    sink += find_room(room_names[i % room_count]);
+}
+
+/**
+ * @brief Looks up a client by username.
+ * @param i Call number.
+ */
+static void op_find_client(long i) {
+    sink += find_client_by_username(usernames[i % client_count]);
+}
+
+/**
+ * @brief Appends a line to a room's history, evicting the oldest when full.
+ * @param i Call number.
+ */
+static void op_add_history(long i) {
+    add_message_to_history(room_ids[i % room_count], MICRO_LINE);
+}
+
+/**
+ * @brief Replays a room's history to one of its members.
+ * @param i Call number.
+ */
+static void op_send_history(long i) {
+    int client = (int)(i % client_count);
+
+    send_room_history(client, client_rooms[client]);
+}
+
+/**
+ * @brief Parses and dispatches a /typing line.
+ *
+ * /typing sends nothing back (repeats within a round only refresh the
+ * client's activity), so the time is the dispatch path itself rather than
+ * a reply's send().
+ *
+ * @param i Call number.
+ */
+static void op_dispatch(long i) {
+    char line[] = "/typing\n";
+
+    handle_client_message((int)(i % client_count), line);
+}
+
+/**
+ * @brief Sweeps the room table for empty rooms (none are).
+ * @param i Call number.
+ */
+static void op_cleanup(long i) {
+    (void)i;
+    cleanup_empty_rooms();
+}
+
+/**
+ * @brief Times one case and records its result.
+ *
+ * Batches double until one takes at least `min_ns`; that batch is the
+ * measurement, and the smaller ones serve as warm-up.
+ *
+ * @param name Function measured.
+ * @param op Performs call number i.
+ * @param min_ns Minimum batch time.
+ */
+static void measure(const char *name, void (*op)(long), double min_ns) {
+    MicroResult *r = &results[result_count++];
+    unsigned long allocs;
+    double start, elapsed;
+    long ops = 1;
+    long i;
+
+    for (;;) {
+        allocs = allocations;
+        start = now_ns();
+        for (i = 0; i < ops; i++) op(i);
+        elapsed = now_ns() - start;
+        allocs = allocations - allocs;
+        if (elapsed >= min_ns) break;
+        ops *= 2;
+    }
+
+    r->name = name;
+    r->ops = ops;
+    r->ns_per_op = elapsed / ops;
+    r->allocs_per_op = (double)allocs / ops;
+    printf("%-26s %10ld %12.1f %10.2f\n", r->name, r->ops, r->ns_per_op, r->allocs_per_op);
+}
+
+/**
+ * @brief Writes the results as JSON.
+ *
+ * @param path Output file.
+ * @return 0 on success, -1 on failure.
+ */
+static int write_json(const char *path) {
+    FILE *f = fopen(path, "w");
+    int i;
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fprintf(f, "{\n  \"clients\": %d,\n  \"rooms\": %d,\n  \"members_per_room\": %d,\n  \"results\": [\n",
+            client_count, room_count, client_count / room_count);
+    for (i = 0; i < result_count; i++) {
+        fprintf(f, "    {\"name\": \"%s\", \"ops\": %ld, \"ns_per_op\": %.1f, \"allocs_per_op\": %.3f}%s\n",
+                results[i].name, results[i].ops, results[i].ns_per_op, results[i].allocs_per_op,
+                i + 1 < result_count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Prints the usage line.
+ *
+ * @param prog Program name.
+ */
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-c clients] [-r rooms] [-t ms] [-o results.json]\n", prog);
+}
+
+/**
+ * @brief Fills the tables, runs every case and reports.
+ *
+ * @param argc Argument count.
+ * @param argv Options.
+ * @return 0 on success, 1 on failure.
+ */
+int main(int argc, char *argv[]) {
+    const char *json = NULL;
+    double min_ns = MICRO_MIN_MS * 1e6;
+    int queued = 0;
+    int ok = 1;
+    int i;
+
+    for (i = 1; i < argc && ok; i++) {
+        if (i + 1 >= argc) {
+            ok = 0;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            client_count = atoi(argv[++i]);
+            ok = client_count >= 1;
+        } else if (strcmp(argv[i], "-r") == 0) {
+            room_count = atoi(argv[++i]);
+            ok = room_count >= 1;
+        } else if (strcmp(argv[i], "-t") == 0) {
+            min_ns = atoi(argv[++i]) * 1e6;
+            ok = min_ns >= 1e6;
+        } else if (strcmp(argv[i], "-o") == 0) {
+            json = argv[++i];
+        } else {
+            ok = 0;
+        }
+    }
+    if (!ok || room_count > client_count) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    raise_fd_limit();
+    if (fill_tables() < 0) return 1;
+
+    printf("Clients: %d in %d rooms (%d per room)\n", client_count, room_count, client_count / room_count);
+    printf("%-26s %10s %12s %10s\n", "function", "calls", "ns/call", "allocs");
+
+    measure("broadcast_to_room", op_broadcast, min_ns);
+    measure("find_room", op_find_room, min_ns);
+    measure("find_client_by_username", op_find_client, min_ns);
+    measure("add_message_to_history", op_add_history, min_ns);
+    measure("send_room_history", op_send_history, min_ns);
+    measure("handle_client_message", op_dispatch, min_ns);
+    measure("cleanup_empty_rooms", op_cleanup, min_ns);
+
+    /* Queued output means a send came up short and the numbers include queueing */
+    for (i = 0; i < client_capacity; i++) {
+        if (client_fds[i] >= 0 && (clients[i].out.bytes > 0 || (client_flags[i] & CLIENT_CLOSING))) queued++;
+    }
+    if (queued > 0) {
+        fprintf(stderr, "Warning: %d clients queued output or were dropped; results include it\n", queued);
+    }
+
+    if (json) {
+        if (write_json(json) < 0) return 1;
+        printf("Results written to %s\n", json);
+    }
+    return 0;
+}
@@ -0,0 +1,535 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "directory.h"
+#include "name_index.h"
+#include "protocol.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define DIR_INITIAL_SLOTS 64    /**< Slots allocated on first use */
+
+/**
+ * @brief A cached listing and the generation it was rendered from.
+ */
+typedef struct {
+    MsgBuf **pages;             /**< Rendered pages, NULL if none */
+    int count;                  /**< Number of pages */
+    unsigned long generation;   /**< Generation of the rendered state */
+} DirCache;
+
+/**
+ * @file directory.c
+ * @brief Mutex-protected username and room registry.
+ *
+ * Entries live in slot tables that double on demand, with a stack of free
+ * slots each and a NameIndex over the names, the same layout the shards use
+ * for their client and room tables.
+ */
+
+/**
+ * @brief A claimed username.
+ */
+typedef struct {
+    char name[MAX_USERNAME];    /**< Username, "" for a free slot */
+    char room[MAX_ROOMNAME];    /**< Current room, "" if none */
+    int shard;                  /**< Shard the user is connected to */
+} DirUser;
+
+/**
+ * @brief A registered room.
+ */
+typedef struct {
+    char name[MAX_ROOMNAME];    /**< Room name, "" for a free slot */
+    int members;                /**< Members on all shards */
+    int pinned;                 /**< Flag: kept while empty */
+    unsigned long generation;   /**< Generation of the last change to its members */
+    DirCache users;             /**< Cached /users reply */
+} DirRoom;
+
+/** @brief Guards everything below. */
+static pthread_mutex_t dir_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static DirUser *users = NULL;
+static int user_capacity = 0;
+static int *free_users = NULL;
+static int free_user_count = 0;
+static NameIndex user_index;
+
+static DirRoom *rooms = NULL;
+static int room_capacity = 0;
+static int *free_rooms = NULL;
+static int free_room_count = 0;
+static int room_count = 0;
+static NameIndex room_index;
+
+/** @brief Last generation handed out; bumped by every change. */
+static unsigned long generation = 0;
+
+/** @brief Generation of the last change to the room list or a member count. */
+static unsigned long room_list_generation = 0;
+
+/** @brief Cached /rooms reply. */
+static DirCache room_list;
+
+/**
+ * @brief Key callback for the username index.
+ *
+ * @param slot User slot.
+ * @return The username.
+ */
+static const char *user_key(int slot) {
+    return users[slot].name;
+}
+
+/**
+ * @brief Key callback for the room index.
+ *
+ * @param slot Room slot.
+ * @return The room name.
+ */
+static const char *room_key(int slot) {
+    return rooms[slot].name;
+}
+
+/**
+ * @brief Doubles the user table and frees the new slots.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int grow_users(void) {
+    int new_cap = user_capacity ? user_capacity * 2 : DIR_INITIAL_SLOTS;
+    DirUser *new_users;
+    int *new_free;
+    int i;
+
+    if (!user_capacity && name_index_init(&user_index, DIR_INITIAL_SLOTS, user_key) < 0) return -1;
+
+    new_users = realloc(users, new_cap * sizeof(*new_users));
+    if (!new_users) return -1;
+    users = new_users;
+
+    new_free = realloc(free_users, new_cap * sizeof(*new_free));
+    if (!new_free) return -1;
+    free_users = new_free;
+
+    memset(&users[user_capacity], 0, (new_cap - user_capacity) * sizeof(*users));
+    for (i = new_cap - 1; i >= user_capacity; i--) {
+        free_users[free_user_count++] = i;
+    }
+    user_capacity = new_cap;
+    return 0;
+}
+
+/**
+ * @brief Doubles the room table and frees the new slots.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int grow_rooms(void) {
+    int new_cap = room_capacity ? room_capacity * 2 : DIR_INITIAL_SLOTS;
+    DirRoom *new_rooms;
+    int *new_free;
+    int i;
+
+    if (!room_capacity && name_index_init(&room_index, DIR_INITIAL_SLOTS, room_key) < 0) return -1;
+
+    new_rooms = realloc(rooms, new_cap * sizeof(*new_rooms));
+    if (!new_rooms) return -1;
+    rooms = new_rooms;
+
+    new_free = realloc(free_rooms, new_cap * sizeof(*new_free));
+    if (!new_free) return -1;
+    free_rooms = new_free;
+
+    memset(&rooms[room_capacity], 0, (new_cap - room_capacity) * sizeof(*rooms));
+    for (i = new_cap - 1; i >= room_capacity; i--) {
+        free_rooms[free_room_count++] = i;
+    }
+    room_capacity = new_cap;
+    return 0;
+}
+
+/**
+ * @brief Drops a cached listing (lock held).
+ *
+ * @param cache The cache.
+ */
+static void cache_clear(DirCache *cache) {
+    int i;
+
+    for (i = 0; i < cache->count; i++) {
+        msgbuf_unref(cache->pages[i]);
+    }
+    free(cache->pages);
+    cache->pages = NULL;
+    cache->count = 0;
+    cache->generation = 0;
+}
+
+/**
+ * @brief Records a change to a room's members (lock held).
+ *
+ * @param slot Room slot.
+ */
+static void room_changed(int slot) {
+    rooms[slot].generation = ++generation;
+    room_list_generation = generation;
+}
+
+/**
+ * @brief Finds a user slot (lock held).
+ *
+ * @param username The name.
+ * @return Slot, or -1.
+ */
+static int find_user(const char *username) {
+    return user_capacity ? name_index_find(&user_index, username) : -1;
+}
+
+/**
+ * @brief Finds a room slot (lock held).
+ *
+ * @param room The name.
+ * @return Slot, or -1.
+ */
+static int find_room(const char *room) {
+    return room_capacity ? name_index_find(&room_index, room) : -1;
+}
+
+/**
+ * @brief Registers a room (lock held).
+ *
+ * @param room The name.
+ * @return Slot, or -1 on allocation failure.
+ */
+static int add_room(const char *room) {
+    int slot;
+
+    if (free_room_count == 0 && grow_rooms() < 0) return -1;
+
+    slot = free_rooms[free_room_count - 1];
+    strncpy(rooms[slot].name, room, MAX_ROOMNAME - 1);
+    rooms[slot].name[MAX_ROOMNAME - 1] = '\0';
+    if (name_index_insert(&room_index, rooms[slot].name, slot) < 0) {
+        rooms[slot].name[0] = '\0';
+        return -1;
+    }
+    free_room_count--;
+    rooms[slot].members = 0;
+    rooms[slot].pinned = 0;
+    room_count++;
+    room_changed(slot);
+    return slot;
+}
+
+/**
+ * @brief Unregisters a room (lock held).
+ *
+ * @param slot Room slot.
+ */
+static void remove_room(int slot) {
+    name_index_remove(&room_index, rooms[slot].name);
+    rooms[slot].name[0] = '\0';
+    cache_clear(&rooms[slot].users);
+    free_rooms[free_room_count++] = slot;
+    room_count--;
+    room_list_generation = ++generation;
+}
+
+/**
+ * @brief Reserves a username.
+ *
+ * @param username The name.
+ * @param shard Owning shard.
+ * @return 0 on success, 1 if taken, -1 on allocation failure.
+ */
+int dir_claim_user(const char *username, int shard) {
+    int slot;
+    int rc = 0;
+
+    pthread_mutex_lock(&dir_lock);
+    if (find_user(username) >= 0) {
+        rc = 1;
+    } else if (free_user_count == 0 && grow_users() < 0) {
+        rc = -1;
+    } else {
+        slot = free_users[free_user_count - 1];
+        strncpy(users[slot].name, username, MAX_USERNAME - 1);
+        users[slot].name[MAX_USERNAME - 1] = '\0';
+        if (name_index_insert(&user_index, users[slot].name, slot) < 0) {
+            users[slot].name[0] = '\0';
+            rc = -1;
+        } else {
+            free_user_count--;
+            users[slot].room[0] = '\0';
+            users[slot].shard = shard;
+        }
+    }
+    pthread_mutex_unlock(&dir_lock);
+    return rc;
+}
+
+/**
+ * @brief Releases a username.
+ *
+ * @param username The name.
+ */
+void dir_release_user(const char *username) {
+    int slot;
+    int room;
+
+    pthread_mutex_lock(&dir_lock);
+    slot = find_user(username);
+    if (slot >= 0) {
+        /* The name disappears from its room's listing */
+        if (users[slot].room[0] != '\0' && (room = find_room(users[slot].room)) >= 0) {
+            room_changed(room);
+        }
+        name_index_remove(&user_index, users[slot].name);
+        users[slot].name[0] = '\0';
+        users[slot].room[0] = '\0';
+        free_users[free_user_count++] = slot;
+    }
+    pthread_mutex_unlock(&dir_lock);
+}
+
+/**
+ * @brief Returns the shard a user is connected to.
+ *
+ * @param username The name.
+ * @return Shard index, or -1.
+ */
+int dir_find_user(const char *username) {
+    int slot;
+    int shard = -1;
+
+    pthread_mutex_lock(&dir_lock);
+    slot = find_user(username);
+    if (slot >= 0) shard = users[slot].shard;
+    pthread_mutex_unlock(&dir_lock);
+    return shard;
+}
+
+/**
+ * @brief Registers a permanent room.
+ *
+ * @param room The name.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int dir_pin_room(const char *room) {
+    int slot;
+
+    pthread_mutex_lock(&dir_lock);
+    slot = find_room(room);
+    if (slot < 0) slot = add_room(room);
+    if (slot >= 0) rooms[slot].pinned = 1;
+    pthread_mutex_unlock(&dir_lock);
+    return slot >= 0 ? 0 : -1;
+}
+
+/**
+ * @brief Moves a member between rooms.
+ *
+ * @param username Member's name, or "".
+ * @param from Room being left, or NULL.
+ * @param to Room being entered, or NULL.
+ * @param room_limit Maximum number of registered rooms.
+ * @return 0 on success, -1 if the room limit is reached or allocation fails.
+ */
+int dir_move_user(const char *username, const char *from, const char *to, int room_limit) {
+    int user;
+    int slot;
+
+    pthread_mutex_lock(&dir_lock);
+
+    /* Enter first: a refused room leaves the member where it was */
+    if (to) {
+        slot = find_room(to);
+        if (slot < 0) {
+            slot = room_count < room_limit ? add_room(to) : -1;
+        }
+        if (slot < 0) {
+            pthread_mutex_unlock(&dir_lock);
+            return -1;
+        }
+        rooms[slot].members++;
+        room_changed(slot);
+    }
+
+    if (from) {
+        slot = find_room(from);
+        if (slot >= 0) {
+            room_changed(slot);
+            if (--rooms[slot].members <= 0 && !rooms[slot].pinned) {
+                remove_room(slot);
+            }
+        }
+    }
+
+    user = username[0] ? find_user(username) : -1;
+    if (user >= 0) {
+        strncpy(users[user].room, to ? to : "", MAX_ROOMNAME - 1);
+        users[user].room[MAX_ROOMNAME - 1] = '\0';
+    }
+
+    pthread_mutex_unlock(&dir_lock);
+    return 0;
+}
+
+/**
+ * @brief Returns a room's member count.
+ *
+ * @param room Room name.
+ * @return Member count, or -1 if not registered.
+ */
+int dir_room_members(const char *room) {
+    int slot;
+    int members = -1;
+
+    pthread_mutex_lock(&dir_lock);
+    slot = find_room(room);
+    if (slot >= 0) members = rooms[slot].members;
+    pthread_mutex_unlock(&dir_lock);
+    return members;
+}
+
+/**
+ * @brief Returns the number of registered rooms.
+ *
+ * @return Room count.
+ */
+int dir_room_count(void) {
+    int count;
+
+    pthread_mutex_lock(&dir_lock);
+    count = room_count;
+    pthread_mutex_unlock(&dir_lock);
+    return count;
+}
+
+/**
+ * @brief Visits every registered room.
+ *
+ * @param fn Callback.
+ * @param arg Passed through to fn.
+ * @return Room list generation.
+ */
+unsigned long dir_each_room(DirRoomFn fn, void *arg) {
+    unsigned long gen;
+    int i;
+
+    pthread_mutex_lock(&dir_lock);
+    for (i = 0; i < room_capacity; i++) {
+        if (rooms[i].name[0] != '\0') {
+            fn(rooms[i].name, rooms[i].members, arg);
+        }
+    }
+    gen = room_list_generation;
+    pthread_mutex_unlock(&dir_lock);
+    return gen;
+}
+
+/**
+ * @brief Visits every named user in a room.
+ *
+ * @param room Room name.
+ * @param fn Callback.
+ * @param arg Passed through to fn.
+ * @return The room's generation, or 0 if it is not registered.
+ */
+unsigned long dir_each_member(const char *room, DirUserFn fn, void *arg) {
+    unsigned long gen = 0;
+    int slot;
+    int i;
+
+    pthread_mutex_lock(&dir_lock);
+    for (i = 0; i < user_capacity; i++) {
+        if (users[i].name[0] != '\0' && strcmp(users[i].room, room) == 0) {
+            fn(users[i].name, arg);
+        }
+    }
+    slot = find_room(room);
+    if (slot >= 0) gen = rooms[slot].generation;
+    pthread_mutex_unlock(&dir_lock);
+    return gen;
+}
+
+/**
+ * @brief Finds the cache for a listing and its current generation (lock held).
+ *
+ * @param room Room name, or NULL for the room list.
+ * @param current Set to the generation the cache must match.
+ * @return The cache, or NULL if the room is not registered.
+ */
+static DirCache *find_cache(const char *room, unsigned long *current) {
+    int slot;
+
+    if (!room) {
+        *current = room_list_generation;
+        return &room_list;
+    }
+    slot = find_room(room);
+    if (slot < 0) return NULL;
+    *current = rooms[slot].generation;
+    return &rooms[slot].users;
+}
+
+/**
+ * @brief Returns a cached page if the cache is current.
+ *
+ * @param room Room name, or NULL for the room list.
+ * @param page Page index.
+ * @param pages Set to the page count, or 0 if stale.
+ * @return New reference to the page, or NULL.
+ */
+MsgBuf *dir_cached_page(const char *room, int page, int *pages) {
+    DirCache *cache;
+    unsigned long current;
+    MsgBuf *buf = NULL;
+
+    *pages = 0;
+    pthread_mutex_lock(&dir_lock);
+    cache = find_cache(room, &current);
+    if (cache && cache->count > 0 && cache->generation == current) {
+        *pages = cache->count;
+        if (page >= 0 && page < cache->count) {
+            buf = msgbuf_ref(cache->pages[page]);
+        }
+    }
+    pthread_mutex_unlock(&dir_lock);
+    return buf;
+}
+
+/**
+ * @brief Replaces a cached listing if it was rendered from the current state.
+ *
+ * @param room Room name, or NULL for the room list.
+ * @param gen Generation the pages were rendered from.
+ * @param pages Pages to cache.
+ * @param count Number of pages.
+ */
+void dir_cache_pages(const char *room, unsigned long gen, MsgBuf **pages, int count) {
+    DirCache *cache;
+    unsigned long current;
+    MsgBuf **copy;
+    int i;
+
+    if (count <= 0) return;
+
+    pthread_mutex_lock(&dir_lock);
+    cache = find_cache(room, &current);
+    if (cache && gen == current && cache->generation != current) {
+        copy = malloc(count * sizeof(*copy));
+        if (copy) {
+            cache_clear(cache);
+            for (i = 0; i < count; i++) {
+                copy[i] = msgbuf_ref(pages[i]);
+            }
+            cache->pages = copy;
+            cache->count = count;
+            cache->generation = gen;
+        }
+    }
+    pthread_mutex_unlock(&dir_lock);
+}
@@ -0,0 +1,147 @@
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include "msgbuf.h"
+
+/**
+ * @file directory.h
+ * @brief Server-wide registry of usernames and rooms, shared by all shards.
+ *
+ * Every reactor thread keeps its own clients and its own copies of the rooms
+ * they use; what must be consistent across threads lives here: which names
+ * are taken and on which shard their owner is connected, which room each
+ * user is in, and how many members each room has in total. All functions
+ * take one mutex, so they belong on command paths (/name, /join, /rooms),
+ * never on the per-message path.
+ *
+ * The directory also caches the rendered /rooms and /users replies, so that
+ * repeated polls from any thread share one copy. Every change bumps a
+ * generation counter: the room list's on any room or member count change,
+ * a room's own on any change to its members or their names. A cached
+ * listing is served only while the generation it was rendered from is
+ * current.
+ */
+
+/**
+ * @brief Callback for dir_each_room().
+ *
+ * @param name Room name.
+ * @param members Users in the room on all shards.
+ * @param arg Caller's argument.
+ */
+typedef void (*DirRoomFn)(const char *name, int members, void *arg);
+
+/**
+ * @brief Callback for dir_each_member().
+ *
+ * @param username Name of a user in the room.
+ * @param arg Caller's argument.
+ */
+typedef void (*DirUserFn)(const char *username, void *arg);
+
+/**
+ * @brief Reserves a username for a client of `shard`.
+ *
+ * @param username The name.
+ * @param shard Shard the client is connected to.
+ * @return 0 on success, 1 if the name is taken, -1 on allocation failure.
+ */
+int dir_claim_user(const char *username, int shard);
+
+/**
+ * @brief Releases a username (and its room membership record).
+ * @param username The name; ignored if not claimed.
+ */
+void dir_release_user(const char *username);
+
+/**
+ * @brief Looks up the shard a user is connected to.
+ *
+ * @param username The name.
+ * @return Shard index, or -1 if nobody has that name.
+ */
+int dir_find_user(const char *username);
+
+/**
+ * @brief Creates a room that stays registered while it is empty (the lobby).
+ *
+ * @param room Room name; already registered rooms are marked permanent.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int dir_pin_room(const char *room);
+
+/**
+ * @brief Moves one member from a room to another in a single step.
+ *
+ * The target room is registered on first use, which fails once
+ * `room_limit` rooms exist; nothing changes in that case. The source room
+ * is unregistered when its last member leaves unless it is pinned.
+ *
+ * @param username Member's name, or "" for a client without one.
+ * @param from Room being left, or NULL.
+ * @param to Room being entered, or NULL.
+ * @param room_limit Maximum number of registered rooms.
+ * @return 0 on success, -1 if the room limit is reached or allocation fails.
+ */
+int dir_move_user(const char *username, const char *from, const char *to, int room_limit);
+
+/**
+ * @brief Returns a room's member count across all shards.
+ *
+ * @param room Room name.
+ * @return Member count, or -1 if the room is not registered.
+ */
+int dir_room_members(const char *room);
+
+/**
+ * @brief Returns the number of registered rooms.
+ *
+ * @return Room count.
+ */
+int dir_room_count(void);
+
+/**
+ * @brief Calls `fn` for every registered room, in registration slot order.
+ *
+ * Runs under the directory lock: `fn` must not call back into the directory.
+ *
+ * @param fn Callback.
+ * @param arg Passed through to fn.
+ * @return Generation of the room list that was visited.
+ */
+unsigned long dir_each_room(DirRoomFn fn, void *arg);
+
+/**
+ * @brief Calls `fn` for every named user in a room, on any shard.
+ *
+ * Runs under the directory lock: `fn` must not call back into the directory.
+ *
+ * @param room Room name.
+ * @param fn Callback.
+ * @param arg Passed through to fn.
+ * @return Generation of the room's member list, or 0 if the room is not registered.
+ */
+unsigned long dir_each_member(const char *room, DirUserFn fn, void *arg);
+
+/**
+ * @brief Looks up a page of a cached listing.
+ *
+ * @param room Room whose /users listing is wanted, or NULL for /rooms.
+ * @param page Page index, from 0.
+ * @param pages Set to the number of cached pages if the cache is current, else 0.
+ * @return A new reference to the page, or NULL if the cache is stale or has no such page.
+ */
+MsgBuf *dir_cached_page(const char *room, int page, int *pages);
+
+/**
+ * @brief Caches a rendered listing unless the directory has changed since.
+ *
+ * @param room Room the /users listing belongs to, or NULL for /rooms.
+ * @param generation Value returned by the dir_each_room() or dir_each_member()
+ *                   call it was rendered from.
+ * @param pages Rendered pages; the cache takes its own references.
+ * @param count Number of pages.
+ */
+void dir_cache_pages(const char *room, unsigned long generation, MsgBuf **pages, int count);
+
+#endif /* DIRECTORY_H */
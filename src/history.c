@@ -0,0 +1,252 @@
+#include "history.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @file history.c
+ * @brief Byte-packed history ring implementation.
+ *
+ * While not wrapped, live records occupy [head, tail). Once a record no
+ * longer fits before the end of the buffer it is written at offset 0 and
+ * the ring is wrapped: records occupy [head, end) followed by [0, tail).
+ */
+
+/** @brief Records start on multiples of this, so headers stay aligned. */
+#define RECORD_ALIGN    sizeof(unsigned int)
+
+/**
+ * @brief Bytes taken by a record holding a message of `len` characters.
+ *
+ * @param len Message length without the terminator.
+ * @return Record size including header, terminator and padding.
+ */
+static size_t record_size(size_t len) {
+    return (sizeof(unsigned int) + len + 1 + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+}
+
+/**
+ * @brief Reads the message length stored in the record at `pos`.
+ *
+ * @param hist The history.
+ * @param pos Record offset.
+ * @return Message length.
+ */
+static size_t record_len(const HistoryRing *hist, size_t pos) {
+    unsigned int len;
+    memcpy(&len, hist->data + pos, sizeof(len));
+    return len;
+}
+
+/**
+ * @brief Returns the offset of the record following the one at `pos`.
+ *
+ * @param hist The history.
+ * @param pos Record offset.
+ * @return Offset of the next record.
+ */
+static size_t next_record(const HistoryRing *hist, size_t pos) {
+    pos += record_size(record_len(hist, pos));
+    if (hist->wrapped && pos == hist->end) pos = 0;
+    return pos;
+}
+
+/**
+ * @brief Drops the oldest record.
+ *
+ * @param hist The history (must not be empty).
+ */
+static void evict_oldest(HistoryRing *hist) {
+    hist->bytes -= record_size(record_len(hist, hist->head));
+    hist->head = next_record(hist, hist->head);
+    hist->count--;
+
+    if (hist->count == 0) {
+        hist->head = 0;
+        hist->tail = 0;
+        hist->wrapped = 0;
+    } else if (hist->wrapped && hist->head == 0) {
+        hist->wrapped = 0;
+    }
+}
+
+/**
+ * @brief Moves the records, oldest first, into a buffer of a new size.
+ *
+ * @param hist The history.
+ * @param cap New size; must hold all live records.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int resize(HistoryRing *hist, size_t cap) {
+    char *data = malloc(cap);
+    size_t pos = hist->head;
+    size_t out = 0;
+    size_t size;
+    int i;
+
+    if (!data) return -1;
+
+    for (i = 0; i < hist->count; i++) {
+        size = record_size(record_len(hist, pos));
+        memcpy(data + out, hist->data + pos, size);
+        out += size;
+        pos = next_record(hist, pos);
+    }
+
+    free(hist->data);
+    hist->data = data;
+    hist->cap = cap;
+    hist->head = 0;
+    hist->tail = out;
+    hist->wrapped = 0;
+    return 0;
+}
+
+/**
+ * @brief Empties a history and sets its limits.
+ *
+ * @param hist The history.
+ * @param max_count Maximum number of messages kept.
+ * @param max_bytes Byte budget.
+ */
+void history_init(HistoryRing *hist, int max_count, size_t max_bytes) {
+    memset(hist, 0, sizeof(*hist));
+    history_set_limits(hist, max_count, max_bytes);
+}
+
+/**
+ * @brief Changes the limits of a history.
+ *
+ * @param hist The history.
+ * @param max_count Maximum number of messages kept.
+ * @param max_bytes Byte budget.
+ */
+void history_set_limits(HistoryRing *hist, int max_count, size_t max_bytes) {
+    hist->max_count = max_count > 0 ? max_count : 1;
+    hist->max_bytes = max_bytes > HISTORY_MIN_BYTES ? max_bytes : HISTORY_MIN_BYTES;
+
+    while (hist->count > hist->max_count) {
+        evict_oldest(hist);
+    }
+
+    if (hist->data && hist->cap > hist->max_bytes) {
+        while (hist->bytes > hist->max_bytes) {
+            evict_oldest(hist);
+        }
+        resize(hist, hist->max_bytes);
+    }
+}
+
+/**
+ * @brief Releases the storage and forgets all messages.
+ *
+ * @param hist The history.
+ */
+void history_clear(HistoryRing *hist) {
+    free(hist->data);
+    hist->data = NULL;
+    hist->cap = 0;
+    hist->head = 0;
+    hist->tail = 0;
+    hist->end = 0;
+    hist->bytes = 0;
+    hist->wrapped = 0;
+    hist->count = 0;
+}
+
+/**
+ * @brief Appends a message, evicting the oldest ones if needed.
+ *
+ * @param hist The history.
+ * @param message NUL-terminated message.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int history_add(HistoryRing *hist, const char *message) {
+    size_t len = strlen(message);
+    size_t need;
+    size_t pos;
+    size_t cap;
+    unsigned int header;
+
+    /* The largest message must still fit in an empty ring */
+    if (record_size(len) > hist->max_bytes) {
+        len = hist->max_bytes - sizeof(unsigned int) - RECORD_ALIGN;
+    }
+    need = record_size(len);
+
+    while (hist->count >= hist->max_count) {
+        evict_oldest(hist);
+    }
+
+    while (1) {
+        if (!hist->wrapped) {
+            if (hist->cap - hist->tail >= need) {
+                pos = hist->tail;
+                break;
+            }
+            if (hist->head >= need) {
+                /* Wrap: the older records end where the tail was */
+                hist->end = hist->tail;
+                hist->wrapped = 1;
+                hist->tail = 0;
+                pos = 0;
+                break;
+            }
+        } else if (hist->head - hist->tail >= need) {
+            pos = hist->tail;
+            break;
+        }
+
+        if (hist->cap < hist->max_bytes) {
+            /* Grow towards the budget before evicting anything */
+            cap = hist->cap ? hist->cap * 2 : HISTORY_INITIAL_BYTES;
+            while (cap < hist->bytes + need) cap *= 2;
+            if (cap > hist->max_bytes) cap = hist->max_bytes;
+            if (resize(hist, cap) < 0) return -1;
+            continue;
+        }
+
+        evict_oldest(hist);
+    }
+
+    header = (unsigned int)len;
+    memcpy(hist->data + pos, &header, sizeof(header));
+    memcpy(hist->data + pos + sizeof(header), message, len);
+    hist->data[pos + sizeof(header) + len] = '\0';
+
+    hist->tail = pos + need;
+    hist->bytes += need;
+    hist->count++;
+    return 0;
+}
+
+/**
+ * @brief Starts a walk over the stored messages, oldest first.
+ *
+ * @param hist The history.
+ * @param it Iterator to initialize.
+ */
+void history_iter_init(const HistoryRing *hist, HistoryIter *it) {
+    it->pos = hist->head;
+    it->left = hist->count;
+}
+
+/**
+ * @brief Returns the next message of a walk.
+ *
+ * @param hist The history.
+ * @param it Iterator.
+ * @param len Optional output for the message length.
+ * @return NUL-terminated message, or NULL when the walk is done.
+ */
+const char *history_iter_next(const HistoryRing *hist, HistoryIter *it, size_t *len) {
+    const char *message;
+
+    if (it->left <= 0) return NULL;
+
+    message = hist->data + it->pos + sizeof(unsigned int);
+    if (len) *len = record_len(hist, it->pos);
+
+    it->pos = next_record(hist, it->pos);
+    it->left--;
+    return message;
+}
@@ -0,0 +1,97 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+/**
+ * @file history.h
+ * @brief Byte-packed ring of recent room messages.
+ *
+ * Each record is a length header followed by the NUL-terminated message, so
+ * a room holding ten short lines costs a few hundred bytes rather than ten
+ * full network buffers. Storage is allocated on the first message and grows
+ * up to the byte budget; after that the oldest records are evicted. Records
+ * never straddle the end of the buffer, so they can be read in place.
+ */
+
+#define HISTORY_MIN_BYTES       4096    /**< Smallest byte budget accepted */
+#define HISTORY_INITIAL_BYTES   1024    /**< Size of the first allocation */
+
+/**
+ * @brief History of one room.
+ */
+typedef struct {
+    char *data;             /**< Ring storage, NULL until the first message */
+    size_t cap;             /**< Allocated bytes */
+    size_t head;            /**< Offset of the oldest record */
+    size_t tail;            /**< Offset where the next record is written */
+    size_t end;             /**< End of the older segment while wrapped */
+    size_t bytes;           /**< Bytes taken by live records */
+    int wrapped;            /**< Flag: 1 if records continue at offset 0 */
+    int count;              /**< Number of stored messages */
+    int max_count;          /**< Message limit */
+    size_t max_bytes;       /**< Byte budget for the storage */
+} HistoryRing;
+
+/**
+ * @brief Position while walking a history from oldest to newest.
+ */
+typedef struct {
+    size_t pos;             /**< Offset of the next record */
+    int left;               /**< Records not yet returned */
+} HistoryIter;
+
+/**
+ * @brief Empties a history and sets its limits; storage is allocated lazily.
+ *
+ * @param hist The history.
+ * @param max_count Maximum number of messages kept.
+ * @param max_bytes Byte budget (raised to HISTORY_MIN_BYTES if smaller).
+ */
+void history_init(HistoryRing *hist, int max_count, size_t max_bytes);
+
+/**
+ * @brief Changes the limits of a history, evicting old messages to fit.
+ *
+ * @param hist The history.
+ * @param max_count Maximum number of messages kept.
+ * @param max_bytes Byte budget (raised to HISTORY_MIN_BYTES if smaller).
+ */
+void history_set_limits(HistoryRing *hist, int max_count, size_t max_bytes);
+
+/**
+ * @brief Releases the storage and forgets all messages (limits are kept).
+ * @param hist The history.
+ */
+void history_clear(HistoryRing *hist);
+
+/**
+ * @brief Appends a message, evicting the oldest ones if needed.
+ *
+ * Messages longer than the budget allows are truncated.
+ *
+ * @param hist The history.
+ * @param message NUL-terminated message.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int history_add(HistoryRing *hist, const char *message);
+
+/**
+ * @brief Starts a walk over the stored messages, oldest first.
+ *
+ * @param hist The history.
+ * @param it Iterator to initialize.
+ */
+void history_iter_init(const HistoryRing *hist, HistoryIter *it);
+
+/**
+ * @brief Returns the next message of a walk.
+ *
+ * @param hist The history (must not be modified during the walk).
+ * @param it Iterator.
+ * @param len Optional output for the message length.
+ * @return NUL-terminated message, or NULL when the walk is done.
+ */
+const char *history_iter_next(const HistoryRing *hist, HistoryIter *it, size_t *len);
+
+#endif /* HISTORY_H */
@@ -0,0 +1,174 @@
+#include "io_backend.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+/**
+ * @file io_backend.c
+ * @brief Dispatches the I/O interface to the backend chosen at startup.
+ *
+ * The Makefile defines IO_HAVE_URING, IO_HAVE_EPOLL and IO_HAVE_SELECT for
+ * the backends linked into the build.
+ */
+
+/** @brief Compiled-in backends, most preferred first. */
+static const IoBackendOps *const backends[] = {
+#ifdef IO_HAVE_URING
+    &io_uring_backend,
+#endif
+#ifdef IO_HAVE_EPOLL
+    &io_epoll_backend,
+#endif
+#ifdef IO_HAVE_SELECT
+    &io_select_backend,
+#endif
+    NULL
+};
+
+/** @brief The active backend, or NULL before io_init(). */
+static __thread const IoBackendOps *io = NULL;
+
+/**
+ * @brief Initializes the requested backend, or the first one that works.
+ *
+ * @param name Backend name, or NULL for the default order.
+ * @return 0 on success, -1 on failure.
+ */
+int io_init(const char *name) {
+    int i;
+
+    for (i = 0; backends[i]; i++) {
+        if (name && strcmp(name, backends[i]->name) != 0) continue;
+
+        if (backends[i]->init() == 0) {
+            io = backends[i];
+            return 0;
+        }
+        if (!name && backends[i + 1]) {
+            fprintf(stderr, "%s backend unavailable, falling back to %s\n",
+                    backends[i]->name, backends[i + 1]->name);
+        }
+    }
+
+    if (name) {
+        fprintf(stderr, "I/O backend '%s' is not available in this build\n", name);
+    }
+    return -1;
+}
+
+/**
+ * @brief Starts watching a client descriptor.
+ *
+ * @param fd File descriptor.
+ * @return 0 on success, -1 on failure.
+ */
+int io_add(int fd) {
+    return io ? io->add(fd) : -1;
+}
+
+/**
+ * @brief Starts accepting connections on a listening socket.
+ *
+ * @param fd Listening socket.
+ * @return 0 on success, -1 on failure.
+ */
+int io_listen(int fd) {
+    if (!io) return -1;
+    return io->listen ? io->listen(fd) : io->add(fd);
+}
+
+/**
+ * @brief Enables or disables write notifications.
+ *
+ * @param fd File descriptor.
+ * @param enable 1 to enable, 0 to disable.
+ * @return 0 on success, -1 on failure.
+ */
+int io_watch_write(int fd, int enable) {
+    if (!io || !io->watch_write) return -1;
+    return io->watch_write(fd, enable);
+}
+
+/**
+ * @brief Submits output to a completion backend.
+ *
+ * @param fd File descriptor.
+ * @param bufs Buffers to write.
+ * @param count Number of buffers.
+ * @param offset Bytes of the first buffer already sent.
+ * @return 0 if submitted, -1 otherwise.
+ */
+int io_send(int fd, MsgBuf *const *bufs, int count, size_t offset) {
+    if (!io || !io->send) return -1;
+    return io->send(fd, bufs, count, offset);
+}
+
+/**
+ * @brief Stops watching a descriptor.
+ *
+ * @param fd File descriptor.
+ */
+void io_remove(int fd) {
+    if (io) io->remove(fd);
+}
+
+/**
+ * @brief Stops watching a descriptor and closes it.
+ *
+ * @param fd File descriptor.
+ */
+void io_close_fd(int fd) {
+    if (fd < 0) return;
+
+    if (io && io->close_fd) {
+        io->close_fd(fd);
+        return;
+    }
+    io_remove(fd);
+    close(fd);
+}
+
+/**
+ * @brief Waits for events.
+ *
+ * @param events Output array.
+ * @param max_events Capacity of the array.
+ * @param timeout_ms Timeout in milliseconds, or -1.
+ * @return Number of events, 0 on timeout, -1 on error.
+ */
+int io_wait(IoEvent *events, int max_events, int timeout_ms) {
+    if (!io) {
+        errno = EINVAL;
+        return -1;
+    }
+    return io->wait(events, max_events, timeout_ms);
+}
+
+/**
+ * @brief Releases the active backend.
+ */
+void io_close(void) {
+    if (io) {
+        io->close();
+        io = NULL;
+    }
+}
+
+/**
+ * @brief Returns the name of the active backend.
+ *
+ * @return Backend name, or "none".
+ */
+const char *io_backend_name(void) {
+    return io ? io->name : "none";
+}
+
+/**
+ * @brief Reports whether the active backend performs the I/O itself.
+ *
+ * @return 1 for completion backends, 0 otherwise.
+ */
+int io_completion_mode(void) {
+    return io ? io->completion : 0;
+}
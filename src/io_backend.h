@@ -0,0 +1,168 @@
+#ifndef IO_BACKEND_H
+#define IO_BACKEND_H
+
+#include "msgbuf.h"
+
+/**
+ * @file io_backend.h
+ * @brief I/O interface used by the server event loop.
+ *
+ * The backends are chosen at build time (`make IO=epoll`, `make IO=select`
+ * or `make IO=uring`). An io_uring build also links epoll and select and
+ * falls back to them at runtime when the kernel lacks io_uring support.
+ *
+ * Readiness backends (epoll, select) report descriptors that can be read or
+ * written, and the server performs the recv()/send() calls itself.
+ * Completion backends (io_uring) do the I/O: io_wait() delivers accepted
+ * descriptors, received bytes and finished sends, and output is handed over
+ * with io_send(). io_completion_mode() tells the two apart.
+ *
+ * Backend state is thread-local: each reactor thread calls io_init() and
+ * drives its own epoll set, select sets or ring.
+ */
+
+#define IO_EVENT_READ   0x01    /**< Descriptor has data (or a pending accept) */
+#define IO_EVENT_WRITE  0x02    /**< Descriptor can accept more output */
+#define IO_EVENT_ERROR  0x04    /**< Descriptor reported an error or hang-up */
+#define IO_EVENT_ACCEPT 0x08    /**< Completion: `result` is a newly accepted descriptor */
+#define IO_EVENT_DATA   0x10    /**< Completion: `result` bytes were received into `data` */
+#define IO_EVENT_SENT   0x20    /**< Completion: io_send() finished, `result` bytes or -errno */
+
+#define IO_MAX_EVENTS   256     /**< Maximum events returned by one io_wait() */
+#define IO_SEND_MAX_BUFS 256    /**< Maximum buffers accepted by one io_send() */
+
+/**
+ * @brief A single event reported by io_wait().
+ */
+typedef struct {
+    int fd;                 /**< File descriptor the event is about */
+    unsigned int events;    /**< Bitmask of IO_EVENT_* flags */
+    int result;             /**< Completion result: accepted fd or byte count */
+    char *data;             /**< IO_EVENT_DATA: received bytes, writable and valid until the next io_wait() */
+} IoEvent;
+
+/**
+ * @brief Operations implemented by one backend.
+ *
+ * Optional hooks may be NULL; the dispatcher then uses the readiness
+ * behavior (io_listen() registers like io_add(), io_close_fd() removes and
+ * closes the descriptor immediately).
+ */
+typedef struct {
+    const char *name;                                   /**< Backend name for logs and -i */
+    int completion;                                     /**< 1 if the backend performs the I/O itself */
+    int (*init)(void);                                  /**< Set up; -1 if unsupported here */
+    int (*add)(int fd);                                 /**< Start watching a client */
+    int (*listen)(int fd);                              /**< Start accepting on a listening socket */
+    int (*watch_write)(int fd, int enable);             /**< Toggle write readiness */
+    int (*send)(int fd, MsgBuf *const *bufs, int count, size_t offset); /**< Submit output */
+    void (*remove)(int fd);                             /**< Stop watching */
+    void (*close_fd)(int fd);                           /**< Stop watching and close */
+    int (*wait)(IoEvent *events, int max_events, int timeout_ms); /**< Collect events */
+    void (*close)(void);                                /**< Release everything */
+} IoBackendOps;
+
+/**
+ * @brief Initializes a backend.
+ *
+ * @param name Backend to use ("uring", "epoll" or "select"), or NULL to try
+ *             the compiled-in backends in order of preference.
+ * @return 0 on success, -1 if no (or not the requested) backend is usable.
+ */
+int io_init(const char *name);
+
+/**
+ * @brief Starts watching a client descriptor.
+ *
+ * Readiness backends expect a non-blocking descriptor: the epoll backend is
+ * edge-triggered, so callers have to drain it until EAGAIN on every wakeup.
+ * Completion backends start receiving into their own buffers.
+ *
+ * @param fd File descriptor to register.
+ * @return 0 on success, -1 on failure.
+ */
+int io_add(int fd);
+
+/**
+ * @brief Starts accepting connections on a listening socket.
+ *
+ * @param fd Listening socket.
+ * @return 0 on success, -1 on failure.
+ */
+int io_listen(int fd);
+
+/**
+ * @brief Enables or disables write notifications for a descriptor.
+ *
+ * Enabled only while a client has queued output, so idle sockets do not
+ * produce writable wakeups. Unused in completion mode.
+ *
+ * @param fd Registered file descriptor.
+ * @param enable 1 to report IO_EVENT_WRITE, 0 to stop.
+ * @return 0 on success, -1 on failure.
+ */
+int io_watch_write(int fd, int enable);
+
+/**
+ * @brief Submits output to a completion backend.
+ *
+ * The backend keeps its own references until the send completes and then
+ * reports IO_EVENT_SENT. At most one send per descriptor may be pending.
+ *
+ * @param fd Registered file descriptor.
+ * @param bufs Buffers to write, in order.
+ * @param count Number of buffers.
+ * @param offset Bytes of the first buffer that were already sent.
+ * @return 0 if submitted, -1 on failure or if the backend is readiness-based.
+ */
+int io_send(int fd, MsgBuf *const *bufs, int count, size_t offset);
+
+/**
+ * @brief Stops watching a descriptor. Safe to call for unknown descriptors.
+ * @param fd File descriptor to remove.
+ */
+void io_remove(int fd);
+
+/**
+ * @brief Stops watching a descriptor and closes it.
+ *
+ * Completion backends may delay the close until a pending send finishes,
+ * so the descriptor number is not reused while the kernel still uses it.
+ *
+ * @param fd File descriptor to close.
+ */
+void io_close_fd(int fd);
+
+/**
+ * @brief Waits until at least one event is available.
+ *
+ * @param events Output array of events.
+ * @param max_events Capacity of the events array.
+ * @param timeout_ms Timeout in milliseconds, or -1 to wait forever.
+ * @return Number of events stored, 0 on timeout, -1 on error (errno set).
+ */
+int io_wait(IoEvent *events, int max_events, int timeout_ms);
+
+/**
+ * @brief Releases all backend resources.
+ */
+void io_close(void);
+
+/**
+ * @brief Returns the name of the active backend.
+ * @return Static string such as "epoll", or "none" before io_init().
+ */
+const char *io_backend_name(void);
+
+/**
+ * @brief Reports whether the active backend performs the I/O itself.
+ * @return 1 for completion backends, 0 otherwise (or before io_init()).
+ */
+int io_completion_mode(void);
+
+/* --- Compiled-in backends --- */
+extern const IoBackendOps io_uring_backend;    /**< io_uring (IO=uring) */
+extern const IoBackendOps io_epoll_backend;    /**< epoll (IO=epoll, IO=uring) */
+extern const IoBackendOps io_select_backend;   /**< select (IO=select, IO=uring) */
+
+#endif /* IO_BACKEND_H */
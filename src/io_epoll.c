@@ -0,0 +1,134 @@
+#include "io_backend.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+/**
+ * @file io_epoll.c
+ * @brief Edge-triggered epoll implementation of the I/O backend.
+ *
+ * Each descriptor is registered once with EPOLLET, so a wakeup costs
+ * O(ready sockets) instead of O(capacity) and there is no FD_SETSIZE limit.
+ */
+
+/** @brief The epoll instance, or -1 when the backend is not initialized. */
+static __thread int epoll_fd = -1;
+
+/**
+ * @brief Creates the epoll instance.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int epoll_io_init(void) {
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Registers a descriptor for edge-triggered read notifications.
+ *
+ * @param fd File descriptor to register.
+ * @return 0 on success, -1 on failure.
+ */
+static int epoll_io_add(int fd) {
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds or removes EPOLLOUT interest for a descriptor.
+ *
+ * @param fd Registered file descriptor.
+ * @param enable 1 to watch for writability, 0 to stop.
+ * @return 0 on success, -1 on failure.
+ */
+static int epoll_io_watch_write(int fd, int enable) {
+    struct epoll_event ev;
+
+    if (epoll_fd < 0) return -1;
+
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (enable ? EPOLLOUT : 0);
+    ev.data.fd = fd;
+
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+/**
+ * @brief Removes a descriptor from the epoll set.
+ *
+ * @param fd File descriptor to remove.
+ */
+static void epoll_io_remove(int fd) {
+    struct epoll_event ev;
+
+    if (epoll_fd < 0 || fd < 0) return;
+
+    /* Errors are ignored: the descriptor may never have been registered */
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+/**
+ * @brief Waits for ready descriptors.
+ *
+ * @param events Output array of ready events.
+ * @param max_events Capacity of the events array.
+ * @param timeout_ms Timeout in milliseconds, or -1 to wait forever.
+ * @return Number of events, 0 on timeout, -1 on error.
+ */
+static int epoll_io_wait(IoEvent *events, int max_events, int timeout_ms) {
+    struct epoll_event ready[IO_MAX_EVENTS];
+    int n, i;
+
+    if (max_events > IO_MAX_EVENTS) max_events = IO_MAX_EVENTS;
+
+    n = epoll_wait(epoll_fd, ready, max_events, timeout_ms);
+    if (n < 0) return -1;
+
+    for (i = 0; i < n; i++) {
+        events[i].fd = ready[i].data.fd;
+        events[i].events = 0;
+        events[i].result = 0;
+        events[i].data = NULL;
+        if (ready[i].events & (EPOLLIN | EPOLLRDHUP)) events[i].events |= IO_EVENT_READ;
+        if (ready[i].events & EPOLLOUT) events[i].events |= IO_EVENT_WRITE;
+        if (ready[i].events & (EPOLLERR | EPOLLHUP)) events[i].events |= IO_EVENT_ERROR;
+    }
+    return n;
+}
+
+/**
+ * @brief Closes the epoll instance.
+ */
+static void epoll_io_close(void) {
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+}
+
+/** @brief epoll backend operations. */
+const IoBackendOps io_epoll_backend = {
+    "epoll",
+    0,
+    epoll_io_init,
+    epoll_io_add,
+    NULL,
+    epoll_io_watch_write,
+    NULL,
+    epoll_io_remove,
+    NULL,
+    epoll_io_wait,
+    epoll_io_close
+};
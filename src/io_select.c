@@ -0,0 +1,154 @@
+#include "io_backend.h"
+#include <stdio.h>
+#include <errno.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+/**
+ * @file io_select.c
+ * @brief select() implementation of the I/O backend.
+ *
+ * Kept as a portable fallback and as a baseline for benchmarking the epoll
+ * backend. Descriptors at or above FD_SETSIZE are rejected.
+ */
+
+/** @brief Set of registered descriptors, copied before every select(). */
+static __thread fd_set watched_fds;
+
+/** @brief Descriptors that currently have queued output. */
+static __thread fd_set write_fds;
+
+/** @brief Highest registered descriptor, or -1 when none. */
+static __thread int max_watched_fd = -1;
+
+/**
+ * @brief Clears the watched descriptor set.
+ *
+ * @return Always 0.
+ */
+static int select_io_init(void) {
+    FD_ZERO(&watched_fds);
+    FD_ZERO(&write_fds);
+    max_watched_fd = -1;
+    return 0;
+}
+
+/**
+ * @brief Adds a descriptor to the watched set.
+ *
+ * @param fd File descriptor to register.
+ * @return 0 on success, -1 if the descriptor does not fit in an fd_set.
+ */
+static int select_io_add(int fd) {
+    if (fd < 0 || fd >= FD_SETSIZE) {
+        fprintf(stderr, "select backend: fd %d exceeds FD_SETSIZE\n", fd);
+        errno = EMFILE;
+        return -1;
+    }
+
+    FD_SET(fd, &watched_fds);
+    if (fd > max_watched_fd) {
+        max_watched_fd = fd;
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds or removes a descriptor from the write set.
+ *
+ * @param fd Registered file descriptor.
+ * @param enable 1 to watch for writability, 0 to stop.
+ * @return 0 on success, -1 if the descriptor is out of range.
+ */
+static int select_io_watch_write(int fd, int enable) {
+    if (fd < 0 || fd >= FD_SETSIZE) return -1;
+
+    if (enable) {
+        FD_SET(fd, &write_fds);
+    } else {
+        FD_CLR(fd, &write_fds);
+    }
+    return 0;
+}
+
+/**
+ * @brief Removes a descriptor from the watched set.
+ *
+ * @param fd File descriptor to remove.
+ */
+static void select_io_remove(int fd) {
+    if (fd < 0 || fd >= FD_SETSIZE) return;
+
+    FD_CLR(fd, &watched_fds);
+    FD_CLR(fd, &write_fds);
+    while (max_watched_fd >= 0 && !FD_ISSET(max_watched_fd, &watched_fds)) {
+        max_watched_fd--;
+    }
+}
+
+/**
+ * @brief Waits for ready descriptors using select().
+ *
+ * @param events Output array of ready events.
+ * @param max_events Capacity of the events array.
+ * @param timeout_ms Timeout in milliseconds, or -1 to wait forever.
+ * @return Number of events, 0 on timeout, -1 on error.
+ */
+static int select_io_wait(IoEvent *events, int max_events, int timeout_ms) {
+    fd_set readfds = watched_fds;
+    fd_set writefds = write_fds;
+    struct timeval tv;
+    struct timeval *tvp = NULL;
+    int activity;
+    int fd;
+    int n = 0;
+
+    if (timeout_ms >= 0) {
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        tvp = &tv;
+    }
+
+    activity = select(max_watched_fd + 1, &readfds, &writefds, NULL, tvp);
+    if (activity <= 0) return activity;
+
+    for (fd = 0; fd <= max_watched_fd && n < max_events; fd++) {
+        unsigned int ev = 0;
+
+        if (FD_ISSET(fd, &readfds)) ev |= IO_EVENT_READ;
+        if (FD_ISSET(fd, &writefds)) ev |= IO_EVENT_WRITE;
+
+        if (ev) {
+            events[n].fd = fd;
+            events[n].events = ev;
+            events[n].result = 0;
+            events[n].data = NULL;
+            n++;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Clears the watched descriptor set.
+ */
+static void select_io_close(void) {
+    FD_ZERO(&watched_fds);
+    FD_ZERO(&write_fds);
+    max_watched_fd = -1;
+}
+
+/** @brief select backend operations. */
+const IoBackendOps io_select_backend = {
+    "select",
+    0,
+    select_io_init,
+    select_io_add,
+    NULL,
+    select_io_watch_write,
+    NULL,
+    select_io_remove,
+    NULL,
+    select_io_wait,
+    select_io_close
+};
@@ -0,0 +1,747 @@
+#define _GNU_SOURCE
+
+#include "io_backend.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/**
+ * @file io_uring.c
+ * @brief io_uring implementation of the I/O backend (completion mode).
+ *
+ * The listening socket uses a single multishot accept. Each client gets one
+ * multishot recv that picks buffers from a ring of provided buffers, so
+ * steady traffic needs no per-read submissions at all. Output is submitted
+ * as a chain of linked SENDMSG requests covering everything queued for the
+ * client, and every io_wait() turns all prepared requests into one
+ * io_uring_enter() call.
+ *
+ * The ring is driven through the raw system calls, so no liburing is
+ * needed. Setup asks for IORING_SETUP_SINGLE_ISSUER, which only kernels
+ * with multishot recv (6.0+) accept; older kernels fail io_init() and the
+ * server falls back to epoll.
+ */
+
+#define URING_SQ_ENTRIES    1024    /**< Submission queue size */
+#define URING_CQ_ENTRIES    8192    /**< Completion queue size */
+#define URING_BUF_COUNT     256     /**< Provided receive buffers (power of two); also caps unread input */
+#define URING_BUF_SIZE      4096    /**< Size of each receive buffer */
+#define URING_BUF_GROUP     0       /**< Buffer group id of the receive ring */
+#define URING_SEND_LINKS    (IO_SEND_MAX_BUFS / OUTQ_IOV_MAX) /**< SENDMSGs per chain */
+
+/** @brief Request kinds, stored in the top byte of user_data. */
+enum {
+    OP_ACCEPT = 1,
+    OP_RECV,
+    OP_SEND,
+    OP_CANCEL
+};
+
+/**
+ * @brief Output submitted for one descriptor and not completed yet.
+ */
+typedef struct SendState {
+    struct msghdr mh[URING_SEND_LINKS];     /**< One header per linked SENDMSG */
+    struct iovec iov[IO_SEND_MAX_BUFS];     /**< Gather list for all links */
+    MsgBuf *held[IO_SEND_MAX_BUFS];         /**< References kept until completion */
+    int held_count;                         /**< Entries in held */
+    int links_left;                         /**< Completions still expected */
+    long sent;                              /**< Bytes written so far */
+    int error;                              /**< First error other than cancellation */
+    struct SendState *next_free;            /**< Free list link */
+} SendState;
+
+/**
+ * @brief Per-descriptor bookkeeping.
+ */
+typedef struct {
+    unsigned int gen;       /**< Bumped on removal; completions of older requests are dropped */
+    int recv_armed;         /**< Flag: multishot recv is active */
+    int close_pending;      /**< Flag: close once the pending send completes */
+    SendState *send;        /**< Pending send, or NULL */
+} FdState;
+
+/* --- Ring state --- */
+static __thread int ring_fd = -1;
+static __thread unsigned int sq_entries;
+static __thread unsigned int *sq_head;
+static __thread unsigned int *sq_tail;
+static __thread unsigned int *sq_mask;
+static __thread unsigned int sq_local_tail;
+static __thread struct io_uring_sqe *sqes;
+static __thread unsigned int *cq_head;
+static __thread unsigned int *cq_tail;
+static __thread unsigned int *cq_mask;
+static __thread struct io_uring_cqe *cqes;
+static __thread void *ring_ptr = MAP_FAILED;
+static __thread size_t ring_len;
+static __thread size_t sqes_len;
+
+/* --- Provided receive buffers --- */
+static __thread struct io_uring_buf_ring *buf_ring = MAP_FAILED;
+static __thread size_t buf_ring_len;
+static __thread char *buf_base = NULL;
+static __thread unsigned short buf_tail;
+
+/** @brief Buffers handed out by the last io_wait(), returned on the next one. */
+static __thread unsigned short recycle[URING_BUF_COUNT];
+static __thread int recycle_count = 0;
+
+/* --- Descriptors --- */
+static __thread FdState *fds = NULL;
+static __thread int fd_capacity = 0;
+static __thread int listen_fd = -1;
+
+/** @brief Descriptors whose recv stopped for lack of buffers. */
+static __thread int *starved = NULL;
+static __thread int starved_count = 0;
+static __thread int starved_cap = 0;
+
+static __thread SendState *free_sends = NULL;
+
+/**
+ * @brief Packs a request kind, generation and descriptor into user_data.
+ *
+ * @param op Request kind.
+ * @param gen Descriptor generation.
+ * @param fd Descriptor.
+ * @return user_data value.
+ */
+static unsigned long long pack(int op, unsigned int gen, int fd) {
+    return ((unsigned long long)op << 56) |
+           ((unsigned long long)(gen & 0xffffff) << 32) |
+           (unsigned int)fd;
+}
+
+/**
+ * @brief Returns the state of a descriptor, growing the table if needed.
+ *
+ * @param fd Descriptor.
+ * @return State, or NULL on allocation failure.
+ */
+static FdState *fd_state(int fd) {
+    int new_cap;
+    FdState *grown;
+
+    if (fd < 0) return NULL;
+    if (fd < fd_capacity) return &fds[fd];
+
+    new_cap = fd_capacity ? fd_capacity : 64;
+    while (new_cap <= fd) new_cap *= 2;
+
+    grown = realloc(fds, new_cap * sizeof(*grown));
+    if (!grown) return NULL;
+    memset(grown + fd_capacity, 0, (new_cap - fd_capacity) * sizeof(*grown));
+
+    fds = grown;
+    fd_capacity = new_cap;
+    return &fds[fd];
+}
+
+/**
+ * @brief Hands prepared requests to the kernel and optionally waits.
+ *
+ * @param wait_nr Completions to wait for.
+ * @param flags io_uring_enter flags.
+ * @param arg Extended argument, or NULL.
+ * @param argsz Size of arg.
+ * @return io_uring_enter result.
+ */
+static int enter(unsigned int wait_nr, unsigned int flags, void *arg, size_t argsz) {
+    unsigned int to_submit;
+
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+    to_submit = sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_nr, flags, arg, argsz);
+}
+
+/**
+ * @brief Number of prepared requests the kernel has not consumed yet.
+ *
+ * @return Pending submissions.
+ */
+static unsigned int unsubmitted(void) {
+    return sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Makes sure `count` submission slots are free.
+ *
+ * @param count Slots needed.
+ * @return 0 on success, -1 if the queue stays full.
+ */
+static int reserve_sqes(unsigned int count) {
+    if (sq_entries - unsubmitted() >= count) return 0;
+
+    enter(0, 0, NULL, 0);
+    return sq_entries - unsubmitted() >= count ? 0 : -1;
+}
+
+/**
+ * @brief Returns a cleared submission entry; call reserve_sqes() first.
+ *
+ * @return Submission entry.
+ */
+static struct io_uring_sqe *next_sqe(void) {
+    struct io_uring_sqe *sqe = &sqes[sq_local_tail & *sq_mask];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sq_local_tail++;
+    return sqe;
+}
+
+/**
+ * @brief Returns a receive buffer to the kernel (published on the next publish_buffers()).
+ *
+ * @param bid Buffer id.
+ */
+static void add_buffer(unsigned short bid) {
+    struct io_uring_buf *buf = &buf_ring->bufs[buf_tail & (URING_BUF_COUNT - 1)];
+
+    buf->addr = (unsigned long long)(unsigned long)(buf_base + (size_t)bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    buf_tail++;
+}
+
+/**
+ * @brief Makes buffers added with add_buffer() visible to the kernel.
+ */
+static void publish_buffers(void) {
+    __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Arms a multishot recv for a descriptor.
+ *
+ * @param fd Descriptor.
+ * @return 0 on success, -1 on failure.
+ */
+static int arm_recv(int fd) {
+    FdState *st = fd_state(fd);
+    struct io_uring_sqe *sqe;
+
+    if (!st || reserve_sqes(1) < 0) return -1;
+
+    sqe = next_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = pack(OP_RECV, st->gen, fd);
+    st->recv_armed = 1;
+    return 0;
+}
+
+/**
+ * @brief Arms the multishot accept on the listening socket.
+ *
+ * @param fd Listening socket.
+ * @return 0 on success, -1 on failure.
+ */
+static int arm_accept(int fd) {
+    FdState *st = fd_state(fd);
+    struct io_uring_sqe *sqe;
+
+    if (!st || reserve_sqes(1) < 0) return -1;
+
+    sqe = next_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = pack(OP_ACCEPT, st->gen, fd);
+    return 0;
+}
+
+/**
+ * @brief Releases the ring and all buffers.
+ */
+static void uring_io_close(void) {
+    SendState *st;
+    int fd, i;
+
+    if (ring_fd >= 0) {
+        close(ring_fd);
+        ring_fd = -1;
+    }
+    if (ring_ptr != MAP_FAILED) munmap(ring_ptr, ring_len);
+    if (sqes && (void *)sqes != MAP_FAILED) munmap(sqes, sqes_len);
+    if (buf_ring != MAP_FAILED) munmap(buf_ring, buf_ring_len);
+    ring_ptr = MAP_FAILED;
+    sqes = NULL;
+    buf_ring = MAP_FAILED;
+
+    for (fd = 0; fd < fd_capacity; fd++) {
+        if (fds[fd].send) {
+            for (i = 0; i < fds[fd].send->held_count; i++) {
+                msgbuf_unref(fds[fd].send->held[i]);
+            }
+            free(fds[fd].send);
+        }
+    }
+    while ((st = free_sends) != NULL) {
+        free_sends = st->next_free;
+        free(st);
+    }
+
+    free(buf_base);
+    free(fds);
+    free(starved);
+    buf_base = NULL;
+    fds = NULL;
+    starved = NULL;
+    fd_capacity = 0;
+    starved_count = 0;
+    starved_cap = 0;
+    recycle_count = 0;
+    listen_fd = -1;
+}
+
+/**
+ * @brief Creates the ring and registers the provided buffer ring.
+ *
+ * @return 0 on success, -1 if io_uring is unavailable or too old.
+ */
+static int uring_io_init(void) {
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    char *cq_base;
+    size_t sq_len, cq_len;
+    unsigned int i;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = URING_CQ_ENTRIES;
+
+    ring_fd = (int)syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &p);
+    if (ring_fd < 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG) ||
+        !(p.features & IORING_FEAT_NODROP)) {
+        fprintf(stderr, "io_uring: kernel lacks required features\n");
+        uring_io_close();
+        return -1;
+    }
+
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring_len = sq_len > cq_len ? sq_len : cq_len;
+    ring_ptr = mmap(NULL, ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring_fd, IORING_OFF_SQ_RING);
+    sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring_fd, IORING_OFF_SQES);
+    if (ring_ptr == MAP_FAILED || (void *)sqes == MAP_FAILED) {
+        perror("io_uring mmap");
+        uring_io_close();
+        return -1;
+    }
+
+    sq_entries = p.sq_entries;
+    sq_head = (unsigned int *)((char *)ring_ptr + p.sq_off.head);
+    sq_tail = (unsigned int *)((char *)ring_ptr + p.sq_off.tail);
+    sq_mask = (unsigned int *)((char *)ring_ptr + p.sq_off.ring_mask);
+    sq_local_tail = *sq_tail;
+    for (i = 0; i < p.sq_entries; i++) {
+        ((unsigned int *)((char *)ring_ptr + p.sq_off.array))[i] = i;
+    }
+
+    cq_base = ring_ptr;
+    cq_head = (unsigned int *)(cq_base + p.cq_off.head);
+    cq_tail = (unsigned int *)(cq_base + p.cq_off.tail);
+    cq_mask = (unsigned int *)(cq_base + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(cq_base + p.cq_off.cqes);
+
+    /* Receive buffers: one slab, described to the kernel by a buffer ring */
+    buf_ring_len = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+    buf_ring = mmap(NULL, buf_ring_len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    buf_base = malloc((size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+    if (buf_ring == MAP_FAILED || !buf_base) {
+        fprintf(stderr, "io_uring: cannot allocate receive buffers\n");
+        uring_io_close();
+        return -1;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)(unsigned long)buf_ring;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = URING_BUF_GROUP;
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("io_uring_register(PBUF_RING)");
+        uring_io_close();
+        return -1;
+    }
+
+    buf_tail = 0;
+    for (i = 0; i < URING_BUF_COUNT; i++) {
+        add_buffer((unsigned short)i);
+    }
+    publish_buffers();
+    return 0;
+}
+
+/**
+ * @brief Starts receiving from a client.
+ *
+ * @param fd Client socket.
+ * @return 0 on success, -1 on failure.
+ */
+static int uring_io_add(int fd) {
+    return arm_recv(fd);
+}
+
+/**
+ * @brief Starts accepting on the listening socket.
+ *
+ * @param fd Listening socket.
+ * @return 0 on success, -1 on failure.
+ */
+static int uring_io_listen(int fd) {
+    listen_fd = fd;
+    return arm_accept(fd);
+}
+
+/**
+ * @brief Write readiness is not used in completion mode.
+ *
+ * @param fd Descriptor.
+ * @param enable Ignored.
+ * @return Always 0.
+ */
+static int uring_io_watch_write(int fd, int enable) {
+    (void)fd;
+    (void)enable;
+    return 0;
+}
+
+/**
+ * @brief Submits queued output as a chain of linked SENDMSG requests.
+ *
+ * Links keep the chunks in order without waiting for each other. A send
+ * stays pending only while the socket buffer is full; if one comes back
+ * short or fails, the kernel cancels the rest of the chain and the caller
+ * resubmits from wherever the completed bytes end.
+ *
+ * @param fd Client socket.
+ * @param bufs Buffers to write.
+ * @param count Number of buffers.
+ * @param offset Bytes of the first buffer already sent.
+ * @return 0 if submitted, -1 on failure.
+ */
+static int uring_io_send(int fd, MsgBuf *const *bufs, int count, size_t offset) {
+    FdState *st = fd_state(fd);
+    SendState *ss;
+    struct io_uring_sqe *sqe;
+    int links;
+    int i, k, chunk;
+
+    if (!st || st->send || count <= 0) return -1;
+    if (count > IO_SEND_MAX_BUFS) count = IO_SEND_MAX_BUFS;
+
+    links = (count + OUTQ_IOV_MAX - 1) / OUTQ_IOV_MAX;
+    if (reserve_sqes(links) < 0) return -1;
+
+    ss = free_sends;
+    if (ss) {
+        free_sends = ss->next_free;
+    } else {
+        ss = malloc(sizeof(*ss));
+        if (!ss) return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        ss->held[i] = msgbuf_ref(bufs[i]);
+        ss->iov[i].iov_base = bufs[i]->data;
+        ss->iov[i].iov_len = bufs[i]->len;
+    }
+    ss->iov[0].iov_base = bufs[0]->data + offset;
+    ss->iov[0].iov_len -= offset;
+    ss->held_count = count;
+    ss->links_left = links;
+    ss->sent = 0;
+    ss->error = 0;
+
+    for (k = 0; k < links; k++) {
+        chunk = count - k * OUTQ_IOV_MAX;
+        if (chunk > OUTQ_IOV_MAX) chunk = OUTQ_IOV_MAX;
+
+        memset(&ss->mh[k], 0, sizeof(ss->mh[k]));
+        ss->mh[k].msg_iov = &ss->iov[k * OUTQ_IOV_MAX];
+        ss->mh[k].msg_iovlen = chunk;
+
+        sqe = next_sqe();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd;
+        sqe->addr = (unsigned long long)(unsigned long)&ss->mh[k];
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = pack(OP_SEND, st->gen, fd);
+        if (k < links - 1) {
+            sqe->flags = IOSQE_IO_LINK;
+        }
+    }
+
+    st->send = ss;
+    return 0;
+}
+
+/**
+ * @brief Cancels every request on a descriptor; late completions are dropped.
+ *
+ * A send stuck behind a peer that stopped reading is cancelled as well, so
+ * a deferred close cannot wait forever.
+ *
+ * @param fd Descriptor.
+ */
+static void uring_io_remove(int fd) {
+    FdState *st = fd_state(fd);
+    struct io_uring_sqe *sqe;
+
+    if (!st) return;
+
+    if ((st->recv_armed || st->send || fd == listen_fd) && reserve_sqes(1) == 0) {
+        sqe = next_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data = pack(OP_CANCEL, 0, fd);
+    }
+    if (fd == listen_fd) listen_fd = -1;
+    st->recv_armed = 0;
+    st->gen++;
+}
+
+/**
+ * @brief Stops receiving and closes the descriptor once no send uses it.
+ *
+ * @param fd Descriptor.
+ */
+static void uring_io_close_fd(int fd) {
+    FdState *st = fd_state(fd);
+
+    uring_io_remove(fd);
+
+    /* Queued sends go out before the cancellation, which only stops what blocks */
+    if (unsubmitted() > 0) {
+        enter(0, 0, NULL, 0);
+    }
+
+    if (st && st->send) {
+        st->close_pending = 1;
+        return;
+    }
+    close(fd);
+}
+
+/**
+ * @brief Records a descriptor whose multishot recv ran out of buffers.
+ *
+ * @param fd Descriptor.
+ */
+static void add_starved(int fd) {
+    int *grown;
+
+    if (starved_count == starved_cap) {
+        starved_cap = starved_cap ? starved_cap * 2 : 64;
+        grown = realloc(starved, starved_cap * sizeof(*grown));
+        if (!grown) return;
+        starved = grown;
+    }
+    starved[starved_count++] = fd;
+}
+
+/**
+ * @brief Finishes one request of a send chain.
+ *
+ * @param fd Descriptor.
+ * @param gen Generation the send was submitted under.
+ * @param res Completion result.
+ * @param ev Event to fill.
+ * @return 1 if an event was produced, 0 otherwise.
+ */
+static int complete_send(int fd, unsigned int gen, int res, IoEvent *ev) {
+    FdState *st = fd_state(fd);
+    SendState *ss;
+    int i;
+
+    if (!st || !st->send) return 0;
+    ss = st->send;
+
+    if (res >= 0) {
+        ss->sent += res;
+    } else if (res != -ECANCELED && ss->error == 0) {
+        ss->error = res;
+    }
+    if (--ss->links_left > 0) return 0;
+
+    for (i = 0; i < ss->held_count; i++) {
+        msgbuf_unref(ss->held[i]);
+    }
+    st->send = NULL;
+    ss->next_free = free_sends;
+    free_sends = ss;
+
+    if (st->close_pending) {
+        st->close_pending = 0;
+        close(fd);
+        return 0;
+    }
+    if (gen != (st->gen & 0xffffff)) return 0;
+
+    ev->fd = fd;
+    ev->events = IO_EVENT_SENT;
+    ev->result = (ss->sent == 0 && ss->error) ? ss->error : (int)ss->sent;
+    ev->data = NULL;
+    return 1;
+}
+
+/**
+ * @brief Turns one completion into at most one event.
+ *
+ * @param cqe Completion entry.
+ * @param ev Event to fill.
+ * @return 1 if an event was produced, 0 otherwise.
+ */
+static int handle_cqe(const struct io_uring_cqe *cqe, IoEvent *ev) {
+    int op = (int)(cqe->user_data >> 56);
+    unsigned int gen = (unsigned int)(cqe->user_data >> 32) & 0xffffff;
+    int fd = (int)(cqe->user_data & 0xffffffffu);
+    int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    FdState *st = fd_state(fd);
+    unsigned short bid;
+
+    if (op == OP_SEND) {
+        return complete_send(fd, gen, cqe->res, ev);
+    }
+    if (op != OP_ACCEPT && op != OP_RECV) return 0;
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        recycle[recycle_count++] = bid;
+    }
+
+    /* The descriptor was removed after this request was issued */
+    if (!st || gen != (st->gen & 0xffffff)) return 0;
+
+    if (op == OP_ACCEPT) {
+        if (!more && fd == listen_fd) arm_accept(fd);
+        if (cqe->res < 0) return 0;
+
+        ev->fd = fd;
+        ev->events = IO_EVENT_ACCEPT;
+        ev->result = cqe->res;
+        ev->data = NULL;
+        return 1;
+    }
+
+    if (cqe->res == -ENOBUFS) {
+        /* Resumed once the buffers handed out in this round come back */
+        st->recv_armed = 0;
+        add_starved(fd);
+        return 0;
+    }
+
+    ev->fd = fd;
+    ev->data = NULL;
+    ev->result = cqe->res;
+    if (cqe->res > 0) {
+        ev->events = IO_EVENT_DATA;
+        ev->data = buf_base + (size_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) * URING_BUF_SIZE;
+        if (!more) {
+            st->recv_armed = 0;
+            arm_recv(fd);
+        }
+    } else {
+        /* End of stream or error: the multishot recv is over */
+        ev->events = IO_EVENT_ERROR;
+        st->recv_armed = 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Submits prepared requests, waits for completions and converts them to events.
+ *
+ * @param events Output array.
+ * @param max_events Capacity of the array.
+ * @param timeout_ms Timeout in milliseconds, or -1 to wait forever.
+ * @return Number of events, 0 on timeout, -1 on error.
+ */
+static int uring_io_wait(IoEvent *events, int max_events, int timeout_ms) {
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned int head, tail;
+    int n = 0;
+    int i, fd;
+
+    /* Data handed out by the previous call has been processed by now */
+    for (i = 0; i < recycle_count; i++) {
+        add_buffer(recycle[i]);
+    }
+    if (recycle_count > 0) publish_buffers();
+    recycle_count = 0;
+
+    for (i = 0; i < starved_count; i++) {
+        fd = starved[i];
+        if (fd < fd_capacity && !fds[fd].recv_armed) arm_recv(fd);
+    }
+    starved_count = 0;
+
+    head = *cq_head;
+    tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        if (timeout_ms >= 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+            arg.ts = (unsigned long long)(unsigned long)&ts;
+        }
+        if (enter(1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) < 0 &&
+            errno != ETIME && errno != EBUSY) {
+            return -1;
+        }
+        tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    } else if (unsubmitted() > 0) {
+        enter(0, 0, NULL, 0);
+    }
+
+    while (head != tail && n < max_events) {
+        n += handle_cqe(&cqes[head & *cq_mask], &events[n]);
+        head++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+/** @brief io_uring backend operations. */
+const IoBackendOps io_uring_backend = {
+    "uring",
+    1,
+    uring_io_init,
+    uring_io_add,
+    uring_io_listen,
+    uring_io_watch_write,
+    uring_io_send,
+    uring_io_remove,
+    uring_io_close_fd,
+    uring_io_wait,
+    uring_io_close
+};
@@ -0,0 +1,267 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "msgbuf.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/**
+ * @file msgbuf.c
+ * @brief Reference-counted message buffers and output queues.
+ */
+
+/**
+ * @brief Allocates a buffer for the caller to fill.
+ *
+ * @param len Message length.
+ * @return Buffer holding one reference, or NULL on allocation failure.
+ */
+MsgBuf *msgbuf_alloc(size_t len) {
+    MsgBuf *buf = malloc(sizeof(*buf) + len);
+
+    if (!buf) return NULL;
+
+    buf->refs = 1;
+    buf->len = len;
+    return buf;
+}
+
+/**
+ * @brief Allocates a buffer holding a copy of `data`.
+ *
+ * @param data Message bytes.
+ * @param len Message length.
+ * @return Buffer holding one reference, or NULL on allocation failure.
+ */
+MsgBuf *msgbuf_new(const char *data, size_t len) {
+    MsgBuf *buf = msgbuf_alloc(len);
+
+    if (buf) {
+        memcpy(buf->data, data, len);
+    }
+    return buf;
+}
+
+/**
+ * @brief Takes another reference.
+ *
+ * Atomic, since buffers posted to other shards are shared between threads.
+ *
+ * @param buf The buffer.
+ * @return The same buffer.
+ */
+MsgBuf *msgbuf_ref(MsgBuf *buf) {
+    __atomic_fetch_add(&buf->refs, 1, __ATOMIC_RELAXED);
+    return buf;
+}
+
+/**
+ * @brief Drops a reference.
+ *
+ * @param buf The buffer, or NULL.
+ */
+void msgbuf_unref(MsgBuf *buf) {
+    if (buf && __atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(buf);
+    }
+}
+
+/**
+ * @brief Doubles the ring, unwrapping it to start at position 0.
+ *
+ * @param q The queue.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int grow_queue(OutQueue *q) {
+    int new_cap = q->cap ? q->cap * 2 : OUTQ_INITIAL_SLOTS;
+    MsgBuf **bufs = malloc(new_cap * sizeof(*bufs));
+    int i;
+
+    if (!bufs) return -1;
+
+    for (i = 0; i < q->count; i++) {
+        bufs[i] = q->bufs[(q->head + i) % q->cap];
+    }
+
+    free(q->bufs);
+    q->bufs = bufs;
+    q->cap = new_cap;
+    q->head = 0;
+    return 0;
+}
+
+/**
+ * @brief Appends a reference to a queue.
+ *
+ * @param q The queue.
+ * @param buf Buffer to queue.
+ * @param offset Bytes of buf already sent.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int outq_push(OutQueue *q, MsgBuf *buf, size_t offset) {
+    if (q->count == q->cap && grow_queue(q) < 0) return -1;
+
+    if (q->count == 0) {
+        q->offset = offset;
+    }
+    q->bufs[(q->head + q->count) % q->cap] = msgbuf_ref(buf);
+    q->count++;
+    q->bytes += buf->len - offset;
+    return 0;
+}
+
+/**
+ * @brief Drops the oldest reference.
+ *
+ * @param q The queue (must not be empty).
+ */
+static void pop_front(OutQueue *q) {
+    msgbuf_unref(q->bufs[q->head]);
+    q->head = (q->head + 1) % q->cap;
+    q->count--;
+    q->offset = 0;
+}
+
+/**
+ * @brief Writes queued buffers until the queue is empty or the socket is full.
+ *
+ * @param q The queue.
+ * @param fd Non-blocking socket.
+ * @return 0 if the queue is empty, 1 if data remains, -1 on socket error.
+ */
+int outq_flush(OutQueue *q, int fd) {
+    struct iovec iov[OUTQ_IOV_MAX];
+    struct msghdr mh;
+    MsgBuf *buf;
+    ssize_t n;
+    size_t want;
+    int iovcnt;
+    int i;
+
+    while (q->count > 0) {
+        iovcnt = q->count < OUTQ_IOV_MAX ? q->count : OUTQ_IOV_MAX;
+        for (i = 0; i < iovcnt; i++) {
+            buf = q->bufs[(q->head + i) % q->cap];
+            iov[i].iov_base = buf->data;
+            iov[i].iov_len = buf->len;
+        }
+        iov[0].iov_base = q->bufs[q->head]->data + q->offset;
+        iov[0].iov_len -= q->offset;
+
+        want = 0;
+        for (i = 0; i < iovcnt; i++) {
+            want += iov[i].iov_len;
+        }
+
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = iovcnt;
+
+        do {
+            n = sendmsg(fd, &mh, MSG_NOSIGNAL | MSG_DONTWAIT);
+        } while (n < 0 && errno == EINTR);
+
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+            return -1;
+        }
+
+        outq_consume(q, (size_t)n);
+
+        /* A short write means the socket buffer is full */
+        if ((size_t)n < want) return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Removes bytes the socket has accepted from the front of a queue.
+ *
+ * @param q The queue.
+ * @param n Bytes written.
+ */
+void outq_consume(OutQueue *q, size_t n) {
+    if (n > q->bytes) n = q->bytes;
+    q->bytes -= n;
+
+    /* Release every buffer that was written completely */
+    while (q->count > 0 && n >= q->bufs[q->head]->len - q->offset) {
+        n -= q->bufs[q->head]->len - q->offset;
+        pop_front(q);
+    }
+    q->offset += n;
+}
+
+/**
+ * @brief Merges the newest references so the queue holds at most `max`.
+ *
+ * @param q The queue.
+ * @param max Number of references to keep (at least 2).
+ * @return 0 on success, -1 on allocation failure (queue unchanged).
+ */
+int outq_flatten(OutQueue *q, int max) {
+    MsgBuf *merged;
+    MsgBuf *buf;
+    size_t len = 0;
+    int i;
+
+    if (q->count <= max) return 0;
+
+    /* The oldest entry may be partially sent, so it is never merged */
+    for (i = max - 1; i < q->count; i++) {
+        len += q->bufs[(q->head + i) % q->cap]->len;
+    }
+
+    merged = msgbuf_alloc(len);
+    if (!merged) return -1;
+
+    len = 0;
+    for (i = max - 1; i < q->count; i++) {
+        buf = q->bufs[(q->head + i) % q->cap];
+        memcpy(merged->data + len, buf->data, buf->len);
+        len += buf->len;
+        msgbuf_unref(buf);
+    }
+
+    q->bufs[(q->head + max - 1) % q->cap] = merged;
+    q->count = max;
+    return 0;
+}
+
+/**
+ * @brief Copies the oldest references into an array.
+ *
+ * @param q The queue.
+ * @param bufs Output array.
+ * @param max Capacity of bufs.
+ * @return Number of references stored.
+ */
+int outq_peek(const OutQueue *q, MsgBuf **bufs, int max) {
+    int count = q->count < max ? q->count : max;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        bufs[i] = q->bufs[(q->head + i) % q->cap];
+    }
+    return count;
+}
+
+/**
+ * @brief Drops every queued reference and releases the ring.
+ *
+ * @param q The queue.
+ */
+void outq_clear(OutQueue *q) {
+    while (q->count > 0) {
+        pop_front(q);
+    }
+    free(q->bufs);
+    q->bufs = NULL;
+    q->cap = 0;
+    q->head = 0;
+    q->offset = 0;
+    q->bytes = 0;
+}
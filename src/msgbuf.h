@@ -0,0 +1,130 @@
+#ifndef MSGBUF_H
+#define MSGBUF_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @file msgbuf.h
+ * @brief Reference-counted message buffers and per-client output queues.
+ *
+ * A broadcast is rendered once into a MsgBuf; each recipient's OutQueue
+ * only holds a reference to it, so queued fan-out costs one pointer per
+ * member instead of one copy. A buffer must not be modified once it has
+ * been queued, and is freed when its last reference is dropped. Reference
+ * counts are atomic, so holders may live on different reactor threads.
+ */
+
+/**
+ * @brief An immutable, shared message.
+ */
+typedef struct {
+    int refs;               /**< Number of holders (queues, inboxes and the creator) */
+    size_t len;             /**< Bytes in data */
+    char data[];            /**< Message bytes (not NUL-terminated) */
+} MsgBuf;
+
+#define OUTQ_INITIAL_SLOTS  16  /**< References allocated on a queue's first use */
+#define OUTQ_IOV_MAX        64  /**< Buffers handed to one sendmsg() call */
+
+/**
+ * @brief FIFO of message references not yet accepted by a socket.
+ */
+typedef struct {
+    MsgBuf **bufs;          /**< Ring of references */
+    int head;               /**< Position of the oldest reference */
+    int count;              /**< Number of queued references */
+    int cap;                /**< Allocated ring size */
+    size_t offset;          /**< Bytes of the oldest buffer already sent */
+    size_t bytes;           /**< Total unsent bytes */
+} OutQueue;
+
+/**
+ * @brief Allocates a buffer for `len` bytes for the caller to fill.
+ *
+ * @param len Message length.
+ * @return Buffer holding one reference, or NULL on allocation failure.
+ */
+MsgBuf *msgbuf_alloc(size_t len);
+
+/**
+ * @brief Allocates a buffer holding a copy of `data`.
+ *
+ * @param data Message bytes.
+ * @param len Message length.
+ * @return Buffer holding one reference, or NULL on allocation failure.
+ */
+MsgBuf *msgbuf_new(const char *data, size_t len);
+
+/**
+ * @brief Takes another reference.
+ * @param buf The buffer.
+ * @return The same buffer.
+ */
+MsgBuf *msgbuf_ref(MsgBuf *buf);
+
+/**
+ * @brief Drops a reference, freeing the buffer with the last one.
+ * @param buf The buffer, or NULL.
+ */
+void msgbuf_unref(MsgBuf *buf);
+
+/**
+ * @brief Appends a reference to a queue.
+ *
+ * @param q The queue.
+ * @param buf Buffer to queue; the queue takes its own reference.
+ * @param offset Bytes at the start of buf that were already sent.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int outq_push(OutQueue *q, MsgBuf *buf, size_t offset);
+
+/**
+ * @brief Writes queued buffers with scatter-gather sends until empty or the socket is full.
+ *
+ * @param q The queue.
+ * @param fd Non-blocking socket.
+ * @return 0 if the queue is empty, 1 if data remains, -1 on socket error.
+ */
+int outq_flush(OutQueue *q, int fd);
+
+/**
+ * @brief Removes bytes that were written from the front of a queue.
+ *
+ * Used after outq_flush()'s own sends and after sends completed by the
+ * I/O backend.
+ *
+ * @param q The queue.
+ * @param n Bytes written.
+ */
+void outq_consume(OutQueue *q, size_t n);
+
+/**
+ * @brief Copies the newest queued messages into one buffer so at most `max` references remain.
+ *
+ * Lets a single scatter-gather submission cover everything queued, at the
+ * cost of one copy of the merged tail.
+ *
+ * @param q The queue.
+ * @param max Number of references to keep (at least 2).
+ * @return 0 on success, -1 on allocation failure (queue unchanged).
+ */
+int outq_flatten(OutQueue *q, int max);
+
+/**
+ * @brief Copies the oldest references into an array without removing them.
+ *
+ * @param q The queue.
+ * @param bufs Output array.
+ * @param max Capacity of bufs.
+ * @return Number of references stored.
+ */
+int outq_peek(const OutQueue *q, MsgBuf **bufs, int max);
+
+/**
+ * @brief Drops every queued reference and releases the ring.
+ * @param q The queue.
+ */
+void outq_clear(OutQueue *q);
+
+#endif /* MSGBUF_H */
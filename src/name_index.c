@@ -0,0 +1,207 @@
+#include "name_index.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @file name_index.c
+ * @brief Linear-probing hash index used for room and username lookups.
+ */
+
+/**
+ * @brief Simple hash function for string to integer.
+ *
+ * @param str The string to hash.
+ * @return The hash value.
+ */
+unsigned int hash_string(const char *str) {
+    unsigned int hash = 5381;
+    int c;
+    while ((c = *str++)) {
+        hash = ((hash << 5) + hash) + c;
+    }
+    return hash;
+}
+
+/**
+ * @brief Allocates an empty slot array.
+ *
+ * @param capacity Number of slots (power of two).
+ * @return Slot array, or NULL on allocation failure.
+ */
+static NameIndexSlot *alloc_slots(size_t capacity) {
+    NameIndexSlot *slots = malloc(capacity * sizeof(*slots));
+    size_t i;
+
+    if (!slots) return NULL;
+
+    for (i = 0; i < capacity; i++) {
+        slots[i].hash = 0;
+        slots[i].value = NAME_INDEX_EMPTY;
+    }
+    return slots;
+}
+
+/**
+ * @brief Finds the slot holding a key.
+ *
+ * @param index The index.
+ * @param key Key to search for.
+ * @param hash Precomputed hash of the key.
+ * @return Slot position, or -1 if the key is not present.
+ */
+static long find_slot(const NameIndex *index, const char *key, unsigned int hash) {
+    size_t mask = index->capacity - 1;
+    size_t pos = hash & mask;
+    const NameIndexSlot *slot;
+
+    if (!index->slots) return -1;
+
+    while (1) {
+        slot = &index->slots[pos];
+        if (slot->value == NAME_INDEX_EMPTY) return -1;
+        if (slot->value >= 0 && slot->hash == hash &&
+            strcmp(index->key_of(slot->value), key) == 0) {
+            return (long)pos;
+        }
+        pos = (pos + 1) & mask;
+    }
+}
+
+/**
+ * @brief Places an entry in the first free slot of its probe sequence.
+ *
+ * @param slots Slot array.
+ * @param capacity Number of slots.
+ * @param hash Hash of the key.
+ * @param value Value to store.
+ * @return 1 if a never-used slot was consumed, 0 if a tombstone was reused.
+ */
+static int place(NameIndexSlot *slots, size_t capacity, unsigned int hash, int value) {
+    size_t mask = capacity - 1;
+    size_t pos = hash & mask;
+    int was_empty;
+
+    while (slots[pos].value >= 0) {
+        pos = (pos + 1) & mask;
+    }
+
+    was_empty = slots[pos].value == NAME_INDEX_EMPTY;
+    slots[pos].hash = hash;
+    slots[pos].value = value;
+    return was_empty;
+}
+
+/**
+ * @brief Rebuilds the table with a new capacity, dropping tombstones.
+ *
+ * @param index The index.
+ * @param capacity New number of slots (power of two).
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int rehash(NameIndex *index, size_t capacity) {
+    NameIndexSlot *slots = alloc_slots(capacity);
+    size_t i;
+
+    if (!slots) return -1;
+
+    for (i = 0; i < index->capacity; i++) {
+        if (index->slots[i].value >= 0) {
+            place(slots, capacity, index->slots[i].hash, index->slots[i].value);
+        }
+    }
+
+    free(index->slots);
+    index->slots = slots;
+    index->capacity = capacity;
+    index->used = index->count;
+    return 0;
+}
+
+/**
+ * @brief Initializes (or resets) an index.
+ *
+ * @param index The index.
+ * @param expected Expected number of entries.
+ * @param key_of Callback resolving a stored value to its key.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int name_index_init(NameIndex *index, size_t expected, NameIndexKeyFn key_of) {
+    size_t capacity = 16;
+
+    /* Keep the load factor at or below one half */
+    while (capacity < expected * 2) capacity *= 2;
+
+    free(index->slots);
+    index->slots = alloc_slots(capacity);
+    index->capacity = index->slots ? capacity : 0;
+    index->count = 0;
+    index->used = 0;
+    index->key_of = key_of;
+
+    return index->slots ? 0 : -1;
+}
+
+/**
+ * @brief Releases the slot array.
+ *
+ * @param index The index.
+ */
+void name_index_free(NameIndex *index) {
+    free(index->slots);
+    index->slots = NULL;
+    index->capacity = 0;
+    index->count = 0;
+    index->used = 0;
+}
+
+/**
+ * @brief Looks up a key.
+ *
+ * @param index The index.
+ * @param key Key to search for.
+ * @return Stored value, or -1 if not present.
+ */
+int name_index_find(const NameIndex *index, const char *key) {
+    long pos = find_slot(index, key, hash_string(key));
+    return pos < 0 ? -1 : index->slots[pos].value;
+}
+
+/**
+ * @brief Inserts a key.
+ *
+ * @param index The index.
+ * @param key Key of the entry.
+ * @param value Table index to store.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int name_index_insert(NameIndex *index, const char *key, int value) {
+    if (!index->slots && name_index_init(index, 0, index->key_of) < 0) {
+        return -1;
+    }
+
+    if ((index->used + 1) * 2 > index->capacity) {
+        /* Grow only when live entries need it; otherwise just purge tombstones */
+        size_t capacity = index->capacity;
+        if ((index->count + 1) * 2 > capacity) capacity *= 2;
+        if (rehash(index, capacity) < 0) return -1;
+    }
+
+    index->used += place(index->slots, index->capacity, hash_string(key), value);
+    index->count++;
+    return 0;
+}
+
+/**
+ * @brief Removes a key if present.
+ *
+ * @param index The index.
+ * @param key Key to remove.
+ */
+void name_index_remove(NameIndex *index, const char *key) {
+    long pos = find_slot(index, key, hash_string(key));
+
+    if (pos < 0) return;
+
+    index->slots[pos].value = NAME_INDEX_DELETED;
+    index->count--;
+}
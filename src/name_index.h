@@ -0,0 +1,95 @@
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+
+#include <stddef.h>
+
+/**
+ * @file name_index.h
+ * @brief Open-addressing hash index from names to table indices.
+ *
+ * Maps a string key (room name, username) to an integer index into one of
+ * the server's tables. Keys are not copied: the index stores the hash and
+ * the value, and reads the key back through a callback when a hash matches.
+ * Lookups use linear probing, so their cost stays flat as tables grow.
+ */
+
+/**
+ * @brief Simple hash function for strings.
+ * @param str Input string.
+ * @return Hash value.
+ */
+unsigned int hash_string(const char *str);
+
+/**
+ * @brief Returns the key currently stored for a table index.
+ */
+typedef const char *(*NameIndexKeyFn)(int value);
+
+/**
+ * @brief One slot of the open-addressing table.
+ */
+typedef struct {
+    unsigned int hash;      /**< Cached hash of the key */
+    int value;              /**< Table index, or NAME_INDEX_EMPTY / NAME_INDEX_DELETED */
+} NameIndexSlot;
+
+#define NAME_INDEX_EMPTY    (-1)    /**< Slot was never used */
+#define NAME_INDEX_DELETED  (-2)    /**< Slot held a removed entry (tombstone) */
+
+/**
+ * @brief A name -> index hash table.
+ */
+typedef struct {
+    NameIndexSlot *slots;   /**< Slot array, capacity is a power of two */
+    size_t capacity;        /**< Number of slots */
+    size_t count;           /**< Live entries */
+    size_t used;            /**< Live entries plus tombstones */
+    NameIndexKeyFn key_of;  /**< Resolves a value back to its key */
+} NameIndex;
+
+/**
+ * @brief Initializes (or resets) an index.
+ *
+ * @param index The index.
+ * @param expected Expected number of entries; the table grows past it on demand.
+ * @param key_of Callback resolving a stored value to its key.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int name_index_init(NameIndex *index, size_t expected, NameIndexKeyFn key_of);
+
+/**
+ * @brief Releases the slot array.
+ * @param index The index.
+ */
+void name_index_free(NameIndex *index);
+
+/**
+ * @brief Looks up a key.
+ *
+ * @param index The index.
+ * @param key Key to search for.
+ * @return Stored value, or -1 if not present.
+ */
+int name_index_find(const NameIndex *index, const char *key);
+
+/**
+ * @brief Inserts a key. The key must not already be present.
+ *
+ * @param index The index.
+ * @param key Key of the entry (must equal key_of(value)).
+ * @param value Table index to store.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int name_index_insert(NameIndex *index, const char *key, int value);
+
+/**
+ * @brief Removes a key if present.
+ *
+ * Must be called while key_of(value) still returns the old key.
+ *
+ * @param index The index.
+ * @param key Key to remove.
+ */
+void name_index_remove(NameIndex *index, const char *key);
+
+#endif /* NAME_INDEX_H */
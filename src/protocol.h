@@ -9,10 +9,10 @@
 #define MAX_USERNAME    32      /**< Maximum length of a username */
 #define MAX_ROOMNAME    32      /**< Maximum length of a room name */
 #define MAX_MESSAGE     512     /**< Maximum length of a single message */
-#define MAX_CLIENTS     100     /**< Maximum number of concurrent clients */
-#define MAX_ROOMS       50      /**< Maximum number of active rooms */
+#define MAX_CLIENTS     100     /**< Default limit on concurrent clients (server option -c) */
+#define MAX_ROOMS       50      /**< Default limit on active rooms (server option -r) */
 #define BUFFER_SIZE     4096    /**< Network buffer size */
-#define MAX_HISTORY     10      /**< Number of messages stored in history per room */
+#define MAX_HISTORY     10      /**< Default number of messages kept in a room's history (server option -m) */
 
 /**
  * @brief Enumeration of supported message types.
@@ -46,13 +46,4 @@ typedef struct {
     char timestamp[32];         /**< Formatted timestamp string */
 } Message;
 
-/**
- * @brief Circular buffer for storing chat history.
- */
-typedef struct {
-    char messages[MAX_HISTORY][BUFFER_SIZE]; /**< Array of stored messages */
-    int count;                               /**< Current number of stored messages */
-    int head;                                /**< Index for the circular buffer head */
-} MessageHistory;
-
 #endif /* PROTOCOL_H */
\ No newline at end of file
@@ -1,3 +1,5 @@
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,28 +8,56 @@
 #include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <sys/resource.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <limits.h>
 #include "protocol.h"
 #include "server_utils.h"
 #include "colors.h"
+#include "io_backend.h"
+#include "shard.h"
+#include "stats.h"
+#include "worker.h"
 
 /**
  * @file server.c
  * @brief Main entry point for the Chat Server.
  *
- * This file handles the TCP socket initialization, the main event loop using select(),
+ * This file handles the TCP socket initialization, the main event loop on top of the I/O backend (io_uring, epoll or select),
  * accepting new connections, and routing data between clients and the server logic.
+ * With `threads` > 1 every reactor thread runs this loop on its own SO_REUSEPORT
+ * listening socket, and the kernel spreads incoming connections across them.
+ * With `workers` > 0 the loop only frames input and moves output, and chat
+ * commands run on the worker threads (see worker.h).
  */
 
+#define LOOP_READY_NS   100000  /**< A wait shorter than this found its events already pending */
+
 /**
  * @brief Global flag to control the main loop execution.
- * Modified by the signal handler to initiate graceful shutdown.
+ * Modified by the signal handler to initiate graceful shutdown; read by every
+ * reactor thread, hence the atomic accesses.
  */
 volatile sig_atomic_t running = 1;
 
+/**
+ * @brief Set by SIGUSR1; shard 0 then prints the command latency dump.
+ */
+volatile sig_atomic_t latency_dump_requested = 0;
+
+/**
+ * @brief I/O backend requested with `-i` / `io_backend`, empty for the default.
+ */
+char io_backend_choice[16] = "";
+
+/**
+ * @brief Path of the admin stats socket (`-u` / `admin_socket`), empty for none.
+ */
+char admin_socket_path[108] = "";
+
 /**
  * @brief Handles system signals (like SIGINT/Ctrl+C).
  *
@@ -35,7 +65,169 @@ volatile sig_atomic_t running = 1;
  */
 void sigint_handler(int sig) {
     (void)sig;
-    running = 0;
+    __atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Handles SIGUSR1 by requesting a latency dump.
+ *
+ * @param sig The signal number.
+ */
+void sigusr1_handler(int sig) {
+    (void)sig;
+    __atomic_store_n(&latency_dump_requested, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Apply one configuration setting.
+ *
+ * Shared by the command line and the config file, so every option can be
+ * given either way.
+ *
+ * @param key Setting name (e.g. "max_clients").
+ * @param value Setting value as text.
+ * @param port Pointer to store port number.
+ * @return 0 on success, -1 for an unknown key or invalid value.
+ */
+int apply_setting(const char *key, const char *value, int *port) {
+    char *end;
+    long messages;
+    unsigned long bytes = 0;
+
+    if (strcmp(key, "port") == 0) {
+        *port = atoi(value);
+    } else if (strcmp(key, "max_clients") == 0) {
+        max_clients = atoi(value);
+        if (max_clients < 1) return -1;
+    } else if (strcmp(key, "max_rooms") == 0) {
+        max_rooms = atoi(value);
+        if (max_rooms < 1) return -1;
+    } else if (strcmp(key, "queue_limit") == 0) {
+        output_queue_limit = strtoul(value, NULL, 10);
+        if (output_queue_limit == 0) return -1;
+    } else if (strcmp(key, "history_messages") == 0) {
+        history_max_messages = atoi(value);
+        if (history_max_messages < 1) return -1;
+    } else if (strcmp(key, "history_bytes") == 0) {
+        history_max_bytes = strtoul(value, NULL, 10);
+        if (history_max_bytes < HISTORY_MIN_BYTES) return -1;
+    } else if (strncmp(key, "history.", 8) == 0) {
+        /* history.<room> = <messages>[,<bytes>] */
+        messages = strtol(value, &end, 10);
+        if (*end == ',') {
+            bytes = strtoul(end + 1, &end, 10);
+            if (bytes < HISTORY_MIN_BYTES) return -1;
+        }
+        if (end == value || *end != '\0' || messages < 1 || messages > INT_MAX) return -1;
+        return set_room_history_limits(key + 8, (int)messages, bytes);
+    } else if (strcmp(key, "idle_timeout") == 0) {
+        idle_timeout = atoi(value);
+        if (idle_timeout < 1) return -1;
+    } else if (strcmp(key, "room_grace") == 0) {
+        room_grace = atoi(value);
+        if (room_grace < 0) return -1;
+    } else if (strcmp(key, "typing_interval") == 0) {
+        typing_interval = atoi(value);
+        if (typing_interval < 1) return -1;
+    } else if (strcmp(key, "threads") == 0) {
+        shard_count = atoi(value);
+        if (shard_count < 1 || shard_count > MAX_SHARDS) return -1;
+    } else if (strcmp(key, "workers") == 0) {
+        worker_count = atoi(value);
+        if (worker_count < 0 || worker_count > MAX_WORKERS) return -1;
+    } else if (strcmp(key, "cpu_affinity") == 0) {
+        return shard_parse_affinity(value);
+    } else if (strcmp(key, "io_backend") == 0) {
+        if (strlen(value) >= sizeof(io_backend_choice)) return -1;
+        snprintf(io_backend_choice, sizeof(io_backend_choice), "%s", value);
+    } else if (strcmp(key, "admin_socket") == 0) {
+        if (strlen(value) >= sizeof(admin_socket_path)) return -1;
+        snprintf(admin_socket_path, sizeof(admin_socket_path), "%s", value);
+    } else if (strcmp(key, "oper_password") == 0) {
+        if (strlen(value) >= sizeof(oper_password)) return -1;
+        snprintf(oper_password, sizeof(oper_password), "%s", value);
+    } else if (strcmp(key, "shed_typing") == 0) {
+        shed_typing = atoi(value);
+        if (shed_typing < 0) return -1;
+    } else if (strcmp(key, "shed_history") == 0) {
+        shed_history = atoi(value);
+        if (shed_history < 0) return -1;
+    } else if (strcmp(key, "shed_accept") == 0) {
+        shed_accept = atoi(value);
+        if (shed_accept < 0) return -1;
+    } else if (strcmp(key, "slow_clients") == 0) {
+        if (strcmp(value, "drop") == 0) {
+            slow_client_policy = SLOW_CLIENT_DROP;
+        } else if (strcmp(value, "disconnect") == 0) {
+            slow_client_policy = SLOW_CLIENT_DISCONNECT;
+        } else {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Load settings from a config file.
+ *
+ * Each non-empty line is `key = value`; lines starting with '#' are comments.
+ * Keys are the same as accepted by apply_setting().
+ *
+ * @param path Path to the config file.
+ * @param port Pointer to store port number.
+ * @return 0 on success, -1 on failure.
+ */
+int load_config_file(const char *path, int *port) {
+    FILE *fp = fopen(path, "r");
+    char line[256];
+    char *key;
+    char *value;
+    char *eq;
+    char *end;
+    int line_no = 0;
+
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        line_no++;
+
+        key = line;
+        while (*key == ' ' || *key == '\t') key++;
+        if (*key == '#' || *key == '\n' || *key == '\0') continue;
+
+        eq = strchr(key, '=');
+        if (!eq) {
+            fprintf(stderr, "%s:%d: expected key = value\n", path, line_no);
+            fclose(fp);
+            return -1;
+        }
+
+        /* Trim whitespace around key and value */
+        end = eq;
+        while (end > key && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        *end = '\0';
+
+        value = eq + 1;
+        while (*value == ' ' || *value == '\t') value++;
+        end = value + strlen(value);
+        while (end > value && (end[-1] == '\n' || end[-1] == '\r' ||
+                               end[-1] == ' ' || end[-1] == '\t')) end--;
+        *end = '\0';
+
+        if (apply_setting(key, value, port) < 0) {
+            fprintf(stderr, "%s:%d: invalid setting '%s'\n", path, line_no, key);
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+    return 0;
 }
 
 /**
@@ -45,28 +237,123 @@ void sigint_handler(int sig) {
  * @param argv Argument vector.
  * @param port Pointer to store port number.
  * @return 0 on success, -1 on failure.
+ *
+ * Options are applied in order, so flags after `-f` override the file:
+ *  - `-p <port>` port to listen on.
+ *  - `-c <n>` maximum number of concurrent clients.
+ *  - `-r <n>` maximum number of rooms.
+ *  - `-q <bytes>` per-client output queue high-water mark.
+ *  - `-s <disconnect|drop>` what to do with clients that exceed it.
+ *  - `-t <seconds>` inactivity timeout.
+ *  - `-g <seconds>` how long an empty room is kept before it is retired.
+ *  - `-m <n>` messages kept in each room's history.
+ *  - `-b <bytes>` byte budget of each room's history.
+ *  - `-i <uring|epoll|select>` I/O backend (default: best one compiled in).
+ *  - `-n <threads>` reactor threads, each with its own listening socket.
+ *  - `-a <none|auto|cpu list>` pin reactor threads to CPUs.
+ *  - `-w <workers>` worker threads for commands (0 runs them on the reactors).
+ *  - `-u <path>` Unix socket that serves the stats in Prometheus format.
+ *  - `-f <path>` config file with `key = value` lines.
  */
 int parse_arguments(int argc, char *argv[], int *port) {
+    static const char *const flags[][2] = {
+        {"-p", "port"},
+        {"-c", "max_clients"},
+        {"-r", "max_rooms"},
+        {"-q", "queue_limit"},
+        {"-s", "slow_clients"},
+        {"-t", "idle_timeout"},
+        {"-g", "room_grace"},
+        {"-m", "history_messages"},
+        {"-b", "history_bytes"},
+        {"-i", "io_backend"},
+        {"-n", "threads"},
+        {"-a", "cpu_affinity"},
+        {"-w", "workers"},
+        {"-u", "admin_socket"}
+    };
+    size_t f;
     int i;
+    int ok = 1;
+
+    for (i = 1; i < argc && ok; i++) {
+        if (i + 1 >= argc) {
+            ok = 0;
+            break;
+        }
 
-    for (i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
-            *port = atoi(argv[i + 1]);
+        if (strcmp(argv[i], "-f") == 0) {
+            ok = load_config_file(argv[i + 1], port) == 0;
             i++;
+            continue;
+        }
+
+        for (f = 0; f < sizeof(flags) / sizeof(flags[0]); f++) {
+            if (strcmp(argv[i], flags[f][0]) == 0) break;
         }
+
+        if (f == sizeof(flags) / sizeof(flags[0]) ||
+            apply_setting(flags[f][1], argv[i + 1], port) < 0) {
+            ok = 0;
+            break;
+        }
+        i++;
     }
 
-    if (*port == 0) {
-        fprintf(stderr, "Usage: %s -p <port>\n", argv[0]);
+    if (!ok || *port == 0) {
+        fprintf(stderr, "Usage: %s -p <port> [-c <max_clients>] [-r <max_rooms>] "
+                        "[-q <queue_bytes>] [-s disconnect|drop] [-t <idle_secs>] "
+                        "[-g <room_grace_secs>] "
+                        "[-m <history_msgs>] [-b <history_bytes>] [-i <io_backend>] "
+                        "[-n <threads>] [-a none|auto|<cpus>] [-w <workers>] [-u <admin_socket>] "
+                        "[-f <config>]\n", argv[0]);
         return -1;
     }
 
     return 0;
 }
 
+/**
+ * @brief Raise the open file limit so max_clients sockets can be held.
+ */
+void raise_fd_limit(void) {
+    struct rlimit lim;
+    rlim_t wanted = (rlim_t)max_clients + 64;
+
+    if (getrlimit(RLIMIT_NOFILE, &lim) < 0 || lim.rlim_cur >= wanted) return;
+
+    lim.rlim_cur = (lim.rlim_max == RLIM_INFINITY || lim.rlim_max > wanted) ? wanted : lim.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &lim) < 0) {
+        perror("setrlimit");
+    }
+    if (lim.rlim_cur < wanted) {
+        fprintf(stderr, "Warning: open file limit %lu is below max_clients %d\n",
+                (unsigned long)lim.rlim_cur, max_clients);
+    }
+}
+
+/**
+ * @brief Switch a socket to non-blocking mode.
+ *
+ * @param fd Socket file descriptor.
+ * @return 0 on success, -1 on failure.
+ */
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("fcntl");
+        return -1;
+    }
+    return 0;
+}
+
 /**
  * @brief Create and configure server socket.
  *
+ * With several shards each one binds its own socket to the port with
+ * SO_REUSEPORT, so accepts are spread by the kernel without a shared queue.
+ *
  * @param port Port number to bind to.
  * @return Socket file descriptor on success, -1 on failure.
  */
@@ -83,7 +370,8 @@ int create_server_socket(int port) {
     }
 
     /* Set socket options to reuse address */
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        (shard_count > 1 && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)) {
         perror("setsockopt");
         close(server_fd);
         return -1;
@@ -102,160 +390,428 @@ int create_server_socket(int port) {
     }
 
     /* Start listening */
-    if (listen(server_fd, 10) < 0) {
+    if (listen(server_fd, SOMAXCONN) < 0) {
         perror("listen");
         close(server_fd);
         return -1;
     }
 
-    printf("Chat server started on port %d\n", port);
-    printf("Waiting for connections...\n");
+    /* Completion backends accept on their own and want a blocking socket */
+    if ((!io_completion_mode() && set_nonblocking(server_fd) < 0) || io_listen(server_fd) < 0) {
+        close(server_fd);
+        return -1;
+    }
+
+    if (shard_id == 0) {
+        printf("Chat server started on port %d (%s backend", port, io_backend_name());
+        if (shard_count > 1) {
+            printf(", %d threads", shard_count);
+        }
+        if (worker_count > 0) {
+            printf(", %d worker%s", worker_count, worker_count == 1 ? "" : "s");
+        }
+        printf(")\n");
+        printf("Waiting for connections...\n");
+    }
 
     return server_fd;
 }
 
 /**
- * @brief Setup file descriptor set for select().
+ * @brief Handle maintenance tasks.
  *
- * @param readfds Pointer to fd_set to configure.
- * @param server_fd Server socket file descriptor.
- * @return Maximum file descriptor number.
+ * Called on every loop iteration: due inactivity and room timers fire right
+ * away, regardless of how busy the sockets are. Rooms are only retired here,
+ * so a handler never sees a room it just left disappear. Messages from other
+ * shards are delivered next, and output queued during the iteration is
+ * submitted last (completion backends only). Shard 0 also samples the
+ * per-second rates for /stats and prints the latency dump after SIGUSR1.
+ * Rooms get their coalesced typing notices here, and history replays
+ * postponed while the loop lagged go out once it has caught up.
  */
-int setup_fd_set(fd_set *readfds, int server_fd) {
-    int max_fd = server_fd;
-    int i;
-
-    FD_ZERO(readfds);
-    FD_SET(server_fd, readfds);
-
-    for (i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].fd > 0) {
-            FD_SET(clients[i].fd, readfds);
-            if (clients[i].fd > max_fd) {
-                max_fd = clients[i].fd;
-            }
+void handle_maintenance(void) {
+    char report[STATS_REPORT_SIZE];
+
+    stats_phase(PHASE_MAINTENANCE, NULL);
+    if (shard_id == 0) {
+        stats_tick(clock_now());
+        if (__atomic_exchange_n(&latency_dump_requested, 0, __ATOMIC_RELAXED)) {
+            stats_format_latency(LATENCY_SIGNAL, report, sizeof(report));
+            fputs(report, stdout);
+            fflush(stdout);
         }
     }
+    check_inactive_clients();
+    check_empty_rooms();
+    process_shard_inbox();
+    /* After the inbox, so typers posted by other shards make this round */
+    flush_typing();
+    replay_postponed_history();
+    process_pending_disconnects();
+    stats_phase(PHASE_WRITE, NULL);
+    flush_pending_output();
+}
 
-    return max_fd;
+/**
+ * @brief Tell a connection why it is refused and close it.
+ *
+ * @param client_fd Accepted socket.
+ * @param msg Null-terminated notice.
+ */
+void reject_client(int client_fd, const char *msg) {
+    send(client_fd, msg, strlen(msg), MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(client_fd);
 }
 
 /**
- * @brief Handle maintenance tasks (periodic cleanup).
+ * @brief Store an accepted socket in a free client slot.
+ *
+ * While the loop lags past shed_accept the connection is turned away
+ * before it costs a slot, a greeting and a backend registration.
+ *
+ * @param client_fd Accepted socket (non-blocking unless a completion backend accepted it).
+ * @param client_addr Peer address.
  */
-void handle_maintenance(void) {
-    check_inactive_clients();
-    cleanup_empty_rooms();
+void accept_client(int client_fd, const struct sockaddr_in *client_addr) {
+    int client_idx;
+    char msg[BUFFER_SIZE];
+
+    if (loop_overloaded(shed_accept)) {
+        reject_client(client_fd, COLOR_ERROR "[ERROR] Server is busy, try again later." COLOR_RESET "\n");
+        stats_add(STAT_SHED_ACCEPTS, 1);
+        return;
+    }
+
+    client_idx = add_client(client_fd, client_addr);
+    if (client_idx >= 0 && io_add(client_fd) == 0) {
+        snprintf(msg, sizeof(msg),
+                 COLOR_SERVER "[SERVER] Connected to chat server. Set your username with /name <username>" COLOR_RESET "\n");
+        send_message(client_fd, msg);
+
+        printf("New connection from %s:%d\n",
+               inet_ntoa(client_addr->sin_addr),
+               ntohs(client_addr->sin_port));
+        return;
+    }
+
+    if (client_idx >= 0) {
+        /* Registration with the backend failed; undo the slot */
+        handle_disconnect(client_idx);
+        return;
+    }
+
+    reject_client(client_fd, COLOR_ERROR "[ERROR] Server is full." COLOR_RESET "\n");
 }
 
 /**
- * @brief Handle new client connection.
+ * @brief Handle new client connections.
+ *
+ * The listening socket is edge-triggered, so every pending connection is
+ * accepted before returning.
  *
  * @param server_fd Server socket file descriptor.
  */
 void handle_new_connection(int server_fd) {
     struct sockaddr_in client_addr;
-    socklen_t addr_len = sizeof(client_addr);
-    int client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &addr_len);
+    socklen_t addr_len;
+    int client_fd;
 
-    if (client_fd < 0) {
-        return;
+    while (1) {
+        addr_len = sizeof(client_addr);
+        client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &addr_len);
+
+        if (client_fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+
+        if (set_nonblocking(client_fd) < 0) {
+            close(client_fd);
+            continue;
+        }
+
+        accept_client(client_fd, &client_addr);
     }
+}
 
-    int added = 0;
-    int j;
-    char msg[BUFFER_SIZE];
+/**
+ * @brief Receive buffer for clients without a pending partial line (one per shard).
+ */
+__thread char read_buffer[BUFFER_SIZE];
 
-    for (j = 0; j < MAX_CLIENTS; j++) {
-        if (clients[j].fd == -1) {
-            clients[j].fd = client_fd;
-            clients[j].addr = client_addr;
-            clients[j].last_activity = time(NULL);
-            added = 1;
+/**
+ * @brief Handle one chunk of input that sits in `buf`.
+ *
+ * Complete lines are handled in place and only the trailing fragment is
+ * kept in the client's input buffer.
+ *
+ * @param client_idx Index of the client.
+ * @param buf Pending fragment (if any) followed by the new bytes.
+ * @param used Bytes in buf; less than BUFFER_SIZE.
+ * @return 0 to keep reading, -1 once the client is gone or closing.
+ */
+int process_client_chunk(int client_idx, char *buf, size_t used) {
+    int fd = client_fds[client_idx];
+    size_t consumed;
 
-            snprintf(msg, sizeof(msg),
-                     COLOR_SERVER "[SERVER] Connected to chat server. Set your username with /name <username>" COLOR_RESET "\n");
-            send_message(client_fd, msg);
+    clients[client_idx].in_len = 0;
+    consumed = handle_client_input(client_idx, buf, used);
 
-            printf("New connection from %s:%d\n",
-                   inet_ntoa(client_addr.sin_addr),
-                   ntohs(client_addr.sin_port));
-            break;
+    if (client_fds[client_idx] != fd || (client_flags[client_idx] & CLIENT_CLOSING)) {
+        return -1;
+    }
+
+    if (used - consumed == BUFFER_SIZE - 1) {
+        /* No newline in a full buffer: reject the line and skip its tail */
+        send_message(fd, COLOR_ERROR "[ERROR] Message too long." COLOR_RESET "\n");
+        clients[client_idx].in_discard = 1;
+    } else if (used > consumed &&
+               save_partial_input(client_idx, buf + consumed, used - consumed) < 0) {
+        schedule_disconnect(client_idx);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read everything available from one client.
+ *
+ * Sockets are edge-triggered, so the descriptor is drained until recv()
+ * reports EAGAIN. Each read may carry several commands or end mid-line.
+ * When a fragment is pending, the next read lands directly behind it so
+ * the line is never copied twice.
+ *
+ * @param client_idx Index of the client that became readable.
+ */
+void handle_client_data(int client_idx) {
+    int fd = client_fds[client_idx];
+    char *buf;
+    size_t used;
+    ssize_t bytes;
+
+    /* Stop as soon as a handler disconnects the client (e.g. /quit) */
+    while (client_fds[client_idx] == fd && !(client_flags[client_idx] & CLIENT_CLOSING)) {
+        if (clients[client_idx].in_len > 0) {
+            buf = clients[client_idx].in_buf;
+            used = clients[client_idx].in_len;
+        } else {
+            buf = read_buffer;
+            used = 0;
+        }
+
+        bytes = recv(fd, buf + used, BUFFER_SIZE - 1 - used, 0);
+
+        if (bytes < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            handle_disconnect(client_idx);
+            return;
+        }
+
+        if (bytes == 0) {
+            handle_disconnect(client_idx);
+            return;
+        }
+        stats_add(STAT_BYTES_IN, bytes);
+
+        if (process_client_chunk(client_idx, buf, used + bytes) < 0) {
+            return;
         }
     }
+}
+
+/**
+ * @brief Handle bytes a completion backend received for a client.
+ *
+ * The backend's buffer is parsed in place unless a fragment is pending, in
+ * which case the bytes are appended to it. Chunks are capped like a recv()
+ * into the client buffer, so over-long lines are rejected the same way.
+ *
+ * @param client_idx Index of the client.
+ * @param data Received bytes (modified in place).
+ * @param len Number of bytes.
+ */
+void handle_client_bytes(int client_idx, char *data, size_t len) {
+    char *buf;
+    size_t used;
+    size_t chunk;
+
+    stats_add(STAT_BYTES_IN, (long)len);
+    while (len > 0) {
+        if (clients[client_idx].in_len > 0) {
+            buf = clients[client_idx].in_buf;
+            used = clients[client_idx].in_len;
+            chunk = BUFFER_SIZE - 1 - used;
+            if (chunk > len) chunk = len;
+            memcpy(buf + used, data, chunk);
+        } else {
+            buf = data;
+            used = 0;
+            chunk = len < BUFFER_SIZE - 1 ? len : BUFFER_SIZE - 1;
+        }
 
-    if (!added) {
-        char msg[] = COLOR_ERROR "[ERROR] Server is full." COLOR_RESET "\n";
-        send(client_fd, msg, strlen(msg), 0);
-        close(client_fd);
+        if (process_client_chunk(client_idx, buf, used + chunk) < 0) {
+            return;
+        }
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+/**
+ * @brief Take over a socket accepted by a completion backend.
+ *
+ * @param client_fd Accepted socket.
+ */
+void handle_accepted(int client_fd) {
+    struct sockaddr_in client_addr;
+    socklen_t addr_len = sizeof(client_addr);
+
+    if (getpeername(client_fd, (struct sockaddr *)&client_addr, &addr_len) < 0) {
+        memset(&client_addr, 0, sizeof(client_addr));
     }
+    accept_client(client_fd, &client_addr);
 }
 
 /**
- * @brief Handle messages from all connected clients.
+ * @brief Dispatch ready events reported by the I/O backend.
  *
- * @param readfds Pointer to fd_set with ready file descriptors.
+ * @param events Array of ready events.
+ * @param count Number of events.
+ * @param server_fd Server socket file descriptor.
  */
-void handle_client_messages(fd_set *readfds) {
+void handle_events(const IoEvent *events, int count, int server_fd) {
+    int wake_fd = shard_wake_fd();
     int i;
+    int client_idx;
+
+    /* Finished sends first, so queues only hold output the kernel still has */
+    for (i = 0; i < count; i++) {
+        if (events[i].events & IO_EVENT_SENT) {
+            stats_phase(PHASE_WRITE, NULL);
+            client_idx = find_client_by_fd(events[i].fd);
+            if (client_idx >= 0) {
+                complete_client_output(client_idx, events[i].result);
+            }
+        }
+    }
 
-    for (i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].fd > 0 && FD_ISSET(clients[i].fd, readfds)) {
-            char buffer[BUFFER_SIZE];
-            int bytes = recv(clients[i].fd, buffer, sizeof(buffer) - 1, 0);
+    for (i = 0; i < count; i++) {
+        if (events[i].events & IO_EVENT_ACCEPT) {
+            stats_phase(PHASE_ACCEPT, NULL);
+            handle_accepted(events[i].result);
+            continue;
+        }
 
-            if (bytes <= 0) {
-                handle_disconnect(i);
+        if (events[i].fd == wake_fd) {
+            /* Another shard posted to our inbox; handle_maintenance() delivers it */
+            stats_phase(PHASE_MAINTENANCE, NULL);
+            shard_ack_wake(!(events[i].events & IO_EVENT_DATA));
+            continue;
+        }
+
+        if (events[i].fd == server_fd) {
+            stats_phase(PHASE_ACCEPT, NULL);
+            handle_new_connection(server_fd);
+            continue;
+        }
+
+        client_idx = find_client_by_fd(events[i].fd);
+        if (client_idx < 0 || (client_flags[client_idx] & CLIENT_DRAINING)) {
+            /* A draining client only waits for its last send */
+            continue;
+        }
+
+        if (events[i].events & IO_EVENT_WRITE) {
+            stats_phase(PHASE_WRITE, NULL);
+            flush_client_output(client_idx);
+        }
+
+        stats_phase(PHASE_READ, NULL);
+        if (events[i].events & IO_EVENT_DATA) {
+            handle_client_bytes(client_idx, events[i].data, events[i].result);
+        } else if (events[i].events & (IO_EVENT_READ | IO_EVENT_ERROR)) {
+            /* Completion backends report end of stream as a bare error */
+            if (io_completion_mode()) {
+                handle_disconnect(client_idx);
             } else {
-                buffer[bytes] = '\0';
-                handle_client_message(i, buffer);
+                handle_client_data(client_idx);
             }
         }
     }
+
+    /* Slow consumers and failed writes are torn down outside the handlers */
+    stats_phase(PHASE_MAINTENANCE, NULL);
+    process_pending_disconnects();
+}
+
+/**
+ * @brief Estimate how long ready events waited for this iteration.
+ *
+ * Events that became ready while the previous iteration was busy are
+ * reported by a wait that returns at once (within LOOP_READY_NS), so they
+ * may have waited as long as that iteration took. A wait that had to block
+ * found nothing pending.
+ * The estimate rises at once and decays by an eighth per iteration and by
+ * the time spent blocked, so one slow iteration sheds load briefly, a
+ * steady backlog keeps shedding and an idle loop recovers within a wait.
+ *
+ * @param busy_ns Time the previous iteration spent working.
+ * @param wait_ns Time this iteration spent in io_wait().
+ */
+void update_loop_lag(unsigned long busy_ns, unsigned long wait_ns) {
+    unsigned long lag = wait_ns < LOOP_READY_NS ? busy_ns : 0;
+    unsigned long decayed = loop_lag - loop_lag / 8;
+
+    decayed = decayed > wait_ns ? decayed - wait_ns : 0;
+    loop_lag = lag > decayed ? lag : decayed;
+    stats_lag(loop_lag);
 }
 
 /**
  * @brief Main server event loop.
  *
+ * Every iteration measures the loop lag (see update_loop_lag()), which
+ * decides what handlers shed under overload.
+ *
  * @param server_fd Server socket file descriptor.
  */
 void run_server_loop(int server_fd) {
-    int loop_count = 0;
-
-    while (running) {
-        fd_set readfds;
-        int max_fd;
-        struct timeval tv = {1, 0};
-        int activity;
-
-        max_fd = setup_fd_set(&readfds, server_fd);
+    IoEvent events[IO_MAX_EVENTS];
+    unsigned long woke = 0;
+    unsigned long idle;
+    unsigned long now;
+    int activity;
 
+    while (__atomic_load_n(&running, __ATOMIC_RELAXED)) {
         /* Wait for activity on sockets */
-        activity = select(max_fd + 1, &readfds, NULL, NULL, &tv);
+        stats_phase(PHASE_IDLE, &idle);
+        activity = io_wait(events, IO_MAX_EVENTS, 1000);
+        stats_phase(PHASE_MAINTENANCE, &now);
 
-        if (activity < 0 && errno != EINTR) {
-            perror("select");
-            break;
+        if (woke != 0) {
+            update_loop_lag(idle - woke, now - idle);
         }
+        woke = now;
 
-        /* Timeout handling (Maintenance tasks) */
-        if (activity <= 0) {
-            loop_count++;
-            /* Check inactive clients and clean rooms every ~10 seconds */
-            if (loop_count >= 10) {
-                handle_maintenance();
-                loop_count = 0;
-            }
-            continue;
+        if (activity < 0) {
+            if (errno == EINTR) continue;
+            perror("io_wait");
+            break;
         }
 
-        /* Handle New Connection */
-        if (FD_ISSET(server_fd, &readfds)) {
-            handle_new_connection(server_fd);
+        /* One clock read per iteration; handlers use the cached values */
+        clock_tick();
+
+        if (activity > 0) {
+            handle_events(events, activity, server_fd);
         }
 
-        /* Handle Client Messages */
-        handle_client_messages(&readfds);
+        /* Timers are serviced whether or not there was socket activity */
+        handle_maintenance();
     }
 }
 
@@ -267,22 +823,72 @@ void run_server_loop(int server_fd) {
 void shutdown_server(int server_fd) {
     int i;
 
-    printf("\nShutting down server...\n");
+    if (shard_id == 0) {
+        printf("\nShutting down server...\n");
+    }
 
-    for (i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].fd > 0) {
-            close(clients[i].fd);
+    for (i = 0; i < client_capacity; i++) {
+        if (client_fds[i] > 0) {
+            io_close_fd(client_fds[i]);
         }
     }
 
-    close(server_fd);
+    io_close_fd(server_fd);
+    io_close();
+}
+
+/**
+ * @brief Run one shard: its tables, backend, listening socket and loop.
+ *
+ * A shard that cannot start stops the others as well.
+ *
+ * @param arg Pointer to the port number.
+ * @return 0 on success, -1 on failure.
+ */
+int run_reactor(void *arg) {
+    int port = *(int *)arg;
+    int wake_fd = shard_wake_fd();
+    int server_fd;
+
+    /* Initialize internal structures */
+    stats_attach(shard_id);
+    init_clients();
+    init_rooms();
+
+    if (io_init(io_backend_choice[0] ? io_backend_choice : NULL) < 0) {
+        __atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    /* Inbox wakeups arrive like client input */
+    if (wake_fd >= 0 &&
+        ((!io_completion_mode() && set_nonblocking(wake_fd) < 0) || io_add(wake_fd) < 0)) {
+        io_close();
+        __atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    /* Create and configure server socket */
+    server_fd = create_server_socket(port);
+    if (server_fd < 0) {
+        io_close();
+        __atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    /* Run main server loop */
+    run_server_loop(server_fd);
+
+    /* Cleanup and shutdown */
+    shutdown_server(server_fd);
+    return 0;
 }
 
 /**
  * @brief Main server function.
  *
- * Initializes the server socket, binds to the specified port, and enters
- * the main event loop to handle client connections and messages.
+ * Starts one reactor per configured thread, each binding the port and
+ * running the event loop, and waits for them to shut down.
  *
  * @param argc Argument count.
  * @param argv Argument vector (expects -p <port>).
@@ -290,7 +896,7 @@ void shutdown_server(int server_fd) {
  */
 int main(int argc, char *argv[]) {
     int port = 0;
-    int server_fd;
+    int rc;
 
     /* Parse command line arguments */
     if (parse_arguments(argc, argv, &port) < 0) {
@@ -300,22 +906,31 @@ int main(int argc, char *argv[]) {
     /* Setup signal handlers */
     signal(SIGINT, sigint_handler);
     signal(SIGTERM, sigint_handler);
+    signal(SIGUSR1, sigusr1_handler);
+    /* Writes to a peer that already closed must fail with EPIPE, not kill us */
+    signal(SIGPIPE, SIG_IGN);
 
-    /* Initialize internal structures */
-    init_clients();
-    init_rooms();
+    raise_fd_limit();
 
-    /* Create and configure server socket */
-    server_fd = create_server_socket(port);
-    if (server_fd < 0) {
+    if (shard_init() < 0) {
+        return 1;
+    }
+    if (worker_start(handle_job) < 0) {
+        shard_free();
+        return 1;
+    }
+    if (admin_socket_path[0] && stats_serve(admin_socket_path) < 0) {
+        worker_stop();
+        shard_free();
         return 1;
     }
 
-    /* Run main server loop */
-    run_server_loop(server_fd);
+    rc = shard_run(run_reactor, &port);
+    stats_stop();
 
-    /* Cleanup and shutdown */
-    shutdown_server(server_fd);
+    /* Workers may still post to the inboxes until they are joined */
+    worker_stop();
+    shard_free();
 
-    return 0;
+    return rc == 0 ? 0 : 1;
 }
\ No newline at end of file
@@ -1,10 +1,21 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "server_utils.h"
 #include "colors.h"
+#include "io_backend.h"
+#include "name_index.h"
+#include "directory.h"
+#include "shard.h"
+#include "stats.h"
+#include "timer_wheel.h"
+#include "worker.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
@@ -17,8 +28,111 @@
  */
 
 /* --- Global Definitions --- */
-Client clients[MAX_CLIENTS];
-Room rooms[MAX_ROOMS];
+/* Client and room tables belong to the reactor thread (shard) that uses them */
+__thread Client *clients = NULL;
+__thread int *client_fds = NULL;
+__thread int *client_rooms = NULL;
+__thread unsigned char *client_flags = NULL;
+__thread time_t *client_last_activity = NULL;
+__thread unsigned long *client_ids = NULL;
+__thread int client_capacity = 0;
+int max_clients = MAX_CLIENTS;
+
+__thread Room *rooms = NULL;
+__thread int room_capacity = 0;
+int max_rooms = MAX_ROOMS;
+
+size_t output_queue_limit = OUTPUT_QUEUE_LIMIT;
+SlowClientPolicy slow_client_policy = SLOW_CLIENT_DISCONNECT;
+
+int idle_timeout = IDLE_TIMEOUT;
+int room_grace = ROOM_GRACE;
+int typing_interval = TYPING_INTERVAL;
+
+/* --- Operator Settings --- */
+char oper_password[OPER_PASSWORD_MAX] = "";
+
+/* --- Overload Settings --- */
+int shed_typing = SHED_TYPING_MS;
+int shed_history = SHED_HISTORY_MS;
+int shed_accept = SHED_ACCEPT_MS;
+__thread unsigned long loop_lag = 0;
+
+int history_max_messages = MAX_HISTORY;
+size_t history_max_bytes = HISTORY_BYTES;
+
+/**
+ * @brief History limits of one room, set with history.<room>.
+ */
+typedef struct {
+    char room[MAX_ROOMNAME];        /**< Room name */
+    int max_messages;               /**< Messages kept */
+    size_t max_bytes;               /**< Byte budget, 0 for history_max_bytes */
+} RoomHistoryLimits;
+
+/** @brief Rooms with their own history limits; written only before the shards start. */
+static RoomHistoryLimits room_history_limits[ROOM_HISTORY_LIMITS];
+static int room_history_limit_count = 0;
+
+/** @brief Client slots per word of a room's member bitmap. */
+#define MEMBER_WORD_BITS (8 * (int)sizeof(unsigned long))
+
+/** @brief Username -> client index for named, connected clients. */
+static __thread NameIndex username_index;
+
+/** @brief Room name -> room index for active rooms. */
+static __thread NameIndex room_index;
+
+/** @brief Stack of free client slots; popping yields the lowest index first. */
+static __thread int *free_clients = NULL;
+static __thread int free_client_count = 0;
+
+/** @brief Stack of free room slots. */
+static __thread int *free_rooms = NULL;
+static __thread int free_room_count = 0;
+
+/** @brief Direct fd -> client index map (-1 for unused descriptors). */
+static __thread int *fd_clients = NULL;
+static __thread int fd_capacity = 0;
+
+/** @brief Clients waiting for process_pending_disconnects() (client_capacity entries). */
+static __thread int *pending_close = NULL;
+static __thread int pending_close_count = 0;
+
+/** @brief Clients whose history replay was postponed (client_capacity entries). */
+static __thread int *replay_list = NULL;
+static __thread int replay_count = 0;
+
+/** @brief Clients with output to hand to a completion backend (client_capacity entries). */
+static __thread int *flush_list = NULL;
+static __thread int flush_count = 0;
+
+/** @brief Number of flush_pending_output() rounds so far. */
+static __thread unsigned long flush_round = 0;
+
+/** @brief Inactivity deadlines, one timer per client slot (ticks are clock_now() seconds). */
+static __thread TimerWheel client_timers;
+
+/** @brief Retirement deadlines, one timer per room slot, armed while a room has no local members. */
+static __thread TimerWheel room_timers;
+
+/** @brief Rooms emptied with room_grace 0, retired by check_empty_rooms() (room_capacity entries). */
+static __thread int *retire_list = NULL;
+static __thread int retire_count = 0;
+
+/** @brief Rooms with typers waiting for flush_typing() (room_capacity entries). */
+static __thread int *typing_rooms = NULL;
+static __thread int typing_room_count = 0;
+
+/** @brief Current flush_typing() round (a client is counted once per round) and when it ends. */
+static __thread unsigned long typing_round = 1;
+static __thread time_t typing_due = 0;
+
+/** @brief Connected clients on all shards, checked against max_clients. */
+static int connected_clients = 0;
+
+/** @brief Last connection id handed out, on any shard. */
+static unsigned long last_client_id = 0;
 
 const char *USER_COLORS[10] = {
     COLOR_USER_1, COLOR_USER_2, COLOR_USER_3, COLOR_USER_4, COLOR_USER_5,
@@ -28,227 +142,1765 @@ const char *USER_COLORS[10] = {
 /* --- Initialization --- */
 
 /**
- * @brief Initializes the global clients array.
- * Sets file descriptors to -1 and clears usernames.
+ * @brief Key callback for the username index.
+ *
+ * @param client_idx Index of the client.
+ * @return The client's username.
+ */
+static const char *client_key(int client_idx) {
+    return clients[client_idx].username;
+}
+
+/**
+ * @brief Key callback for the room index.
+ *
+ * @param room_idx Index of the room.
+ * @return The room's name.
  */
-void init_clients(void) {
-    int i;
-    for (i = 0; i < MAX_CLIENTS; i++) {
-        clients[i].fd = -1;
-        clients[i].username[0] = '\0';
-        clients[i].current_room[0] = '\0';
-        clients[i].last_activity = 0;
-        clients[i].last_typing_sent = 0;
+static const char *room_key(int room_idx) {
+    return rooms[room_idx].name;
+}
+
+/**
+ * @brief Updates the output queue gauges after a client's queue changed.
+ *
+ * @param before Bytes the queue held before the change.
+ * @param after Bytes it holds now.
+ */
+static void account_queue(size_t before, size_t after) {
+    if (before == after) return;
+
+    stats_add(STAT_QUEUED_BYTES, (long)after - (long)before);
+    if (before == 0 || after == 0) {
+        stats_add(STAT_QUEUED_CLIENTS, after > 0 ? 1 : -1);
     }
 }
 
 /**
- * @brief Initializes the global rooms array.
- * Sets up the default "lobby" room and marks others as inactive.
+ * @brief Returns a client slot to its pristine, unused state.
+ *
+ * @param client_idx Index of the client slot.
  */
-void init_rooms(void) {
-    int i;
-    for (i = 0; i < MAX_ROOMS; i++) {
-        rooms[i].active = 0;
-        rooms[i].name[0] = '\0';
-        rooms[i].history.count = 0;
-        rooms[i].history.head = 0;
+static void reset_client(int client_idx) {
+    Client *c = &clients[client_idx];
+
+    client_fds[client_idx] = -1;
+    client_rooms[client_idx] = -1;
+    client_flags[client_idx] = 0;
+    client_last_activity[client_idx] = 0;
+    client_ids[client_idx] = 0;
+
+    c->username[0] = '\0';
+    c->room_slot = -1;
+    c->typing_round = 0;
+    account_queue(c->out.bytes, 0);
+    outq_clear(&c->out);
+    c->send_inflight = 0;
+    free(c->in_buf);
+    c->in_buf = NULL;
+    c->in_len = 0;
+    c->in_discard = 0;
+}
+
+/**
+ * @brief Returns a room slot to its inactive state.
+ *
+ * retire_queued and typing_queued are left alone, so a slot that is reused
+ * while still listed is not listed twice.
+ *
+ * @param r The room slot.
+ */
+static void reset_room(Room *r) {
+    r->active = 0;
+    r->typing_count = 0;
+    r->name[0] = '\0';
+    history_clear(&r->history);
+    msgbuf_unref(r->replay);
+    r->replay = NULL;
+    free(r->members);
+    r->members = NULL;
+    r->member_count = 0;
+    r->member_cap = 0;
+    free(r->member_bits);
+    r->member_bits = NULL;
+    r->member_words = 0;
+}
+
+static void finish_disconnect(int client_idx);
+
+/**
+ * @brief Timer callback: disconnects a client whose inactivity timer fired,
+ * or closes one whose last send outlived DRAIN_TIMEOUT.
+ *
+ * @param client_idx Index of the client.
+ */
+static void expire_client(int client_idx) {
+    time_t now = clock_now();
+
+    if ((client_flags[client_idx] & CLIENT_DRAINING)) {
+        /* The peer stopped reading; give up on the rest of its output */
+        finish_disconnect(client_idx);
+        return;
     }
-    /* Create default "lobby" */
-    strcpy(rooms[0].name, "lobby");
-    rooms[0].active = 1;
+    if (client_fds[client_idx] <= 0 || (client_flags[client_idx] & CLIENT_CLOSING)) return;
+
+    printf("Client timeout: %s (inactive for %ld s)\n",
+           clients[client_idx].username[0] ? clients[client_idx].username : "unnamed",
+           (long)(now - client_last_activity[client_idx]));
+    stats_add(STAT_TIMEOUTS, 1);
+
+    send_message(client_fds[client_idx], "[SERVER] Disconnected due to inactivity.\n");
+    handle_disconnect(client_idx);
 }
 
-/* --- Helpers --- */
+/**
+ * @brief Frees a room slot and drops the room's name and history.
+ *
+ * @param room_idx Index of the room.
+ */
+static void retire_room(int room_idx) {
+    printf("Cleaning up empty room: '%s'\n", rooms[room_idx].name);
+    timer_cancel(&room_timers, room_idx);
+    name_index_remove(&room_index, rooms[room_idx].name);
+    reset_room(&rooms[room_idx]);
+    free_rooms[free_room_count++] = room_idx;
+}
 
 /**
- * @brief Generates a current timestamp string.
+ * @brief Timer callback: retires a room that stayed empty through its grace period.
  *
- * @param buffer Buffer to store the timestamp string.
- * @param size Size of the buffer.
+ * A copy whose room still has members on other shards is kept, since its
+ * history is replayed to clients joining here, and checked again later.
+ *
+ * @param room_idx Index of the room.
  */
-void get_timestamp(char *buffer, size_t size) {
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    strftime(buffer, size, "%H:%M:%S", t);
+static void expire_room(int room_idx) {
+    if (!rooms[room_idx].active || room_idx == LOBBY_ROOM || rooms[room_idx].member_count > 0) return;
+
+    if (dir_room_members(rooms[room_idx].name) > 0) {
+        timer_arm(&room_timers, room_idx, (unsigned long)clock_now() + ROOM_RECHECK_INTERVAL);
+        return;
+    }
+    retire_room(room_idx);
 }
 
 /**
- * @brief Finds a client index by their socket file descriptor.
+ * @brief Schedules the retirement of a room that has just lost its last local member.
  *
- * @param fd The file descriptor to search for.
- * @return Index in clients array, or -1 if not found.
+ * With a grace period the room's timer is armed; without one the room is
+ * listed and goes at the end of the loop iteration, after the handler that
+ * emptied it is done with it.
+ *
+ * @param room_idx Index of the room.
  */
-int find_client_by_fd(int fd) {
+static void room_emptied(int room_idx) {
+    if (room_idx == LOBBY_ROOM) return;
+
+    if (room_grace > 0) {
+        timer_arm(&room_timers, room_idx, (unsigned long)clock_now() + room_grace);
+    } else if (!rooms[room_idx].retire_queued) {
+        rooms[room_idx].retire_queued = 1;
+        retire_list[retire_count++] = room_idx;
+    }
+}
+
+/**
+ * @brief Doubles the client table (up to max_clients) and frees the new slots.
+ *
+ * @return 0 on success, -1 if the limit is reached or allocation fails.
+ */
+static int grow_clients(void) {
+    int new_cap = client_capacity ? client_capacity * 2 : INITIAL_TABLE_SLOTS;
+    Client *new_clients;
+    int *new_fds;
+    int *new_rooms;
+    unsigned char *new_flags;
+    time_t *new_activity;
+    unsigned long *new_ids;
+    int *new_free;
+    int *new_pending;
+    int *new_replay;
+    int *new_flush;
     int i;
-    for (i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].fd == fd) return i;
+
+    if (new_cap > max_clients) new_cap = max_clients;
+    if (new_cap <= client_capacity) return -1;
+
+    new_clients = realloc(clients, new_cap * sizeof(*new_clients));
+    if (!new_clients) return -1;
+    clients = new_clients;
+
+    /* Hot fields, one parallel array each */
+    new_fds = realloc(client_fds, new_cap * sizeof(*new_fds));
+    if (!new_fds) return -1;
+    client_fds = new_fds;
+
+    new_rooms = realloc(client_rooms, new_cap * sizeof(*new_rooms));
+    if (!new_rooms) return -1;
+    client_rooms = new_rooms;
+
+    new_flags = realloc(client_flags, new_cap * sizeof(*new_flags));
+    if (!new_flags) return -1;
+    client_flags = new_flags;
+
+    new_activity = realloc(client_last_activity, new_cap * sizeof(*new_activity));
+    if (!new_activity) return -1;
+    client_last_activity = new_activity;
+
+    new_ids = realloc(client_ids, new_cap * sizeof(*new_ids));
+    if (!new_ids) return -1;
+    client_ids = new_ids;
+
+    new_free = realloc(free_clients, new_cap * sizeof(*new_free));
+    if (!new_free) return -1;
+    free_clients = new_free;
+
+    new_pending = realloc(pending_close, new_cap * sizeof(*new_pending));
+    if (!new_pending) return -1;
+    pending_close = new_pending;
+
+    new_replay = realloc(replay_list, new_cap * sizeof(*new_replay));
+    if (!new_replay) return -1;
+    replay_list = new_replay;
+
+    new_flush = realloc(flush_list, new_cap * sizeof(*new_flush));
+    if (!new_flush) return -1;
+    flush_list = new_flush;
+
+    if (timer_wheel_reserve(&client_timers, new_cap) < 0) return -1;
+
+    /* Push in reverse so the lowest new index is handed out first */
+    memset(&clients[client_capacity], 0, (new_cap - client_capacity) * sizeof(*clients));
+    for (i = new_cap - 1; i >= client_capacity; i--) {
+        reset_client(i);
+        free_clients[free_client_count++] = i;
     }
-    return -1;
+
+    client_capacity = new_cap;
+    return 0;
 }
 
 /**
- * @brief Finds a client index by their username.
+ * @brief Doubles the room table (up to max_rooms) and frees the new slots.
  *
- * @param username The username string to search for.
- * @return Index in clients array, or -1 if not found.
+ * @return 0 on success, -1 if the limit is reached or allocation fails.
  */
-int find_client_by_username(const char *username) {
+static int grow_rooms(void) {
+    int new_cap = room_capacity ? room_capacity * 2 : INITIAL_TABLE_SLOTS;
+    Room *new_rooms;
+    int *new_free;
+    int *new_retire;
+    int *new_typing;
     int i;
-    for (i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].fd > 0 && strcmp(clients[i].username, username) == 0) {
-            return i;
-        }
+
+    if (new_cap > max_rooms) new_cap = max_rooms;
+    if (new_cap <= room_capacity) return -1;
+
+    new_rooms = realloc(rooms, new_cap * sizeof(*new_rooms));
+    if (!new_rooms) return -1;
+    rooms = new_rooms;
+
+    new_free = realloc(free_rooms, new_cap * sizeof(*new_free));
+    if (!new_free) return -1;
+    free_rooms = new_free;
+
+    new_retire = realloc(retire_list, new_cap * sizeof(*new_retire));
+    if (!new_retire) return -1;
+    retire_list = new_retire;
+
+    new_typing = realloc(typing_rooms, new_cap * sizeof(*new_typing));
+    if (!new_typing) return -1;
+    typing_rooms = new_typing;
+
+    if (timer_wheel_reserve(&room_timers, new_cap) < 0) return -1;
+
+    memset(&rooms[room_capacity], 0, (new_cap - room_capacity) * sizeof(*rooms));
+    for (i = new_cap - 1; i >= room_capacity; i--) {
+        reset_room(&rooms[i]);
+        free_rooms[free_room_count++] = i;
     }
-    return -1;
+
+    room_capacity = new_cap;
+    return 0;
 }
 
 /**
- * @brief Finds a room index by its name.
+ * @brief Makes the fd -> client map large enough to hold a descriptor.
  *
- * @param name The name of the room.
- * @return Index in rooms array, or -1 if not found/inactive.
+ * @param fd The descriptor.
+ * @return 0 on success, -1 on allocation failure.
  */
-int find_room(const char *name) {
+static int reserve_fd_slot(int fd) {
+    int new_cap;
+    int *new_map;
     int i;
-    for (i = 0; i < MAX_ROOMS; i++) {
-        if (rooms[i].active && strcmp(rooms[i].name, name) == 0) {
-            return i;
-        }
+
+    if (fd < fd_capacity) return 0;
+
+    new_cap = fd_capacity ? fd_capacity : INITIAL_TABLE_SLOTS;
+    while (new_cap <= fd) new_cap *= 2;
+
+    new_map = realloc(fd_clients, new_cap * sizeof(*new_map));
+    if (!new_map) return -1;
+
+    for (i = fd_capacity; i < new_cap; i++) {
+        new_map[i] = -1;
     }
-    return -1;
+    fd_clients = new_map;
+    fd_capacity = new_cap;
+    return 0;
 }
 
 /**
- * @brief Creates a new room if space is available.
+ * @brief Takes a client out of its room, the name registries and the connection count.
  *
- * @param name The name of the new room.
- * @return Index of the new room, or -1 if full or exists.
+ * @param client_idx Index of the client.
  */
-int create_room(const char *name) {
+static void detach_client(int client_idx) {
+    Client *c = &clients[client_idx];
+
+    set_client_room(client_idx, -1);
+    if (c->username[0] != '\0') {
+        name_index_remove(&username_index, c->username);
+        dir_release_user(c->username);
+    }
+    __atomic_sub_fetch(&connected_clients, 1, __ATOMIC_RELAXED);
+    stats_add(STAT_CLIENTS, -1);
+}
+
+/**
+ * @brief Initializes the calling shard's clients table.
+ * Releases any previous table and allocates the first slab of free slots.
+ */
+void init_clients(void) {
     int i;
-    if (find_room(name) >= 0) return -1;
 
-    for (i = 0; i < MAX_ROOMS; i++) {
-        if (!rooms[i].active) {
-            strncpy(rooms[i].name, name, MAX_ROOMNAME - 1);
-            rooms[i].name[MAX_ROOMNAME - 1] = '\0';
-            rooms[i].active = 1;
-            return i;
+    for (i = 0; i < client_capacity; i++) {
+        if (client_fds[i] >= 0) {
+            detach_client(i);
         }
+        reset_client(i);
     }
-    return -1;
+    free(clients);
+    free(client_fds);
+    free(client_rooms);
+    free(client_flags);
+    free(client_last_activity);
+    free(client_ids);
+    free(free_clients);
+    free(pending_close);
+    free(replay_list);
+    free(flush_list);
+    free(fd_clients);
+    clients = NULL;
+    client_fds = NULL;
+    client_rooms = NULL;
+    client_flags = NULL;
+    client_last_activity = NULL;
+    client_ids = NULL;
+    free_clients = NULL;
+    pending_close = NULL;
+    replay_list = NULL;
+    flush_list = NULL;
+    fd_clients = NULL;
+    client_capacity = 0;
+    free_client_count = 0;
+    pending_close_count = 0;
+    replay_count = 0;
+    flush_count = 0;
+    fd_capacity = 0;
+
+    timer_wheel_init(&client_timers, 0, (unsigned long)clock_now(), expire_client);
+    grow_clients();
+    name_index_init(&username_index, client_capacity, client_key);
 }
 
-/* --- Networking --- */
+/**
+ * @brief Initializes the calling shard's rooms table.
+ * Sets up the default "lobby" room and marks others as inactive.
+ */
+void init_rooms(void) {
+    int i;
+
+    for (i = 0; i < room_capacity; i++) {
+        reset_room(&rooms[i]);
+    }
+    free(rooms);
+    free(free_rooms);
+    rooms = NULL;
+    free_rooms = NULL;
+    free(retire_list);
+    retire_list = NULL;
+    free(typing_rooms);
+    typing_rooms = NULL;
+    room_capacity = 0;
+    free_room_count = 0;
+    retire_count = 0;
+    typing_room_count = 0;
+    typing_due = 0;
+
+    timer_wheel_init(&room_timers, 0, (unsigned long)clock_now(), expire_room);
+    grow_rooms();
+    name_index_init(&room_index, room_capacity, room_key);
+
+    /* Create default "lobby"; the first free slot is always LOBBY_ROOM */
+    create_room("lobby");
+    dir_pin_room("lobby");
+}
 
 /**
- * @brief Reliable send function to ensure all bytes are transmitted.
+ * @brief Claims a free client slot for a newly accepted socket.
  *
  * @param fd Socket file descriptor.
- * @param buf Buffer containing data to send.
- * @param len Length of data to send.
- * @return 0 on success, -1 on failure.
+ * @param addr Peer address, or NULL.
+ * @return Index of the new client, or -1 if the server is full.
  */
-int send_all(int fd, const char *buf, size_t len) {
-    size_t total_sent = 0;
-    size_t bytes_left = len;
-    ssize_t n;
+int add_client(int fd, const struct sockaddr_in *addr) {
+    int client_idx;
 
-    while (total_sent < len) {
-        n = send(fd, buf + total_sent, bytes_left, 0);
-        if (n == -1) {
-            return -1;
-        }
-        total_sent += n;
-        bytes_left -= n;
+    if (fd < 0 || reserve_fd_slot(fd) < 0) return -1;
+
+    /* max_clients is server-wide; each shard's table may grow up to it */
+    if (__atomic_add_fetch(&connected_clients, 1, __ATOMIC_RELAXED) > max_clients ||
+        (free_client_count == 0 && grow_clients() < 0)) {
+        __atomic_sub_fetch(&connected_clients, 1, __ATOMIC_RELAXED);
+        return -1;
     }
-    return 0;
+
+    client_idx = free_clients[--free_client_count];
+    client_fds[client_idx] = fd;
+    client_ids[client_idx] = __atomic_add_fetch(&last_client_id, 1, __ATOMIC_RELAXED);
+    if (addr) {
+        clients[client_idx].addr = *addr;
+    } else {
+        memset(&clients[client_idx].addr, 0, sizeof(clients[client_idx].addr));
+    }
+    fd_clients[fd] = client_idx;
+    update_client_activity(client_idx);
+    stats_add(STAT_CLIENTS, 1);
+    return client_idx;
 }
 
 /**
- * @brief Helper to send a null-terminated string to a client.
+ * @brief Returns a client slot to the free list.
  *
- * @param client_fd Client socket file descriptor.
- * @param msg The message string.
+ * @param client_idx Index of the client.
  */
-void send_message(int client_fd, const char *msg) {
-    size_t len = strlen(msg);
-    if (send_all(client_fd, msg, len) == -1) {
-        perror("send_all failed");
+static void release_client(int client_idx) {
+    int fd = client_fds[client_idx];
+
+    if (fd >= 0 && fd < fd_capacity && fd_clients[fd] == client_idx) {
+        fd_clients[fd] = -1;
     }
+    timer_cancel(&client_timers, client_idx);
+    reset_client(client_idx);
+    free_clients[free_client_count++] = client_idx;
 }
 
 /**
- * @brief Broadcasts a message to all users in a specific room.
+ * @brief Closes a detached client's socket and frees its slot.
  *
- * @param room Name of the room.
- * @param msg Message content.
- * @param exclude_fd File descriptor to exclude from broadcast (e.g., sender), or -1.
+ * @param client_idx Index of the client.
  */
-void broadcast_to_room(const char *room, const char *msg, int exclude_fd) {
-    int i;
-    for (i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].fd > 0 && clients[i].fd != exclude_fd &&
-            strcmp(clients[i].current_room, room) == 0) {
-            send_message(clients[i].fd, msg);
+static void finish_disconnect(int client_idx) {
+    io_close_fd(client_fds[client_idx]);
+    release_client(client_idx);
+}
+
+/* --- Helpers --- */
+
+/** @brief Clock state refreshed by clock_tick(). */
+static __thread int clock_ready = 0;
+static __thread time_t cached_wall = 0;
+static __thread time_t cached_mono = 0;
+static __thread char cached_timestamp[sizeof("HH:MM:SS")];
+
+/**
+ * @brief Reads the clock once for the current loop iteration.
+ *
+ * The HH:MM:SS string is only re-rendered when the wall-clock second
+ * changes, so localtime()/strftime() run at most once per second.
+ */
+void clock_tick(void) {
+    struct timespec ts;
+    time_t wall = time(NULL);
+    struct tm t;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        cached_mono = ts.tv_sec;
+    } else {
+        cached_mono = wall;
+    }
+
+    if (!clock_ready || wall != cached_wall) {
+        cached_wall = wall;
+        if (localtime_r(&wall, &t)) {
+            strftime(cached_timestamp, sizeof(cached_timestamp), "%H:%M:%S", &t);
         }
     }
+    clock_ready = 1;
 }
 
-/* --- History --- */
+/**
+ * @brief Tells whether this shard's loop lags past a shedding threshold.
+ *
+ * @param limit_ms Threshold in milliseconds, 0 to never shed.
+ * @return 1 if over the threshold, 0 otherwise.
+ */
+int loop_overloaded(int limit_ms) {
+    return limit_ms > 0 && loop_lag >= (unsigned long)limit_ms * 1000000UL;
+}
 
 /**
- * @brief Adds a message to the circular history buffer of a room.
+ * @brief Returns the monotonic time read by the last clock_tick().
  *
- * @param room_name Name of the room.
- * @param message The message string to store.
+ * @return Seconds on the monotonic clock.
+ */
+time_t clock_now(void) {
+    if (!clock_ready) clock_tick();
+    return cached_mono;
+}
+
+/**
+ * @brief Copies the cached current timestamp string.
+ *
+ * @param buffer Buffer to store the timestamp string.
+ * @param size Size of the buffer.
  */
-void add_message_to_history(const char *room_name, const char *message) {
-    int room_idx = find_room(room_name);
-    MessageHistory *hist;
+void get_timestamp(char *buffer, size_t size) {
+    if (size == 0) return;
+    if (!clock_ready) clock_tick();
 
-    if (room_idx < 0) return;
+    if (size > sizeof(cached_timestamp)) size = sizeof(cached_timestamp);
+    memcpy(buffer, cached_timestamp, size);
+    buffer[size - 1] = '\0';
+}
+
+/**
+ * @brief Finds a client index by their socket file descriptor.
+ *
+ * @param fd The file descriptor to search for.
+ * @return Index in clients array, or -1 if not found.
+ */
+int find_client_by_fd(int fd) {
+    if (fd < 0 || fd >= fd_capacity) return -1;
+    return fd_clients[fd];
+}
+
+/**
+ * @brief Finds a client index by their username.
+ *
+ * @param username The username string to search for.
+ * @return Index in clients array, or -1 if not found.
+ */
+int find_client_by_username(const char *username) {
+    return name_index_find(&username_index, username);
+}
+
+/**
+ * @brief Finds a room index by its name.
+ *
+ * @param name The name of the room.
+ * @return Index in rooms array, or -1 if not found/inactive.
+ */
+int find_room(const char *name) {
+    return name_index_find(&room_index, name);
+}
+
+/**
+ * @brief Sets one room's history limits.
+ *
+ * @param room Room name.
+ * @param max_messages Messages kept.
+ * @param max_bytes Byte budget, or 0 for the default.
+ * @return 0 on success, -1 on an invalid name or a full table.
+ */
+int set_room_history_limits(const char *room, int max_messages, size_t max_bytes) {
+    RoomHistoryLimits *limits = NULL;
+    int i;
+
+    if (room[0] == '\0' || strlen(room) >= MAX_ROOMNAME || max_messages < 1) return -1;
 
-    hist = &rooms[room_idx].history;
+    for (i = 0; i < room_history_limit_count && !limits; i++) {
+        if (strcmp(room_history_limits[i].room, room) == 0) {
+            limits = &room_history_limits[i];
+        }
+    }
+    if (!limits) {
+        if (room_history_limit_count == ROOM_HISTORY_LIMITS) return -1;
+        limits = &room_history_limits[room_history_limit_count++];
+        snprintf(limits->room, sizeof(limits->room), "%s", room);
+    }
+    limits->max_messages = max_messages;
+    limits->max_bytes = max_bytes;
+    return 0;
+}
 
-    strncpy(hist->messages[hist->head], message, BUFFER_SIZE - 1);
-    hist->messages[hist->head][BUFFER_SIZE - 1] = '\0';
+/**
+ * @brief Starts a new room's history with its own limits or the defaults.
+ *
+ * @param room_idx Index of the room, already named.
+ */
+static void init_room_history(int room_idx) {
+    int max_messages = history_max_messages;
+    size_t max_bytes = history_max_bytes;
+    int i;
 
-    hist->head = (hist->head + 1) % MAX_HISTORY;
-    if (hist->count < MAX_HISTORY) {
-        hist->count++;
+    for (i = 0; i < room_history_limit_count; i++) {
+        if (strcmp(room_history_limits[i].room, rooms[room_idx].name) == 0) {
+            max_messages = room_history_limits[i].max_messages;
+            if (room_history_limits[i].max_bytes > 0) {
+                max_bytes = room_history_limits[i].max_bytes;
+            }
+            break;
+        }
     }
+    history_init(&rooms[room_idx].history, max_messages, max_bytes);
 }
 
 /**
- * @brief Sends the recent chat history of a room to a specific client.
+ * @brief Creates a new room if space is available.
  *
- * @param client_idx Index of the client receiving history.
- * @param room_name Name of the room.
+ * @param name The name of the new room.
+ * @return Index of the new room, or -1 if full or exists.
  */
-void send_room_history(int client_idx, const char *room_name) {
-    int room_idx = find_room(room_name);
-    MessageHistory *hist;
-    int start, i;
+int create_room(const char *name) {
+    int i;
+    if (find_room(name) >= 0) return -1;
 
-    if (room_idx < 0) return;
+    if (free_room_count == 0 && grow_rooms() < 0) return -1;
 
-    hist = &rooms[room_idx].history;
+    i = free_rooms[free_room_count - 1];
+    strncpy(rooms[i].name, name, MAX_ROOMNAME - 1);
+    rooms[i].name[MAX_ROOMNAME - 1] = '\0';
+    if (name_index_insert(&room_index, rooms[i].name, i) < 0) {
+        rooms[i].name[0] = '\0';
+        return -1;
+    }
+    free_room_count--;
+    rooms[i].active = 1;
+    init_room_history(i);
 
-    if (hist->count == 0) {
-        return;
+    /* Empty from the start: retired unless someone joins in time */
+    room_emptied(i);
+    return i;
+}
+
+/**
+ * @brief Moves a client from its current room into another one.
+ *
+ * @param client_idx Index of the client.
+ * @param room_idx Index of the target room, or -1 to leave.
+ * @return 0 on success, -1 on allocation failure or at the room limit.
+ */
+int set_client_room(int client_idx, int room_idx) {
+    Client *c = &clients[client_idx];
+    Room *room = room_idx >= 0 ? &rooms[room_idx] : NULL;
+    Room *old;
+    int moved;
+
+    if (room && room->member_count == room->member_cap) {
+        int new_cap = room->member_cap ? room->member_cap * 2 : 8;
+        int *new_members = realloc(room->members, new_cap * sizeof(*new_members));
+        if (!new_members) return -1;
+        room->members = new_members;
+        room->member_cap = new_cap;
     }
 
-    send_message(clients[client_idx].fd, COLOR_SYSTEM "[SERVER] --- Recent messages ---" COLOR_RESET "\n");
+    /* The bitmap covers the whole client table, which may have grown */
+    if (room && client_idx / MEMBER_WORD_BITS >= room->member_words) {
+        int words = (client_capacity + MEMBER_WORD_BITS - 1) / MEMBER_WORD_BITS;
+        unsigned long *new_bits = realloc(room->member_bits, words * sizeof(*new_bits));
+        if (!new_bits) return -1;
+        memset(new_bits + room->member_words, 0, (words - room->member_words) * sizeof(*new_bits));
+        room->member_bits = new_bits;
+        room->member_words = words;
+    }
 
-    start = (hist->head - hist->count + MAX_HISTORY) % MAX_HISTORY;
-    for (i = 0; i < hist->count; i++) {
-        int idx = (start + i) % MAX_HISTORY;
-        send_message(clients[client_idx].fd, hist->messages[idx]);
+    /* The directory may refuse a room that is new server-wide; nothing has moved yet */
+    if (dir_move_user(c->username, client_rooms[client_idx] >= 0 ? rooms[client_rooms[client_idx]].name : NULL,
+                      room ? room->name : NULL, max_rooms) < 0) {
+        return -1;
+    }
+
+    if (client_rooms[client_idx] >= 0) {
+        /* Swap-remove: the last member takes our slot */
+        old = &rooms[client_rooms[client_idx]];
+        moved = old->members[--old->member_count];
+        old->members[c->room_slot] = moved;
+        clients[moved].room_slot = c->room_slot;
+        old->member_bits[client_idx / MEMBER_WORD_BITS] &= ~(1UL << (client_idx % MEMBER_WORD_BITS));
+        if (old->member_count == 0) {
+            room_emptied(client_rooms[client_idx]);
+        }
+        client_rooms[client_idx] = -1;
+        c->room_slot = -1;
+    }
+
+    if (!room) return 0;
+
+    if (room->member_count == 0) {
+        timer_cancel(&room_timers, room_idx);
+    }
+    client_rooms[client_idx] = room_idx;
+    c->room_slot = room->member_count;
+    room->members[room->member_count++] = client_idx;
+    room->member_bits[client_idx / MEMBER_WORD_BITS] |= 1UL << (client_idx % MEMBER_WORD_BITS);
+    return 0;
+}
+
+/* --- Networking --- */
+
+/**
+ * @brief Sends without blocking, retrying on EINTR.
+ *
+ * @param fd Socket file descriptor.
+ * @param buf Data to send.
+ * @param len Length of data.
+ * @return Bytes written (0 if the socket is full), or -1 on socket error.
+ */
+static ssize_t send_nonblocking(int fd, const char *buf, size_t len) {
+    ssize_t n;
+
+    do {
+        n = send(fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    return n;
+}
+
+/**
+ * @brief Marks a client for flush_pending_output().
+ *
+ * The flag is left alone by reset_client(), so a slot that is reused while
+ * still listed is not listed twice.
+ *
+ * @param client_idx Index of the client.
+ */
+static void request_flush(int client_idx) {
+    if (clients[client_idx].flush_queued) return;
+
+    clients[client_idx].flush_queued = 1;
+    flush_list[flush_count++] = client_idx;
+}
+
+/**
+ * @brief Sends or queues bytes for a client.
+ *
+ * Shared by queue_output() and queue_msgbuf(): the bytes come from `buf`
+ * when one is given, otherwise from `data`, which is copied into a new
+ * buffer only if the socket does not take it all right away.
+ *
+ * @param client_idx Index of the client.
+ * @param data Bytes to send.
+ * @param len Number of bytes.
+ * @param buf Shared buffer holding `data`, or NULL.
+ * @return 0 if sent or queued, -1 if dropped.
+ */
+static int enqueue_output(int client_idx, const char *data, size_t len, MsgBuf *buf) {
+    Client *c = &clients[client_idx];
+    int fd = client_fds[client_idx];
+    size_t before = c->out.bytes;
+    ssize_t n = 0;
+    int rc;
+
+    if (fd < 0 || (client_flags[client_idx] & CLIENT_CLOSING)) return -1;
+
+    /* Fast path: nothing pending, so the socket may take it right away */
+    if (c->out.bytes == 0 && !io_completion_mode()) {
+        n = send_nonblocking(fd, data, len);
+        if (n < 0) {
+            schedule_disconnect(client_idx);
+            return -1;
+        }
+        if ((size_t)n == len) {
+            stats_add(STAT_MESSAGES_OUT, 1);
+            stats_add(STAT_BYTES_OUT, (long)len);
+            return 0;
+        }
+    }
+
+    /*
+     * A partially written message is always finished, or the stream would be
+     * corrupted. In completion mode the queue also holds this iteration's
+     * output, which the kernel has not been offered yet; the reader only
+     * counts as stalled once a send stayed pending through a whole round.
+     */
+    if (n == 0 && c->out.bytes + len > output_queue_limit &&
+        (!io_completion_mode() || (c->send_inflight && flush_round - c->send_round >= 2))) {
+        stats_add(STAT_DROPPED, 1);
+        if (slow_client_policy == SLOW_CLIENT_DROP) {
+            return -1;
+        }
+        printf("Slow consumer: %s (%lu bytes queued), disconnecting\n",
+               c->username[0] ? c->username : "unnamed", (unsigned long)c->out.bytes);
+        schedule_disconnect(client_idx);
+        return -1;
+    }
+
+    if (buf) {
+        rc = outq_push(&c->out, buf, (size_t)n);
+    } else {
+        buf = msgbuf_new(data + n, len - n);
+        rc = buf ? outq_push(&c->out, buf, 0) : -1;
+        msgbuf_unref(buf);
+    }
+    if (rc < 0) {
+        schedule_disconnect(client_idx);
+        return -1;
+    }
+    account_queue(before, c->out.bytes);
+    stats_add(STAT_MESSAGES_OUT, 1);
+    stats_add(STAT_BYTES_OUT, (long)len);
+
+    if (io_completion_mode()) {
+        request_flush(client_idx);
+    } else if (c->out.count == 1) {
+        io_watch_write(fd, 1);
+    }
+    return 0;
+}
+
+/**
+ * @brief Queues bytes for a client, writing directly when possible.
+ *
+ * @param client_idx Index of the client.
+ * @param data Bytes to send.
+ * @param len Number of bytes.
+ * @return 0 if sent or queued, -1 if dropped.
+ */
+int queue_output(int client_idx, const char *data, size_t len) {
+    return enqueue_output(client_idx, data, len, NULL);
+}
+
+/**
+ * @brief Queues a reference to a shared buffer for a client.
+ *
+ * @param client_idx Index of the client.
+ * @param buf Buffer to send.
+ * @return 0 if sent or queued, -1 if dropped.
+ */
+int queue_msgbuf(int client_idx, MsgBuf *buf) {
+    return enqueue_output(client_idx, buf->data, buf->len, buf);
+}
+
+/**
+ * @brief Writes queued output until the queue is empty or the socket is full.
+ *
+ * @param client_idx Index of the client.
+ * @return 0 if the queue is empty, 1 if data remains, -1 on socket error.
+ */
+int flush_client_output(int client_idx) {
+    int fd = client_fds[client_idx];
+    size_t before = clients[client_idx].out.bytes;
+    int rc = outq_flush(&clients[client_idx].out, fd);
+
+    account_queue(before, clients[client_idx].out.bytes);
+    if (rc < 0) {
+        schedule_disconnect(client_idx);
+        return -1;
+    }
+    if (rc == 0) {
+        io_watch_write(fd, 0);
+    }
+    return rc;
+}
+
+/**
+ * @brief Hands a client's queued output to the completion backend.
+ *
+ * @param client_idx Index of the client.
+ */
+static void submit_client_output(int client_idx) {
+    Client *c = &clients[client_idx];
+    int fd = client_fds[client_idx];
+    MsgBuf *bufs[IO_SEND_MAX_BUFS];
+    int count;
+
+    if (fd < 0 || c->send_inflight || c->out.count == 0) return;
+
+    /* One submission should carry the whole backlog; on failure it just sends less */
+    outq_flatten(&c->out, IO_SEND_MAX_BUFS);
+    count = outq_peek(&c->out, bufs, IO_SEND_MAX_BUFS);
+    if (io_send(fd, bufs, count, c->out.offset) < 0) {
+        schedule_disconnect(client_idx);
+        return;
+    }
+    c->send_inflight = 1;
+    c->send_round = flush_round;
+}
+
+/**
+ * @brief Submits the output queued during this iteration (completion mode).
+ *
+ * Each client gets at most one send in flight covering everything it has
+ * queued, so a burst of broadcasts costs one submission per recipient.
+ */
+void flush_pending_output(void) {
+    int i, idx;
+
+    for (i = 0; i < flush_count; i++) {
+        idx = flush_list[i];
+        clients[idx].flush_queued = 0;
+        if (!(client_flags[idx] & CLIENT_CLOSING)) {
+            submit_client_output(idx);
+        }
+    }
+    flush_count = 0;
+    flush_round++;
+}
+
+/**
+ * @brief Accounts for a send completed by the backend (completion mode).
+ *
+ * @param client_idx Index of the client.
+ * @param result Bytes written, or -errno.
+ */
+void complete_client_output(int client_idx, int result) {
+    Client *c = &clients[client_idx];
+    size_t before;
+
+    c->send_inflight = 0;
+    if (result < 0) {
+        if ((client_flags[client_idx] & CLIENT_DRAINING)) {
+            finish_disconnect(client_idx);
+        } else {
+            schedule_disconnect(client_idx);
+        }
+        return;
+    }
+
+    before = c->out.bytes;
+    outq_consume(&c->out, (size_t)result);
+    account_queue(before, c->out.bytes);
+    if ((client_flags[client_idx] & CLIENT_DRAINING)) {
+        /* Already disconnected: send what is left, then close */
+        submit_client_output(client_idx);
+        if (!c->send_inflight) {
+            finish_disconnect(client_idx);
+        }
+    } else if (c->out.count > 0) {
+        request_flush(client_idx);
+    }
+}
+
+/**
+ * @brief Marks a client to be disconnected once the current iteration ends.
+ *
+ * @param client_idx Index of the client.
+ */
+void schedule_disconnect(int client_idx) {
+    int i, kept;
+
+    if ((client_flags[client_idx] & CLIENT_CLOSING) || client_fds[client_idx] < 0) return;
+
+    if (pending_close_count == client_capacity) {
+        /* Drop entries whose clients were already disconnected directly */
+        kept = 0;
+        for (i = 0; i < pending_close_count; i++) {
+            if ((client_flags[pending_close[i]] & CLIENT_CLOSING)) {
+                pending_close[kept++] = pending_close[i];
+            }
+        }
+        pending_close_count = kept;
+    }
+
+    client_flags[client_idx] |= CLIENT_CLOSING;
+    pending_close[pending_close_count++] = client_idx;
+}
+
+/**
+ * @brief Disconnects every client scheduled with schedule_disconnect().
+ *
+ * Disconnect notices may fail and schedule further clients, so the list is
+ * processed until it is empty.
+ */
+void process_pending_disconnects(void) {
+    int idx;
+
+    while (pending_close_count > 0) {
+        idx = pending_close[--pending_close_count];
+        /* The slot may have been freed and reused since it was scheduled */
+        if ((client_flags[idx] & CLIENT_CLOSING)) {
+            handle_disconnect(idx);
+        }
+    }
+}
+
+/**
+ * @brief Helper to queue a null-terminated string for a client.
+ *
+ * @param client_fd Client socket file descriptor.
+ * @param msg The message string.
+ */
+void send_message(int client_fd, const char *msg) {
+    int client_idx = find_client_by_fd(client_fd);
+
+    if (client_idx < 0) return;
+    queue_output(client_idx, msg, strlen(msg));
+}
+
+/**
+ * @brief Queues a shared buffer for the local members of a room.
+ *
+ * Dense rooms are walked a bitmap word at a time, taking the set bits with
+ * count-trailing-zeros; the excluded member is masked out of its word up
+ * front. Rooms with fewer members than bitmap words walk the member list.
+ * Members with any of skip_flags set are left out (chat passes 0).
+ *
+ * @param room The room.
+ * @param buf Message.
+ * @param exclude_idx Index of a client to skip, or -1.
+ * @param skip_flags CLIENT_* flags of members to skip.
+ */
+static void deliver_to_room(const Room *room, MsgBuf *buf, int exclude_idx, unsigned char skip_flags) {
+    int exclude_word = exclude_idx >= 0 ? exclude_idx / MEMBER_WORD_BITS : -1;
+    unsigned long exclude_mask = exclude_idx >= 0 ? 1UL << (exclude_idx % MEMBER_WORD_BITS) : 0;
+    unsigned long word;
+    int recipients = 0;
+    int w;
+    int i;
+
+    if (room->member_count < room->member_words) {
+        for (i = 0; i < room->member_count; i++) {
+            if (room->members[i] != exclude_idx && !(client_flags[room->members[i]] & skip_flags)) {
+                queue_msgbuf(room->members[i], buf);
+                recipients++;
+            }
+        }
+        stats_fanout(recipients);
+        return;
+    }
+
+    for (w = 0; w < room->member_words; w++) {
+        word = room->member_bits[w];
+        if (w == exclude_word) word &= ~exclude_mask;
+
+        recipients += __builtin_popcountl(word);
+        while (word) {
+            i = w * MEMBER_WORD_BITS + __builtin_ctzl(word);
+            word &= word - 1;
+            if (skip_flags && (client_flags[i] & skip_flags)) {
+                recipients--;
+                continue;
+            }
+            queue_msgbuf(i, buf);
+        }
+    }
+    stats_fanout(recipients);
+}
+
+/**
+ * @brief Delivers a room message on this shard and posts it to the others.
+ *
+ * @param room_idx Index of the room, or -1.
+ * @param msg Message content.
+ * @param exclude_fd File descriptor to exclude (e.g., sender), or -1.
+ * @param record Flag: also append it to the room's history on every shard.
+ */
+static void publish_to_room(int room_idx, const char *msg, int exclude_fd, int record) {
+    size_t len = strlen(msg);
+    MsgBuf *buf;
+
+    if (room_idx < 0) return;
+
+    if (record) {
+        add_message_to_history(room_idx, msg);
+    }
+
+    /*
+     * One shared copy; members that cannot take it right away queue a
+     * reference. The NUL kept past len lets other shards record it.
+     */
+    buf = msgbuf_alloc(len + 1);
+    if (!buf) return;
+    memcpy(buf->data, msg, len + 1);
+    buf->len = len;
+
+    deliver_to_room(&rooms[room_idx], buf, exclude_fd >= 0 ? find_client_by_fd(exclude_fd) : -1, 0);
+    if (shard_count > 1) {
+        shard_post_room(rooms[room_idx].name, buf, record, -1, 0);
+    }
+    msgbuf_unref(buf);
+}
+
+/**
+ * @brief Broadcasts a message to all users in a specific room.
+ *
+ * Only the room's members are visited; members on other shards are reached
+ * through their shard's inbox.
+ *
+ * @param room_idx Index of the room.
+ * @param msg Message content.
+ * @param exclude_fd File descriptor to exclude from broadcast (e.g., sender), or -1.
+ */
+void broadcast_to_room(int room_idx, const char *msg, int exclude_fd) {
+    publish_to_room(room_idx, msg, exclude_fd, 0);
+}
+
+/**
+ * @brief Returns when a typing round that includes `now` ends.
+ *
+ * Rounds end on multiples of typing_interval, the same instants on every
+ * shard.
+ *
+ * @param now Monotonic seconds.
+ * @return End of the round.
+ */
+static time_t typing_round_end(time_t now) {
+    return typing_interval > 0 ? now - now % typing_interval + typing_interval : now;
+}
+
+/**
+ * @brief Counts a typer towards a room's next notice and lists the room for flush_typing().
+ *
+ * @param room_idx Index of the room.
+ * @param name The typer's name.
+ * @param client The typer's client slot (on whichever shard it is).
+ * @param client_id Its connection id.
+ */
+static void add_typer(int room_idx, const char *name, int client, unsigned long client_id) {
+    Room *room = &rooms[room_idx];
+
+    if (room->typing_count == 0) {
+        room->typing_client = client;
+        room->typing_client_id = client_id;
+    }
+    if (room->typing_count < TYPING_NAMES) {
+        snprintf(room->typing_names[room->typing_count], MAX_USERNAME, "%s", name);
+    }
+    room->typing_count++;
+
+    if (!room->typing_queued) {
+        /*
+         * A round that ran out while no one typed would end right away and
+         * split typers who started together, some of them still on their
+         * way from other shards; the first typer starts a fresh one.
+         */
+        if (typing_room_count == 0) {
+            typing_due = typing_round_end(clock_now());
+        }
+        room->typing_queued = 1;
+        typing_rooms[typing_room_count++] = room_idx;
+    }
+}
+
+/**
+ * @brief Delivers the messages other shards and workers posted to this one.
+ *
+ * Room messages reach the local members; recorded ones also go into the
+ * local copy of the room's history, which is created on first use so that
+ * every shard can replay it to clients joining later. Typers in a room whose
+ * notices this shard renders count towards its next notice.
+ */
+void process_shard_inbox(void) {
+    ShardMsg *msg = shard_take();
+    ShardMsg *next;
+    char name[MAX_USERNAME];
+    size_t len;
+    int idx;
+    int exclude;
+
+    for (; msg; msg = next) {
+        next = msg->next;
+
+        if (msg->kind == SHARD_MSG_USER) {
+            idx = find_client_by_username(msg->target);
+            if (idx >= 0) {
+                queue_msgbuf(idx, msg->buf);
+            }
+        } else if (msg->kind == SHARD_MSG_CLIENT) {
+            idx = msg->client;
+            if (idx >= 0 && idx < client_capacity && client_ids[idx] == msg->client_id) {
+                queue_msgbuf(idx, msg->buf);
+            }
+        } else if (msg->kind == SHARD_MSG_TYPING) {
+            idx = find_room(msg->target);
+            if (idx >= 0) {
+                exclude = msg->client >= 0 && msg->client < client_capacity &&
+                          client_ids[msg->client] == msg->client_id ? msg->client : -1;
+                deliver_to_room(&rooms[idx], msg->buf, exclude, CLIENT_NO_TYPING);
+            }
+        } else if (msg->kind == SHARD_MSG_TYPER) {
+            /* This shard renders the room's notices, with or without members here */
+            idx = find_room(msg->target);
+            if (idx < 0) {
+                idx = create_room(msg->target);
+            }
+            if (idx >= 0) {
+                len = msg->buf->len < MAX_USERNAME ? msg->buf->len : MAX_USERNAME - 1;
+                memcpy(name, msg->buf->data, len);
+                name[len] = '\0';
+                add_typer(idx, name, msg->client, msg->client_id);
+            }
+        } else {
+            idx = find_room(msg->target);
+            if (idx < 0 && msg->record) {
+                idx = create_room(msg->target);
+            }
+            if (idx >= 0) {
+                if (msg->record) {
+                    add_message_to_history(idx, msg->buf->data);
+                }
+                /* The id tells whether the slot to skip is on this shard */
+                exclude = msg->client >= 0 && msg->client < client_capacity &&
+                          client_ids[msg->client] == msg->client_id ? msg->client : -1;
+                deliver_to_room(&rooms[idx], msg->buf, exclude, 0);
+            }
+        }
+        shard_msg_free(msg);
+    }
+}
+
+/* --- History --- */
+
+/**
+ * @brief Adds a message to the circular history buffer of a room.
+ *
+ * @param room_idx Index of the room.
+ * @param message The message string to store.
+ */
+void add_message_to_history(int room_idx, const char *message) {
+    if (room_idx < 0) return;
+
+    history_add(&rooms[room_idx].history, message);
+    msgbuf_unref(rooms[room_idx].replay);
+    rooms[room_idx].replay = NULL;
+}
+
+/** @brief Framing around a history replay. */
+static const char HISTORY_HEADER[] = COLOR_SYSTEM "[SERVER] --- Recent messages ---" COLOR_RESET "\n";
+static const char HISTORY_FOOTER[] = COLOR_SYSTEM "[SERVER] --- End of history ---" COLOR_RESET "\n";
+
+/**
+ * @brief Assembles a room's history replay into one contiguous buffer.
+ *
+ * @param room Room whose history is non-empty.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int build_replay(Room *room) {
+    HistoryIter it;
+    const char *message;
+    size_t len;
+    size_t total = sizeof(HISTORY_HEADER) - 1 + sizeof(HISTORY_FOOTER) - 1;
+    char *out;
+
+    history_iter_init(&room->history, &it);
+    while (history_iter_next(&room->history, &it, &len) != NULL) {
+        total += len;
+    }
+
+    room->replay = msgbuf_alloc(total);
+    if (!room->replay) return -1;
+
+    out = room->replay->data;
+    memcpy(out, HISTORY_HEADER, sizeof(HISTORY_HEADER) - 1);
+    out += sizeof(HISTORY_HEADER) - 1;
+
+    history_iter_init(&room->history, &it);
+    while ((message = history_iter_next(&room->history, &it, &len)) != NULL) {
+        memcpy(out, message, len);
+        out += len;
+    }
+
+    memcpy(out, HISTORY_FOOTER, sizeof(HISTORY_FOOTER) - 1);
+    return 0;
+}
+
+/**
+ * @brief Lists a client for replay_postponed_history().
+ *
+ * The flag is cleared by reset_client(), so a reused slot can be listed
+ * twice; a full list is compacted, keeping one entry per flagged client.
+ *
+ * @param client_idx Index of the client.
+ */
+static void postpone_replay(int client_idx) {
+    int i, kept;
+
+    if ((client_flags[client_idx] & CLIENT_REPLAY)) return;
+
+    if (replay_count == client_capacity) {
+        kept = 0;
+        for (i = 0; i < replay_count; i++) {
+            if ((client_flags[replay_list[i]] & CLIENT_REPLAY)) {
+                client_flags[replay_list[i]] &= ~CLIENT_REPLAY;
+                replay_list[kept++] = replay_list[i];
+            }
+        }
+        for (i = 0; i < kept; i++) {
+            client_flags[replay_list[i]] |= CLIENT_REPLAY;
+        }
+        replay_count = kept;
+    }
+
+    client_flags[client_idx] |= CLIENT_REPLAY;
+    replay_list[replay_count++] = client_idx;
+    stats_add(STAT_POSTPONED_REPLAYS, 1);
+}
+
+/**
+ * @brief Sends the postponed replays once the loop has caught up.
+ *
+ * A client that changed rooms meanwhile gets its current room's history.
+ */
+void replay_postponed_history(void) {
+    int idx;
+
+    if (replay_count == 0 || loop_overloaded(shed_history)) return;
+
+    while (replay_count > 0) {
+        idx = replay_list[--replay_count];
+        if ((client_flags[idx] & CLIENT_REPLAY)) {
+            client_flags[idx] &= ~CLIENT_REPLAY;
+            if (!(client_flags[idx] & CLIENT_CLOSING)) {
+                send_room_history(idx, client_rooms[idx]);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Sends the recent chat history of a room to a specific client in one write.
+ *
+ * @param client_idx Index of the client receiving history.
+ * @param room_idx Index of the room.
+ */
+void send_room_history(int client_idx, int room_idx) {
+    Room *room;
+
+    if (room_idx < 0) return;
+
+    room = &rooms[room_idx];
+
+    if (room->history.count == 0) {
+        return;
+    }
+
+    if (loop_overloaded(shed_history)) {
+        postpone_replay(client_idx);
+        return;
+    }
+
+    /* Rebuilt once per change, then shared by every join until the next message */
+    if (!room->replay && build_replay(room) < 0) {
+        return;
+    }
+
+    queue_msgbuf(client_idx, room->replay);
+}
+
+/* --- Rendering --- */
+
+/**
+ * @brief Formats a chat line or a membership notice for a room.
+ *
+ * @param msg Output buffer.
+ * @param size Its size.
+ * @param type MSG_CHAT, or the notice: MSG_SETNAME (joined the lobby),
+ *             MSG_JOIN, MSG_LEAVE or MSG_QUIT (disconnected).
+ * @param username The sender or subject.
+ * @param text MSG_CHAT: the message.
+ */
+static void render_room_event(char *msg, size_t size, MessageType type, const char *username, const char *text) {
+    char timestamp[32];
+    const char *user_color = get_user_color(username);
+    const char *action;
+
+    get_timestamp(timestamp, sizeof(timestamp));
+
+    if (type == MSG_CHAT) {
+        snprintf(msg, size, COLOR_TIMESTAMP "[%s]" COLOR_RESET " %s%s" COLOR_RESET ": %s\n",
+                 timestamp, user_color, username, text);
+        return;
+    }
+
+    if (type == MSG_SETNAME) {
+        action = "joined the lobby";
+    } else if (type == MSG_JOIN) {
+        action = "joined the room";
+    } else if (type == MSG_LEAVE) {
+        action = "left the room";
+    } else {
+        action = "disconnected";
+    }
+    snprintf(msg, size, COLOR_TIMESTAMP "[%s]" COLOR_RESET COLOR_ACTION " *** %s%s%s %s ***" COLOR_RESET "\n",
+             timestamp, user_color, username, COLOR_ACTION, action);
+}
+
+/**
+ * @brief Tells whether a room event goes into the room's history.
+ *
+ * @param type Event type (see render_room_event()).
+ * @return 1 for chat lines and join notices, 0 otherwise.
+ */
+static int room_event_recorded(MessageType type) {
+    return type == MSG_CHAT || type == MSG_SETNAME || type == MSG_JOIN;
+}
+
+/**
+ * @brief Tells whether the subject of a room event is left out of its delivery.
+ *
+ * @param type Event type (see render_room_event()).
+ * @return 1 for join and leave notices, 0 otherwise.
+ */
+static int room_event_skips_sender(MessageType type) {
+    return type == MSG_SETNAME || type == MSG_JOIN || type == MSG_LEAVE;
+}
+
+/**
+ * @brief Formats one side of a private message.
+ *
+ * @param msg Output buffer.
+ * @param size Its size.
+ * @param direction "from" for the recipient's copy, "to" for the sender's.
+ * @param peer The other party.
+ * @param content Message content.
+ */
+static void render_private_message(char *msg, size_t size, const char *direction, const char *peer, const char *content) {
+    char timestamp[32];
+
+    get_timestamp(timestamp, sizeof(timestamp));
+    snprintf(msg, size, COLOR_TIMESTAMP "[%s]" COLOR_RESET COLOR_PM " [PM %s %s%s" COLOR_PM "]: " COLOR_RESET "%s\n",
+             timestamp, direction, get_user_color(peer), peer, content);
+}
+
+/**
+ * @brief Entry lines of a listing, collected before it is split into pages.
+ */
+typedef struct {
+    char *text;                 /**< Lines back to back */
+    size_t len;                 /**< Bytes used in text */
+    size_t cap;                 /**< Bytes allocated for text */
+    size_t *ends;               /**< End offset of each line in text */
+    int count;                  /**< Number of lines */
+    int ends_cap;               /**< Entries allocated for ends */
+    int failed;                 /**< Flag: an allocation failed */
+} ListLines;
+
+/**
+ * @brief Appends one line to a listing.
+ *
+ * @param lines The listing.
+ * @param line Line text, newline included.
+ */
+static void add_list_line(ListLines *lines, const char *line) {
+    size_t n = strlen(line);
+    size_t new_cap;
+    char *new_text;
+    size_t *new_ends;
+
+    if (lines->failed) return;
+
+    if (lines->len + n > lines->cap) {
+        new_cap = lines->cap ? lines->cap * 2 : BUFFER_SIZE;
+        while (new_cap < lines->len + n) new_cap *= 2;
+        new_text = realloc(lines->text, new_cap);
+        if (!new_text) {
+            lines->failed = 1;
+            return;
+        }
+        lines->text = new_text;
+        lines->cap = new_cap;
+    }
+    if (lines->count == lines->ends_cap) {
+        new_ends = realloc(lines->ends, (lines->ends_cap ? lines->ends_cap * 2 : LIST_PAGE_LINES) * sizeof(*new_ends));
+        if (!new_ends) {
+            lines->failed = 1;
+            return;
+        }
+        lines->ends = new_ends;
+        lines->ends_cap = lines->ends_cap ? lines->ends_cap * 2 : LIST_PAGE_LINES;
+    }
+
+    memcpy(lines->text + lines->len, line, n);
+    lines->len += n;
+    lines->ends[lines->count++] = lines->len;
+}
+
+/**
+ * @brief Directory callback: adds one /rooms line.
+ *
+ * @param name Room name.
+ * @param members Users in the room on all shards.
+ * @param arg The ListLines being built.
+ */
+static void append_room_line(const char *name, int members, void *arg) {
+    char line[256];
+
+    snprintf(line, sizeof(line), COLOR_INFO "  - %.31s" COLOR_RESET " (%d users)\n", name, members);
+    add_list_line(arg, line);
+}
+
+/**
+ * @brief Directory callback: adds one /users line.
+ *
+ * @param username Name of a room member.
+ * @param arg The ListLines being built.
+ */
+static void append_user_line(const char *username, void *arg) {
+    char line[256];
+
+    snprintf(line, sizeof(line), "  - %s%.31s" COLOR_RESET "\n", get_user_color(username), username);
+    add_list_line(arg, line);
+}
+
+/**
+ * @brief Renders one page of a listing: a title, up to LIST_PAGE_LINES
+ *        lines and, if more follow, how to get the next page.
+ *
+ * @param lines The listing.
+ * @param title Title, e.g. "Available rooms".
+ * @param command Command that shows the listing, for the next-page hint.
+ * @param page Page index, from 0.
+ * @param pages Number of pages.
+ * @return The page, or NULL on allocation failure.
+ */
+static MsgBuf *render_list_page(const ListLines *lines, const char *title, const char *command, int page, int pages) {
+    char header[128];
+    char footer[128];
+    int first = page * LIST_PAGE_LINES;
+    int last = first + LIST_PAGE_LINES < lines->count ? first + LIST_PAGE_LINES : lines->count;
+    size_t start = first > 0 ? lines->ends[first - 1] : 0;
+    size_t body = last > first ? lines->ends[last - 1] - start : 0;
+    size_t header_len;
+    size_t footer_len;
+    MsgBuf *buf;
+
+    if (pages > 1) {
+        snprintf(header, sizeof(header), COLOR_SERVER "[SERVER] %s (page %d of %d):" COLOR_RESET "\n",
+                 title, page + 1, pages);
+    } else {
+        snprintf(header, sizeof(header), COLOR_SERVER "[SERVER] %s:" COLOR_RESET "\n", title);
+    }
+    footer[0] = '\0';
+    if (page + 1 < pages) {
+        snprintf(footer, sizeof(footer), COLOR_SERVER "[SERVER] More: %s %d" COLOR_RESET "\n", command, page + 2);
+    }
+    header_len = strlen(header);
+    footer_len = strlen(footer);
+
+    buf = msgbuf_alloc(header_len + body + footer_len);
+    if (!buf) return NULL;
+    memcpy(buf->data, header, header_len);
+    if (body > 0) memcpy(buf->data + header_len, lines->text + start, body);
+    memcpy(buf->data + header_len + body, footer, footer_len);
+    buf->len = header_len + body + footer_len;
+    return buf;
+}
+
+/**
+ * @brief Returns one page of the /rooms or /users reply.
+ *
+ * Pages come from the directory's cache while nothing has changed; on a
+ * miss the whole listing is rendered once and cached for everyone.
+ *
+ * @param room Room for /users ("" for a client without one), or NULL for /rooms.
+ * @param page Page index, from 0.
+ * @param pages Set to the number of pages.
+ * @return A reference to the page, or NULL if there is no such page or allocation fails.
+ */
+static MsgBuf *listing_page(const char *room, int page, int *pages) {
+    ListLines lines;
+    MsgBuf **rendered;
+    MsgBuf *buf = NULL;
+    unsigned long gen = 0;
+    char title[MAX_ROOMNAME + 16];
+    int i;
+
+    buf = dir_cached_page(room, page, pages);
+    if (buf || *pages > 0) return buf;
+
+    memset(&lines, 0, sizeof(lines));
+    if (!room) {
+        gen = dir_each_room(append_room_line, &lines);
+        snprintf(title, sizeof(title), "Available rooms");
+    } else {
+        if (room[0] != '\0') gen = dir_each_member(room, append_user_line, &lines);
+        snprintf(title, sizeof(title), "Users in '%s'", room);
+    }
+
+    *pages = lines.count > 0 ? (lines.count + LIST_PAGE_LINES - 1) / LIST_PAGE_LINES : 1;
+    rendered = lines.failed ? NULL : calloc(*pages, sizeof(*rendered));
+    if (rendered) {
+        for (i = 0; i < *pages; i++) {
+            rendered[i] = render_list_page(&lines, title, room ? "/users" : "/rooms", i, *pages);
+            if (!rendered[i]) break;
+        }
+        if (i == *pages) {
+            if (gen != 0) dir_cache_pages(room, gen, rendered, *pages);
+            if (page >= 0 && page < *pages) buf = msgbuf_ref(rendered[page]);
+        }
+        for (i = 0; i < *pages; i++) {
+            msgbuf_unref(rendered[i]);
+        }
+        free(rendered);
+    }
+
+    free(lines.text);
+    free(lines.ends);
+    return buf;
+}
+
+/**
+ * @brief Builds the reply to /rooms or /users.
+ *
+ * @param room Room for /users, or NULL for /rooms.
+ * @param arg Page number as typed (from 1), or NULL/"" for the first page.
+ * @return The reply, or NULL on allocation failure.
+ */
+static MsgBuf *render_listing(const char *room, const char *arg) {
+    char msg[128];
+    int page = arg && arg[0] != '\0' ? atoi(arg) : 1;
+    int pages = 0;
+    MsgBuf *buf;
+
+    if (page < 1) {
+        snprintf(msg, sizeof(msg), COLOR_ERROR "[ERROR] Invalid page number." COLOR_RESET "\n");
+        return msgbuf_new(msg, strlen(msg));
+    }
+
+    buf = listing_page(room, page - 1, &pages);
+    if (!buf && pages > 0) {
+        snprintf(msg, sizeof(msg), COLOR_ERROR "[ERROR] No page %d; the last page is %d." COLOR_RESET "\n",
+                 page, pages);
+        return msgbuf_new(msg, strlen(msg));
+    }
+    return buf;
+}
+
+/* --- Worker Jobs --- */
+
+/**
+ * @brief Hands a command to the worker that owns the client's room.
+ *
+ * @param client_idx Index of the client.
+ * @param type Job type (see WorkerJob).
+ * @param room_idx Room the job belongs to, or -1 for none.
+ * @param target MSG_PRIVATE: recipient, otherwise NULL.
+ * @param text Message text, or NULL.
+ */
+static void submit_job(int client_idx, MessageType type, int room_idx, const char *target, const char *text) {
+    WorkerJob job;
+
+    job.type = type;
+    job.shard = shard_id;
+    job.client = client_idx;
+    job.client_id = client_ids[client_idx];
+    memcpy(job.username, clients[client_idx].username, sizeof(job.username));
+    snprintf(job.room, sizeof(job.room), "%s", room_idx >= 0 ? rooms[room_idx].name : "");
+    snprintf(job.target, sizeof(job.target), "%s", target ? target : "");
+    snprintf(job.text, sizeof(job.text), "%s", text ? text : "");
+
+    worker_submit(&job);
+}
+
+/**
+ * @brief Publishes a chat line or membership notice to a room.
+ *
+ * With workers the room's worker renders and publishes it, so it is ordered
+ * with every other line of that room.
+ *
+ * @param client_idx Index of the sender or subject.
+ * @param room_idx Index of the room, or -1 (nothing to do).
+ * @param type Event type (see render_room_event()).
+ * @param text MSG_CHAT: the message, otherwise NULL.
+ */
+static void room_event(int client_idx, int room_idx, MessageType type, const char *text) {
+    char msg[BUFFER_SIZE];
+
+    if (room_idx < 0) return;
+
+    if (worker_count > 0) {
+        submit_job(client_idx, type, room_idx, NULL, text);
+        return;
+    }
+
+    render_room_event(msg, sizeof(msg), type, clients[client_idx].username, text);
+    publish_to_room(room_idx, msg, room_event_skips_sender(type) ? client_fds[client_idx] : -1,
+                    room_event_recorded(type));
+}
+
+/**
+ * @brief Sends a worker's reply to the client that submitted the job.
+ *
+ * @param job The job.
+ * @param msg Null-terminated reply.
+ */
+static void reply_to_job(const WorkerJob *job, const char *msg) {
+    MsgBuf *buf = msgbuf_new(msg, strlen(msg));
+
+    if (!buf) return;
+    shard_post_client(job->shard, job->client, job->client_id, buf);
+    msgbuf_unref(buf);
+}
+
+/**
+ * @brief Worker side of /msg.
+ *
+ * @param job The MSG_PRIVATE job.
+ */
+static void run_private_message(const WorkerJob *job) {
+    char msg[BUFFER_SIZE];
+    int target_shard = dir_find_user(job->target);
+    MsgBuf *buf;
+
+    if (target_shard < 0) {
+        reply_to_job(job, COLOR_ERROR "[ERROR] User not found." COLOR_RESET "\n");
+        return;
+    }
+
+    render_private_message(msg, sizeof(msg), "from", job->username, job->text);
+    buf = msgbuf_new(msg, strlen(msg));
+    if (buf) {
+        shard_post_user(target_shard, job->target, buf);
+        msgbuf_unref(buf);
+    }
+
+    render_private_message(msg, sizeof(msg), "to", job->target, job->text);
+    reply_to_job(job, msg);
+}
+
+/**
+ * @brief Runs one job on a worker thread.
+ *
+ * Only the directory and the inboxes are shared with the reactors, so the
+ * job carries everything else it needs.
+ *
+ * @param job The job.
+ */
+void handle_job(const WorkerJob *job) {
+    char msg[BUFFER_SIZE];
+    MsgBuf *buf;
+    size_t len;
+
+    clock_tick();
+
+    if (job->type == MSG_PRIVATE) {
+        run_private_message(job);
+    } else if (job->type == MSG_LIST_ROOMS || job->type == MSG_LIST_USERS) {
+        buf = render_listing(job->type == MSG_LIST_USERS ? job->room : NULL, job->text);
+        if (!buf) return;
+        shard_post_client(job->shard, job->client, job->client_id, buf);
+        msgbuf_unref(buf);
+    } else {
+        /* Posted to every shard, the sender's included; NUL kept for history */
+        render_room_event(msg, sizeof(msg), job->type, job->username, job->text);
+        len = strlen(msg);
+        buf = msgbuf_alloc(len + 1);
+        if (!buf) return;
+        memcpy(buf->data, msg, len + 1);
+        buf->len = len;
+        if (room_event_skips_sender(job->type)) {
+            shard_post_room(job->room, buf, room_event_recorded(job->type), job->client, job->client_id);
+        } else {
+            shard_post_room(job->room, buf, room_event_recorded(job->type), -1, 0);
+        }
+        msgbuf_unref(buf);
     }
-
-    send_message(clients[client_idx].fd, COLOR_SYSTEM "[SERVER] --- End of history ---" COLOR_RESET "\n");
 }
 
 /* --- Handlers --- */
@@ -259,7 +1911,11 @@ void send_room_history(int client_idx, const char *room_name) {
  * @param client_idx Index of the client.
  */
 void update_client_activity(int client_idx) {
-    clients[client_idx].last_activity = time(NULL);
+    time_t now = clock_now();
+
+    client_last_activity[client_idx] = now;
+    /* Fires once more than idle_timeout seconds have passed */
+    timer_arm(&client_timers, client_idx, (unsigned long)now + idle_timeout + 1);
 }
 
 /**
@@ -270,37 +1926,53 @@ void update_client_activity(int client_idx) {
  */
 void handle_setname(int client_idx, const char *username) {
     char msg[BUFFER_SIZE];
-    char timestamp[32];
+    int rc;
 
     if (strlen(username) == 0 || strlen(username) >= MAX_USERNAME) {
-        send_message(clients[client_idx].fd, COLOR_ERROR "[ERROR] Invalid username length." COLOR_RESET "\n");
+        send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] Invalid username length." COLOR_RESET "\n");
         return;
     }
 
-    if (find_client_by_username(username) >= 0) {
-        send_message(clients[client_idx].fd, COLOR_ERROR "[ERROR] Username already taken." COLOR_RESET "\n");
+    /* Names are unique server-wide, so the claim goes through the shared directory */
+    rc = find_client_by_username(username) >= 0 ? 1 : dir_claim_user(username, shard_id);
+    if (rc > 0) {
+        send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] Username already taken." COLOR_RESET "\n");
         return;
     }
+    if (rc < 0) {
+        send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] Out of memory." COLOR_RESET "\n");
+        return;
+    }
+
+    if (clients[client_idx].username[0] != '\0') {
+        name_index_remove(&username_index, clients[client_idx].username);
+        dir_release_user(clients[client_idx].username);
+    }
 
     strncpy(clients[client_idx].username, username, MAX_USERNAME - 1);
     clients[client_idx].username[MAX_USERNAME - 1] = '\0';
 
-    strncpy(clients[client_idx].current_room, "lobby", MAX_ROOMNAME - 1);
-    clients[client_idx].current_room[MAX_ROOMNAME - 1] = '\0';
+    if (name_index_insert(&username_index, clients[client_idx].username, client_idx) < 0) {
+        dir_release_user(clients[client_idx].username);
+        clients[client_idx].username[0] = '\0';
+        send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] Out of memory." COLOR_RESET "\n");
+        return;
+    }
+
+    if (set_client_room(client_idx, LOBBY_ROOM) < 0) {
+        send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] Out of memory." COLOR_RESET "\n");
+        return;
+    }
 
     update_client_activity(client_idx);
 
     snprintf(msg, sizeof(msg), COLOR_SERVER "[SERVER] Welcome, %s%s%s! You are in 'lobby'. Type /help for commands." COLOR_RESET "\n",
              get_user_color(username), username, COLOR_SERVER);
-    send_message(clients[client_idx].fd, msg);
+    send_message(client_fds[client_idx], msg);
 
-    send_room_history(client_idx, "lobby");
+    send_room_history(client_idx, LOBBY_ROOM);
 
-    get_timestamp(timestamp, sizeof(timestamp));
-    snprintf(msg, sizeof(msg), COLOR_TIMESTAMP "[%s]" COLOR_RESET COLOR_ACTION " *** %s%s%s joined the lobby ***" COLOR_RESET "\n",
-             timestamp, get_user_color(username), username, COLOR_ACTION);
-    broadcast_to_room("lobby", msg, clients[client_idx].fd);
-    add_message_to_history("lobby", msg);
+    room_event(client_idx, LOBBY_ROOM, MSG_SETNAME, NULL);
 }
 
 /**
@@ -310,55 +1982,52 @@ void handle_setname(int client_idx, const char *username) {
  * @param room_name Name of the room to join.
  */
 void handle_join(int client_idx, const char *room_name) {
-    char old_room[MAX_ROOMNAME];
+    int room_idx;
+    int old_room;
     char msg[BUFFER_SIZE];
-    char timestamp[32];
-    const char *user_color;
 
     if (strlen(clients[client_idx].username) == 0) {
-        send_message(clients[client_idx].fd, COLOR_ERROR "[ERROR] Set username first with /name <username>" COLOR_RESET "\n");
+        send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] Set username first with /name <username>" COLOR_RESET "\n");
         return;
     }
 
     if (strlen(room_name) == 0 || strlen(room_name) >= MAX_ROOMNAME) {
-        send_message(clients[client_idx].fd, COLOR_ERROR "[ERROR] Invalid room name." COLOR_RESET "\n");
+        send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] Invalid room name." COLOR_RESET "\n");
         return;
     }
 
     update_client_activity(client_idx);
 
-    if (find_room(room_name) < 0) {
-        if (create_room(room_name) < 0) {
-            send_message(clients[client_idx].fd, COLOR_ERROR "[ERROR] Cannot create room (server full)." COLOR_RESET "\n");
+    room_idx = find_room(room_name);
+    if (room_idx < 0) {
+        room_idx = create_room(room_name);
+        if (room_idx < 0) {
+            /* Rooms in their grace period, or copies of rooms emptied elsewhere, may hold slots */
+            cleanup_empty_rooms();
+            room_idx = create_room(room_name);
+        }
+        if (room_idx < 0) {
+            send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] Cannot create room (server full)." COLOR_RESET "\n");
             return;
         }
     }
 
-    /* Notify old room */
-    strncpy(old_room, clients[client_idx].current_room, MAX_ROOMNAME - 1);
-    old_room[MAX_ROOMNAME - 1] = '\0';
-
-    get_timestamp(timestamp, sizeof(timestamp));
-    user_color = get_user_color(clients[client_idx].username);
-
-    snprintf(msg, sizeof(msg), COLOR_TIMESTAMP "[%s]" COLOR_RESET COLOR_ACTION " *** %s%s%s left the room ***" COLOR_RESET "\n",
-             timestamp, user_color, clients[client_idx].username, COLOR_ACTION);
-    broadcast_to_room(old_room, msg, clients[client_idx].fd);
+    /* Move first: the room limit is server-wide and only checked here */
+    old_room = client_rooms[client_idx];
+    if (set_client_room(client_idx, room_idx) < 0) {
+        send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] Cannot create room (server full)." COLOR_RESET "\n");
+        return;
+    }
 
-    strncpy(clients[client_idx].current_room, room_name, MAX_ROOMNAME - 1);
-    clients[client_idx].current_room[MAX_ROOMNAME - 1] = '\0';
+    /* Notify old room */
+    room_event(client_idx, old_room, MSG_LEAVE, NULL);
 
     snprintf(msg, sizeof(msg), COLOR_SERVER "[SERVER] You joined room '%s'" COLOR_RESET "\n", room_name);
-    send_message(clients[client_idx].fd, msg);
-
-    send_room_history(client_idx, room_name);
+    send_message(client_fds[client_idx], msg);
 
-    snprintf(msg, sizeof(msg), COLOR_TIMESTAMP "[%s]" COLOR_RESET COLOR_ACTION " *** %s%s%s joined the room ***" COLOR_RESET "\n",
-             timestamp, user_color, clients[client_idx].username, COLOR_ACTION);
-    broadcast_to_room(room_name, msg, clients[client_idx].fd);
-    add_message_to_history(room_name, msg);
+    send_room_history(client_idx, room_idx);
 
-    cleanup_empty_rooms();
+    room_event(client_idx, room_idx, MSG_JOIN, NULL);
 }
 
 /**
@@ -371,8 +2040,8 @@ void handle_leave(int client_idx) {
 
     update_client_activity(client_idx);
 
-    if (strcmp(clients[client_idx].current_room, "lobby") == 0) {
-        send_message(clients[client_idx].fd, COLOR_ERROR "[ERROR] You are already in lobby." COLOR_RESET "\n");
+    if (client_rooms[client_idx] == LOBBY_ROOM) {
+        send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] You are already in lobby." COLOR_RESET "\n");
         return;
     }
 
@@ -383,106 +2052,82 @@ void handle_leave(int client_idx) {
 /**
  * @brief Counts the number of users in a specific room.
  *
- * @param room_name Name of the room.
+ * @param room_idx Index of the room.
  * @return Number of users.
  */
-int count_users_in_room(const char *room_name) {
-    int count = 0;
-    int i;
-    for (i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].fd > 0 && strcmp(clients[i].current_room, room_name) == 0) {
-            count++;
-        }
-    }
-    return count;
+int count_users_in_room(int room_idx) {
+    return rooms[room_idx].member_count;
 }
 
 /**
  * @brief Handles the /rooms command to list available rooms.
  *
  * @param client_idx Index of the client.
+ * @param page Page number as typed, or NULL for the first page.
  */
-void handle_list_rooms(int client_idx) {
-    char msg[BUFFER_SIZE];
-    int i;
-    int count;
-    char line[256];
+void handle_list_rooms(int client_idx, const char *page) {
+    MsgBuf *buf;
 
     update_client_activity(client_idx);
 
-    msg[0] = '\0';
-    strncat(msg, COLOR_SERVER "[SERVER] Available rooms:" COLOR_RESET "\n", BUFFER_SIZE - 1);
-
-    for (i = 0; i < MAX_ROOMS; i++) {
-        if (rooms[i].active) {
-            count = count_users_in_room(rooms[i].name);
-            snprintf(line, sizeof(line), COLOR_INFO "  - %.31s" COLOR_RESET " (%d users)\n", rooms[i].name, count);
-
-            if (strlen(msg) + strlen(line) < BUFFER_SIZE) {
-                strcat(msg, line);
-            }
-        }
+    if (worker_count > 0) {
+        submit_job(client_idx, MSG_LIST_ROOMS, client_rooms[client_idx], NULL, page);
+        return;
     }
-    send_message(clients[client_idx].fd, msg);
+
+    buf = render_listing(NULL, page);
+    if (!buf) return;
+    queue_msgbuf(client_idx, buf);
+    msgbuf_unref(buf);
 }
 
 /**
  * @brief Checks for inactive clients and disconnects them.
+ *
+ * Only the timers that are due are visited, so this is cheap enough to call
+ * on every event loop iteration.
  */
 void check_inactive_clients(void) {
-    time_t now = time(NULL);
-    const time_t timeout = 300;
-    int i;
+    timer_wheel_advance(&client_timers, (unsigned long)clock_now());
+}
 
-    for (i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].fd > 0 && clients[i].last_activity > 0) {
-            if (now - clients[i].last_activity > timeout) {
-                printf("Client timeout: %s (inactive for %ld s)\n",
-                       clients[i].username[0] ? clients[i].username : "unnamed",
-                       (long)(now - clients[i].last_activity));
+/**
+ * @brief Retires the rooms whose grace period has run out.
+ *
+ * Only the timers that are due are visited, so a burst of disconnects costs
+ * one timer per emptied room rather than a scan of the table per disconnect.
+ */
+void check_empty_rooms(void) {
+    int room_idx;
 
-                send_message(clients[i].fd, "[SERVER] Disconnected due to inactivity.\n");
-                handle_disconnect(i);
-            }
-        }
+    while (retire_count > 0) {
+        room_idx = retire_list[--retire_count];
+        rooms[room_idx].retire_queued = 0;
+        expire_room(room_idx);
     }
+    timer_wheel_advance(&room_timers, (unsigned long)clock_now());
 }
 
 /**
- * @brief Deactivates empty rooms (except lobby).
+ * @brief Deactivates every empty room (except lobby) right away.
+ *
+ * Ignores grace periods; used when the table is full. A room without local
+ * members is kept while the directory still lists members on other shards,
+ * since its history copy is still needed here.
  */
 void cleanup_empty_rooms(void) {
     int i;
-    for (i = 0; i < MAX_ROOMS; i++) {
+    for (i = 0; i < room_capacity; i++) {
         if (rooms[i].active) {
-            if (strcmp(rooms[i].name, "lobby") == 0) continue;
-
-            if (count_users_in_room(rooms[i].name) == 0) {
-                printf("Cleaning up empty room: '%s'\n", rooms[i].name);
-                rooms[i].active = 0;
-                rooms[i].name[0] = '\0';
-                rooms[i].history.count = 0;
-                rooms[i].history.head = 0;
+            if (i == LOBBY_ROOM) continue;
+
+            if (count_users_in_room(i) == 0 && dir_room_members(rooms[i].name) <= 0) {
+                retire_room(i);
             }
         }
     }
 }
 
-/**
- * @brief Simple hash function for string to integer.
- *
- * @param str The string to hash.
- * @return The hash value.
- */
-unsigned int hash_string(const char *str) {
-    unsigned int hash = 5381;
-    int c;
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + c;
-    }
-    return hash;
-}
-
 /**
  * @brief Gets a consistent color for a username based on hash.
  *
@@ -498,30 +2143,23 @@ const char *get_user_color(const char *username) {
  * @brief Handles the /users command to list users in the current room.
  *
  * @param client_idx Index of the client.
+ * @param page Page number as typed, or NULL for the first page.
  */
-void handle_list_users(int client_idx) {
-    char msg[BUFFER_SIZE];
-    int i;
-    char line[256];
-    const char *user_color;
+void handle_list_users(int client_idx, const char *page) {
+    int room_idx = client_rooms[client_idx];
+    MsgBuf *buf;
 
     update_client_activity(client_idx);
 
-    snprintf(msg, sizeof(msg), COLOR_SERVER "[SERVER] Users in '%s':" COLOR_RESET "\n", clients[client_idx].current_room);
-
-    for (i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].fd > 0 && strlen(clients[i].username) > 0 &&
-            strcmp(clients[i].current_room, clients[client_idx].current_room) == 0) {
-
-            user_color = get_user_color(clients[i].username);
-            snprintf(line, sizeof(line), "  - %s%.31s" COLOR_RESET "\n", user_color, clients[i].username);
-
-            if (strlen(msg) + strlen(line) < BUFFER_SIZE) {
-                strcat(msg, line);
-            }
-        }
+    if (worker_count > 0) {
+        submit_job(client_idx, MSG_LIST_USERS, room_idx, NULL, page);
+        return;
     }
-    send_message(clients[client_idx].fd, msg);
+
+    buf = render_listing(room_idx >= 0 ? rooms[room_idx].name : "", page);
+    if (!buf) return;
+    queue_msgbuf(client_idx, buf);
+    msgbuf_unref(buf);
 }
 
 /**
@@ -533,31 +2171,39 @@ void handle_list_users(int client_idx) {
  */
 void handle_private_message(int client_idx, const char *target, const char *content) {
     int target_idx;
+    int target_shard;
     char msg[BUFFER_SIZE];
-    char timestamp[32];
-    const char *sender_color;
-    const char *target_color;
+    MsgBuf *buf;
 
     update_client_activity(client_idx);
 
+    if (worker_count > 0) {
+        submit_job(client_idx, MSG_PRIVATE, client_rooms[client_idx], target, content);
+        return;
+    }
+
+    /* Local recipients are found without touching the directory */
     target_idx = find_client_by_username(target);
+    target_shard = target_idx >= 0 ? shard_id : dir_find_user(target);
 
-    if (target_idx < 0) {
-        send_message(clients[client_idx].fd, COLOR_ERROR "[ERROR] User not found." COLOR_RESET "\n");
+    if (target_shard < 0) {
+        send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] User not found." COLOR_RESET "\n");
         return;
     }
 
-    get_timestamp(timestamp, sizeof(timestamp));
-    sender_color = get_user_color(clients[client_idx].username);
-    target_color = get_user_color(target);
-
-    snprintf(msg, sizeof(msg), COLOR_TIMESTAMP "[%s]" COLOR_RESET COLOR_PM " [PM from %s%s" COLOR_PM "]: " COLOR_RESET "%s\n",
-             timestamp, sender_color, clients[client_idx].username, content);
-    send_message(clients[target_idx].fd, msg);
+    render_private_message(msg, sizeof(msg), "from", clients[client_idx].username, content);
+    if (target_idx >= 0) {
+        send_message(client_fds[target_idx], msg);
+    } else {
+        buf = msgbuf_new(msg, strlen(msg));
+        if (buf) {
+            shard_post_user(target_shard, target, buf);
+            msgbuf_unref(buf);
+        }
+    }
 
-    snprintf(msg, sizeof(msg), COLOR_TIMESTAMP "[%s]" COLOR_RESET COLOR_PM " [PM to %s%s" COLOR_PM "]: " COLOR_RESET "%s\n",
-             timestamp, target_color, target, content);
-    send_message(clients[client_idx].fd, msg);
+    render_private_message(msg, sizeof(msg), "to", target, content);
+    send_message(client_fds[client_idx], msg);
 }
 
 /**
@@ -567,32 +2213,192 @@ void handle_private_message(int client_idx, const char *target, const char *cont
  * @param content Message content.
  */
 void handle_chat_message(int client_idx, const char *content) {
-    char msg[BUFFER_SIZE];
-    char timestamp[32];
-    const char *user_color;
-    int i;
-
     if (strlen(clients[client_idx].username) == 0) {
-        send_message(clients[client_idx].fd, COLOR_ERROR "[ERROR] Set username first with /name <username>" COLOR_RESET "\n");
+        send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] Set username first with /name <username>" COLOR_RESET "\n");
         return;
     }
 
     update_client_activity(client_idx);
 
-    get_timestamp(timestamp, sizeof(timestamp));
-    user_color = get_user_color(clients[client_idx].username);
+    room_event(client_idx, client_rooms[client_idx], MSG_CHAT, content);
+}
+
+/* --- Command Table --- */
+
+#define COMMAND_MAX_ARGS    2       /**< Most arguments a command takes */
+#define COMMAND_SLOTS       32      /**< Lookup slots (power of two, over twice the commands) */
+
+/**
+ * @brief A command handler, called with the command's parsed arguments.
+ *
+ * @param client_idx Index of the client.
+ * @param args COMMAND_MAX_ARGS arguments, NULL where not given.
+ */
+typedef void (*CommandFn)(int client_idx, const char *const *args);
+
+/**
+ * @brief One entry of the command table.
+ */
+typedef struct {
+    const char *name;       /**< Command word, slash included */
+    int min_args;           /**< Arguments required */
+    int max_args;           /**< Arguments parsed; further words are ignored */
+    int rest;               /**< Flag: the last argument is the rest of the line */
+    const char *syntax;     /**< Synopsis for /help and usage errors */
+    const char *help;       /**< Description for /help */
+    CommandFn run;          /**< Handler */
+} Command;
+
+/** @brief /name <username> */
+static void run_name(int client_idx, const char *const *args) { handle_setname(client_idx, args[0]); }
+/** @brief /join <room> */
+static void run_join(int client_idx, const char *const *args) { handle_join(client_idx, args[0]); }
+/** @brief /leave */
+static void run_leave(int client_idx, const char *const *args) { (void)args; handle_leave(client_idx); }
+/** @brief /rooms [page] */
+static void run_rooms(int client_idx, const char *const *args) { handle_list_rooms(client_idx, args[0]); }
+/** @brief /users [page] */
+static void run_users(int client_idx, const char *const *args) { handle_list_users(client_idx, args[0]); }
+/** @brief /msg <user> <message> */
+static void run_msg(int client_idx, const char *const *args) { handle_private_message(client_idx, args[0], args[1]); }
+/** @brief /quit */
+static void run_quit(int client_idx, const char *const *args) { (void)args; handle_quit(client_idx); }
+/** @brief /ping */
+static void run_ping(int client_idx, const char *const *args) { (void)args; handle_ping(client_idx); }
+/** @brief /typing [on|off] */
+static void run_typing(int client_idx, const char *const *args) { handle_typing(client_idx, args[0]); }
+/** @brief /help */
+static void run_help(int client_idx, const char *const *args) { (void)args; handle_help(client_idx); }
+/** @brief /oper <password> */
+static void run_oper(int client_idx, const char *const *args) { handle_oper(client_idx, args[0]); }
+/** @brief /stats */
+static void run_stats(int client_idx, const char *const *args) { (void)args; handle_stats(client_idx); }
+
+/** @brief Every command, in /help order. */
+static const Command commands[] = {
+    {"/name",   1, 1, 0, "/name <username>",      "Set your username",                  run_name},
+    {"/join",   1, 1, 0, "/join <room>",          "Join or create a room",              run_join},
+    {"/leave",  0, 0, 0, "/leave",                "Leave current room (go to lobby)",   run_leave},
+    {"/rooms",  0, 1, 0, "/rooms [page]",         "List all rooms",                     run_rooms},
+    {"/users",  0, 1, 0, "/users [page]",         "List users in current room",         run_users},
+    {"/msg",    2, 2, 1, "/msg <user> <message>", "Send private message",               run_msg},
+    {"/quit",   0, 0, 0, "/quit",                 "Exit the chat",                      run_quit},
+    {"/ping",   0, 0, 0, "/ping",                 "Check server responsiveness",        run_ping},
+    {"/typing", 0, 1, 0, "/typing [on|off]",      "Send typing notification; on/off shows or hides others'", run_typing},
+    {"/help",   0, 0, 0, "/help",                 "Show this help",                     run_help},
+    {"/oper",   1, 1, 0, "/oper <password>",      "Become a server operator",           run_oper},
+    {"/stats",  0, 0, 0, "/stats",                "Show server statistics (operators)", run_stats}
+};
+
+#define COMMAND_COUNT ((int)(sizeof(commands) / sizeof(commands[0])))
+#define COMMAND_CHAT  COMMAND_COUNT     /**< Latency histogram of plain chat lines (below STATS_MAX_COMMANDS) */
+
+/** @brief Fails to compile once the commands plus chat outgrow the latency histograms. */
+typedef char command_latency_slots_check[(COMMAND_COUNT + 1 <= STATS_MAX_COMMANDS) ? 1 : -1];
+
+/** @brief Open-addressing index over `commands`, built once: slot -> entry, or -1. */
+static int command_slots[COMMAND_SLOTS];
+static pthread_once_t command_slots_once = PTHREAD_ONCE_INIT;
 
-    snprintf(msg, sizeof(msg), COLOR_TIMESTAMP "[%s]" COLOR_RESET " %s%s" COLOR_RESET ": %s\n",
-             timestamp, user_color, clients[client_idx].username, content);
+/**
+ * @brief Hashes a command word.
+ *
+ * @param word Start of the word.
+ * @param len Length of the word.
+ * @return Lookup slot.
+ */
+static unsigned int command_hash(const char *word, size_t len) {
+    unsigned int hash = 5381;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = ((hash << 5) + hash) + (unsigned char)word[i];
+    }
+    return hash & (COMMAND_SLOTS - 1);
+}
+
+/**
+ * @brief Builds the command index (run once, from any thread).
+ */
+static void index_commands(void) {
+    unsigned int slot;
+    int i;
+
+    for (i = 0; i < COMMAND_SLOTS; i++) {
+        command_slots[i] = -1;
+    }
+    for (i = 0; i < COMMAND_COUNT; i++) {
+        slot = command_hash(commands[i].name, strlen(commands[i].name));
+        while (command_slots[slot] >= 0) {
+            slot = (slot + 1) & (COMMAND_SLOTS - 1);
+        }
+        command_slots[slot] = i;
+        stats_name_command(i, commands[i].name);
+    }
+    stats_name_command(COMMAND_CHAT, "chat");
+}
 
-    add_message_to_history(clients[client_idx].current_room, msg);
+/**
+ * @brief Looks up a command word.
+ *
+ * @param word Start of the word (not NUL-terminated).
+ * @param len Length of the word.
+ * @return The command, or NULL if there is none by that name.
+ */
+static const Command *find_command(const char *word, size_t len) {
+    const Command *cmd;
+    unsigned int slot;
+
+    for (slot = command_hash(word, len); command_slots[slot] >= 0; slot = (slot + 1) & (COMMAND_SLOTS - 1)) {
+        cmd = &commands[command_slots[slot]];
+        if (strncmp(cmd->name, word, len) == 0 && cmd->name[len] == '\0') return cmd;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Splits a command's arguments off its line without modifying it.
+ *
+ * Words are separated by spaces. A trailing "rest" argument starts after
+ * the single space that ends the previous word and runs to the end of the
+ * line. Each argument is copied, NUL-terminated, into `scratch`.
+ *
+ * @param cmd The command.
+ * @param line Text after the command word.
+ * @param scratch Storage for the arguments.
+ * @param size Size of scratch.
+ * @param args Set to COMMAND_MAX_ARGS arguments, NULL where not given.
+ * @return Number of arguments found.
+ */
+static int parse_command_args(const Command *cmd, const char *line, char *scratch, size_t size, const char **args) {
+    const char *p = line;
+    size_t used = 0;
+    size_t n;
+    int count = 0;
+    int i;
+
+    for (i = 0; i < COMMAND_MAX_ARGS; i++) {
+        args[i] = NULL;
+    }
 
-    for (i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].fd > 0 &&
-            strcmp(clients[i].current_room, clients[client_idx].current_room) == 0) {
-            send_message(clients[i].fd, msg);
+    while (count < cmd->max_args) {
+        if (cmd->rest && count == cmd->max_args - 1) {
+            n = strlen(p);
+        } else {
+            while (*p == ' ') p++;
+            n = strcspn(p, " ");
         }
+        if (n == 0 || used + n + 1 > size) break;
+
+        memcpy(scratch + used, p, n);
+        scratch[used + n] = '\0';
+        args[count++] = scratch + used;
+        used += n + 1;
+
+        p += n;
+        if (*p == ' ') p++;
     }
+    return count;
 }
 
 /**
@@ -602,19 +2408,15 @@ void handle_chat_message(int client_idx, const char *content) {
  */
 void handle_help(int client_idx) {
     char msg[BUFFER_SIZE];
-    msg[0] = '\0';
-    strncat(msg, COLOR_SERVER "[SERVER] Available commands:" COLOR_RESET "\n", BUFFER_SIZE - 1);
-    strncat(msg, COLOR_INFO "  /name <username>        " COLOR_RESET "- Set your username\n", BUFFER_SIZE - strlen(msg) - 1);
-    strncat(msg, COLOR_INFO "  /join <room>            " COLOR_RESET "- Join or create a room\n", BUFFER_SIZE - strlen(msg) - 1);
-    strncat(msg, COLOR_INFO "  /leave                  " COLOR_RESET "- Leave current room (go to lobby)\n", BUFFER_SIZE - strlen(msg) - 1);
-    strncat(msg, COLOR_INFO "  /rooms                  " COLOR_RESET "- List all rooms\n", BUFFER_SIZE - strlen(msg) - 1);
-    strncat(msg, COLOR_INFO "  /users                  " COLOR_RESET "- List users in current room\n", BUFFER_SIZE - strlen(msg) - 1);
-    strncat(msg, COLOR_INFO "  /msg <user> <message>   " COLOR_RESET "- Send private message\n", BUFFER_SIZE - strlen(msg) - 1);
-    strncat(msg, COLOR_INFO "  /quit                   " COLOR_RESET "- Exit the chat\n", BUFFER_SIZE - strlen(msg) - 1);
-    strncat(msg, COLOR_INFO "  /ping                   " COLOR_RESET "- Check server responsiveness\n", BUFFER_SIZE - strlen(msg) - 1);
-    strncat(msg, COLOR_INFO "  /typing                 " COLOR_RESET "- Send typing notification\n", BUFFER_SIZE - strlen(msg) - 1);
-    strncat(msg, COLOR_INFO "  /help                   " COLOR_RESET "- Show this help\n", BUFFER_SIZE - strlen(msg) - 1);
-    send_message(clients[client_idx].fd, msg);
+    size_t len;
+    int i;
+
+    len = snprintf(msg, sizeof(msg), COLOR_SERVER "[SERVER] Available commands:" COLOR_RESET "\n");
+    for (i = 0; i < COMMAND_COUNT && len < sizeof(msg); i++) {
+        len += snprintf(msg + len, sizeof(msg) - len, COLOR_INFO "  %-24s" COLOR_RESET "- %s\n",
+                        commands[i].syntax, commands[i].help);
+    }
+    send_message(client_fds[client_idx], msg);
 }
 
 /**
@@ -623,7 +2425,7 @@ void handle_help(int client_idx) {
  * @param client_idx Index of the client.
  */
 void handle_quit(int client_idx) {
-    send_message(clients[client_idx].fd, COLOR_SERVER "[SERVER] Goodbye! Disconnecting..." COLOR_RESET "\n");
+    send_message(client_fds[client_idx], COLOR_SERVER "[SERVER] Goodbye! Disconnecting..." COLOR_RESET "\n");
     handle_disconnect(client_idx);
 }
 
@@ -638,101 +2440,337 @@ void handle_ping(int client_idx) {
     get_timestamp(timestamp, sizeof(timestamp));
 
     snprintf(msg, sizeof(msg), COLOR_SUCCESS "[SERVER] PONG [%s]" COLOR_RESET "\n", timestamp);
-    send_message(clients[client_idx].fd, msg);
+    send_message(client_fds[client_idx], msg);
+}
+
+/**
+ * @brief Grants operator rights to a client that knows oper_password.
+ *
+ * @param client_idx Index of the client.
+ * @param password Password as typed.
+ */
+void handle_oper(int client_idx, const char *password) {
+    if (oper_password[0] == '\0') {
+        send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] Operator access is not enabled on this server." COLOR_RESET "\n");
+        return;
+    }
+    if (strcmp(password, oper_password) != 0) {
+        printf("Failed /oper attempt from %s\n",
+               clients[client_idx].username[0] ? clients[client_idx].username : "unnamed client");
+        send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] Wrong operator password." COLOR_RESET "\n");
+        return;
+    }
+
+    client_flags[client_idx] |= CLIENT_OPER;
+    send_message(client_fds[client_idx], COLOR_SUCCESS "[SERVER] You are now a server operator." COLOR_RESET "\n");
+}
+
+/**
+ * @brief Sends the server statistics to an operator.
+ *
+ * @param client_idx Index of the client.
+ */
+void handle_stats(int client_idx) {
+    char msg[STATS_REPORT_SIZE];
+    size_t len;
+
+    if (!(client_flags[client_idx] & CLIENT_OPER)) {
+        send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] /stats is for operators; see /oper." COLOR_RESET "\n");
+        return;
+    }
+
+    len = stats_format(msg, sizeof(msg));
+    queue_output(client_idx, msg, len);
+}
+
+/**
+ * @brief Returns the shard that renders a room's typing notices.
+ *
+ * @param name Room name.
+ * @return Shard index.
+ */
+static int typing_owner(const char *name) {
+    return shard_count > 1 ? (int)(hash_string(name) % (unsigned int)shard_count) : shard_id;
 }
 
 /**
  * @brief Handles typing notifications.
  *
+ * Typers are only recorded here, on the shard that renders the room's
+ * notices; flush_typing() on that shard tells the room.
+ *
  * @param client_idx Index of the client.
+ * @param mode "on", "off", or NULL when the client is typing.
  */
-void handle_typing(int client_idx) {
-    time_t now;
-    char msg[BUFFER_SIZE];
-    const char *user_color;
+void handle_typing(int client_idx, const char *mode) {
+    int room_idx = client_rooms[client_idx];
+    MsgBuf *name;
+    int owner;
+
+    if (mode) {
+        if (strcmp(mode, "off") == 0) {
+            client_flags[client_idx] |= CLIENT_NO_TYPING;
+            send_message(client_fds[client_idx], COLOR_SERVER "[SERVER] Typing notices are off." COLOR_RESET "\n");
+        } else if (strcmp(mode, "on") == 0) {
+            client_flags[client_idx] &= ~CLIENT_NO_TYPING;
+            send_message(client_fds[client_idx], COLOR_SERVER "[SERVER] Typing notices are on." COLOR_RESET "\n");
+        } else {
+            send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] Usage: /typing [on|off]" COLOR_RESET "\n");
+        }
+        return;
+    }
 
-    if (strlen(clients[client_idx].username) == 0)
-    {
+    if (clients[client_idx].username[0] == '\0' || room_idx < 0) {
         return;
     }
 
     update_client_activity(client_idx);
 
-    now = time(NULL);
-    if (now - clients[client_idx].last_typing_sent < 3) {
+    /* Counted once per round, however often the client reports typing */
+    if (clients[client_idx].typing_round == typing_round) {
         return;
     }
 
-    clients[client_idx].last_typing_sent = now;
-    user_color = get_user_color(clients[client_idx].username);
+    /* The first notification to go when the loop falls behind */
+    if (loop_overloaded(shed_typing)) {
+        stats_add(STAT_SHED_TYPING, 1);
+        return;
+    }
 
-    snprintf(msg, sizeof(msg),
-             COLOR_INFO "\x1b[3m ... %s%s%s is typing ... \x1b[0m" COLOR_RESET "\n",
-             user_color, clients[client_idx].username, COLOR_INFO);
+    clients[client_idx].typing_round = typing_round;
+    owner = typing_owner(rooms[room_idx].name);
+    if (owner == shard_id) {
+        add_typer(room_idx, clients[client_idx].username, client_idx, client_ids[client_idx]);
+        return;
+    }
 
-    broadcast_to_room(clients[client_idx].current_room, msg, clients[client_idx].fd);
+    /* Every typer goes to the one shard that renders the room's notices */
+    name = msgbuf_new(clients[client_idx].username, strlen(clients[client_idx].username));
+    if (!name) return;
+    shard_post_typer(owner, rooms[room_idx].name, name, client_idx, client_ids[client_idx]);
+    msgbuf_unref(name);
 }
 
 /**
- * @brief Processes incoming raw text from a client.
- * Parses commands or routes to chat handler.
+ * @brief Formats a room's typing notice, e.g. "A, B and 12 others are typing".
+ *
+ * @param msg Output buffer.
+ * @param size Its size.
+ * @param room Room with at least one typer.
+ */
+static void render_typing(char *msg, size_t size, const Room *room) {
+    int shown = room->typing_count < TYPING_NAMES ? room->typing_count : TYPING_NAMES;
+    int others = room->typing_count - shown;
+    const char *name;
+    const char *sep;
+    size_t len;
+    int i;
+
+    len = snprintf(msg, size, COLOR_INFO "\x1b[3m ... ");
+    for (i = 0; i < shown && len < size; i++) {
+        name = room->typing_names[i];
+        sep = i == 0 ? "" : (i == shown - 1 && others == 0 ? " and " : ", ");
+        len += snprintf(msg + len, size - len, "%s%s%s%s", sep, get_user_color(name), name, COLOR_INFO);
+    }
+    if (others > 0 && len < size) {
+        len += snprintf(msg + len, size - len, " and %d other%s", others, others == 1 ? "" : "s");
+    }
+    if (len < size) {
+        snprintf(msg + len, size - len, " %s typing ... \x1b[0m" COLOR_RESET "\n",
+                 room->typing_count == 1 ? "is" : "are");
+    }
+}
+
+/**
+ * @brief Sends a room's typing notice to its members here and on the other shards.
+ *
+ * Members that opted out with /typing off are skipped.
+ *
+ * @param room_idx Index of the room.
+ */
+static void publish_typing(int room_idx) {
+    Room *room = &rooms[room_idx];
+    char msg[BUFFER_SIZE];
+    MsgBuf *buf;
+    int exclude = -1;
+    unsigned long exclude_id = 0;
+
+    /* A lone typer is not told about themselves, on whichever shard they are */
+    if (room->typing_count == 1) {
+        exclude = room->typing_client;
+        exclude_id = room->typing_client_id;
+    }
+
+    render_typing(msg, sizeof(msg), room);
+    buf = msgbuf_new(msg, strlen(msg));
+    if (!buf) return;
+
+    deliver_to_room(room, buf,
+                    exclude >= 0 && exclude < client_capacity && client_ids[exclude] == exclude_id ? exclude : -1,
+                    CLIENT_NO_TYPING);
+    if (shard_count > 1) {
+        shard_post_typing(room->name, buf, exclude, exclude_id);
+    }
+    msgbuf_unref(buf);
+}
+
+/**
+ * @brief Sends each room's coalesced typing notice once per typing_interval.
+ *
+ * Only the shard that renders a room's notices has typers listed for it
+ * (see handle_typing()). A lone typer is not told about themselves; with
+ * several, everyone in the room gets the same notice.
+ */
+void flush_typing(void) {
+    time_t now = clock_now();
+    Room *room;
+    int room_idx;
+
+    if (now < typing_due) return;
+
+    typing_due = typing_round_end(now);
+    typing_round++;
+
+    while (typing_room_count > 0) {
+        room_idx = typing_rooms[--typing_room_count];
+        room = &rooms[room_idx];
+        room->typing_queued = 0;
+        if (room->active && room->typing_count > 0) {
+            publish_typing(room_idx);
+        }
+        room->typing_count = 0;
+    }
+}
+
+/**
+ * @brief Runs one line: a command from the command table or a chat message.
  *
  * @param client_idx Index of the client.
  * @param buffer The raw message buffer.
+ * @return Command number for the latency histograms (COMMAND_CHAT for chat),
+ *         or -1 for unknown commands and usage errors, which are not timed.
  */
-void handle_client_message(int client_idx, char *buffer) {
+static int run_client_message(int client_idx, char *buffer) {
     size_t len = strlen(buffer);
-    char *cmd;
-    char *arg1;
-    char *arg2;
+    const Command *cmd;
+    const char *args[COMMAND_MAX_ARGS];
+    char scratch[BUFFER_SIZE];
+    char msg[BUFFER_SIZE];
+    size_t n;
 
     if (len > 0 && buffer[len - 1] == '\n') buffer[len - 1] = '\0';
 
-    if (buffer[0] == '/') {
-        cmd = strtok(buffer, " ");
+    if (buffer[0] != '/') {
+        handle_chat_message(client_idx, buffer);
+        return COMMAND_CHAT;
+    }
 
-        if (strcmp(cmd, "/name") == 0) {
-            arg1 = strtok(NULL, " ");
-            if (arg1) {
-                handle_setname(client_idx, arg1);
-            } else {
-                send_message(clients[client_idx].fd, COLOR_ERROR "[ERROR] Usage: /name <username>" COLOR_RESET "\n");
-            }
-        } else if (strcmp(cmd, "/join") == 0) {
-            arg1 = strtok(NULL, " ");
-            if (arg1) {
-                handle_join(client_idx, arg1);
-            } else {
-                send_message(clients[client_idx].fd, COLOR_ERROR "[ERROR] Usage: /join <room>" COLOR_RESET "\n");
-            }
-        } else if (strcmp(cmd, "/leave") == 0) {
-            handle_leave(client_idx);
-        } else if (strcmp(cmd, "/rooms") == 0) {
-            handle_list_rooms(client_idx);
-        } else if (strcmp(cmd, "/users") == 0) {
-            handle_list_users(client_idx);
-        } else if (strcmp(cmd, "/msg") == 0) {
-            arg1 = strtok(NULL, " ");
-            arg2 = strtok(NULL, "");
-            if (arg1 && arg2) {
-                handle_private_message(client_idx, arg1, arg2);
-            } else {
-                send_message(clients[client_idx].fd, COLOR_ERROR "[ERROR] Usage: /msg <user> <message>" COLOR_RESET "\n");
-            }
-        } else if (strcmp(cmd, "/help") == 0) {
-            handle_help(client_idx);
-        } else if (strcmp(cmd, "/quit") == 0) {
-            handle_quit(client_idx);
-        } else if (strcmp(cmd, "/ping") == 0) {
-            handle_ping(client_idx);
-        } else if (strcmp(cmd, "/typing") == 0) {
-            handle_typing(client_idx);
-        } else {
-            send_message(clients[client_idx].fd, COLOR_ERROR "[ERROR] Unknown command. Type /help for help." COLOR_RESET "\n");
+    n = strcspn(buffer, " ");
+    cmd = find_command(buffer, n);
+    if (!cmd) {
+        send_message(client_fds[client_idx], COLOR_ERROR "[ERROR] Unknown command. Type /help for help." COLOR_RESET "\n");
+        return -1;
+    }
+
+    if (parse_command_args(cmd, buffer + n, scratch, sizeof(scratch), args) < cmd->min_args) {
+        snprintf(msg, sizeof(msg), COLOR_ERROR "[ERROR] Usage: %s" COLOR_RESET "\n", cmd->syntax);
+        send_message(client_fds[client_idx], msg);
+        return -1;
+    }
+    cmd->run(client_idx, args);
+    return (int)(cmd - commands);
+}
+
+/**
+ * @brief Processes incoming raw text from a client.
+ * Looks commands up in the command table or routes to chat handler.
+ * Every handled line is timed, from lookup to the handler's return, into
+ * its command's latency histogram (see stats.h); the same clock readings
+ * charge the time to the dispatch phase of the loop.
+ *
+ * @param client_idx Index of the client.
+ * @param buffer The raw message buffer.
+ */
+void handle_client_message(int client_idx, char *buffer) {
+    unsigned long start, end;
+    LoopPhase phase = stats_phase(PHASE_DISPATCH, &start);
+    int command;
+
+    stats_add(STAT_MESSAGES_IN, 1);
+    pthread_once(&command_slots_once, index_commands);
+
+    command = run_client_message(client_idx, buffer);
+    stats_phase(phase, &end);
+    if (command >= 0) {
+        stats_command_time(command, end - start);
+    }
+}
+
+/**
+ * @brief Handles every complete line in a chunk of received data.
+ *
+ * @param client_idx Index of the client.
+ * @param data Received bytes (modified in place).
+ * @param len Number of bytes in data.
+ * @return Number of bytes consumed.
+ */
+size_t handle_client_input(int client_idx, char *data, size_t len) {
+    int fd = client_fds[client_idx];
+    char *line = data;
+    char *end = data + len;
+    char *nl;
+    size_t line_len;
+
+    if (clients[client_idx].in_discard) {
+        /* Skip the tail of a line that was already rejected as too long */
+        nl = memchr(data, '\n', len);
+        if (!nl) return len;
+        clients[client_idx].in_discard = 0;
+        line = nl + 1;
+    }
+
+    while (line < end && (nl = memchr(line, '\n', end - line)) != NULL) {
+        line_len = nl - line;
+        *nl = '\0';
+        if (line_len > 0 && line[line_len - 1] == '\r') {
+            line[--line_len] = '\0';
         }
-    } else {
-        handle_chat_message(client_idx, buffer);
+
+        if (line_len > 0) {
+            handle_client_message(client_idx, line);
+        }
+
+        line = nl + 1;
+
+        /* The handler may have disconnected the client (e.g. /quit) */
+        if (client_fds[client_idx] != fd || (client_flags[client_idx] & CLIENT_CLOSING)) {
+            return len;
+        }
+    }
+
+    return line - data;
+}
+
+/**
+ * @brief Stores an incomplete line in the client's input buffer.
+ *
+ * @param client_idx Index of the client.
+ * @param data Start of the incomplete line.
+ * @param len Its length.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int save_partial_input(int client_idx, const char *data, size_t len) {
+    Client *c = &clients[client_idx];
+
+    if (!c->in_buf) {
+        c->in_buf = malloc(BUFFER_SIZE);
+        if (!c->in_buf) return -1;
     }
+
+    /* Input may already live in in_buf, so the regions can overlap */
+    memmove(c->in_buf, data, len);
+    c->in_len = len;
+    return 0;
 }
 
 /**
@@ -743,31 +2781,39 @@ void handle_client_message(int client_idx, char *buffer) {
  */
 void handle_disconnect(int client_idx) {
     char ip_str[INET_ADDRSTRLEN];
+    size_t before;
     int port;
-    char msg[BUFFER_SIZE];
-    char timestamp[32];
-    const char *user_color;
+
+    /* Already gone; complete_client_output() or the drain timer closes it */
+    if ((client_flags[client_idx] & CLIENT_DRAINING)) return;
 
     inet_ntop(AF_INET, &(clients[client_idx].addr.sin_addr), ip_str, INET_ADDRSTRLEN);
     port = ntohs(clients[client_idx].addr.sin_port);
 
     if (strlen(clients[client_idx].username) > 0) {
-        get_timestamp(timestamp, sizeof(timestamp));
-        user_color = get_user_color(clients[client_idx].username);
-
-        snprintf(msg, sizeof(msg), COLOR_TIMESTAMP "[%s]" COLOR_RESET COLOR_ACTION " *** %s%s%s disconnected ***" COLOR_RESET "\n",
-                 timestamp, user_color, clients[client_idx].username, COLOR_ACTION);
-        broadcast_to_room(clients[client_idx].current_room, msg, -1);
+        room_event(client_idx, client_rooms[client_idx], MSG_QUIT, NULL);
 
         printf("Lost connection from %s:%d (user: %s)\n", ip_str, port, clients[client_idx].username);
     } else {
         printf("Lost connection from %s:%d (no username set)\n", ip_str, port);
     }
 
-    close(clients[client_idx].fd);
-    clients[client_idx].fd = -1;
-    clients[client_idx].username[0] = '\0';
-    clients[client_idx].current_room[0] = '\0';
+    /* Last chance for queued output such as the goodbye notice */
+    if (io_completion_mode()) {
+        submit_client_output(client_idx);
+        if (clients[client_idx].send_inflight) {
+            /* Closing now would cancel the send and drop what is queued behind it */
+            detach_client(client_idx);
+            client_flags[client_idx] |= CLIENT_CLOSING | CLIENT_DRAINING;
+            timer_arm(&client_timers, client_idx, (unsigned long)clock_now() + DRAIN_TIMEOUT);
+            return;
+        }
+    } else if (clients[client_idx].out.count > 0) {
+        before = clients[client_idx].out.bytes;
+        outq_flush(&clients[client_idx].out, client_fds[client_idx]);
+        account_queue(before, clients[client_idx].out.bytes);
+    }
 
-    cleanup_empty_rooms();
-}
\ No newline at end of file
+    detach_client(client_idx);
+    finish_disconnect(client_idx);
+}
@@ -2,6 +2,9 @@
 #define SERVER_UTILS_H
 
 #include "protocol.h"
+#include "history.h"
+#include "msgbuf.h"
+#include "worker.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <time.h>
@@ -12,60 +15,206 @@
  *
  * Contains declarations for client management, room logic, message handling,
  * and helper functions used by the main server loop.
- */
-
-/**
- * @brief Represents a connected client.
+ *
+ * The client and room tables belong to the calling reactor thread (see
+ * shard.h). Rooms are local copies: members on other shards are reached
+ * through their inboxes, and server-wide names and counts come from the
+ * directory (see directory.h).
+ */
+
+#define OUTPUT_QUEUE_LIMIT  (256 * 1024) /**< Default per-client output queue high-water mark (bytes) */
+#define IDLE_TIMEOUT        300         /**< Default seconds of inactivity before a client is disconnected */
+#define DRAIN_TIMEOUT       5           /**< Seconds a disconnected client's in-flight send may take to finish (completion mode) */
+#define ROOM_RECHECK_INTERVAL 10        /**< Seconds between checks of an empty room copy whose room has members on other shards */
+#define ROOM_GRACE          0           /**< Default seconds an empty room is kept before it is retired */
+#define HISTORY_BYTES       (16 * 1024) /**< Default byte budget of a room's history */
+#define ROOM_HISTORY_LIMITS 32          /**< Rooms that can be given their own history limits (history.<room>) */
+#define LIST_PAGE_LINES     50          /**< Entries per page of a /rooms or /users reply */
+#define OPER_PASSWORD_MAX   64          /**< Size of the oper_password setting, NUL included */
+#define TYPING_INTERVAL     2           /**< Default seconds between a room's coalesced typing notices */
+#define TYPING_NAMES        2           /**< Typers named in a notice; the others are only counted */
+#define SHED_TYPING_MS      25          /**< Default loop lag (ms) above which /typing notifications are dropped */
+#define SHED_HISTORY_MS     50          /**< Default loop lag (ms) above which history replays are postponed */
+#define SHED_ACCEPT_MS      100         /**< Default loop lag (ms) above which new connections are turned away */
+
+/**
+ * @brief What to do with a client whose output queue passes the high-water mark.
+ */
+typedef enum {
+    SLOW_CLIENT_DISCONNECT, /**< Disconnect the slow consumer */
+    SLOW_CLIENT_DROP        /**< Keep the client but drop messages that do not fit */
+} SlowClientPolicy;
+
+/**
+ * @brief Per-client state that only the client's own I/O, commands and log
+ *        lines use.
+ *
+ * The fields that loops over many clients read (descriptor, room, flags,
+ * activity, id) are kept apart in the parallel client_* arrays below, so a
+ * scan reads a few bytes per client instead of a whole Client. The output
+ * queue comes first because a broadcast touches it for every member.
  */
 typedef struct {
-    int fd;                         /**< Socket file descriptor */
+    OutQueue out;                   /**< Output not yet accepted by the socket */
+    int send_inflight;              /**< Flag: completion mode, part of out is being sent */
+    int flush_queued;               /**< Flag: completion mode, listed for flush_pending_output() */
+    unsigned long send_round;       /**< flush_pending_output() round that submitted it */
     char username[MAX_USERNAME];    /**< Client's display name */
-    char current_room[MAX_ROOMNAME];/**< Name of the room the client is currently in */
+    int room_slot;                  /**< Position of this client in the room's member array */
+    unsigned long typing_round;     /**< flush_typing() round in which the client was last counted as typing */
     struct sockaddr_in addr;        /**< Client's network address information */
-    time_t last_activity;           /**< Timestamp of last action for timeout handling */
-    time_t last_typing_sent;        /**< Timestamp of last "typing..." notification */
+    char *in_buf;                   /**< Partial input line kept between reads (allocated on demand) */
+    size_t in_len;                  /**< Number of bytes held in in_buf */
+    int in_discard;                 /**< Flag: 1 while skipping the rest of an over-long line */
 } Client;
 
+#define CLIENT_CLOSING  0x01        /**< client_flags: scheduled for disconnect */
+#define CLIENT_OPER     0x02        /**< client_flags: logged in with /oper */
+#define CLIENT_REPLAY   0x04        /**< client_flags: history replay postponed until the loop catches up */
+#define CLIENT_NO_TYPING 0x08       /**< client_flags: opted out of typing notices (/typing off) */
+#define CLIENT_DRAINING 0x10        /**< client_flags: disconnected, socket kept open until its last send completes */
+
 /**
- * @brief Represents a chat room.
+ * @brief A shard's copy of a chat room: its local members and history.
  */
 typedef struct {
     char name[MAX_ROOMNAME];        /**< Name of the room */
     int active;                     /**< Flag: 1 if active, 0 if empty/unused */
-    MessageHistory history;         /**< Rolling history of recent messages */
+    HistoryRing history;            /**< Rolling history of recent messages */
+    MsgBuf *replay;                 /**< History replay (header, messages, footer), NULL when stale */
+    int *members;                   /**< Dense array of client indices currently in the room */
+    int member_count;               /**< Number of valid entries in members */
+    int member_cap;                 /**< Allocated size of members */
+    unsigned long *member_bits;     /**< Bitmap of the same client indices, for dense fan-out */
+    int member_words;               /**< Allocated words of member_bits */
+    int retire_queued;              /**< Flag: emptied with no grace period, listed for check_empty_rooms() */
+    int typing_count;               /**< Members who sent /typing since the last flush_typing(), here and (on the notice shard) elsewhere */
+    char typing_names[TYPING_NAMES][MAX_USERNAME]; /**< The first of them, named in the notice */
+    int typing_client;              /**< Slot of the first of them, skipped when they type alone */
+    unsigned long typing_client_id; /**< Its connection id, which tells the shards apart */
+    int typing_queued;              /**< Flag: listed for flush_typing() */
 } Room;
 
-/* --- Global State Arrays --- */
-extern Client clients[MAX_CLIENTS];
-extern Room rooms[MAX_ROOMS];
+#define LOBBY_ROOM      0           /**< Index of the default "lobby" room in `rooms` */
+
+#define INITIAL_TABLE_SLOTS 64      /**< Slots allocated up front; tables double on demand */
+
+/* --- Global State Tables (per reactor thread) --- */
+extern __thread Client *clients;    /**< Client slots; valid indices are [0, client_capacity) */
+extern __thread int *client_fds;    /**< Socket descriptor of each slot, -1 for a free slot */
+extern __thread int *client_rooms;  /**< Index of each slot's room in `rooms`, or -1 if none */
+extern __thread unsigned char *client_flags;    /**< CLIENT_* flags of each slot */
+extern __thread time_t *client_last_activity;   /**< clock_now() of each slot's last action, for timeouts */
+extern __thread unsigned long *client_ids;      /**< Connection id of each slot, unique server-wide; 0 for a free slot */
+extern __thread int client_capacity; /**< Number of allocated client slots */
+extern int max_clients;             /**< Limit on connected clients, across all shards */
+extern __thread Room *rooms;        /**< Local room slots; valid indices are [0, room_capacity) */
+extern __thread int room_capacity;  /**< Number of allocated room slots */
+extern int max_rooms;               /**< Limit on rooms, across all shards */
+
+/* --- Output Queue Settings --- */
+extern size_t output_queue_limit;           /**< Per-client high-water mark in bytes */
+extern SlowClientPolicy slow_client_policy; /**< Action taken when the mark is exceeded */
+
+/* --- History Settings (applied to rooms as they are created) --- */
+extern int history_max_messages;            /**< Messages kept per room */
+extern size_t history_max_bytes;            /**< Byte budget per room */
+
+/**
+ * @brief Gives one room its own history limits (history.<room> setting).
+ *
+ * They apply whenever the room is created, on every shard; other rooms
+ * keep history_max_messages and history_max_bytes. Set before the shards
+ * start. Setting a room again replaces its limits.
+ *
+ * @param room Room name.
+ * @param max_messages Messages kept.
+ * @param max_bytes Byte budget, or 0 for history_max_bytes.
+ * @return 0 on success, -1 for an invalid name or when ROOM_HISTORY_LIMITS
+ *         rooms already have limits.
+ */
+int set_room_history_limits(const char *room, int max_messages, size_t max_bytes);
+
+/* --- Timeout Settings --- */
+extern int idle_timeout;                    /**< Seconds of inactivity before disconnect */
+extern int room_grace;                      /**< Seconds an empty room (and its history) is kept */
+extern int typing_interval;                 /**< Seconds between a room's coalesced typing notices */
+
+/* --- Operator Settings --- */
+extern char oper_password[OPER_PASSWORD_MAX]; /**< Password for /oper, "" to disable it */
+
+/* --- Overload Settings (loop lag in milliseconds, 0 disables) --- */
+extern int shed_typing;                     /**< Drop /typing notifications above this lag */
+extern int shed_history;                    /**< Postpone history replays above this lag */
+extern int shed_accept;                     /**< Turn new connections away above this lag */
+extern __thread unsigned long loop_lag;     /**< This shard's smoothed event-loop lag (ns), set by the loop */
 
 /* --- Initialization Functions --- */
 
 /**
- * @brief Initializes the clients array, setting default values.
+ * @brief Initializes the clients table with its first slab of free slots.
+ *
+ * Uses max_clients as the growth limit, so set it before calling.
  */
 void init_clients(void);
 
 /**
- * @brief Initializes the rooms array and creates the default lobby.
+ * @brief Initializes the rooms table and creates the default lobby.
+ *
+ * Uses max_rooms as the growth limit, so set it before calling.
  */
 void init_rooms(void);
 
+/**
+ * @brief Claims a free client slot for a new connection in O(1).
+ *
+ * The table grows (doubling, up to max_clients) when no slot is free.
+ *
+ * @param fd Socket file descriptor.
+ * @param addr Peer address, or NULL.
+ * @return Index of the new client, or -1 if the server is full.
+ */
+int add_client(int fd, const struct sockaddr_in *addr);
+
 /* --- Time Utilities --- */
 
 /**
- * @brief Generates a current timestamp string.
+ * @brief Reads the clock; called once per event loop iteration.
+ *
+ * Handlers use the cached values below instead of querying the clock.
+ * The first use reads the clock on demand, so tests need not call it.
+ */
+void clock_tick(void);
+
+/**
+ * @brief Returns the monotonic seconds read by the last clock_tick().
+ * @return Monotonic time, used for timeouts and rate limits.
+ */
+time_t clock_now(void);
+
+/**
+ * @brief Copies the HH:MM:SS timestamp cached by the last clock_tick().
  *
  * @param buffer Buffer to store the timestamp.
  * @param size Size of the buffer.
  */
 void get_timestamp(char *buffer, size_t size);
 
+/**
+ * @brief Tells whether this shard's loop lags past a shedding threshold.
+ *
+ * @param limit_ms Threshold in milliseconds (shed_typing etc.); 0 never sheds.
+ * @return 1 if the work the threshold guards should be shed, 0 otherwise.
+ */
+int loop_overloaded(int limit_ms);
+
 /* --- Lookup Functions --- */
 
 /**
  * @brief Finds a client index by their socket file descriptor.
  *
+ * Direct lookup in an fd-indexed table.
+ *
  * @param fd The socket file descriptor.
  * @return Index in `clients` array, or -1 if not found.
  */
@@ -74,6 +223,8 @@ int find_client_by_fd(int fd);
 /**
  * @brief Finds a client index by their username.
  *
+ * Backed by a hash index, so the cost does not grow with the number of clients.
+ *
  * @param username The username to search for.
  * @return Index in `clients` array, or -1 if not found.
  */
@@ -82,33 +233,107 @@ int find_client_by_username(const char *username);
 /**
  * @brief Finds a room index by name.
  *
+ * Backed by a hash index, so the cost does not grow with the number of rooms.
+ *
  * @param name The name of the room.
  * @return Index in `rooms` array, or -1 if not found.
  */
 int find_room(const char *name);
 
 /**
- * @brief Finds an empty slot and marks a new room as active.
+ * @brief Takes a free room slot and marks a new room as active.
  *
  * @param name Name of the new room.
  * @return Index of the new room, or -1 if max rooms reached or name exists.
  */
 int create_room(const char *name);
 
+/**
+ * @brief Moves a client into a room's member index.
+ *
+ * Removes the client from its previous room (O(1) swap-remove) and appends
+ * it to the new one, updating the directory's member counts. Does not send
+ * any notifications.
+ *
+ * @param client_idx Index of the client.
+ * @param room_idx Index of the target room, or -1 to leave all rooms.
+ * @return 0 on success, -1 on allocation failure or if the room would
+ *         exceed max_rooms server-wide (the client stays where it was).
+ */
+int set_client_room(int client_idx, int room_idx);
+
 /* --- Network / Messaging Functions --- */
 
 /**
- * @brief Ensures all bytes of a buffer are sent over the socket.
+ * @brief Queues bytes for a client without blocking.
  *
- * @param fd Socket file descriptor.
- * @param buf Data buffer.
- * @param len Length of data to send.
- * @return 0 on success, -1 on failure.
+ * Data is written straight to the socket when its queue is empty; whatever
+ * the kernel does not accept is buffered and flushed by flush_client_output()
+ * once the socket becomes writable. With a completion backend everything is
+ * queued and submitted by flush_pending_output(). If the queue would grow
+ * past output_queue_limit the client is handled according to
+ * slow_client_policy.
+ *
+ * @param client_idx Index of the client.
+ * @param data Bytes to send.
+ * @param len Number of bytes.
+ * @return 0 if the data was sent or queued, -1 if it was dropped.
+ */
+int queue_output(int client_idx, const char *data, size_t len);
+
+/**
+ * @brief Queues a shared buffer for a client without copying it.
+ *
+ * Same as queue_output(), but a queued message only takes a reference, so
+ * fanning one buffer out to many clients allocates nothing per recipient.
+ *
+ * @param client_idx Index of the client.
+ * @param buf Buffer to send; the caller keeps its own reference.
+ * @return 0 if the data was sent or queued, -1 if it was dropped.
+ */
+int queue_msgbuf(int client_idx, MsgBuf *buf);
+
+/**
+ * @brief Writes as much queued output as the socket accepts.
+ *
+ * @param client_idx Index of the client.
+ * @return 0 if the queue is now empty, 1 if data remains, -1 on socket error.
+ */
+int flush_client_output(int client_idx);
+
+/**
+ * @brief Submits all output queued during this loop iteration.
+ *
+ * Only used with completion backends, where queued output is handed to
+ * io_send() once per iteration instead of being written on the spot.
+ */
+void flush_pending_output(void);
+
+/**
+ * @brief Records the result of a send submitted by flush_pending_output().
+ *
+ * @param client_idx Index of the client.
+ * @param result Bytes written, or -errno.
  */
-int send_all(int fd, const char *buf, size_t len);
+void complete_client_output(int client_idx, int result);
 
 /**
- * @brief Wrapper to send a string message to a client.
+ * @brief Marks a client for disconnection at the end of the current loop iteration.
+ *
+ * Used from send paths where tearing the client down immediately would
+ * invalidate the caller's iteration (e.g. during a broadcast).
+ *
+ * @param client_idx Index of the client.
+ */
+void schedule_disconnect(int client_idx);
+
+/**
+ * @brief Disconnects all clients marked by schedule_disconnect().
+ */
+void process_pending_disconnects(void);
+
+/**
+ * @brief Wrapper to queue a string message for a client.
  *
  * @param client_fd Client socket descriptor.
  * @param msg Null-terminated string to send.
@@ -118,11 +343,28 @@ void send_message(int client_fd, const char *msg);
 /**
  * @brief Broadcasts a message to all users in a specific room.
  *
- * @param room Name of the target room.
+ * @param room_idx Index of the target room.
  * @param msg The message to broadcast.
  * @param exclude_fd File descriptor to exclude from broadcast (e.g., sender), or -1.
  */
-void broadcast_to_room(const char *room, const char *msg, int exclude_fd);
+void broadcast_to_room(int room_idx, const char *msg, int exclude_fd);
+
+/**
+ * @brief Delivers messages posted to this shard by other shards and workers.
+ *
+ * Called once per loop iteration; cheap when the inbox is empty.
+ */
+void process_shard_inbox(void);
+
+/**
+ * @brief Runs one command on a worker thread (see worker.h).
+ *
+ * Renders chat lines, notices, private messages and listings, and posts the
+ * result to the shards through their inboxes.
+ *
+ * @param job The job.
+ */
+void handle_job(const WorkerJob *job);
 
 /* --- Command Handlers --- */
 
@@ -148,15 +390,25 @@ void handle_leave(int client_idx);
 
 /**
  * @brief Handles the /rooms command.
+ *
+ * Replies with one page of LIST_PAGE_LINES rooms, served from the
+ * directory's cache until a room or member count changes.
+ *
  * @param client_idx Index of the client.
+ * @param page Page number as typed (from 1), or NULL for the first page.
  */
-void handle_list_rooms(int client_idx);
+void handle_list_rooms(int client_idx, const char *page);
 
 /**
  * @brief Handles the /users command.
+ *
+ * Replies with one page of LIST_PAGE_LINES users, served from the
+ * directory's cache until someone joins, leaves or renames in the room.
+ *
  * @param client_idx Index of the client.
+ * @param page Page number as typed (from 1), or NULL for the first page.
  */
-void handle_list_users(int client_idx);
+void handle_list_users(int client_idx, const char *page);
 
 /**
  * @brief Handles private messaging (/msg).
@@ -186,18 +438,85 @@ void handle_help(int client_idx);
 void handle_quit(int client_idx);
 
 /**
- * @brief Handles typing notifications (/typing).
- * @param client_idx Index of the client who is typing.
+ * @brief Handles the /ping command.
+ * @param client_idx Index of the client.
+ */
+void handle_ping(int client_idx);
+
+/**
+ * @brief Handles the /oper command.
+ * @param client_idx Index of the client.
+ * @param password The operator password.
  */
-void handle_typing(int client_idx);
+void handle_oper(int client_idx, const char *password);
+
+/**
+ * @brief Handles the /stats command (operators only).
+ *
+ * Replies with server-wide counters and gauges (see stats.h).
+ *
+ * @param client_idx Index of the client.
+ */
+void handle_stats(int client_idx);
+
+/**
+ * @brief Handles typing notifications (/typing [on|off]).
+ *
+ * Without an argument the client is counted as typing in its room, once
+ * per flush_typing() round; "off" stops typing notices to the client and
+ * "on" resumes them.
+ *
+ * @param client_idx Index of the client.
+ * @param mode "on", "off", or NULL when the client is typing.
+ */
+void handle_typing(int client_idx, const char *mode);
+
+/**
+ * @brief Sends each room's coalesced typing notice, every typing_interval seconds.
+ *
+ * One shard per room, chosen by hashing its name, renders the notice: the
+ * other shards send it the typers they counted, and it tells the whole
+ * room. The notice names the first TYPING_NAMES typers and counts the
+ * rest, so its fan-out does not grow with the number of typers. Called
+ * once per event loop iteration.
+ */
+void flush_typing(void);
 
 /**
  * @brief Parses and routes raw input from a client.
+ *
+ * Commands are looked up in a hashed command table; their arguments are
+ * split off by a re-entrant parser that leaves the line intact.
+ *
  * @param client_idx Index of the client.
- * @param buffer Raw string buffer received from socket.
+ * @param buffer Raw string buffer received from socket (a trailing newline is stripped in place).
  */
 void handle_client_message(int client_idx, char *buffer);
 
+/**
+ * @brief Splits received bytes into lines and handles every complete one.
+ *
+ * Lines are terminated in place, so a large read is parsed in a single pass
+ * without copying. A trailing incomplete line is left for the caller to keep
+ * until the next read.
+ *
+ * @param client_idx Index of the client.
+ * @param data Received bytes (modified in place).
+ * @param len Number of bytes in data.
+ * @return Number of bytes consumed; data[ret..len) is an incomplete line.
+ */
+size_t handle_client_input(int client_idx, char *data, size_t len);
+
+/**
+ * @brief Keeps an incomplete line until the rest of it arrives.
+ *
+ * @param client_idx Index of the client.
+ * @param data Start of the incomplete line.
+ * @param len Its length; must be less than BUFFER_SIZE.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int save_partial_input(int client_idx, const char *data, size_t len);
+
 /**
  * @brief Handles client disconnection (cleanup).
  * @param client_idx Index of the client.
@@ -208,22 +527,34 @@ void handle_disconnect(int client_idx);
 
 /**
  * @brief Adds a message to a room's history buffer.
- * @param room_name Target room.
+ * @param room_idx Index of the target room.
  * @param message Message string.
  */
-void add_message_to_history(const char *room_name, const char *message);
+void add_message_to_history(int room_idx, const char *message);
 
 /**
  * @brief Sends stored history to a client (usually upon join).
+ *
+ * While the loop lags past shed_history the replay is postponed instead;
+ * replay_postponed_history() sends it once the loop has caught up.
+ *
  * @param client_idx Index of the client.
- * @param room_name Room to retrieve history from.
+ * @param room_idx Index of the room to retrieve history from.
  */
-void send_room_history(int client_idx, const char *room_name);
+void send_room_history(int client_idx, int room_idx);
+
+/**
+ * @brief Sends the postponed replays, each for the client's current room.
+ *
+ * Does nothing while the loop still lags past shed_history; called once per
+ * event loop iteration.
+ */
+void replay_postponed_history(void);
 
 /* --- Activity & Cleanup --- */
 
 /**
- * @brief Updates the last_activity timestamp for a client.
+ * @brief Updates the client_last_activity entry for a client.
  * @param client_idx Index of the client.
  */
 void update_client_activity(int client_idx);
@@ -235,13 +566,22 @@ void check_inactive_clients(void);
 
 /**
  * @brief Counts number of users currently in a room.
- * @param room_name Name of the room.
+ * @param room_idx Index of the room.
  * @return Number of users.
  */
-int count_users_in_room(const char *room_name);
+int count_users_in_room(int room_idx);
+
+/**
+ * @brief Retires rooms that stayed empty for room_grace seconds.
+ *
+ * A room is scheduled when its last local member leaves (a timer, or a
+ * list when room_grace is 0) and its timer is cancelled when someone joins,
+ * so each room is retired in O(1); called once per event loop iteration.
+ */
+void check_empty_rooms(void);
 
 /**
- * @brief Removes rooms that have zero users (except lobby).
+ * @brief Removes rooms that have zero users (except lobby), ignoring the grace period.
  */
 void cleanup_empty_rooms(void);
 
@@ -254,11 +594,4 @@ void cleanup_empty_rooms(void);
  */
 const char *get_user_color(const char *username);
 
-/**
- * @brief Simple hash function for strings.
- * @param str Input string.
- * @return Hash value.
- */
-unsigned int hash_string(const char *str);
-
 #endif /* SERVER_UTILS_H */
\ No newline at end of file
@@ -0,0 +1,517 @@
+#define _GNU_SOURCE
+
+#include "shard.h"
+#include "worker.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+/**
+ * @file shard.c
+ * @brief Reactor threads, CPU pinning and lock-free inboxes.
+ *
+ * An inbox is a Treiber stack: posters push with a compare-and-swap, the
+ * owner detaches the whole list with one exchange and reverses it, so
+ * neither side ever waits for the other. The first post into an idle inbox
+ * also writes a byte to the owner's wakeup socket, which its I/O backend
+ * watches like any client, so a sleeping reactor notices at once.
+ */
+
+/**
+ * @brief Inbox and wakeup state of one shard.
+ */
+typedef struct {
+    ShardMsg *inbox;            /**< Posted messages, newest first */
+    int wake_pending;           /**< Flag: a wakeup byte is on its way */
+    int wake_fds[2];            /**< Socket pair: [0] watched by the owner, [1] written by posters */
+    char pad[64];               /**< Keeps shards that are posted to concurrently off one cache line */
+} Shard;
+
+/**
+ * @brief Startup parameters of one reactor thread.
+ */
+typedef struct {
+    int id;                     /**< Shard index */
+    int cpu;                    /**< CPU to pin to, or -1 */
+    int (*reactor)(void *arg);  /**< Event loop */
+    void *arg;                  /**< Its argument */
+    int result;                 /**< Its return value */
+} ShardStart;
+
+int shard_count = 1;
+__thread int shard_id = 0;
+
+static Shard *shards = NULL;
+
+/** @brief CPU list from cpu_affinity; affinity_auto selects the allowed CPUs instead. */
+static int affinity_cpus[MAX_SHARDS];
+static int affinity_count = 0;
+static int affinity_auto = 0;
+
+/** @brief Holds the threads until all of them exist (1 = run, -1 = give up). */
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static int start_state = 0;
+
+/**
+ * @brief Parses the cpu_affinity setting.
+ *
+ * @param spec "none", "auto" or a list like "0,2,4-7".
+ * @return 0 on success, -1 if malformed.
+ */
+int shard_parse_affinity(const char *spec) {
+    const char *p = spec;
+    char *end;
+    long first, last;
+    int count = 0;
+
+    if (strcmp(spec, "none") == 0 || strcmp(spec, "auto") == 0) {
+        affinity_auto = spec[0] == 'a';
+        affinity_count = 0;
+        return 0;
+    }
+
+    while (*p) {
+        first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE) return -1;
+        last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first || last >= CPU_SETSIZE) return -1;
+            p = end;
+        }
+        while (first <= last && count < MAX_SHARDS) {
+            affinity_cpus[count++] = (int)first++;
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p) {
+            return -1;
+        }
+    }
+    if (count == 0) return -1;
+
+    affinity_count = count;
+    affinity_auto = 0;
+    return 0;
+}
+
+/**
+ * @brief Allocates inboxes and wakeup sockets.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int shard_init(void) {
+    int i;
+
+    /* A single shard only needs an inbox when workers post to it */
+    if (shard_count <= 1 && worker_count <= 0) return 0;
+
+    shards = calloc(shard_count, sizeof(*shards));
+    if (!shards) return -1;
+
+    for (i = 0; i < shard_count; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, shards[i].wake_fds) < 0) {
+            perror("socketpair");
+            while (i-- > 0) {
+                close(shards[i].wake_fds[0]);
+                close(shards[i].wake_fds[1]);
+            }
+            free(shards);
+            shards = NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Releases inboxes and wakeup sockets.
+ */
+void shard_free(void) {
+    ShardMsg *msg;
+    int i;
+
+    if (!shards) return;
+
+    for (i = 0; i < shard_count; i++) {
+        while ((msg = shards[i].inbox) != NULL) {
+            shards[i].inbox = msg->next;
+            shard_msg_free(msg);
+        }
+        close(shards[i].wake_fds[0]);
+        close(shards[i].wake_fds[1]);
+    }
+    free(shards);
+    shards = NULL;
+}
+
+/**
+ * @brief Pins the calling thread to one CPU.
+ *
+ * @param id Shard index, for the error message.
+ * @param cpu CPU number, or -1 to leave the thread unpinned.
+ */
+static void pin_thread(int id, int cpu) {
+    cpu_set_t set;
+
+    if (cpu < 0) return;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        fprintf(stderr, "Shard %d: cannot pin to CPU %d\n", id, cpu);
+    }
+}
+
+/**
+ * @brief Picks the CPU for each shard from the cpu_affinity setting.
+ *
+ * @param cpus Output, shard_count entries (-1 = unpinned).
+ */
+static void assign_cpus(int *cpus) {
+    int allowed[MAX_SHARDS];
+    int count = 0;
+    cpu_set_t set;
+    int i;
+
+    if (affinity_auto && sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (i = 0; i < CPU_SETSIZE && count < MAX_SHARDS; i++) {
+            if (CPU_ISSET(i, &set)) allowed[count++] = i;
+        }
+    } else {
+        memcpy(allowed, affinity_cpus, affinity_count * sizeof(*allowed));
+        count = affinity_count;
+    }
+
+    for (i = 0; i < shard_count; i++) {
+        cpus[i] = count > 0 ? allowed[i % count] : -1;
+    }
+}
+
+/**
+ * @brief Thread body: waits for the go signal, then runs one reactor.
+ *
+ * @param arg The thread's ShardStart.
+ * @return NULL.
+ */
+static void *shard_thread(void *arg) {
+    ShardStart *start = arg;
+    int state;
+
+    pthread_mutex_lock(&start_lock);
+    while ((state = start_state) == 0) {
+        pthread_cond_wait(&start_cond, &start_lock);
+    }
+    pthread_mutex_unlock(&start_lock);
+
+    if (state < 0) {
+        start->result = -1;
+        return NULL;
+    }
+
+    shard_id = start->id;
+    pin_thread(start->id, start->cpu);
+    start->result = start->reactor(start->arg);
+    return NULL;
+}
+
+/**
+ * @brief Releases (or cancels) the threads waiting in shard_thread().
+ *
+ * @param state 1 to run the reactors, -1 to give up.
+ */
+static void release_threads(int state) {
+    pthread_mutex_lock(&start_lock);
+    start_state = state;
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&start_lock);
+}
+
+/**
+ * @brief Runs one reactor per shard and waits for all of them.
+ *
+ * @param reactor Event loop of one shard.
+ * @param arg Passed through to reactor.
+ * @return 0 if every reactor returned 0, -1 otherwise.
+ */
+int shard_run(int (*reactor)(void *arg), void *arg) {
+    pthread_t threads[MAX_SHARDS];
+    ShardStart start[MAX_SHARDS];
+    int cpus[MAX_SHARDS];
+    sigset_t block, old;
+    int created;
+    int rc = 0;
+    int i;
+
+    assign_cpus(cpus);
+
+    /* Threads inherit the mask, leaving shutdown signals to the main thread */
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+
+    for (created = 1; created < shard_count; created++) {
+        start[created].id = created;
+        start[created].cpu = cpus[created];
+        start[created].reactor = reactor;
+        start[created].arg = arg;
+        start[created].result = 0;
+        if (pthread_create(&threads[created], NULL, shard_thread, &start[created]) != 0) {
+            fprintf(stderr, "Cannot start reactor thread %d\n", created);
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (created < shard_count) {
+        release_threads(-1);
+        rc = -1;
+    } else {
+        release_threads(1);
+        shard_id = 0;
+        pin_thread(0, cpus[0]);
+        rc = reactor(arg);
+    }
+
+    for (i = 1; i < created; i++) {
+        pthread_join(threads[i], NULL);
+        if (start[i].result != 0) rc = -1;
+    }
+    return rc;
+}
+
+/**
+ * @brief Returns the calling shard's wakeup socket.
+ *
+ * @return Descriptor, or -1 without inboxes.
+ */
+int shard_wake_fd(void) {
+    return shards ? shards[shard_id].wake_fds[0] : -1;
+}
+
+/**
+ * @brief Consumes wakeup bytes and re-arms wakeups.
+ *
+ * @param drain Flag: read the socket until it is empty.
+ */
+void shard_ack_wake(int drain) {
+    char buf[64];
+
+    if (!shards) return;
+
+    if (drain) {
+        while (recv(shards[shard_id].wake_fds[0], buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+        }
+    }
+    /* Cleared before the inbox is taken, so a later post writes a new byte */
+    __atomic_store_n(&shards[shard_id].wake_pending, 0, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Pushes a message onto a shard's inbox and wakes the owner if idle.
+ *
+ * @param target Shard index.
+ * @param msg The message.
+ */
+static void post(int target, ShardMsg *msg) {
+    Shard *s = &shards[target];
+    ShardMsg *head = __atomic_load_n(&s->inbox, __ATOMIC_RELAXED);
+
+    do {
+        msg->next = head;
+    } while (!__atomic_compare_exchange_n(&s->inbox, &head, msg, 1,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    if (!__atomic_exchange_n(&s->wake_pending, 1, __ATOMIC_SEQ_CST)) {
+        send(s->wake_fds[1], "", 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+}
+
+/**
+ * @brief Allocates an inbox entry.
+ *
+ * @param kind Addressing.
+ * @param target Room name or username.
+ * @param buf Message; the entry takes a reference.
+ * @param record History flag.
+ * @return The entry, or NULL on allocation failure.
+ */
+static ShardMsg *new_msg(ShardMsgKind kind, const char *target, MsgBuf *buf, int record) {
+    ShardMsg *msg = malloc(sizeof(*msg));
+
+    if (!msg) return NULL;
+
+    msg->kind = kind;
+    msg->record = record;
+    msg->client = -1;
+    msg->client_id = 0;
+    strncpy(msg->target, target, sizeof(msg->target) - 1);
+    msg->target[sizeof(msg->target) - 1] = '\0';
+    msg->buf = msgbuf_ref(buf);
+    return msg;
+}
+
+/**
+ * @brief Posts a room-wide message to every other shard.
+ *
+ * @param kind SHARD_MSG_ROOM or SHARD_MSG_TYPING.
+ * @param room Room name.
+ * @param buf Message.
+ * @param record History flag.
+ * @param exclude_client Client slot to skip, or -1.
+ * @param exclude_id Its connection id.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int post_room_wide(ShardMsgKind kind, const char *room, MsgBuf *buf, int record,
+                          int exclude_client, unsigned long exclude_id) {
+    ShardMsg *msg;
+    int rc = 0;
+    int i;
+
+    for (i = 0; shards && i < shard_count; i++) {
+        if (i == shard_id) continue;
+
+        msg = new_msg(kind, room, buf, record);
+        if (!msg) {
+            rc = -1;
+            continue;
+        }
+        msg->client = exclude_client;
+        msg->client_id = exclude_id;
+        post(i, msg);
+    }
+    return rc;
+}
+
+/**
+ * @brief Posts a room message to every other shard.
+ *
+ * @param room Room name.
+ * @param buf Message.
+ * @param record History flag.
+ * @param exclude_client Client slot to skip, or -1.
+ * @param exclude_id Its connection id.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int shard_post_room(const char *room, MsgBuf *buf, int record, int exclude_client, unsigned long exclude_id) {
+    return post_room_wide(SHARD_MSG_ROOM, room, buf, record, exclude_client, exclude_id);
+}
+
+/**
+ * @brief Posts a typing notice for a room to every other shard.
+ *
+ * @param room Room name.
+ * @param buf Notice.
+ * @param exclude_client Client slot to skip, or -1.
+ * @param exclude_id Its connection id.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int shard_post_typing(const char *room, MsgBuf *buf, int exclude_client, unsigned long exclude_id) {
+    return post_room_wide(SHARD_MSG_TYPING, room, buf, 0, exclude_client, exclude_id);
+}
+
+/**
+ * @brief Posts a typer to the shard that renders the room's notices.
+ *
+ * @param target Shard index.
+ * @param room Room name.
+ * @param name The typer's name.
+ * @param client The typer's client slot.
+ * @param client_id Its connection id.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int shard_post_typer(int target, const char *room, MsgBuf *name, int client, unsigned long client_id) {
+    ShardMsg *msg;
+
+    if (!shards || target < 0 || target >= shard_count) return -1;
+
+    msg = new_msg(SHARD_MSG_TYPER, room, name, 0);
+    if (!msg) return -1;
+    msg->client = client;
+    msg->client_id = client_id;
+    post(target, msg);
+    return 0;
+}
+
+/**
+ * @brief Posts a message for one user.
+ *
+ * @param target Shard index.
+ * @param username Recipient.
+ * @param buf Message.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int shard_post_user(int target, const char *username, MsgBuf *buf) {
+    ShardMsg *msg;
+
+    if (!shards || target < 0 || target >= shard_count) return -1;
+
+    msg = new_msg(SHARD_MSG_USER, username, buf, 0);
+    if (!msg) return -1;
+    post(target, msg);
+    return 0;
+}
+
+/**
+ * @brief Posts a message for one connection.
+ *
+ * @param target Shard index.
+ * @param client Client slot.
+ * @param client_id Connection id.
+ * @param buf Message.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int shard_post_client(int target, int client, unsigned long client_id, MsgBuf *buf) {
+    ShardMsg *msg;
+
+    if (!shards || target < 0 || target >= shard_count) return -1;
+
+    msg = new_msg(SHARD_MSG_CLIENT, "", buf, 0);
+    if (!msg) return -1;
+    msg->client = client;
+    msg->client_id = client_id;
+    post(target, msg);
+    return 0;
+}
+
+/**
+ * @brief Detaches the calling shard's inbox.
+ *
+ * @return Messages in posting order, or NULL.
+ */
+ShardMsg *shard_take(void) {
+    ShardMsg *list;
+    ShardMsg *ordered = NULL;
+    ShardMsg *next;
+
+    if (!shards || !__atomic_load_n(&shards[shard_id].inbox, __ATOMIC_RELAXED)) return NULL;
+
+    list = __atomic_exchange_n(&shards[shard_id].inbox, NULL, __ATOMIC_SEQ_CST);
+
+    /* The stack is newest first; reverse it */
+    while (list) {
+        next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+    return ordered;
+}
+
+/**
+ * @brief Frees a taken message.
+ *
+ * @param msg The message.
+ */
+void shard_msg_free(ShardMsg *msg) {
+    msgbuf_unref(msg->buf);
+    free(msg);
+}
@@ -0,0 +1,181 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "msgbuf.h"
+#include "protocol.h"
+
+/**
+ * @file shard.h
+ * @brief Reactor threads ("shards") and the inboxes that connect them.
+ *
+ * Each shard runs its own event loop with its own listening socket, I/O
+ * backend, clients and copies of the rooms those clients use; that state is
+ * thread-local, so a shard never touches another shard's clients. Output
+ * for users on other shards is posted to their inboxes instead: lock-free
+ * lists that any thread can push to and only the owner drains, once per
+ * loop iteration. A posted message only carries a reference to the MsgBuf
+ * the sender already rendered.
+ */
+
+#define MAX_SHARDS  64      /**< Upper limit of the threads setting */
+
+/**
+ * @brief What a posted message is addressed to.
+ */
+typedef enum {
+    SHARD_MSG_ROOM,         /**< Every local member of a room */
+    SHARD_MSG_USER,         /**< One user */
+    SHARD_MSG_CLIENT,       /**< One connection, named or not (worker replies) */
+    SHARD_MSG_TYPING,       /**< The local members of a room that take typing notices */
+    SHARD_MSG_TYPER         /**< The shard that renders a room's typing notices: a member typing elsewhere */
+} ShardMsgKind;
+
+/**
+ * @brief A message in a shard's inbox.
+ */
+typedef struct ShardMsg {
+    struct ShardMsg *next;          /**< Inbox link */
+    ShardMsgKind kind;              /**< Addressing */
+    int record;                     /**< Flag: ROOM, also append to the room's history */
+    char target[MAX_ROOMNAME];      /**< Room name or username */
+    int client;                     /**< CLIENT: recipient's slot; ROOM, TYPING: slot of a member to skip, or -1; TYPER: the typer's slot */
+    unsigned long client_id;        /**< That client's connection id, which tells the shards apart */
+    MsgBuf *buf;                    /**< Message; holds one reference (NUL after len when record is set); TYPER: the typer's name */
+} ShardMsg;
+
+extern int shard_count;             /**< Number of reactor threads (threads setting) */
+extern __thread int shard_id;       /**< Shard run by the calling thread */
+
+/**
+ * @brief Parses the cpu_affinity setting.
+ *
+ * "none" leaves scheduling to the kernel, "auto" pins shard i to online
+ * CPU i (modulo the CPU count), and a list such as "0,2,4-7" pins shard i
+ * to the i-th listed CPU (modulo the list length).
+ *
+ * @param spec Setting value.
+ * @return 0 on success, -1 if spec is malformed.
+ */
+int shard_parse_affinity(const char *spec);
+
+/**
+ * @brief Allocates the inboxes and wakeup sockets for shard_count shards.
+ *
+ * Needed with several shards or with workers (see worker.h); otherwise
+ * nothing is allocated and the posting functions fail.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int shard_init(void);
+
+/**
+ * @brief Drops undelivered messages and releases what shard_init() allocated.
+ */
+void shard_free(void);
+
+/**
+ * @brief Runs `reactor` once per shard and waits for every one to return.
+ *
+ * Shard 0 runs on the calling thread; the others get threads of their own,
+ * with SIGINT and SIGTERM blocked so signals reach the main thread. Each
+ * thread sets shard_id and applies its CPU affinity before calling reactor.
+ *
+ * @param reactor Event loop of one shard.
+ * @param arg Passed through to reactor.
+ * @return 0 if every reactor returned 0, -1 otherwise.
+ */
+int shard_run(int (*reactor)(void *arg), void *arg);
+
+/**
+ * @brief Returns the calling shard's wakeup socket.
+ *
+ * The owner watches it with the I/O backend; a byte arrives whenever its
+ * inbox goes from idle to non-empty.
+ *
+ * @return Socket descriptor, or -1 when inboxes are not in use.
+ */
+int shard_wake_fd(void);
+
+/**
+ * @brief Reads pending wakeup bytes and re-arms wakeups for the caller.
+ *
+ * @param drain Flag: read the socket (readiness backends); completion
+ *              backends have already consumed the bytes.
+ */
+void shard_ack_wake(int drain);
+
+/**
+ * @brief Posts a room message to every other shard.
+ *
+ * Called from a worker thread, it goes to every shard.
+ *
+ * @param room Room name.
+ * @param buf Message; each inbox entry takes its own reference.
+ * @param record Flag: receivers also append it to the room's history
+ *               (buf must then hold a NUL after its len bytes).
+ * @param exclude_client Client slot of a member to skip, or -1.
+ * @param exclude_id That member's connection id (skipped only on its own shard).
+ * @return 0 on success, -1 if an allocation failed (some shards miss it).
+ */
+int shard_post_room(const char *room, MsgBuf *buf, int record, int exclude_client, unsigned long exclude_id);
+
+/**
+ * @brief Posts a typing notice for a room to every other shard.
+ *
+ * @param room Room name.
+ * @param buf Notice; each inbox entry takes its own reference.
+ * @param exclude_client Client slot of a lone typer to skip, or -1.
+ * @param exclude_id That typer's connection id.
+ * @return 0 on success, -1 if an allocation failed (some shards miss it).
+ */
+int shard_post_typing(const char *room, MsgBuf *buf, int exclude_client, unsigned long exclude_id);
+
+/**
+ * @brief Tells the shard that renders a room's typing notices about a typer.
+ *
+ * @param target Shard index.
+ * @param room Room name.
+ * @param name The typer's name; the inbox entry takes its own reference.
+ * @param client The typer's client slot.
+ * @param client_id Its connection id.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int shard_post_typer(int target, const char *room, MsgBuf *name, int client, unsigned long client_id);
+
+/**
+ * @brief Posts a message for one user to the shard it is connected to.
+ *
+ * @param target Shard index.
+ * @param username Recipient.
+ * @param buf Message; the inbox entry takes its own reference.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int shard_post_user(int target, const char *username, MsgBuf *buf);
+
+/**
+ * @brief Posts a message for one connection.
+ *
+ * Dropped on delivery if the slot has been reused by another connection.
+ *
+ * @param target Shard index.
+ * @param client Client slot on that shard.
+ * @param client_id The connection's id.
+ * @param buf Message; the inbox entry takes its own reference.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int shard_post_client(int target, int client, unsigned long client_id, MsgBuf *buf);
+
+/**
+ * @brief Takes every message posted to the calling shard.
+ *
+ * @return List in posting order (per sender), or NULL if the inbox is empty.
+ */
+ShardMsg *shard_take(void);
+
+/**
+ * @brief Releases a message taken with shard_take() and its reference.
+ * @param msg The message.
+ */
+void shard_msg_free(ShardMsg *msg);
+
+#endif /* SHARD_H */
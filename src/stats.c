@@ -0,0 +1,719 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+#include "directory.h"
+#include "colors.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+
+/**
+ * @file stats.c
+ * @brief Per-shard counters, /stats and Prometheus reports, admin socket.
+ *
+ * A slot is only written by its own shard, with a relaxed load and store
+ * rather than an atomic add, so an update costs about as much as a plain
+ * increment. Readers use relaxed loads and never write; the latency dump
+ * keeps its own copy of the counts it reported last and subtracts it.
+ * Phase times also carry the start of the phase in progress, which must be
+ * read together with them, so they are guarded by a sequence count.
+ */
+
+#define ADMIN_POLL_MS       200     /**< How often the admin thread checks for stats_stop() */
+#define ADMIN_REQUEST_MS    100     /**< How long a connection may take to send its request */
+#define ADMIN_SEND_TIMEOUT  1       /**< Seconds a report may take to write */
+
+/**
+ * @brief One shard's counters and gauges.
+ */
+typedef struct {
+    long values[STAT_COUNT];                        /**< By StatId */
+    unsigned long fanout[STATS_FANOUT_BUCKETS];     /**< Deliveries per fan-out bucket */
+    long phase_ns[PHASE_COUNT];                     /**< Nanoseconds spent per LoopPhase, up to phase_since */
+    unsigned long phase_seq;                        /**< Odd while phase_ns, phase_since and phase change */
+    unsigned long phase_since;                      /**< When the current phase began (0 before the first switch) */
+    int phase;                                      /**< Current LoopPhase */
+    long lag_ns;                                    /**< Last published event-loop lag */
+    char pad[64];                                   /**< Keeps neighbouring shards off one cache line */
+} StatsSlot;
+
+/**
+ * @brief How a counter or gauge is reported.
+ */
+typedef struct {
+    const char *name;       /**< Prometheus metric name, NULL if only part of the histogram */
+    const char *type;       /**< "counter" or "gauge" */
+    const char *help;       /**< HELP text */
+} StatInfo;
+
+/** @brief Report names, by StatId. */
+static const StatInfo stat_info[STAT_COUNT] = {
+    {"chat_messages_received_total", "counter", "Lines received from clients."},
+    {"chat_messages_sent_total",     "counter", "Messages handed to client sockets or queues."},
+    {"chat_received_bytes_total",    "counter", "Bytes received from clients."},
+    {"chat_sent_bytes_total",        "counter", "Bytes of the messages sent."},
+    {"chat_messages_dropped_total",  "counter", "Messages not delivered to slow clients."},
+    {"chat_broadcasts_total",        "counter", "Room deliveries that reached at least one client, counted per shard."},
+    {NULL,                           NULL,      NULL},
+    {"chat_timeouts_total",          "counter", "Clients disconnected for inactivity."},
+    {"chat_shed_accepts_total",      "counter", "Connections turned away while the event loop lagged."},
+    {"chat_shed_typing_total",       "counter", "Typing notifications dropped while the event loop lagged."},
+    {"chat_postponed_replays_total", "counter", "History replays postponed while the event loop lagged."},
+    {"chat_clients",                 "gauge",   "Connected clients."},
+    {"chat_output_queue_bytes",      "gauge",   "Output waiting in client queues."},
+    {"chat_output_queue_clients",    "gauge",   "Clients with output waiting."}
+};
+
+/** @brief Report names, by LoopPhase. */
+static const char *const phase_names[PHASE_COUNT] = {
+    "idle", "accept", "read", "dispatch", "write", "maintenance"
+};
+
+static StatsSlot slots[MAX_SHARDS];
+
+/** @brief The calling thread's slot. */
+static __thread StatsSlot *local = &slots[0];
+
+/** @brief The calling thread's loop phase and when it was entered (0 before the first switch). */
+static __thread LoopPhase current_phase = PHASE_IDLE;
+static __thread unsigned long phase_start = 0;
+
+/** @brief Command latency histograms per shard (counts wrap, only differences are used). */
+static unsigned int latency[MAX_SHARDS][STATS_MAX_COMMANDS][LATENCY_BUCKETS];
+static __thread unsigned int (*local_latency)[LATENCY_BUCKETS] = latency[0];
+
+/** @brief Command names for the dump, NULL for unused numbers. */
+static const char *command_names[STATS_MAX_COMMANDS];
+
+/** @brief Guards latency_seen: the summed counts at each reader's previous dump. */
+static pthread_mutex_t latency_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int latency_seen[LATENCY_READERS][STATS_MAX_COMMANDS][LATENCY_BUCKETS];
+
+/** @brief Per-second rates sampled by stats_tick(), by StatId. */
+static pthread_mutex_t rate_lock = PTHREAD_MUTEX_INITIALIZER;
+static double rates[STAT_COUNT];
+static double phase_shares[PHASE_COUNT];    /**< Fraction of the last second's reactor time in each phase */
+
+/** @brief Previous sample; only shard 0 uses these. */
+static StatsSnapshot last_sample;
+static time_t last_sample_time = 0;
+
+/** @brief Admin socket state. */
+static int admin_fd = -1;
+static int admin_stopping = 0;
+static pthread_t admin_thread;
+static char admin_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+/**
+ * @brief Selects the calling thread's slot.
+ *
+ * @param slot Shard index.
+ */
+void stats_attach(int slot) {
+    local = &slots[slot];
+    local_latency = latency[slot];
+}
+
+/**
+ * @brief Adds to a value owned by the calling thread.
+ *
+ * @param value The value.
+ * @param n Amount.
+ */
+static void bump(long *value, long n) {
+    __atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Adds to one of the calling shard's counters or gauges.
+ *
+ * @param id Counter or gauge.
+ * @param n Amount.
+ */
+void stats_add(StatId id, long n) {
+    bump(&local->values[id], n);
+}
+
+/**
+ * @brief Returns the histogram bucket of a fan-out size.
+ *
+ * @param recipients Clients reached (at least 1).
+ * @return Bucket index: the smallest i with recipients <= 2^i, capped at the last bucket.
+ */
+static int fanout_bucket(int recipients) {
+    int bucket = recipients <= 1 ? 0 : 64 - __builtin_clzl((unsigned long)recipients - 1);
+
+    return bucket < STATS_FANOUT_BUCKETS - 1 ? bucket : STATS_FANOUT_BUCKETS - 1;
+}
+
+/**
+ * @brief Records a room delivery and its size.
+ *
+ * @param recipients Clients it was queued for.
+ */
+void stats_fanout(int recipients) {
+    unsigned long *bucket;
+
+    if (recipients <= 0) return;
+
+    bump(&local->values[STAT_BROADCASTS], 1);
+    bump(&local->values[STAT_FANOUT], recipients);
+    bucket = &local->fanout[fanout_bucket(recipients)];
+    __atomic_store_n(bucket, __atomic_load_n(bucket, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Reads the monotonic clock in nanoseconds.
+ *
+ * @return Nanoseconds.
+ */
+static unsigned long monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+/**
+ * @brief Switches the calling thread to another loop phase.
+ *
+ * @param phase Phase being entered.
+ * @param now If not NULL, receives the clock.
+ * @return The phase being left.
+ */
+LoopPhase stats_phase(LoopPhase phase, unsigned long *now) {
+    LoopPhase previous = current_phase;
+    unsigned long seq;
+    unsigned long t;
+
+    if (phase == previous && !now) return previous;
+
+    t = monotonic_ns();
+    seq = __atomic_load_n(&local->phase_seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&local->phase_seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (phase_start != 0) {
+        bump(&local->phase_ns[previous], (long)(t - phase_start));
+    }
+    __atomic_store_n(&local->phase_since, t, __ATOMIC_RELAXED);
+    __atomic_store_n(&local->phase, (int)phase, __ATOMIC_RELAXED);
+    __atomic_store_n(&local->phase_seq, seq + 2, __ATOMIC_RELEASE);
+    phase_start = t;
+    current_phase = phase;
+    if (now) *now = t;
+    return previous;
+}
+
+/**
+ * @brief Publishes the calling shard's event-loop lag.
+ *
+ * @param ns Lag in nanoseconds.
+ */
+void stats_lag(unsigned long ns) {
+    __atomic_store_n(&local->lag_ns, (long)ns, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Names a command for the latency dump.
+ *
+ * @param command Command number.
+ * @param name Its name.
+ */
+void stats_name_command(int command, const char *name) {
+    __atomic_store_n(&command_names[command], name, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Maps a duration to its latency bucket.
+ *
+ * @param ns Duration, below 2^LATENCY_MAX_BITS.
+ * @return Bucket index.
+ */
+static int latency_bucket(unsigned long ns) {
+    int major;
+
+    if (ns < (1UL << LATENCY_SUB_BITS)) return (int)ns;
+    major = 63 - __builtin_clzl(ns);
+    return ((major - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) +
+           (int)((ns >> (major - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1));
+}
+
+/**
+ * @brief Returns the smallest duration that falls into a bucket.
+ *
+ * @param index Bucket index (LATENCY_BUCKETS for the end of the range).
+ * @return Nanoseconds.
+ */
+static unsigned long latency_bucket_start(int index) {
+    int major;
+
+    if (index < (1 << LATENCY_SUB_BITS)) return (unsigned long)index;
+    major = (index >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+    return (unsigned long)((1 << LATENCY_SUB_BITS) | (index & ((1 << LATENCY_SUB_BITS) - 1)))
+           << (major - LATENCY_SUB_BITS);
+}
+
+/**
+ * @brief Records how long one command took.
+ *
+ * @param command Command number.
+ * @param ns Duration in nanoseconds.
+ */
+void stats_command_time(int command, unsigned long ns) {
+    unsigned int *count;
+
+    if (ns >= (1UL << LATENCY_MAX_BITS)) ns = (1UL << LATENCY_MAX_BITS) - 1;
+    count = &local_latency[command][latency_bucket(ns)];
+    __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Returns a percentile of a histogram.
+ *
+ * @param counts Samples per bucket.
+ * @param total Number of samples (at least 1).
+ * @param fraction Percentile as a fraction (0.99 for p99).
+ * @return Upper bound of the bucket holding it, in microseconds.
+ */
+static double latency_percentile(const unsigned int *counts, unsigned long total, double fraction) {
+    unsigned long wanted = (unsigned long)(fraction * total + 0.5);
+    unsigned long seen = 0;
+    int i;
+
+    if (wanted < 1) wanted = 1;
+    for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        seen += counts[i];
+        if (seen >= wanted) break;
+    }
+    return latency_bucket_start(i + 1) / 1000.0;
+}
+
+/**
+ * @brief Renders the latency dump and starts a new period.
+ *
+ * @param reader Whose period to report and restart.
+ * @param buf Output buffer.
+ * @param size Its size.
+ * @return Length of the report.
+ */
+size_t stats_format_latency(LatencyReader reader, char *buf, size_t size) {
+    unsigned int (*seen)[LATENCY_BUCKETS] = latency_seen[reader];
+    unsigned int period[LATENCY_BUCKETS];
+    unsigned int sum;
+    unsigned long total;
+    const char *name;
+    size_t len;
+    int shown = 0;
+    int last;
+    int c, b, s;
+
+    pthread_mutex_lock(&latency_lock);
+    len = snprintf(buf, size, "Command latency since the last dump (us, within 6%%):\n"
+                              "  %-8s %10s %10s %10s %10s %10s\n",
+                   "command", "calls", "p50", "p90", "p99", "max");
+
+    for (c = 0; c < STATS_MAX_COMMANDS && len < size; c++) {
+        name = __atomic_load_n(&command_names[c], __ATOMIC_ACQUIRE);
+        if (!name) continue;
+
+        total = 0;
+        last = 0;
+        for (b = 0; b < LATENCY_BUCKETS; b++) {
+            sum = 0;
+            for (s = 0; s < shard_count; s++) {
+                sum += __atomic_load_n(&latency[s][c][b], __ATOMIC_RELAXED);
+            }
+            period[b] = sum - seen[c][b];
+            seen[c][b] = sum;
+            total += period[b];
+            if (period[b] > 0) last = b;
+        }
+        if (total == 0) continue;
+
+        len += snprintf(buf + len, size - len, "  %-8s %10lu %10.1f %10.1f %10.1f %10.1f\n",
+                        name, total,
+                        latency_percentile(period, total, 0.50),
+                        latency_percentile(period, total, 0.90),
+                        latency_percentile(period, total, 0.99),
+                        latency_bucket_start(last + 1) / 1000.0);
+        shown++;
+    }
+    if (shown == 0 && len < size) {
+        len += snprintf(buf + len, size - len, "  (no commands)\n");
+    }
+    pthread_mutex_unlock(&latency_lock);
+    return len < size ? len : size - 1;
+}
+
+/**
+ * @brief Adds one shard's phase times, counting its current phase up to now.
+ *
+ * A shard blocked in its wait has not charged that time yet; without it
+ * the idle share would arrive in lumps whenever the wait returns.
+ *
+ * @param slot The shard's slot.
+ * @param now Monotonic clock in nanoseconds.
+ * @param phase_ns Totals to add to, by LoopPhase.
+ */
+static void collect_phases(StatsSlot *slot, unsigned long now, long *phase_ns) {
+    long ns[PHASE_COUNT];
+    unsigned long seq, since;
+    int phase;
+    int i;
+
+    do {
+        seq = __atomic_load_n(&slot->phase_seq, __ATOMIC_ACQUIRE);
+        for (i = 0; i < PHASE_COUNT; i++) {
+            ns[i] = __atomic_load_n(&slot->phase_ns[i], __ATOMIC_RELAXED);
+        }
+        since = __atomic_load_n(&slot->phase_since, __ATOMIC_RELAXED);
+        phase = __atomic_load_n(&slot->phase, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&slot->phase_seq, __ATOMIC_RELAXED));
+
+    if (since != 0 && now > since) {
+        ns[phase] += (long)(now - since);
+    }
+    for (i = 0; i < PHASE_COUNT; i++) {
+        phase_ns[i] += ns[i];
+    }
+}
+
+/**
+ * @brief Adds up every shard's slot.
+ *
+ * @param snap Receives the totals.
+ */
+void stats_collect(StatsSnapshot *snap) {
+    unsigned long now = monotonic_ns();
+    long lag;
+    int s, i;
+
+    memset(snap, 0, sizeof(*snap));
+    for (s = 0; s < shard_count; s++) {
+        for (i = 0; i < STAT_COUNT; i++) {
+            snap->values[i] += __atomic_load_n(&slots[s].values[i], __ATOMIC_RELAXED);
+        }
+        for (i = 0; i < STATS_FANOUT_BUCKETS; i++) {
+            snap->fanout[i] += __atomic_load_n(&slots[s].fanout[i], __ATOMIC_RELAXED);
+        }
+        collect_phases(&slots[s], now, snap->phase_ns);
+        lag = __atomic_load_n(&slots[s].lag_ns, __ATOMIC_RELAXED);
+        if (lag > snap->lag_ns) snap->lag_ns = lag;
+    }
+    snap->rooms = dir_room_count();
+}
+
+/**
+ * @brief Samples the per-second rates once the second has changed.
+ *
+ * @param now Monotonic seconds.
+ */
+void stats_tick(time_t now) {
+    StatsSnapshot snap;
+    double elapsed;
+    long loop_ns = 0;
+    int i;
+
+    if (now == last_sample_time) return;
+
+    stats_collect(&snap);
+    if (last_sample_time != 0) {
+        elapsed = (double)(now - last_sample_time);
+        pthread_mutex_lock(&rate_lock);
+        for (i = 0; i < STAT_COUNT; i++) {
+            rates[i] = (snap.values[i] - last_sample.values[i]) / elapsed;
+        }
+        /* Shares of the time actually accounted, so the split adds up to 100% */
+        for (i = 0; i < PHASE_COUNT; i++) {
+            loop_ns += snap.phase_ns[i] - last_sample.phase_ns[i];
+        }
+        for (i = 0; i < PHASE_COUNT; i++) {
+            phase_shares[i] = loop_ns > 0 ? (double)(snap.phase_ns[i] - last_sample.phase_ns[i]) / loop_ns : 0.0;
+        }
+        pthread_mutex_unlock(&rate_lock);
+    }
+    last_sample = snap;
+    last_sample_time = now;
+}
+
+/**
+ * @brief Renders the /stats reply.
+ *
+ * @param buf Output buffer.
+ * @param size Its size.
+ * @return Length of the reply.
+ */
+size_t stats_format(char *buf, size_t size) {
+    StatsSnapshot snap;
+    double rate[STAT_COUNT];
+    double share[PHASE_COUNT];
+    const long *v = snap.values;
+    size_t len;
+    int i;
+
+    stats_collect(&snap);
+    pthread_mutex_lock(&rate_lock);
+    memcpy(rate, rates, sizeof(rate));
+    memcpy(share, phase_shares, sizeof(share));
+    pthread_mutex_unlock(&rate_lock);
+
+    len = snprintf(buf, size,
+                   COLOR_SERVER "[SERVER] Server stats:" COLOR_RESET "\n"
+                   COLOR_INFO "  Clients: %ld (%ld with queued output, %ld bytes queued)\n"
+                   "  Rooms: %d\n"
+                   "  Messages in: %ld (%.0f/s), out: %ld (%.0f/s), dropped: %ld\n"
+                   "  Bytes in: %ld (%.0f/s), out: %ld (%.0f/s)\n"
+                   "  Broadcasts: %ld (%.0f/s), average fan-out %.1f\n"
+                   "  Timeouts: %ld\n"
+                   "  Loop lag: %.1f ms (slowest shard); shed: %ld connections, %ld typing, %ld replays postponed\n"
+                   "  Loop time (%% of all shards):",
+                   v[STAT_CLIENTS], v[STAT_QUEUED_CLIENTS], v[STAT_QUEUED_BYTES],
+                   snap.rooms,
+                   v[STAT_MESSAGES_IN], rate[STAT_MESSAGES_IN], v[STAT_MESSAGES_OUT], rate[STAT_MESSAGES_OUT],
+                   v[STAT_DROPPED],
+                   v[STAT_BYTES_IN], rate[STAT_BYTES_IN], v[STAT_BYTES_OUT], rate[STAT_BYTES_OUT],
+                   v[STAT_BROADCASTS], rate[STAT_BROADCASTS],
+                   v[STAT_BROADCASTS] ? (double)v[STAT_FANOUT] / v[STAT_BROADCASTS] : 0.0,
+                   v[STAT_TIMEOUTS],
+                   snap.lag_ns / 1e6, v[STAT_SHED_ACCEPTS], v[STAT_SHED_TYPING], v[STAT_POSTPONED_REPLAYS]);
+
+    for (i = 0; i < PHASE_COUNT && len < size; i++) {
+        len += snprintf(buf + len, size - len, " %s %.1f%s", phase_names[i], share[i] * 100.0,
+                        i < PHASE_COUNT - 1 ? "," : "\n  Fan-out:");
+    }
+    for (i = 0; i < STATS_FANOUT_BUCKETS && len < size; i++) {
+        if (snap.fanout[i] == 0) continue;
+        if (i == STATS_FANOUT_BUCKETS - 1) {
+            len += snprintf(buf + len, size - len, " >%lu: %lu", 1UL << (i - 1), snap.fanout[i]);
+        } else {
+            len += snprintf(buf + len, size - len, " <=%lu: %lu", 1UL << i, snap.fanout[i]);
+        }
+    }
+    if (len < size) {
+        len += snprintf(buf + len, size - len, "%s" COLOR_RESET "\n", v[STAT_BROADCASTS] ? "" : " none");
+    }
+    return len < size ? len : size - 1;
+}
+
+/**
+ * @brief Renders the values in Prometheus text format.
+ *
+ * @param buf Output buffer.
+ * @param size Its size.
+ * @return Length of the report.
+ */
+size_t stats_format_prometheus(char *buf, size_t size) {
+    StatsSnapshot snap;
+    unsigned long cumulative = 0;
+    size_t len = 0;
+    int i;
+
+    stats_collect(&snap);
+
+    for (i = 0; i < STAT_COUNT && len < size; i++) {
+        if (!stat_info[i].name) continue;
+        len += snprintf(buf + len, size - len, "# HELP %s %s\n# TYPE %s %s\n%s %ld\n",
+                        stat_info[i].name, stat_info[i].help,
+                        stat_info[i].name, stat_info[i].type,
+                        stat_info[i].name, snap.values[i]);
+    }
+    if (len < size) {
+        len += snprintf(buf + len, size - len,
+                        "# HELP chat_rooms Rooms on the server.\n# TYPE chat_rooms gauge\nchat_rooms %d\n"
+                        "# HELP chat_broadcast_fanout Clients reached per room delivery.\n"
+                        "# TYPE chat_broadcast_fanout histogram\n",
+                        snap.rooms);
+    }
+    for (i = 0; i < STATS_FANOUT_BUCKETS - 1 && len < size; i++) {
+        cumulative += snap.fanout[i];
+        len += snprintf(buf + len, size - len, "chat_broadcast_fanout_bucket{le=\"%lu\"} %lu\n", 1UL << i, cumulative);
+    }
+    if (len < size) {
+        cumulative += snap.fanout[STATS_FANOUT_BUCKETS - 1];
+        len += snprintf(buf + len, size - len,
+                        "chat_broadcast_fanout_bucket{le=\"+Inf\"} %lu\n"
+                        "chat_broadcast_fanout_sum %ld\n"
+                        "chat_broadcast_fanout_count %lu\n"
+                        "# HELP chat_loop_lag_seconds Event-loop lag of the slowest shard.\n"
+                        "# TYPE chat_loop_lag_seconds gauge\nchat_loop_lag_seconds %.6f\n"
+                        "# HELP chat_loop_seconds_total Reactor time per event-loop phase, all shards together.\n"
+                        "# TYPE chat_loop_seconds_total counter\n",
+                        cumulative, snap.values[STAT_FANOUT], cumulative, snap.lag_ns / 1e9);
+    }
+    for (i = 0; i < PHASE_COUNT && len < size; i++) {
+        len += snprintf(buf + len, size - len, "chat_loop_seconds_total{phase=\"%s\"} %.6f\n",
+                        phase_names[i], snap.phase_ns[i] / 1e9);
+    }
+    return len < size ? len : size - 1;
+}
+
+/**
+ * @brief Writes all of a buffer to a blocking socket.
+ *
+ * @param fd Socket.
+ * @param data Bytes.
+ * @param len Number of bytes.
+ * @return 0 on success, -1 on error or timeout.
+ */
+static int send_all(int fd, const char *data, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0) return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Answers one admin connection.
+ *
+ * @param fd Accepted socket.
+ */
+static void serve_admin_client(int fd) {
+    struct timeval timeout = {ADMIN_SEND_TIMEOUT, 0};
+    struct pollfd pfd;
+    char request[512];
+    char header[160];
+    char body[STATS_REPORT_SIZE];
+    const char *type = "text/plain; version=0.0.4";
+    ssize_t n = 0;
+    size_t len;
+    int header_len;
+
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    /* Scrapers send a request first; a plain `nc -U` sends nothing */
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, ADMIN_REQUEST_MS) > 0) {
+        n = recv(fd, request, sizeof(request) - 1, 0);
+    }
+
+    request[n > 0 ? n : 0] = '\0';
+    if (strstr(request, "latency")) {
+        len = stats_format_latency(LATENCY_ADMIN, body, sizeof(body));
+        type = "text/plain";
+    } else {
+        len = stats_format_prometheus(body, sizeof(body));
+    }
+    if (n >= 4 && memcmp(request, "GET ", 4) == 0) {
+        header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\nContent-Type: %s\r\n"
+                              "Content-Length: %lu\r\n\r\n", type, (unsigned long)len);
+        if (send_all(fd, header, header_len) < 0) return;
+    }
+    send_all(fd, body, len);
+}
+
+/**
+ * @brief Admin thread body: answers connections until stats_stop().
+ *
+ * @param arg Unused.
+ * @return NULL.
+ */
+static void *admin_main(void *arg) {
+    struct pollfd pfd;
+    int fd;
+
+    (void)arg;
+    while (!__atomic_load_n(&admin_stopping, __ATOMIC_ACQUIRE)) {
+        pfd.fd = admin_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, ADMIN_POLL_MS) <= 0) continue;
+
+        fd = accept(admin_fd, NULL, NULL);
+        if (fd < 0) continue;
+        serve_admin_client(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Binds the admin socket and starts its thread.
+ *
+ * @param path Socket path.
+ * @return 0 on success, -1 on failure.
+ */
+int stats_serve(const char *path) {
+    struct sockaddr_un addr;
+    struct stat st;
+    sigset_t block, old;
+    int rc;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Admin socket path too long: %s\n", path);
+        return -1;
+    }
+
+    /* Replace a socket left behind by an earlier run, but never anything else */
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "Admin socket path exists and is not a socket: %s\n", path);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    admin_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (admin_fd < 0) {
+        perror("admin socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (bind(admin_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        chmod(path, S_IRUSR | S_IWUSR) < 0 || listen(admin_fd, 16) < 0) {
+        perror(path);
+        close(admin_fd);
+        admin_fd = -1;
+        return -1;
+    }
+    snprintf(admin_path, sizeof(admin_path), "%s", path);
+
+    /* Shutdown signals are left to the main thread, as with reactors and workers */
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    admin_stopping = 0;
+    rc = pthread_create(&admin_thread, NULL, admin_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (rc != 0) {
+        fprintf(stderr, "Cannot start admin socket thread\n");
+        close(admin_fd);
+        admin_fd = -1;
+        unlink(path);
+        return -1;
+    }
+    printf("Admin socket: %s\n", path);
+    return 0;
+}
+
+/**
+ * @brief Joins the admin thread and removes the socket.
+ */
+void stats_stop(void) {
+    if (admin_fd < 0) return;
+
+    __atomic_store_n(&admin_stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(admin_thread, NULL);
+    close(admin_fd);
+    admin_fd = -1;
+    unlink(admin_path);
+}
@@ -0,0 +1,219 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <time.h>
+#include "shard.h"
+
+/**
+ * @file stats.h
+ * @brief Server counters and gauges, and the reports built from them.
+ *
+ * Every reactor thread updates a slot of its own (selected by stats_attach()),
+ * so updates are plain relaxed stores that never contend with another
+ * thread. Reports add the slots up when they are read: counters only grow,
+ * and each gauge is the sum of the per-shard contributions, so a report may
+ * be a few updates behind but never inconsistent with itself.
+ *
+ * Workers only post to inboxes and never touch client queues, so only
+ * reactor threads update stats.
+ *
+ * Command latencies go into fixed-size log-linear histograms, one per
+ * command and shard (LATENCY_SUB_BITS buckets per power of two, so a
+ * percentile is within about 6%). The counts are never reset; a dump
+ * reports what was added since the previous dump.
+ *
+ * Each reactor also charges its wall-clock time to the loop phase it is in
+ * (see LoopPhase) and publishes its event-loop lag, so an operator can see
+ * which phase a lagging shard spends its time in.
+ */
+
+#define STATS_FANOUT_BUCKETS 18     /**< Fan-out histogram: bucket i counts deliveries to at most 2^i clients; the last is unbounded */
+#define STATS_REPORT_SIZE    8192   /**< Enough for any report */
+#define STATS_MAX_COMMANDS   16     /**< Commands that can be timed */
+#define LATENCY_SUB_BITS     4      /**< log2 of the latency buckets per power of two */
+#define LATENCY_MAX_BITS     35     /**< Latencies are capped just below 2^35 ns (about 34 s) */
+#define LATENCY_BUCKETS      ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) /**< Buckets per histogram */
+
+/**
+ * @brief The counters and gauges kept per shard.
+ */
+typedef enum {
+    STAT_MESSAGES_IN,       /**< Lines received from clients */
+    STAT_MESSAGES_OUT,      /**< Messages handed to client sockets or queues */
+    STAT_BYTES_IN,          /**< Bytes received from clients */
+    STAT_BYTES_OUT,         /**< Bytes of those messages */
+    STAT_DROPPED,           /**< Messages not delivered to a slow client */
+    STAT_BROADCASTS,        /**< Room deliveries that reached at least one client (one per shard) */
+    STAT_FANOUT,            /**< Clients reached by those deliveries */
+    STAT_TIMEOUTS,          /**< Clients disconnected for inactivity */
+    STAT_SHED_ACCEPTS,      /**< Connections turned away while the loop lagged */
+    STAT_SHED_TYPING,       /**< Typing notifications dropped while the loop lagged */
+    STAT_POSTPONED_REPLAYS, /**< History replays postponed while the loop lagged */
+    STAT_CLIENTS,           /**< Gauge: connected clients */
+    STAT_QUEUED_BYTES,      /**< Gauge: output waiting in client queues */
+    STAT_QUEUED_CLIENTS,    /**< Gauge: clients with output waiting */
+    STAT_COUNT
+} StatId;
+
+/**
+ * @brief What a reactor thread is doing, for the loop time breakdown.
+ */
+typedef enum {
+    PHASE_IDLE,             /**< Waiting for events */
+    PHASE_ACCEPT,           /**< Taking new connections */
+    PHASE_READ,             /**< Receiving and framing input */
+    PHASE_DISPATCH,         /**< Running commands and chat lines, including the sends they make */
+    PHASE_WRITE,            /**< Flushing queued output and completed sends */
+    PHASE_MAINTENANCE,      /**< Timers, inbox delivery and disconnects */
+    PHASE_COUNT
+} LoopPhase;
+
+/**
+ * @brief Consumers of the latency dump; each has its own period.
+ */
+typedef enum {
+    LATENCY_SIGNAL,         /**< Dump printed after SIGUSR1 */
+    LATENCY_ADMIN,          /**< Scrapes of the admin socket */
+    LATENCY_READERS
+} LatencyReader;
+
+/**
+ * @brief Server-wide values at one point in time.
+ */
+typedef struct {
+    long values[STAT_COUNT];                        /**< Sums over the shards, by StatId */
+    unsigned long fanout[STATS_FANOUT_BUCKETS];     /**< Deliveries per fan-out bucket (not cumulative) */
+    long phase_ns[PHASE_COUNT];                     /**< Nanoseconds spent per LoopPhase, all shards together, including the phases in progress */
+    long lag_ns;                                    /**< Event-loop lag of the slowest shard */
+    int rooms;                                      /**< Rooms server-wide */
+} StatsSnapshot;
+
+/**
+ * @brief Selects the calling thread's slot.
+ *
+ * Threads that never call it share slot 0, which belongs to shard 0, the
+ * main thread.
+ *
+ * @param slot Shard index.
+ */
+void stats_attach(int slot);
+
+/**
+ * @brief Adds to one of the calling shard's counters or gauges.
+ *
+ * @param id Counter or gauge.
+ * @param n Amount; negative for a gauge that goes down.
+ */
+void stats_add(StatId id, long n);
+
+/**
+ * @brief Records a room delivery and its size.
+ *
+ * @param recipients Clients it was queued for; deliveries to nobody are ignored.
+ */
+void stats_fanout(int recipients);
+
+/**
+ * @brief Switches the calling thread to another loop phase.
+ *
+ * The time since the previous switch is charged to the phase being left.
+ * Switching to the current phase is free unless `now` is wanted.
+ *
+ * @param phase Phase being entered.
+ * @param now If not NULL, receives the monotonic clock in nanoseconds.
+ * @return The phase being left, so a nested phase can restore it.
+ */
+LoopPhase stats_phase(LoopPhase phase, unsigned long *now);
+
+/**
+ * @brief Publishes the calling shard's event-loop lag.
+ *
+ * @param ns Lag in nanoseconds.
+ */
+void stats_lag(unsigned long ns);
+
+/**
+ * @brief Names a command for the latency dump.
+ *
+ * @param command Command number, below STATS_MAX_COMMANDS.
+ * @param name Name shown in the dump; must stay valid.
+ */
+void stats_name_command(int command, const char *name);
+
+/**
+ * @brief Records how long one command took on the calling shard.
+ *
+ * @param command Command number given to stats_name_command().
+ * @param ns Duration in nanoseconds.
+ */
+void stats_command_time(int command, unsigned long ns);
+
+/**
+ * @brief Renders p50/p90/p99/max per command and starts a new period.
+ *
+ * Covers the commands handled since the same reader's previous call, so
+ * SIGUSR1 dumps and admin scrapes do not eat each other's periods.
+ *
+ * @param reader Whose period to report and restart.
+ * @param buf Output buffer.
+ * @param size Its size (STATS_REPORT_SIZE is enough).
+ * @return Length of the report.
+ */
+size_t stats_format_latency(LatencyReader reader, char *buf, size_t size);
+
+/**
+ * @brief Adds up every shard's slot.
+ *
+ * @param snap Receives the totals.
+ */
+void stats_collect(StatsSnapshot *snap);
+
+/**
+ * @brief Samples the per-second rates shown by /stats.
+ *
+ * Called by shard 0 once per loop iteration; it only does work when the
+ * second has changed.
+ *
+ * @param now Monotonic seconds (clock_now()).
+ */
+void stats_tick(time_t now);
+
+/**
+ * @brief Renders the /stats reply.
+ *
+ * @param buf Output buffer.
+ * @param size Its size (STATS_REPORT_SIZE is enough).
+ * @return Length of the reply.
+ */
+size_t stats_format(char *buf, size_t size);
+
+/**
+ * @brief Renders the values in Prometheus text format.
+ *
+ * @param buf Output buffer.
+ * @param size Its size (STATS_REPORT_SIZE is enough).
+ * @return Length of the report.
+ */
+size_t stats_format_prometheus(char *buf, size_t size);
+
+/**
+ * @brief Starts the admin socket thread.
+ *
+ * Listens on a Unix socket that only the server's user may connect to.
+ * Every connection gets the Prometheus report and is closed; a request
+ * starting with "GET " gets it as an HTTP response, so scrapers can use the
+ * socket directly. A request that mentions "latency" gets the command
+ * latency dump instead (see stats_format_latency()).
+ *
+ * @param path Socket path; a stale socket there is replaced.
+ * @return 0 on success, -1 on failure.
+ */
+int stats_serve(const char *path);
+
+/**
+ * @brief Stops the admin socket thread and removes the socket.
+ */
+void stats_stop(void);
+
+#endif /* STATS_H */
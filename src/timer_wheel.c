@@ -0,0 +1,209 @@
+#include "timer_wheel.h"
+#include <stdlib.h>
+
+/**
+ * @file timer_wheel.c
+ * @brief Hashed timing wheel implementation.
+ *
+ * Timers further away than TIMER_WHEEL_SLOTS ticks stay in their slot until
+ * the wheel comes round to the right lap; the inactivity timeouts used by
+ * the server fit within one lap.
+ */
+
+/** @brief List holding timers detached from a slot while it is expired. */
+#define EXPIRING_LIST   TIMER_WHEEL_SLOTS
+
+/**
+ * @brief Links a timer at the head of a list.
+ *
+ * @param wheel The wheel.
+ * @param id Timer id.
+ * @param list List index.
+ */
+static void link_timer(TimerWheel *wheel, int id, int list) {
+    TimerNode *node = &wheel->nodes[id];
+
+    node->list = list;
+    node->prev = -1;
+    node->next = wheel->heads[list];
+    if (node->next >= 0) {
+        wheel->nodes[node->next].prev = id;
+    }
+    wheel->heads[list] = id;
+}
+
+/**
+ * @brief Unlinks a timer from whatever list it is in.
+ *
+ * @param wheel The wheel.
+ * @param id Timer id.
+ */
+static void unlink_timer(TimerWheel *wheel, int id) {
+    TimerNode *node = &wheel->nodes[id];
+
+    if (node->prev >= 0) {
+        wheel->nodes[node->prev].next = node->next;
+    } else {
+        wheel->heads[node->list] = node->next;
+    }
+    if (node->next >= 0) {
+        wheel->nodes[node->next].prev = node->prev;
+    }
+    node->list = -1;
+    node->next = -1;
+    node->prev = -1;
+}
+
+/**
+ * @brief Initializes (or resets) a wheel.
+ *
+ * @param wheel The wheel.
+ * @param capacity Number of timer ids.
+ * @param now Current tick.
+ * @param on_expire Expiry callback.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int timer_wheel_init(TimerWheel *wheel, int capacity, unsigned long now, TimerCallback on_expire) {
+    int i;
+
+    for (i = 0; i <= TIMER_WHEEL_SLOTS; i++) {
+        wheel->heads[i] = -1;
+    }
+
+    free(wheel->nodes);
+    wheel->nodes = NULL;
+    wheel->capacity = 0;
+    wheel->now = now;
+    wheel->on_expire = on_expire;
+
+    return timer_wheel_reserve(wheel, capacity);
+}
+
+/**
+ * @brief Grows the id space.
+ *
+ * @param wheel The wheel.
+ * @param capacity New number of timer ids.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int timer_wheel_reserve(TimerWheel *wheel, int capacity) {
+    TimerNode *nodes;
+    int i;
+
+    if (capacity <= wheel->capacity) return 0;
+
+    nodes = realloc(wheel->nodes, capacity * sizeof(*nodes));
+    if (!nodes) return -1;
+
+    for (i = wheel->capacity; i < capacity; i++) {
+        nodes[i].next = -1;
+        nodes[i].prev = -1;
+        nodes[i].list = -1;
+        nodes[i].expires = 0;
+    }
+
+    wheel->nodes = nodes;
+    wheel->capacity = capacity;
+    return 0;
+}
+
+/**
+ * @brief Releases the wheel's memory.
+ *
+ * @param wheel The wheel.
+ */
+void timer_wheel_free(TimerWheel *wheel) {
+    free(wheel->nodes);
+    wheel->nodes = NULL;
+    wheel->capacity = 0;
+}
+
+/**
+ * @brief Arms or re-arms a timer.
+ *
+ * @param wheel The wheel.
+ * @param id Timer id.
+ * @param expires Tick at which it should fire.
+ */
+void timer_arm(TimerWheel *wheel, int id, unsigned long expires) {
+    TimerNode *node;
+
+    if (id < 0 || id >= wheel->capacity) return;
+    node = &wheel->nodes[id];
+
+    /* Never schedule into a tick that has already been processed */
+    if (expires <= wheel->now) {
+        expires = wheel->now + 1;
+    }
+
+    /* Re-arming within the same tick is common (every message) and free */
+    if (node->list >= 0 && node->list != EXPIRING_LIST && node->expires == expires) {
+        return;
+    }
+
+    if (node->list >= 0) {
+        unlink_timer(wheel, id);
+    }
+    node->expires = expires;
+    link_timer(wheel, id, (int)(expires & (TIMER_WHEEL_SLOTS - 1)));
+}
+
+/**
+ * @brief Disarms a timer.
+ *
+ * @param wheel The wheel.
+ * @param id Timer id.
+ */
+void timer_cancel(TimerWheel *wheel, int id) {
+    if (id < 0 || id >= wheel->capacity) return;
+    if (wheel->nodes[id].list >= 0) {
+        unlink_timer(wheel, id);
+    }
+}
+
+/**
+ * @brief Advances the wheel to `now`, firing due timers.
+ *
+ * @param wheel The wheel.
+ * @param now Current tick.
+ * @return Number of timers fired.
+ */
+int timer_wheel_advance(TimerWheel *wheel, unsigned long now) {
+    unsigned long tick;
+    unsigned long steps;
+    int slot;
+    int id;
+    int fired = 0;
+
+    if (now <= wheel->now) return 0;
+
+    /* After a long stall, one full lap visits every slot once */
+    steps = now - wheel->now;
+    if (steps > TIMER_WHEEL_SLOTS) steps = TIMER_WHEEL_SLOTS;
+
+    for (tick = now - steps + 1; tick <= now; tick++) {
+        slot = (int)(tick & (TIMER_WHEEL_SLOTS - 1));
+        if (wheel->heads[slot] < 0) continue;
+
+        /* Detach the slot so callbacks can safely re-arm into it */
+        wheel->heads[EXPIRING_LIST] = wheel->heads[slot];
+        wheel->heads[slot] = -1;
+        for (id = wheel->heads[EXPIRING_LIST]; id >= 0; id = wheel->nodes[id].next) {
+            wheel->nodes[id].list = EXPIRING_LIST;
+        }
+
+        while ((id = wheel->heads[EXPIRING_LIST]) >= 0) {
+            unlink_timer(wheel, id);
+            if (wheel->nodes[id].expires <= now) {
+                fired++;
+                wheel->on_expire(id);
+            } else {
+                /* Due on a later lap */
+                link_timer(wheel, id, slot);
+            }
+        }
+    }
+
+    wheel->now = now;
+    return fired;
+}
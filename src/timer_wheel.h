@@ -0,0 +1,98 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+/**
+ * @file timer_wheel.h
+ * @brief Hashed timing wheel for per-client deadlines.
+ *
+ * Timers are identified by small integer ids (e.g. client slot indices) and
+ * kept in intrusive, index-linked lists, one per wheel slot. Arming,
+ * re-arming and cancelling are O(1); advancing the wheel only visits the
+ * slots for the elapsed ticks, so the cost scales with the timers that are
+ * due rather than with the number of timers armed.
+ */
+
+#define TIMER_WHEEL_SLOTS   512     /**< Number of slots (power of two), one tick each */
+
+/**
+ * @brief Called for every timer that expires.
+ * @param id Id of the expired timer. The timer is already disarmed.
+ */
+typedef void (*TimerCallback)(int id);
+
+/**
+ * @brief Per-id timer state.
+ */
+typedef struct {
+    int next;                   /**< Next id in the same list, or -1 */
+    int prev;                   /**< Previous id in the same list, or -1 */
+    int list;                   /**< List the timer is linked into, or -1 when disarmed */
+    unsigned long expires;      /**< Tick at which the timer fires */
+} TimerNode;
+
+/**
+ * @brief A timing wheel.
+ */
+typedef struct {
+    int heads[TIMER_WHEEL_SLOTS + 1];   /**< Slot lists, plus one list for timers being expired */
+    TimerNode *nodes;                   /**< Timer state indexed by id */
+    int capacity;                       /**< Number of ids available */
+    unsigned long now;                  /**< Last tick processed */
+    TimerCallback on_expire;            /**< Expiry callback */
+} TimerWheel;
+
+/**
+ * @brief Initializes (or resets) a wheel with all timers disarmed.
+ *
+ * @param wheel The wheel.
+ * @param capacity Number of timer ids.
+ * @param now Current tick.
+ * @param on_expire Callback invoked for each expired timer.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int timer_wheel_init(TimerWheel *wheel, int capacity, unsigned long now, TimerCallback on_expire);
+
+/**
+ * @brief Grows the id space; new timers start disarmed.
+ *
+ * @param wheel The wheel.
+ * @param capacity New number of timer ids (ignored if not larger).
+ * @return 0 on success, -1 on allocation failure.
+ */
+int timer_wheel_reserve(TimerWheel *wheel, int capacity);
+
+/**
+ * @brief Releases the wheel's memory.
+ * @param wheel The wheel.
+ */
+void timer_wheel_free(TimerWheel *wheel);
+
+/**
+ * @brief Arms or re-arms a timer.
+ *
+ * @param wheel The wheel.
+ * @param id Timer id.
+ * @param expires Tick at which it should fire; past ticks fire on the next advance.
+ */
+void timer_arm(TimerWheel *wheel, int id, unsigned long expires);
+
+/**
+ * @brief Disarms a timer. No-op if it is not armed.
+ *
+ * @param wheel The wheel.
+ * @param id Timer id.
+ */
+void timer_cancel(TimerWheel *wheel, int id);
+
+/**
+ * @brief Advances the wheel and fires every timer due at or before `now`.
+ *
+ * Callbacks may arm or cancel any timer, including other due ones.
+ *
+ * @param wheel The wheel.
+ * @param now Current tick.
+ * @return Number of timers fired.
+ */
+int timer_wheel_advance(TimerWheel *wheel, unsigned long now);
+
+#endif /* TIMER_WHEEL_H */
@@ -0,0 +1,216 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "worker.h"
+#include "shard.h"
+#include "name_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+/**
+ * @file worker.c
+ * @brief Worker threads and their bounded job queues.
+ *
+ * A queue is a ring of slots with a sequence number each. Reactors claim a
+ * slot by advancing the tail with a compare-and-swap, copy the job in and
+ * then publish it by bumping the slot's sequence. The owning worker reads
+ * slots in order and sleeps on a semaphore that every submit posts once.
+ *
+ * A full ring makes the submitting reactor yield until a slot frees up.
+ * Workers never wait for reactors (inbox posts do not block), so this cannot
+ * deadlock; meanwhile the stalled reactor reads nothing, and TCP flow control
+ * slows the senders down.
+ */
+
+#define QUEUE_MASK (WORKER_QUEUE_SLOTS - 1)   /**< Ring index mask */
+
+/**
+ * @brief One queue slot.
+ */
+typedef struct {
+    unsigned long seq;          /**< pos + 1 when the job for pos is ready, pos when free */
+    WorkerJob job;              /**< The job */
+} JobSlot;
+
+/**
+ * @brief A worker thread and its queue.
+ */
+typedef struct {
+    JobSlot *slots;             /**< WORKER_QUEUE_SLOTS slots */
+    unsigned long tail;         /**< Next position to claim (producers) */
+    char pad[64];               /**< Keeps the producers' tail off the worker's line */
+    unsigned long head;         /**< Next position to run (worker only) */
+    sem_t ready;                /**< Posted once per submitted job */
+    pthread_t thread;           /**< The worker */
+} Worker;
+
+int worker_count = 0;
+
+static Worker *workers = NULL;
+static int started = 0;
+static int stopping = 0;
+static void (*run_job)(const WorkerJob *job);
+
+/**
+ * @brief Thread body: runs queued jobs until worker_stop().
+ *
+ * @param arg The thread's Worker.
+ * @return NULL.
+ */
+static void *worker_thread(void *arg) {
+    Worker *w = arg;
+    JobSlot *slot;
+
+    /* Not a shard: room posts reach every shard, including the sender's */
+    shard_id = -1;
+
+    for (;;) {
+        while (sem_wait(&w->ready) < 0 && errno == EINTR) {
+        }
+
+        slot = &w->slots[w->head & QUEUE_MASK];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != w->head + 1) {
+            if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) break;
+            /* Claimed by a producer that is still copying; it posted for a later slot */
+            while (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != w->head + 1) {
+                sched_yield();
+            }
+        }
+
+        run_job(&slot->job);
+        __atomic_store_n(&slot->seq, w->head + WORKER_QUEUE_SLOTS, __ATOMIC_RELEASE);
+        w->head++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Releases the queues of the first count workers.
+ *
+ * @param count Workers whose semaphore was initialized.
+ */
+static void free_workers(int count) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        sem_destroy(&workers[i].ready);
+        free(workers[i].slots);
+    }
+    free(workers);
+    workers = NULL;
+}
+
+/**
+ * @brief Allocates the queues and starts the threads.
+ *
+ * @param execute Job handler.
+ * @return 0 on success, -1 on failure.
+ */
+int worker_start(void (*execute)(const WorkerJob *job)) {
+    sigset_t block, old;
+    unsigned long pos;
+    int i;
+
+    if (worker_count <= 0) return 0;
+
+    workers = calloc(worker_count, sizeof(*workers));
+    if (!workers) return -1;
+
+    for (i = 0; i < worker_count; i++) {
+        workers[i].slots = malloc(WORKER_QUEUE_SLOTS * sizeof(*workers[i].slots));
+        if (!workers[i].slots || sem_init(&workers[i].ready, 0, 0) < 0) {
+            free(workers[i].slots);
+            free_workers(i);
+            return -1;
+        }
+        for (pos = 0; pos < WORKER_QUEUE_SLOTS; pos++) {
+            workers[i].slots[pos].seq = pos;
+        }
+    }
+
+    run_job = execute;
+    stopping = 0;
+
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+
+    for (started = 0; started < worker_count; started++) {
+        if (pthread_create(&workers[started].thread, NULL, worker_thread, &workers[started]) != 0) {
+            fprintf(stderr, "Cannot start worker thread %d\n", started);
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (started < worker_count) {
+        worker_stop();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Drains and joins the workers.
+ */
+void worker_stop(void) {
+    int i;
+
+    if (!workers) return;
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < started; i++) {
+        sem_post(&workers[i].ready);
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    started = 0;
+    free_workers(worker_count);
+}
+
+/**
+ * @brief Queues a job with the worker owning its room.
+ *
+ * @param job The job.
+ * @return 0 once queued, -1 without workers.
+ */
+int worker_submit(const WorkerJob *job) {
+    Worker *w;
+    JobSlot *slot;
+    unsigned long pos;
+    unsigned long seq;
+
+    if (!workers) return -1;
+
+    w = &workers[hash_string(job->room) % (unsigned int)worker_count];
+    pos = __atomic_load_n(&w->tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        slot = &w->slots[pos & QUEUE_MASK];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&w->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if ((long)(seq - pos) < 0) {
+            /* Full: the worker frees this slot when it runs the job in it */
+            sched_yield();
+            pos = __atomic_load_n(&w->tail, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&w->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->job = *job;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    sem_post(&w->ready);
+    return 0;
+}
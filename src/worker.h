@@ -0,0 +1,67 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include "protocol.h"
+
+/**
+ * @file worker.h
+ * @brief Worker threads that run chat commands off the reactor threads.
+ *
+ * With `workers` > 0 a reactor only frames input, keeps session state (names,
+ * room membership) and flushes output. Chat lines, private messages, listings
+ * and room notices are handed to a worker as jobs, and the worker posts the
+ * rendered result back through the shard inboxes (see shard.h).
+ *
+ * Every room is owned by one worker, chosen by hashing its name, and that
+ * worker runs the room's jobs in submission order; it is the only thread that
+ * publishes to the room, so every member sees the room's messages in the same
+ * order. Each worker has a bounded queue that many reactors push to; when it
+ * is full, submitting waits for room, which holds the reactor back from
+ * reading more input.
+ */
+
+#define MAX_WORKERS         64      /**< Upper limit of the workers setting */
+#define WORKER_QUEUE_SLOTS  256     /**< Jobs a worker's queue holds (power of two) */
+
+/**
+ * @brief A parsed command waiting for a worker.
+ */
+typedef struct {
+    MessageType type;               /**< MSG_CHAT, MSG_PRIVATE, MSG_LIST_*, or a notice (MSG_SETNAME, MSG_JOIN, MSG_LEAVE, MSG_QUIT) */
+    int shard;                      /**< Shard the client is connected to */
+    int client;                     /**< Client slot on that shard */
+    unsigned long client_id;        /**< The client's connection id, to detect a reused slot */
+    char username[MAX_USERNAME];    /**< Sender's username */
+    char room[MAX_ROOMNAME];        /**< Room the job belongs to; selects the worker */
+    char target[MAX_USERNAME];      /**< MSG_PRIVATE: recipient */
+    char text[BUFFER_SIZE];         /**< Message text, "" if none */
+} WorkerJob;
+
+extern int worker_count;            /**< Number of worker threads (workers setting), 0 to run commands inline */
+
+/**
+ * @brief Starts worker_count threads.
+ *
+ * Shutdown signals stay blocked in the workers, as in reactor threads.
+ *
+ * @param execute Runs one job on a worker thread.
+ * @return 0 on success (or with no workers), -1 on failure.
+ */
+int worker_start(void (*execute)(const WorkerJob *job));
+
+/**
+ * @brief Lets the workers finish their queues and joins them.
+ */
+void worker_stop(void);
+
+/**
+ * @brief Queues a job with the worker that owns job->room.
+ *
+ * Safe to call from any reactor thread. Yields while the queue is full.
+ *
+ * @param job The job; it is copied.
+ * @return 0 once queued, -1 if the workers are not running.
+ */
+int worker_submit(const WorkerJob *job);
+
+#endif /* WORKER_H */
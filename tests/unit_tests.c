@@ -2,8 +2,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
 #include "protocol.h"
 #include "server_utils.h"
+#include "name_index.h"
+#include "timer_wheel.h"
+#include "io_backend.h"
+#include "shard.h"
+#include "directory.h"
+#include "stats.h"
+#include "worker.h"
 
 /**
  * @file unit_tests.c
@@ -22,9 +32,7 @@
 #define NC      "\033[0m"
 
 /* --- External Globals --- */
-/* Accessing global state defined in server_utils.c */
-extern Client clients[MAX_CLIENTS];
-extern Room rooms[MAX_ROOMS];
+/* Global state tables (clients, rooms) are declared in server_utils.h */
 
 /* --- Test Counters --- */
 int tests_passed = 0;
@@ -83,10 +91,11 @@ void test_init_state() {
     int i;
     setup();
 
-    for (i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].fd != -1) clients_empty = 0;
+    for (i = 0; i < client_capacity; i++) {
+        if (client_fds[i] != -1) clients_empty = 0;
     }
     test_result("Clients array initialized empty", clients_empty);
+    test_result("Client table starts with free slots", client_capacity > 0);
     test_result("Lobby room exists by default", strcmp(rooms[0].name, "lobby") == 0);
     test_result("Lobby is active", rooms[0].active == 1);
 }
@@ -95,16 +104,16 @@ void test_setname_logic() {
     setup();
 
     /* Simulate a connected client at index 0 */
-    clients[0].fd = 999; /* Fake socket */
+    add_client(999, NULL); /* Fake socket */
 
     /* Attempt to set name. Note: This may print socket errors to console, which is expected. */
     handle_setname(0, "Alice");
 
     test_result("Handle_setname sets username", strcmp(clients[0].username, "Alice") == 0);
-    test_result("User added to lobby automatically", strcmp(clients[0].current_room, "lobby") == 0);
+    test_result("User added to lobby automatically", client_rooms[0] == LOBBY_ROOM);
 
     /* Attempt to take the same name with another client */
-    clients[1].fd = 888;
+    add_client(888, NULL);
     handle_setname(1, "Alice");
 
     test_result("Cannot take occupied username", strcmp(clients[1].username, "Alice") != 0);
@@ -129,47 +138,1021 @@ void test_room_management() {
     /* 3. Duplicate room */
     dup_idx = create_room("gaming");
     test_result("Cannot create duplicate room", dup_idx == -1);
+
+    /* 4. Cleanup removes the room from the name index */
+    cleanup_empty_rooms();
+    test_result("Cleaned-up room no longer found", find_room("gaming") == -1);
+    test_result("Lobby survives cleanup", find_room("lobby") == LOBBY_ROOM);
 }
 
 void test_join_leave_logic() {
+    int room_idx;
     setup();
 
     /* Preparation: Alice is in Lobby */
-    clients[0].fd = 777;
+    add_client(777, NULL);
     strcpy(clients[0].username, "Alice");
-    strcpy(clients[0].current_room, "lobby");
+    set_client_room(0, LOBBY_ROOM);
 
     /* Create room and join */
-    create_room("tech");
+    room_idx = create_room("tech");
     handle_join(0, "tech");
 
-    test_result("User moved to new room", strcmp(clients[0].current_room, "tech") == 0);
+    test_result("User moved to new room", client_rooms[0] == room_idx);
+    test_result("Room member index updated", rooms[room_idx].member_count == 1 &&
+                                             rooms[LOBBY_ROOM].member_count == 0);
 
     /* Leave */
     handle_leave(0);
-    test_result("User returned to lobby after leave", strcmp(clients[0].current_room, "lobby") == 0);
+    test_result("User returned to lobby after leave", client_rooms[0] == LOBBY_ROOM);
+}
+
+void test_room_bitmap() {
+    int sv[3][2];
+    int idx[3];
+    int room_idx;
+    char out[64];
+    int words;
+    int bits;
+    int i;
+
+    setup();
+    /* Push the members past the first bitmap word */
+    for (i = 0; i < 70; i++) {
+        add_client(1000 + i, NULL);
+    }
+    for (i = 0; i < 3; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]) < 0) {
+            test_result("Socketpairs for bitmap test", 0);
+            return;
+        }
+        idx[i] = add_client(sv[i][0], NULL);
+    }
+    room_idx = create_room("bits");
+
+    /* One member in a two-word bitmap: the member list is walked */
+    set_client_room(idx[2], room_idx);
+    broadcast_to_room(room_idx, "solo\n", -1);
+    test_result("Sparse room reaches its member",
+                recv(sv[2][1], out, sizeof(out), MSG_DONTWAIT) == 5);
+
+    set_client_room(idx[0], room_idx);
+    set_client_room(idx[1], room_idx);
+    bits = 0;
+    for (words = 0; words < rooms[room_idx].member_words; words++) {
+        bits += __builtin_popcountl(rooms[room_idx].member_bits[words]);
+    }
+    test_result("Bitmap matches the member list", bits == 3 && rooms[room_idx].member_count == 3);
+
+    broadcast_to_room(room_idx, "dense\n", sv[1][0]);
+    test_result("Dense fan-out reaches the members",
+                recv(sv[0][1], out, sizeof(out), MSG_DONTWAIT) == 6 &&
+                recv(sv[2][1], out, sizeof(out), MSG_DONTWAIT) == 6);
+    test_result("Excluded member is masked out", recv(sv[1][1], out, sizeof(out), MSG_DONTWAIT) < 0);
+
+    set_client_room(idx[2], -1);
+    test_result("Leaving clears the member's bit",
+                !(rooms[room_idx].member_bits[idx[2] / (8 * sizeof(unsigned long))] &
+                  (1UL << (idx[2] % (8 * sizeof(unsigned long))))));
+
+    setup();
+    for (i = 0; i < 3; i++) {
+        close(sv[i][0]);
+        close(sv[i][1]);
+    }
+}
+
+void test_room_lifecycle() {
+    int room_idx;
+    setup();
+
+    add_client(778, NULL);
+    strcpy(clients[0].username, "Alice");
+    set_client_room(0, LOBBY_ROOM);
+
+    /* Without a grace period the room goes at the end of the iteration */
+    room_grace = 0;
+    room_idx = create_room("blip");
+    set_client_room(0, room_idx);
+    set_client_room(0, LOBBY_ROOM);
+    test_result("Emptied room survives until the timers run", find_room("blip") == room_idx);
+    check_empty_rooms();
+    test_result("Emptied room is retired by its timer", find_room("blip") == -1);
+    test_result("Lobby is never retired", find_room("lobby") == LOBBY_ROOM);
+
+    /* With one, a rejoin keeps the room and its history */
+    room_grace = 60;
+    room_idx = create_room("blip");
+    set_client_room(0, room_idx);
+    add_message_to_history(room_idx, "kept\n");
+    set_client_room(0, LOBBY_ROOM);
+    check_empty_rooms();
+    test_result("Room in its grace period is kept", find_room("blip") == room_idx);
+    set_client_room(0, room_idx);
+    test_result("Rejoined room keeps its history", rooms[room_idx].history.count == 1);
+
+    set_client_room(0, LOBBY_ROOM);
+    cleanup_empty_rooms();
+    test_result("Full cleanup ignores the grace period", find_room("blip") == -1);
+
+    room_grace = ROOM_GRACE;
 }
 
 void test_history_logic() {
     int lobby_idx = 0; /* Lobby is always 0 */
+    HistoryIter it;
     setup();
 
-    add_message_to_history("lobby", "Message 1");
-    add_message_to_history("lobby", "Message 2");
+    add_message_to_history(LOBBY_ROOM, "Message 1");
+    add_message_to_history(LOBBY_ROOM, "Message 2");
 
+    history_iter_init(&rooms[lobby_idx].history, &it);
     test_result("History count incremented", rooms[lobby_idx].history.count == 2);
-    test_result("Message 1 saved correctly", strcmp(rooms[lobby_idx].history.messages[0], "Message 1") == 0);
-    test_result("Message 2 saved correctly", strcmp(rooms[lobby_idx].history.messages[1], "Message 2") == 0);
+    test_result("Message 1 saved correctly", strcmp(history_iter_next(&rooms[lobby_idx].history, &it, NULL), "Message 1") == 0);
+    test_result("Message 2 saved correctly", strcmp(history_iter_next(&rooms[lobby_idx].history, &it, NULL), "Message 2") == 0);
+}
+
+void test_history_ring() {
+    HistoryRing hist;
+    HistoryIter it;
+    char msg[64];
+    const char *m;
+    int i;
+    int in_order = 1;
+
+    history_init(&hist, 5, HISTORY_MIN_BYTES);
+    test_result("History storage allocated lazily", hist.data == NULL);
+
+    for (i = 0; i < 12; i++) {
+        snprintf(msg, sizeof(msg), "line %d", i);
+        history_add(&hist, msg);
+    }
+    history_iter_init(&hist, &it);
+    for (i = 7; i < 12; i++) {
+        snprintf(msg, sizeof(msg), "line %d", i);
+        m = history_iter_next(&hist, &it, NULL);
+        if (!m || strcmp(m, msg) != 0) in_order = 0;
+    }
+    test_result("Message limit keeps the newest messages", hist.count == 5 && in_order);
+    test_result("Short messages use little memory", hist.cap <= HISTORY_INITIAL_BYTES);
+
+    /* Long lines exhaust the byte budget and wrap around the buffer */
+    history_set_limits(&hist, 1000, HISTORY_MIN_BYTES);
+    memset(msg, 'x', sizeof(msg) - 1);
+    msg[sizeof(msg) - 1] = '\0';
+    for (i = 0; i < 500; i++) {
+        msg[0] = (char)('a' + i % 26);
+        history_add(&hist, msg);
+    }
+    history_iter_init(&hist, &it);
+    for (i = 0; i < hist.count; i++) {
+        m = history_iter_next(&hist, &it, NULL);
+        if (i == hist.count - 1 && m[0] != (char)('a' + 499 % 26)) in_order = 0;
+    }
+    test_result("Byte budget evicts oldest and keeps newest",
+                in_order && hist.cap == HISTORY_MIN_BYTES && hist.count < 500 && hist.count > 40);
+
+    history_set_limits(&hist, 3, HISTORY_MIN_BYTES);
+    test_result("Lowering the limit evicts old messages", hist.count == 3);
+
+    history_clear(&hist);
+}
+
+void test_room_history_limits() {
+    int idx;
+
+    setup();
+    test_result("Room limits reject a bad name", set_room_history_limits("", 3, 0) < 0);
+    set_room_history_limits("quiet", 2, 0);
+    set_room_history_limits("archive", 100, 2 * HISTORY_BYTES);
+    set_room_history_limits("quiet", 3, 0);
+
+    idx = create_room("quiet");
+    test_result("A room gets its own message limit",
+                idx >= 0 && rooms[idx].history.max_count == 3 && rooms[idx].history.max_bytes == history_max_bytes);
+    idx = create_room("archive");
+    test_result("A room gets its own byte budget",
+                idx >= 0 && rooms[idx].history.max_count == 100 && rooms[idx].history.max_bytes == 2 * HISTORY_BYTES);
+    idx = create_room("other");
+    test_result("Other rooms keep the defaults",
+                idx >= 0 && rooms[idx].history.max_count == history_max_messages);
+    setup();
+}
+
+void test_history_replay() {
+    char buf[BUFFER_SIZE];
+    ssize_t n;
+    int sv[2];
+    setup();
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        test_result("Socketpair for replay test", 0);
+        return;
+    }
+    add_client(sv[0], NULL);
+
+    add_message_to_history(LOBBY_ROOM, "first\n");
+    add_message_to_history(LOBBY_ROOM, "second\n");
+    send_room_history(0, LOBBY_ROOM);
+
+    n = recv(sv[1], buf, sizeof(buf) - 1, MSG_DONTWAIT);
+    buf[n > 0 ? n : 0] = '\0';
+    test_result("Replay arrives as one write with header and footer",
+                n == (ssize_t)rooms[LOBBY_ROOM].replay->len && strstr(buf, "Recent messages") &&
+                strstr(buf, "first\nsecond\n") && strstr(buf, "End of history"));
+
+    add_message_to_history(LOBBY_ROOM, "third\n");
+    test_result("New message invalidates the replay", rooms[LOBBY_ROOM].replay == NULL);
+
+    send_room_history(0, LOBBY_ROOM);
+    n = recv(sv[1], buf, sizeof(buf) - 1, MSG_DONTWAIT);
+    buf[n > 0 ? n : 0] = '\0';
+    test_result("Rebuilt replay includes the new message", strstr(buf, "second\nthird\n") != NULL);
+
+    close(sv[0]);
+    close(sv[1]);
+}
+
+void test_shared_buffers() {
+    OutQueue a;
+    OutQueue b;
+    MsgBuf *buf;
+    char out[64];
+    ssize_t n;
+    int sv[2];
+
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+
+    buf = msgbuf_new("hello world\n", 12);
+    outq_push(&a, buf, 0);
+    outq_push(&b, buf, 6);
+    msgbuf_unref(buf);
+    test_result("Queues share one buffer by reference", buf->refs == 2);
+    test_result("Queue counts only unsent bytes", a.bytes == 12 && b.bytes == 6);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        test_result("Socketpair for shared buffer test", 0);
+        return;
+    }
+    outq_push(&b, buf, 0);
+    test_result("Flush drains the queue", outq_flush(&b, sv[0]) == 0 && b.count == 0);
+    n = recv(sv[1], out, sizeof(out) - 1, MSG_DONTWAIT);
+    out[n > 0 ? n : 0] = '\0';
+    test_result("Partial buffer resumes at its offset", strcmp(out, "world\nhello world\n") == 0);
+    test_result("Drained queue drops its references", buf->refs == 1);
+
+    outq_clear(&a);
+    outq_clear(&b);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+void test_completed_sends() {
+    OutQueue q;
+    MsgBuf *bufs[4];
+    MsgBuf *buf;
+    int i;
+    int count;
+
+    memset(&q, 0, sizeof(q));
+    for (i = 0; i < 5; i++) {
+        buf = msgbuf_new("abcd", 4);
+        outq_push(&q, buf, 0);
+        msgbuf_unref(buf);
+    }
+
+    /* A backend reports bytes written; the queue releases whole buffers */
+    outq_consume(&q, 6);
+    test_result("Consume pops written buffers", q.count == 4 && q.offset == 2 && q.bytes == 14);
+
+    test_result("Flatten merges the newest buffers", outq_flatten(&q, 2) == 0 && q.count == 2);
+    count = outq_peek(&q, bufs, 4);
+    test_result("Flatten keeps bytes and order",
+                count == 2 && q.bytes == 14 && bufs[1]->len == 12 &&
+                memcmp(bufs[1]->data, "abcdabcdabcd", 12) == 0 && q.offset == 2);
+
+    outq_consume(&q, 14);
+    test_result("Consuming everything empties the queue", q.count == 0 && q.bytes == 0);
+    outq_clear(&q);
+
+    test_result("I/O calls fail cleanly before io_init",
+                io_wait(NULL, 0, 0) < 0 && io_send(0, bufs, 1, 0) < 0 &&
+                strcmp(io_backend_name(), "none") == 0 && io_completion_mode() == 0);
 }
 
 void test_find_client() {
+    int idx;
     setup();
-    clients[5].fd = 123;
-    strcpy(clients[5].username, "Bob");
+    idx = add_client(123, NULL);
+    handle_setname(idx, "Bob");
 
-    test_result("Find client by FD", find_client_by_fd(123) == 5);
-    test_result("Find client by Username", find_client_by_username("Bob") == 5);
+    test_result("Find client by FD", find_client_by_fd(123) == idx);
+    test_result("Find client by Username", find_client_by_username("Bob") == idx);
     test_result("Find non-existent client returns -1", find_client_by_username("Ghost") == -1);
+
+    /* Renaming must re-key the username index */
+    handle_setname(idx, "Robert");
+    test_result("Old username released after rename", find_client_by_username("Bob") == -1);
+    test_result("New username indexed after rename", find_client_by_username("Robert") == idx);
+}
+
+void test_listing_cache() {
+    int sv[2];
+    char buf[BUFFER_SIZE];
+    char name[MAX_USERNAME];
+    MsgBuf *first;
+    MsgBuf *again;
+    int pages;
+    ssize_t n;
+    int i;
+
+    setup();
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        test_result("Socketpair for listing test", 0);
+        return;
+    }
+    add_client(sv[0], NULL);
+    handle_setname(0, "Lister");
+    while (recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+    }
+
+    handle_list_users(0, NULL);
+    n = recv(sv[1], buf, sizeof(buf) - 1, MSG_DONTWAIT);
+    buf[n > 0 ? n : 0] = '\0';
+    test_result("Short listing has a single page", strstr(buf, "Lister") && !strstr(buf, "page"));
+
+    first = dir_cached_page(NULL, 0, &pages);
+    test_result("First poll renders the room list", first == NULL && pages == 0);
+    handle_list_rooms(0, NULL);
+    first = dir_cached_page(NULL, 0, &pages);
+    again = dir_cached_page(NULL, 0, &pages);
+    test_result("Repeat polls share the cached bytes", first && first == again && pages == 1);
+    msgbuf_unref(first);
+    msgbuf_unref(again);
+    while (recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+    }
+
+    /* Members on other shards count too */
+    for (i = 0; i < LIST_PAGE_LINES; i++) {
+        snprintf(name, sizeof(name), "remote%d", i);
+        dir_claim_user(name, 1);
+        dir_move_user(name, NULL, "lobby", max_rooms);
+    }
+    first = dir_cached_page("lobby", 0, &pages);
+    test_result("Joins invalidate the cached listing", first == NULL && pages == 0);
+
+    handle_list_users(0, NULL);
+    n = recv(sv[1], buf, sizeof(buf) - 1, MSG_DONTWAIT);
+    buf[n > 0 ? n : 0] = '\0';
+    test_result("Long listing is split into pages",
+                strstr(buf, "page 1 of 2") && strstr(buf, "More: /users 2"));
+
+    handle_list_users(0, "2");
+    n = recv(sv[1], buf, sizeof(buf) - 1, MSG_DONTWAIT);
+    buf[n > 0 ? n : 0] = '\0';
+    test_result("Second page is served", strstr(buf, "page 2 of 2") && !strstr(buf, "More:"));
+
+    handle_list_users(0, "3");
+    n = recv(sv[1], buf, sizeof(buf) - 1, MSG_DONTWAIT);
+    buf[n > 0 ? n : 0] = '\0';
+    test_result("Page past the end is refused", strstr(buf, "No page 3") != NULL);
+
+    handle_setname(0, "Relister");
+    first = dir_cached_page("lobby", 0, &pages);
+    test_result("Rename invalidates the cached listing", first == NULL && pages == 0);
+
+    for (i = 0; i < LIST_PAGE_LINES; i++) {
+        snprintf(name, sizeof(name), "remote%d", i);
+        dir_move_user(name, "lobby", NULL, max_rooms);
+        dir_release_user(name);
+    }
+    setup();
+    close(sv[0]);
+    close(sv[1]);
+}
+
+void test_command_dispatch() {
+    int sv[2][2];
+    char line[64];
+    char out[BUFFER_SIZE];
+    ssize_t n;
+    int i;
+
+    setup();
+    for (i = 0; i < 2; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]) < 0) {
+            test_result("Socketpairs for dispatch test", 0);
+            return;
+        }
+        add_client(sv[i][0], NULL);
+    }
+
+    strcpy(line, "/name  Ann\n");
+    handle_client_message(0, line);
+    strcpy(line, "/name Ben extra");
+    handle_client_message(1, line);
+    test_result("Arguments skip repeated spaces", strcmp(clients[0].username, "Ann") == 0);
+    test_result("Extra words are ignored", strcmp(clients[1].username, "Ben") == 0);
+    while (recv(sv[1][1], out, sizeof(out), MSG_DONTWAIT) > 0) {
+    }
+    while (recv(sv[0][1], out, sizeof(out), MSG_DONTWAIT) > 0) {
+    }
+
+    strcpy(line, "/msg Ben hello there");
+    handle_client_message(0, line);
+    n = recv(sv[1][1], out, sizeof(out) - 1, MSG_DONTWAIT);
+    out[n > 0 ? n : 0] = '\0';
+    test_result("Last argument takes the rest of the line", strstr(out, "hello there") != NULL);
+    test_result("Parsing leaves the line intact", strcmp(line, "/msg Ben hello there") == 0);
+    while (recv(sv[0][1], out, sizeof(out), MSG_DONTWAIT) > 0) {
+    }
+
+    strcpy(line, "/msg Ben");
+    handle_client_message(0, line);
+    n = recv(sv[0][1], out, sizeof(out) - 1, MSG_DONTWAIT);
+    out[n > 0 ? n : 0] = '\0';
+    test_result("Missing arguments show the usage", strstr(out, "Usage: /msg <user> <message>") != NULL);
+
+    strcpy(line, "/nam Ann");
+    handle_client_message(0, line);
+    n = recv(sv[0][1], out, sizeof(out) - 1, MSG_DONTWAIT);
+    out[n > 0 ? n : 0] = '\0';
+    test_result("Command prefixes are not matched", strstr(out, "Unknown command") != NULL);
+
+    strcpy(line, "/help");
+    handle_client_message(0, line);
+    n = recv(sv[0][1], out, sizeof(out) - 1, MSG_DONTWAIT);
+    out[n > 0 ? n : 0] = '\0';
+    test_result("Help lists every table entry",
+                strstr(out, "/name <username>") && strstr(out, "Send typing notification"));
+
+    setup();
+    for (i = 0; i < 2; i++) {
+        close(sv[i][0]);
+        close(sv[i][1]);
+    }
+}
+
+void test_stats_surface() {
+    StatsSnapshot before;
+    StatsSnapshot after;
+    int sv[3][2];
+    char line[64];
+    char out[STATS_REPORT_SIZE];
+    ssize_t n;
+    int i;
+
+    setup();
+    for (i = 0; i < 3; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]) < 0) {
+            test_result("Socketpairs for stats test", 0);
+            return;
+        }
+    }
+    stats_collect(&before);
+    for (i = 0; i < 3; i++) {
+        add_client(sv[i][0], NULL);
+        snprintf(line, sizeof(line), "/name u%d", i);
+        handle_client_message(i, line);
+        strcpy(line, "/join stats");
+        handle_client_message(i, line);
+    }
+    broadcast_to_room(find_room("stats"), "hello\n", -1);
+    stats_collect(&after);
+    test_result("Clients gauge follows connections", after.values[STAT_CLIENTS] - before.values[STAT_CLIENTS] == 3);
+    test_result("Lines in are counted", after.values[STAT_MESSAGES_IN] - before.values[STAT_MESSAGES_IN] == 6);
+    test_result("Broadcast lands in its fan-out bucket",
+                after.fanout[2] - before.fanout[2] == 1 && after.values[STAT_FANOUT] - before.values[STAT_FANOUT] >= 3);
+    for (i = 0; i < 3; i++) {
+        while (recv(sv[i][1], out, sizeof(out), MSG_DONTWAIT) > 0) {
+        }
+    }
+
+    strcpy(line, "/stats");
+    handle_client_message(0, line);
+    n = recv(sv[0][1], out, sizeof(out) - 1, MSG_DONTWAIT);
+    out[n > 0 ? n : 0] = '\0';
+    test_result("/stats needs operator rights", strstr(out, "for operators") != NULL);
+
+    snprintf(oper_password, sizeof(oper_password), "secret");
+    strcpy(line, "/oper guess");
+    handle_client_message(0, line);
+    test_result("Wrong password is refused", !(client_flags[0] & CLIENT_OPER));
+    strcpy(line, "/oper secret");
+    handle_client_message(0, line);
+    while (recv(sv[0][1], out, sizeof(out), MSG_DONTWAIT) > 0) {
+    }
+    strcpy(line, "/stats");
+    handle_client_message(0, line);
+    n = recv(sv[0][1], out, sizeof(out) - 1, MSG_DONTWAIT);
+    out[n > 0 ? n : 0] = '\0';
+    test_result("Operator gets the stats", strstr(out, "Server stats") && strstr(out, "Clients: "));
+    oper_password[0] = '\0';
+
+    stats_format_prometheus(out, sizeof(out));
+    test_result("Prometheus report has gauges and the histogram",
+                strstr(out, "# TYPE chat_clients gauge") && strstr(out, "chat_broadcast_fanout_bucket{le=\"+Inf\"}"));
+
+    setup();
+    stats_collect(&after);
+    test_result("Disconnects bring the gauges back",
+                after.values[STAT_CLIENTS] == before.values[STAT_CLIENTS] &&
+                after.values[STAT_QUEUED_BYTES] == before.values[STAT_QUEUED_BYTES]);
+
+    /* A shard blocked in its wait has its idle time counted as it goes */
+    stats_phase(PHASE_IDLE, NULL);
+    stats_collect(&before);
+    poll(NULL, 0, 20);
+    stats_collect(&after);
+    test_result("The phase in progress is counted before it ends",
+                after.phase_ns[PHASE_IDLE] - before.phase_ns[PHASE_IDLE] >= 20000000L);
+    for (i = 0; i < 3; i++) {
+        close(sv[i][0]);
+        close(sv[i][1]);
+    }
+}
+
+void test_command_latency() {
+    char line[64];
+    char out[STATS_REPORT_SIZE];
+    char *row;
+    int sv[2];
+    int i;
+
+    setup();
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        test_result("Socketpair for latency test", 0);
+        return;
+    }
+    add_client(sv[0], NULL);
+
+    /* Start a fresh period for both readers */
+    stats_format_latency(LATENCY_SIGNAL, out, sizeof(out));
+    stats_format_latency(LATENCY_ADMIN, out, sizeof(out));
+    for (i = 0; i < 5; i++) {
+        strcpy(line, "/ping");
+        handle_client_message(0, line);
+    }
+    strcpy(line, "/nosuch");
+    handle_client_message(0, line);
+
+    stats_format_latency(LATENCY_SIGNAL, out, sizeof(out));
+    row = strstr(out, "/ping ");
+    test_result("Dump has a row per command used", row && strtol(row + 5, NULL, 10) == 5);
+    test_result("Unknown commands are not timed", strstr(out, "/nosuch") == NULL && strstr(out, "/join") == NULL);
+
+    stats_format_latency(LATENCY_SIGNAL, out, sizeof(out));
+    test_result("A dump starts a new period", strstr(out, "(no commands)") != NULL);
+
+    stats_format_latency(LATENCY_ADMIN, out, sizeof(out));
+    row = strstr(out, "/ping ");
+    test_result("Each reader keeps its own period", row && strtol(row + 5, NULL, 10) == 5);
+
+    setup();
+    close(sv[0]);
+    close(sv[1]);
+}
+
+void test_load_shedding() {
+    StatsSnapshot before;
+    StatsSnapshot after;
+    char line[64];
+    char out[BUFFER_SIZE];
+    int sv[3][2];
+    ssize_t n;
+    int i;
+
+    setup();
+    for (i = 0; i < 3; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]) < 0) {
+            test_result("Socketpairs for shedding test", 0);
+            return;
+        }
+        add_client(sv[i][0], NULL);
+        snprintf(line, sizeof(line), "/name shed%d", i);
+        handle_client_message(i, line);
+    }
+    for (i = 0; i < 2; i++) {
+        strcpy(line, "/join busy");
+        handle_client_message(i, line);
+    }
+    strcpy(line, "kept for later");
+    handle_client_message(0, line);
+    for (i = 0; i < 3; i++) {
+        while (recv(sv[i][1], out, sizeof(out), MSG_DONTWAIT) > 0) {
+        }
+    }
+
+    /* One second behind: past every default threshold */
+    loop_lag = 1000000000UL;
+    stats_collect(&before);
+    strcpy(line, "/typing");
+    handle_client_message(0, line);
+    flush_typing();
+    n = recv(sv[1][1], out, sizeof(out) - 1, MSG_DONTWAIT);
+    stats_collect(&after);
+    test_result("Typing notifications are dropped under lag",
+                n < 0 && after.values[STAT_SHED_TYPING] - before.values[STAT_SHED_TYPING] == 1);
+
+    strcpy(line, "/join busy");
+    handle_client_message(2, line);
+    n = recv(sv[2][1], out, sizeof(out) - 1, MSG_DONTWAIT);
+    out[n > 0 ? n : 0] = '\0';
+    test_result("Join under lag postpones the replay",
+                strstr(out, "You joined") && !strstr(out, "Recent messages") && (client_flags[2] & CLIENT_REPLAY));
+
+    replay_postponed_history();
+    test_result("Replay waits while the loop still lags", recv(sv[2][1], out, sizeof(out), MSG_DONTWAIT) < 0);
+    test_result("A zero threshold never sheds", !loop_overloaded(0) && loop_overloaded(shed_accept));
+
+    loop_lag = 0;
+    replay_postponed_history();
+    n = recv(sv[2][1], out, sizeof(out) - 1, MSG_DONTWAIT);
+    out[n > 0 ? n : 0] = '\0';
+    test_result("Replay follows once the loop catches up",
+                strstr(out, "Recent messages") && strstr(out, "kept for later") && !(client_flags[2] & CLIENT_REPLAY));
+
+    setup();
+    for (i = 0; i < 3; i++) {
+        close(sv[i][0]);
+        close(sv[i][1]);
+    }
+}
+
+void test_typing_notices() {
+    char line[64];
+    char out[BUFFER_SIZE];
+    int sv[5][2];
+    ssize_t n;
+    int i;
+
+    setup();
+    for (i = 0; i < 5; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]) < 0) {
+            test_result("Socketpairs for typing test", 0);
+            return;
+        }
+        add_client(sv[i][0], NULL);
+        snprintf(line, sizeof(line), "/name t%d", i);
+        handle_client_message(i, line);
+        strcpy(line, "/join typing");
+        handle_client_message(i, line);
+    }
+    strcpy(line, "/typing off");
+    handle_client_message(4, line);
+    /* Every flush_typing() call starts a new round */
+    typing_interval = 0;
+    for (i = 0; i < 5; i++) {
+        while (recv(sv[i][1], out, sizeof(out), MSG_DONTWAIT) > 0) {
+        }
+    }
+
+    for (i = 0; i < 4; i++) {
+        strcpy(line, "/typing");
+        handle_client_message(i, line);
+        handle_client_message(i, line);
+    }
+    n = recv(sv[0][1], out, sizeof(out) - 1, MSG_DONTWAIT);
+    test_result("Typing is held until the flush", n < 0);
+
+    flush_typing();
+    n = recv(sv[0][1], out, sizeof(out) - 1, MSG_DONTWAIT);
+    out[n > 0 ? n : 0] = '\0';
+    test_result("One notice names two typers and counts the rest",
+                strstr(out, "and 2 others are typing") && strstr(out, "t0") && strstr(out, "t1") &&
+                !strstr(strstr(out, "typing") + 1, "typing"));
+    test_result("Opted-out members get no notice", recv(sv[4][1], out, sizeof(out), MSG_DONTWAIT) < 0);
+
+    /* Next round: a lone typer is not told about themselves */
+    for (i = 0; i < 4; i++) {
+        while (recv(sv[i][1], out, sizeof(out), MSG_DONTWAIT) > 0) {
+        }
+    }
+    strcpy(line, "/typing");
+    handle_client_message(1, line);
+    flush_typing();
+    n = recv(sv[0][1], out, sizeof(out) - 1, MSG_DONTWAIT);
+    out[n > 0 ? n : 0] = '\0';
+    test_result("A lone typer is named to the others", strstr(out, "is typing") != NULL);
+    test_result("A lone typer does not see their own notice", recv(sv[1][1], out, sizeof(out), MSG_DONTWAIT) < 0);
+    typing_interval = TYPING_INTERVAL;
+
+    setup();
+    for (i = 0; i < 5; i++) {
+        close(sv[i][0]);
+        close(sv[i][1]);
+    }
+}
+
+/**
+ * @brief Frees a list of inbox messages.
+ *
+ * @param msg First message, or NULL.
+ */
+static void drop_messages(ShardMsg *msg) {
+    ShardMsg *next;
+
+    for (; msg; msg = next) {
+        next = msg->next;
+        shard_msg_free(msg);
+    }
+}
+
+void test_typing_across_shards() {
+    char line[64];
+    char name[MAX_ROOMNAME];
+    char here[MAX_ROOMNAME];
+    char there[MAX_ROOMNAME];
+    char out[BUFFER_SIZE];
+    MsgBuf *typer;
+    ShardMsg *msg;
+    int sv[2];
+    ssize_t n;
+    int i;
+
+    setup();
+    shard_count = 2;
+    if (shard_init() < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        test_result("Shard inboxes for typing test", 0);
+        shard_count = 1;
+        return;
+    }
+    /* One room whose notice shard 0 renders, one rendered by shard 1 */
+    here[0] = there[0] = '\0';
+    for (i = 0; !here[0] || !there[0]; i++) {
+        snprintf(name, sizeof(name), "room%d", i);
+        strcpy(hash_string(name) % 2 == 0 ? here : there, name);
+    }
+
+    add_client(sv[0], NULL);
+    handle_setname(0, "Dave");
+    snprintf(line, sizeof(line), "/join %s", here);
+    handle_client_message(0, line);
+    typing_interval = 0;
+    while (recv(sv[1], out, sizeof(out), MSG_DONTWAIT) > 0) {
+    }
+
+    /* Three members on shard 1 type in the same room */
+    shard_id = 1;
+    drop_messages(shard_take());
+    for (i = 0; i < 3; i++) {
+        typer = msgbuf_new(i == 0 ? "Erin" : "Frank", i == 0 ? 4 : 5);
+        shard_post_typer(0, here, typer, i, 12345 + i);
+        msgbuf_unref(typer);
+    }
+    shard_id = 0;
+    shard_ack_wake(1);
+
+    strcpy(line, "/typing");
+    handle_client_message(0, line);
+    process_shard_inbox();
+    flush_typing();
+    n = recv(sv[1], out, sizeof(out) - 1, MSG_DONTWAIT);
+    out[n > 0 ? n : 0] = '\0';
+    test_result("Notice shard counts typers from every shard",
+                strstr(out, "and 2 others are typing") && strstr(out, "Dave") && strstr(out, "Erin"));
+
+    shard_id = 1;
+    msg = shard_take();
+    test_result("Other shards get the rendered notice",
+                msg && msg->kind == SHARD_MSG_TYPING && strcmp(msg->target, here) == 0 && !msg->next);
+    drop_messages(msg);
+    shard_id = 0;
+
+    /* A room rendered elsewhere: typers are reported, not announced */
+    snprintf(line, sizeof(line), "/join %s", there);
+    handle_client_message(0, line);
+    while (recv(sv[1], out, sizeof(out), MSG_DONTWAIT) > 0) {
+    }
+    shard_id = 1;
+    drop_messages(shard_take());
+    shard_id = 0;
+    strcpy(line, "/typing");
+    handle_client_message(0, line);
+    flush_typing();
+    test_result("No local notice for a room rendered elsewhere", recv(sv[1], out, sizeof(out), MSG_DONTWAIT) < 0);
+    shard_id = 1;
+    msg = shard_take();
+    test_result("Typers are reported to the notice shard",
+                msg && msg->kind == SHARD_MSG_TYPER && strcmp(msg->target, there) == 0 && msg->client == 0 &&
+                msg->client_id == client_ids[0] && msg->buf->len == 4 && memcmp(msg->buf->data, "Dave", 4) == 0);
+    drop_messages(msg);
+    shard_id = 0;
+    shard_ack_wake(1);
+    typing_interval = TYPING_INTERVAL;
+
+    setup();
+    shard_free();
+    shard_count = 1;
+    close(sv[0]);
+    close(sv[1]);
+}
+
+void test_line_framing() {
+    char input[] = "/name Alice\r\n/join tech\n/lea";
+    int sv[2];
+    size_t consumed;
+    setup();
+
+    /* A real socket so replies are queued instead of failing */
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        test_result("Socketpair for framing test", 0);
+        return;
+    }
+    add_client(sv[0], NULL);
+
+    consumed = handle_client_input(0, input, strlen(input));
+
+    test_result("Both pipelined commands handled", client_rooms[0] == find_room("tech"));
+    test_result("Carriage return stripped from line", strcmp(clients[0].username, "Alice") == 0);
+    test_result("Partial line left unconsumed", strcmp(input + consumed, "/lea") == 0);
+
+    close(sv[0]);
+    close(sv[1]);
+}
+
+void test_table_growth() {
+    int saved_max = max_clients;
+    int i;
+    int idx = -1;
+    int grew = 1;
+
+    max_clients = INITIAL_TABLE_SLOTS * 4;
+    setup();
+
+    /* Fill past the first slab; the table must double on demand */
+    for (i = 0; i < INITIAL_TABLE_SLOTS * 4; i++) {
+        idx = add_client(1000 + i, NULL);
+        if (idx != i) grew = 0;
+    }
+    test_result("Client table grows past initial slab", grew && client_capacity == max_clients);
+    test_result("Client beyond max_clients is rejected", add_client(5000, NULL) == -1);
+    test_result("Fd lookup after growth", find_client_by_fd(1000 + INITIAL_TABLE_SLOTS * 3) == INITIAL_TABLE_SLOTS * 3);
+
+    max_clients = saved_max;
+    setup();
+}
+
+void test_clock_cache() {
+    char ts[16];
+    char small[4];
+    time_t before = clock_now();
+
+    get_timestamp(ts, sizeof(ts));
+    test_result("Timestamp is HH:MM:SS", strlen(ts) == 8 && ts[2] == ':' && ts[5] == ':');
+
+    get_timestamp(small, sizeof(small));
+    test_result("Timestamp truncates to small buffers", strncmp(small, ts, 3) == 0 && small[3] == '\0');
+
+    clock_tick();
+    test_result("Monotonic clock does not go backwards", clock_now() >= before);
+}
+
+/* --- Timer wheel fixtures --- */
+static TimerWheel test_wheel;
+static int timers_fired = 0;
+
+/**
+ * @brief Expiry callback that counts fires; timers 1 and 2 cancel each other.
+ *
+ * @param id Expired timer id.
+ */
+static void count_expiry(int id) {
+    timers_fired++;
+    if (id == 1) timer_cancel(&test_wheel, 2);
+    if (id == 2) timer_cancel(&test_wheel, 1);
+}
+
+void test_timer_wheel() {
+    timer_wheel_init(&test_wheel, 8, 100, count_expiry);
+
+    timer_arm(&test_wheel, 0, 105);
+    timer_arm(&test_wheel, 3, 110);
+    timer_arm(&test_wheel, 0, 120);     /* re-arm moves the deadline */
+    test_result("Re-armed timer does not fire early", timer_wheel_advance(&test_wheel, 110) == 1);
+    test_result("Re-armed timer fires at new deadline", timer_wheel_advance(&test_wheel, 120) == 1);
+
+    timer_arm(&test_wheel, 4, 130 + TIMER_WHEEL_SLOTS);
+    test_result("Timer beyond one lap waits for its lap",
+                timer_wheel_advance(&test_wheel, 130) == 0 &&
+                timer_wheel_advance(&test_wheel, 130 + TIMER_WHEEL_SLOTS) == 1);
+
+    /* Whichever of timers 1 and 2 fires first cancels the other */
+    timers_fired = 0;
+    timer_arm(&test_wheel, 1, 1000);
+    timer_arm(&test_wheel, 2, 1000);
+    timer_wheel_advance(&test_wheel, 1000);
+    test_result("Callback can cancel another due timer", timers_fired == 1);
+
+    timer_arm(&test_wheel, 5, 1001);
+    timer_cancel(&test_wheel, 5);
+    test_result("Cancelled timer never fires", timer_wheel_advance(&test_wheel, 5000) == 0);
+
+    timer_wheel_free(&test_wheel);
+}
+
+void test_shard_inbox() {
+    int sv[2];
+    char buf[256];
+    MsgBuf *room_msg;
+    MsgBuf *pm;
+    ssize_t n;
+
+    setup();
+    shard_count = 2;
+    if (shard_init() < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        test_result("Shard inboxes for shard test", 0);
+        shard_count = 1;
+        return;
+    }
+
+    add_client(sv[0], NULL);
+    handle_setname(0, "Carol");
+    while (recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+    }
+
+    test_result("Directory knows the user's shard", dir_find_user("Carol") == 0);
+    test_result("Name is taken on every shard", dir_claim_user("Carol", 1) == 1);
+    test_result("Directory counts room members", dir_room_members("lobby") == 1);
+
+    /* Post from shard 1 as its reactor thread would; NUL-terminated for history */
+    shard_id = 1;
+    room_msg = msgbuf_alloc(sizeof("from shard 1\n"));
+    memcpy(room_msg->data, "from shard 1\n", sizeof("from shard 1\n"));
+    room_msg->len = sizeof("from shard 1\n") - 1;
+    pm = msgbuf_new("pm\n", 3);
+    shard_post_room("lobby", room_msg, 1, -1, 0);
+    shard_post_user(0, "Carol", pm);
+    msgbuf_unref(room_msg);
+    msgbuf_unref(pm);
+    shard_id = 0;
+
+    n = recv(shard_wake_fd(), buf, sizeof(buf), MSG_DONTWAIT);
+    test_result("First post wakes the shard once", n == 1);
+    shard_ack_wake(1);
+
+    process_shard_inbox();
+    n = recv(sv[1], buf, sizeof(buf) - 1, MSG_DONTWAIT);
+    buf[n > 0 ? n : 0] = '\0';
+    test_result("Inbox delivers in posting order", strcmp(buf, "from shard 1\npm\n") == 0);
+    test_result("Recorded room message lands in local history",
+                rooms[LOBBY_ROOM].history.count == 2);
+    test_result("Inbox is empty after delivery", shard_take() == NULL);
+
+    setup();
+    test_result("Reset releases the directory entry", dir_find_user("Carol") == -1);
+    shard_free();
+    shard_count = 1;
+    close(sv[0]);
+    close(sv[1]);
+}
+
+void test_worker_jobs() {
+    int sv[2];
+    char buf[BUFFER_SIZE];
+    ssize_t n;
+
+    setup();
+    worker_count = 1;
+    if (shard_init() < 0 || worker_start(handle_job) < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        test_result("Workers for worker test", 0);
+        worker_count = 0;
+        return;
+    }
+
+    add_client(sv[0], NULL);
+    handle_setname(0, "Dave");
+    while (recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+    }
+
+    strcpy(buf, "first");
+    handle_client_message(0, buf);
+    strcpy(buf, "/rooms");
+    handle_client_message(0, buf);
+    strcpy(buf, "second");
+    handle_client_message(0, buf);
+
+    /* Joining lets the worker finish its queue */
+    worker_stop();
+    test_result("Nothing is delivered before the inbox is read",
+                recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT) < 0);
+
+    process_shard_inbox();
+    n = recv(sv[1], buf, sizeof(buf) - 1, MSG_DONTWAIT);
+    buf[n > 0 ? n : 0] = '\0';
+    test_result("Worker replies keep the room's order",
+                strstr(buf, "first") && strstr(buf, "Available rooms") && strstr(buf, "second") &&
+                strstr(buf, "first") < strstr(buf, "Available rooms") &&
+                strstr(buf, "Available rooms") < strstr(buf, "second"));
+    test_result("Join notice skips its subject", strstr(buf, "joined the lobby") == NULL);
+    test_result("Worker output is recorded in history", rooms[LOBBY_ROOM].history.count == 3);
+
+    setup();
+    shard_free();
+    worker_count = 0;
+    close(sv[0]);
+    close(sv[1]);
 }
 
 /* ========================================== */
@@ -194,15 +1177,50 @@ int main() {
     printf(YELLOW "--- User Management Tests ---\n" NC);
     test_setname_logic();
     test_find_client();
+    test_listing_cache();
+    test_command_dispatch();
+    test_stats_surface();
+    test_command_latency();
+    test_load_shedding();
+    test_typing_notices();
+    test_typing_across_shards();
     printf("\n");
 
     printf(YELLOW "--- Room Management Tests ---\n" NC);
     test_room_management();
     test_join_leave_logic();
+    test_room_bitmap();
+    test_room_lifecycle();
+    printf("\n");
+
+    printf(YELLOW "--- Capacity Tests ---\n" NC);
+    test_table_growth();
+    printf("\n");
+
+    printf(YELLOW "--- Timer Tests ---\n" NC);
+    test_clock_cache();
+    test_timer_wheel();
+    printf("\n");
+
+    printf(YELLOW "--- Input Framing Tests ---\n" NC);
+    test_line_framing();
     printf("\n");
 
     printf(YELLOW "--- History Tests ---\n" NC);
     test_history_logic();
+    test_history_ring();
+    test_room_history_limits();
+    test_history_replay();
+    printf("\n");
+
+    printf(YELLOW "--- Output Queue Tests ---\n" NC);
+    test_shared_buffers();
+    test_completed_sends();
+    printf("\n");
+
+    printf(YELLOW "--- Shard Tests ---\n" NC);
+    test_shard_inbox();
+    test_worker_jobs();
     printf("\n");
 
     /* Final Results */